@@ -0,0 +1,316 @@
+#include "cache.h"
+#include "blame-cache.h"
+#include "lockfile.h"
+#include "object-store.h"
+#include "quote.h"
+#include "dir.h"
+
+#define BLAME_CACHE_SIGNATURE "blame-cache v1"
+
+void blame_cache_init(struct blame_cache *cache, struct repository *r,
+		      const char *options)
+{
+	memset(cache, 0, sizeof(*cache));
+	cache->dir = xstrfmt("%s/info/blame-cache", r->objects->odb->path);
+	cache->options = xstrdup(options);
+}
+
+void blame_cache_release(struct blame_cache *cache)
+{
+	FREE_AND_NULL(cache->dir);
+	FREE_AND_NULL(cache->options);
+}
+
+static void cache_file_path(struct blame_cache *cache, struct strbuf *buf,
+			    const struct object_id *commit, const char *path)
+{
+	git_hash_ctx ctx;
+	unsigned char hash[GIT_MAX_RAWSZ];
+	char hex[GIT_MAX_HEXSZ + 1];
+
+	the_hash_algo->init_fn(&ctx);
+	the_hash_algo->update_fn(&ctx, BLAME_CACHE_SIGNATURE,
+				 strlen(BLAME_CACHE_SIGNATURE) + 1);
+	the_hash_algo->update_fn(&ctx, commit->hash, the_hash_algo->rawsz);
+	the_hash_algo->update_fn(&ctx, path, strlen(path) + 1);
+	the_hash_algo->update_fn(&ctx, cache->options,
+				 strlen(cache->options) + 1);
+	the_hash_algo->final_fn(hash, &ctx);
+	/* this may run on several threads; avoid the static buffers */
+	hash_to_hex_algop_r(hex, hash, the_hash_algo);
+
+	strbuf_reset(buf);
+	strbuf_addf(buf, "%s/%.2s/%s", cache->dir, hex, hex + 2);
+}
+
+int blame_cache_has(struct blame_cache *cache,
+		    const struct object_id *commit, const char *path)
+{
+	struct strbuf buf = STRBUF_INIT;
+	int ret;
+
+	cache_file_path(cache, &buf, commit, path);
+	ret = file_exists(buf.buf);
+	strbuf_release(&buf);
+	return ret;
+}
+
+struct blame_cache_record *blame_cache_append(struct blame_cache_entry *entry)
+{
+	struct blame_cache_record *rec;
+
+	ALLOC_GROW(entry->records, entry->nr + 1, entry->alloc);
+	rec = &entry->records[entry->nr++];
+	memset(rec, 0, sizeof(*rec));
+	return rec;
+}
+
+void blame_cache_entry_release(struct blame_cache_entry *entry)
+{
+	int i;
+
+	for (i = 0; i < entry->nr; i++) {
+		free(entry->records[i].path);
+		free(entry->records[i].previous_path);
+	}
+	FREE_AND_NULL(entry->records);
+	entry->nr = entry->alloc = 0;
+}
+
+/* Parse a possibly quoted path up to a tab or the end of the line. */
+static char *parse_path(const char *p, const char **endp)
+{
+	struct strbuf buf = STRBUF_INIT;
+
+	if (*p == '"') {
+		if (unquote_c_style(&buf, p, endp)) {
+			strbuf_release(&buf);
+			return NULL;
+		}
+	} else {
+		const char *end = strchrnul(p, '\t');
+
+		strbuf_add(&buf, p, end - p);
+		*endp = end;
+	}
+	if (!buf.len) {
+		strbuf_release(&buf);
+		return NULL;
+	}
+	return strbuf_detach(&buf, NULL);
+}
+
+static int parse_record(struct blame_cache_entry *entry, const char *line,
+			int lno)
+{
+	struct blame_cache_record *rec = blame_cache_append(entry);
+	const char *p = line;
+	char *end;
+
+	rec->lno = strtol(p, &end, 10);
+	if (*end != ' ' || rec->lno != lno)
+		return -1;
+	rec->num_lines = strtol(end + 1, &end, 10);
+	if (*end != ' ' || rec->num_lines <= 0)
+		return -1;
+	rec->s_lno = strtol(end + 1, &end, 10);
+	if (*end != ' ' || rec->s_lno < 0)
+		return -1;
+	p = end + 1;
+	if (parse_oid_hex(p, &rec->commit, &p) || *p++ != ' ')
+		return -1;
+	if (*p == '-')
+		p++;
+	else if (parse_oid_hex(p, &rec->previous, &p))
+		return -1;
+	if (*p++ != '\t' || !(rec->path = parse_path(p, &p)))
+		return -1;
+	if (!is_null_oid(&rec->previous) &&
+	    (*p++ != '\t' || !(rec->previous_path = parse_path(p, &p))))
+		return -1;
+	return *p ? -1 : 0;
+}
+
+static int parse_entry(struct blame_cache *cache, char *buf,
+		       const struct object_id *commit, const char *path,
+		       struct blame_cache_entry *entry)
+{
+	struct strbuf quoted = STRBUF_INIT;
+	const char *p;
+	char *line, *eol;
+	int lno = 0, ret = -1;
+
+	quote_c_style(path, &quoted, NULL, 0);
+	line = buf;
+	if (!(eol = strchr(line, '\n')))
+		goto out;
+	*eol = '\0';
+	if (strcmp(line, BLAME_CACHE_SIGNATURE))
+		goto out;
+
+	line = eol + 1;
+	if (!(eol = strchr(line, '\n')))
+		goto out;
+	*eol = '\0';
+	if (!skip_prefix(line, "commit ", &p) || strcmp(p, oid_to_hex(commit)))
+		goto out;
+
+	line = eol + 1;
+	if (!(eol = strchr(line, '\n')))
+		goto out;
+	*eol = '\0';
+	if (!skip_prefix(line, "path ", &p) || strcmp(p, quoted.buf))
+		goto out;
+
+	line = eol + 1;
+	if (!(eol = strchr(line, '\n')))
+		goto out;
+	*eol = '\0';
+	if (!skip_prefix(line, "options ", &p) || strcmp(p, cache->options))
+		goto out;
+
+	line = eol + 1;
+	if (!(eol = strchr(line, '\n')))
+		goto out;
+	*eol = '\0';
+	if (!skip_prefix(line, "blob ", &p) ||
+	    parse_oid_hex(p, &entry->blob, &p) || *p)
+		goto out;
+
+	for (line = eol + 1; *line; line = eol + 1) {
+		if (!(eol = strchr(line, '\n')))
+			goto out;
+		*eol = '\0';
+		if (parse_record(entry, line, lno))
+			goto out;
+		lno += entry->records[entry->nr - 1].num_lines;
+	}
+	if (entry->nr)
+		ret = 0;
+out:
+	strbuf_release(&quoted);
+	return ret;
+}
+
+int blame_cache_read(struct blame_cache *cache,
+		     const struct object_id *commit, const char *path,
+		     struct blame_cache_entry *entry)
+{
+	struct strbuf file = STRBUF_INIT;
+	struct strbuf buf = STRBUF_INIT;
+	int ret = -1;
+
+	cache_file_path(cache, &file, commit, path);
+	if (strbuf_read_file(&buf, file.buf, 0) < 0)
+		goto out;
+
+	ret = parse_entry(cache, buf.buf, commit, path, entry);
+	if (ret) {
+		warning(_("ignoring corrupt blame cache file '%s'"), file.buf);
+		blame_cache_entry_release(entry);
+	} else {
+		cache->hits++;
+		/* keep results that are in use from being pruned */
+		utime(file.buf, NULL);
+	}
+out:
+	strbuf_release(&file);
+	strbuf_release(&buf);
+	return ret;
+}
+
+void blame_cache_prune(struct repository *r, timestamp_t expire)
+{
+	struct strbuf path = STRBUF_INIT;
+	size_t baselen;
+	DIR *dir;
+	struct dirent *de;
+
+	strbuf_addf(&path, "%s/info/blame-cache", r->objects->odb->path);
+	dir = opendir(path.buf);
+	if (!dir) {
+		strbuf_release(&path);
+		return;
+	}
+	strbuf_addch(&path, '/');
+	baselen = path.len;
+	while ((de = readdir(dir)) != NULL) {
+		DIR *subdir;
+		struct dirent *sub;
+		size_t dirlen;
+
+		if (is_dot_or_dotdot(de->d_name))
+			continue;
+		strbuf_setlen(&path, baselen);
+		strbuf_addstr(&path, de->d_name);
+		subdir = opendir(path.buf);
+		if (!subdir)
+			continue;
+		strbuf_addch(&path, '/');
+		dirlen = path.len;
+		while ((sub = readdir(subdir)) != NULL) {
+			struct stat st;
+
+			if (is_dot_or_dotdot(sub->d_name))
+				continue;
+			strbuf_setlen(&path, dirlen);
+			strbuf_addstr(&path, sub->d_name);
+			if (!lstat(path.buf, &st) && S_ISREG(st.st_mode) &&
+			    st.st_mtime <= expire)
+				unlink_or_warn(path.buf);
+		}
+		closedir(subdir);
+		strbuf_setlen(&path, dirlen - 1);
+		rmdir(path.buf);
+	}
+	closedir(dir);
+	strbuf_release(&path);
+}
+
+void blame_cache_write(struct blame_cache *cache,
+		       const struct object_id *commit, const char *path,
+		       const struct blame_cache_entry *entry)
+{
+	struct lock_file lk = LOCK_INIT;
+	struct strbuf file = STRBUF_INIT;
+	struct strbuf buf = STRBUF_INIT;
+	int i;
+
+	cache_file_path(cache, &file, commit, path);
+	if (safe_create_leading_directories(file.buf) ||
+	    hold_lock_file_for_update(&lk, file.buf, 0) < 0)
+		goto out;
+
+	strbuf_addf(&buf, "%s\n", BLAME_CACHE_SIGNATURE);
+	strbuf_addf(&buf, "commit %s\n", oid_to_hex(commit));
+	strbuf_addstr(&buf, "path ");
+	quote_c_style(path, &buf, NULL, 0);
+	strbuf_addf(&buf, "\noptions %s\n", cache->options);
+	strbuf_addf(&buf, "blob %s\n", oid_to_hex(&entry->blob));
+	for (i = 0; i < entry->nr; i++) {
+		const struct blame_cache_record *rec = &entry->records[i];
+
+		strbuf_addf(&buf, "%d %d %d %s ", rec->lno, rec->num_lines,
+			    rec->s_lno, oid_to_hex(&rec->commit));
+		if (rec->previous_path)
+			strbuf_addstr(&buf, oid_to_hex(&rec->previous));
+		else
+			strbuf_addch(&buf, '-');
+		strbuf_addch(&buf, '\t');
+		quote_c_style(rec->path, &buf, NULL, 0);
+		if (rec->previous_path) {
+			strbuf_addch(&buf, '\t');
+			quote_c_style(rec->previous_path, &buf, NULL, 0);
+		}
+		strbuf_addch(&buf, '\n');
+	}
+
+	if (write_in_full(get_lock_file_fd(&lk), buf.buf, buf.len) < 0 ||
+	    commit_lock_file(&lk))
+		rollback_lock_file(&lk);
+	else
+		cache->writes++;
+out:
+	strbuf_release(&file);
+	strbuf_release(&buf);
+}
@@ -0,0 +1,81 @@
+#ifndef BLAME_CACHE_H
+#define BLAME_CACHE_H
+
+#include "hash.h"
+
+struct repository;
+
+/*
+ * The blame of a whole file at a commit, as a list of line ranges
+ * sorted by line number, each attributed to a path at a commit.
+ */
+struct blame_cache_record {
+	/* first line and number of lines in the cached file, 0 based */
+	int lno;
+	int num_lines;
+	/* first line in the file the lines are attributed to */
+	int s_lno;
+	struct object_id commit;
+	char *path;
+	/* the origin the attributed one was diffed against, if any */
+	struct object_id previous;
+	char *previous_path;
+};
+
+struct blame_cache_entry {
+	/* the blob that was blamed */
+	struct object_id blob;
+	struct blame_cache_record *records;
+	int nr, alloc;
+};
+
+/*
+ * Results are stored one file per commit and path below
+ * "$GIT_OBJECT_DIRECTORY/info/blame-cache". The options that change
+ * the blame assigned to lines are part of the key, so that runs with
+ * different options do not see each other's results.
+ */
+struct blame_cache {
+	char *dir;
+	char *options;
+	int hits, writes;
+};
+
+void blame_cache_init(struct blame_cache *cache, struct repository *r,
+		      const char *options);
+void blame_cache_release(struct blame_cache *cache);
+
+/*
+ * Return 1 if there is a cached result for the path at the commit.
+ * This only looks at the file system and can be called from any thread.
+ */
+int blame_cache_has(struct blame_cache *cache,
+		    const struct object_id *commit, const char *path);
+
+/*
+ * Read the result for the path at the commit into "entry". Return 0
+ * on success, and -1 if there is none or it cannot be used, in which
+ * case "entry" is left empty.
+ */
+int blame_cache_read(struct blame_cache *cache,
+		     const struct object_id *commit, const char *path,
+		     struct blame_cache_entry *entry);
+
+/*
+ * Store "entry" as the result for the path at the commit. Failing to
+ * store it is not an error; the next run just misses it.
+ */
+void blame_cache_write(struct blame_cache *cache,
+		       const struct object_id *commit, const char *path,
+		       const struct blame_cache_entry *entry);
+
+/*
+ * Remove the stored results that were neither written nor used since
+ * "expire".
+ */
+void blame_cache_prune(struct repository *r, timestamp_t expire);
+
+struct blame_cache_record *blame_cache_append(struct blame_cache_entry *entry);
+void blame_cache_entry_release(struct blame_cache_entry *entry);
+
+#endif /* BLAME_CACHE_H */
@@ -11,6 +11,11 @@
 #include "commit-slab.h"
 #include "bloom.h"
 #include "commit-graph.h"
+#include "prefetch.h"
+#include "userdiff.h"
+#include "promisor-remote.h"
+#include "blame-cache.h"
+#include "replace-object.h"
 
 define_commit_slab(blame_suspects, struct blame_origin *);
 static struct blame_suspects blame_suspects;
@@ -1199,6 +1204,378 @@ void blame_coalesce(struct blame_scoreboard *sb)
 		sanity_check_refcnt(sb);
 }
 
+/*
+ * Diffs prepared ahead of time by worker threads.
+ *
+ * The hunks that pass_blame_to_parent() gets from the diff between the
+ * blob of an origin and that of its parent only depend on the two blobs,
+ * not on the blame assigned so far. While assign_blame() works through
+ * the suspects one at a time, worker threads walk the history of the
+ * suspects ahead of it, following the path from each commit to its
+ * parents like pass_blame() does, and compute these diffs. The main
+ * thread then replays the hunks instead of running the diff itself; it
+ * still assigns all blame in the usual order, so the output does not
+ * depend on the number of threads or on how far ahead they got.
+ *
+ * The workers only read objects. They parse the commits they walk
+ * themselves instead of going through the object hash, and follow a
+ * path no further than the first parent that does not have it; a
+ * rename found by the main thread gets its own walk once its origin is
+ * queued.
+ */
+
+/* How many diffs each thread may have ready before it waits. */
+#define PREFETCH_AHEAD 32
+
+struct prefetch_job {
+	struct prefetch_job *next;
+	struct object_id commit;
+	struct object_id blob;
+	const char *path; /* owned by the "seen" entry */
+};
+
+struct prefetch_seen {
+	struct hashmap_entry ent;
+	struct object_id commit;
+	char *path;
+};
+
+struct prefetch_hunk {
+	long start_a, count_a, start_b, count_b;
+};
+
+struct prefetch_diff {
+	struct prefetch_item item;
+	struct object_id parent_blob;
+	struct object_id blob;
+	struct prefetch_hunk *hunks;
+	int nr, alloc;
+};
+
+struct blame_prefetch {
+	/* its items are struct prefetch_diff, by parent blob and blob */
+	struct prefetch base;
+	struct repository *repo;
+	int xdl_opts;
+	int first_parent_only;
+	/* the main thread will not look past cached results */
+	struct blame_cache *cache;
+
+	struct prefetch_job *jobs, **jobs_tail;
+	/* commit and path pairs that were queued as jobs */
+	struct hashmap seen;
+	int nr_ahead, max_ahead;
+
+	/* used by the main thread only */
+	char *textconv_path;
+	int textconv;
+};
+
+static int prefetch_seen_cmp(const void *unused_cmp_data,
+			     const struct hashmap_entry *eptr,
+			     const struct hashmap_entry *entry_or_key,
+			     const void *unused_keydata)
+{
+	const struct prefetch_seen *a, *b;
+
+	a = container_of(eptr, const struct prefetch_seen, ent);
+	b = container_of(entry_or_key, const struct prefetch_seen, ent);
+	return !oideq(&a->commit, &b->commit) || strcmp(a->path, b->path);
+}
+
+static int prefetch_diff_cmp(const void *unused_cmp_data,
+			     const struct hashmap_entry *eptr,
+			     const struct hashmap_entry *entry_or_key,
+			     const void *unused_keydata)
+{
+	const struct prefetch_diff *a, *b;
+
+	a = container_of(eptr, const struct prefetch_diff, item.ent);
+	b = container_of(entry_or_key, const struct prefetch_diff, item.ent);
+	return !oideq(&a->parent_blob, &b->parent_blob) ||
+		!oideq(&a->blob, &b->blob);
+}
+
+static void prefetch_diff_key(struct prefetch_diff *key,
+			      const struct object_id *parent_blob,
+			      const struct object_id *blob)
+{
+	hashmap_entry_init(&key->item.ent, oidhash(parent_blob) ^ oidhash(blob));
+	oidcpy(&key->parent_blob, parent_blob);
+	oidcpy(&key->blob, blob);
+}
+
+/* Queue a walk from 'commit', unless one was already queued. */
+static void prefetch_queue(struct blame_prefetch *bp,
+			   const struct object_id *commit,
+			   const char *path,
+			   const struct object_id *blob)
+{
+	struct prefetch_seen key, *seen;
+	struct prefetch_job *job;
+
+	hashmap_entry_init(&key.ent, oidhash(commit) ^ strhash(path));
+	oidcpy(&key.commit, commit);
+	key.path = (char *)path;
+
+	pthread_mutex_lock(&bp->base.mutex);
+	if (!hashmap_get(&bp->seen, &key.ent, NULL)) {
+		seen = xmalloc(sizeof(*seen));
+		hashmap_entry_init(&seen->ent, key.ent.hash);
+		oidcpy(&seen->commit, commit);
+		seen->path = xstrdup(path);
+		hashmap_add(&bp->seen, &seen->ent);
+
+		job = xcalloc(1, sizeof(*job));
+		oidcpy(&job->commit, commit);
+		oidcpy(&job->blob, blob);
+		job->path = seen->path;
+		*bp->jobs_tail = job;
+		bp->jobs_tail = &job->next;
+		pthread_cond_signal(&bp->base.work_cond);
+	}
+	pthread_mutex_unlock(&bp->base.mutex);
+}
+
+static int prefetch_hunk_cb(long start_a, long count_a,
+			    long start_b, long count_b, void *data)
+{
+	struct prefetch_diff *d = data;
+
+	ALLOC_GROW(d->hunks, d->nr + 1, d->alloc);
+	d->hunks[d->nr].start_a = start_a;
+	d->hunks[d->nr].count_a = count_a;
+	d->hunks[d->nr].start_b = start_b;
+	d->hunks[d->nr].count_b = count_b;
+	d->nr++;
+	return 0;
+}
+
+static void prefetch_diff(struct blame_prefetch *bp,
+			  const struct object_id *parent_blob,
+			  const struct object_id *blob)
+{
+	struct prefetch_diff key, *d;
+	mmfile_t file_p, file_o;
+	enum object_type type;
+	unsigned long size;
+	int ok;
+
+	prefetch_diff_key(&key, parent_blob, blob);
+	pthread_mutex_lock(&bp->base.mutex);
+	if (hashmap_get(&bp->base.items, &key.item.ent, NULL)) {
+		pthread_mutex_unlock(&bp->base.mutex);
+		return;
+	}
+	d = xcalloc(1, sizeof(*d));
+	prefetch_diff_key(d, parent_blob, blob);
+	d->item.state = PREFETCH_RUNNING;
+	hashmap_add(&bp->base.items, &d->item.ent);
+	bp->nr_ahead++;
+	pthread_mutex_unlock(&bp->base.mutex);
+
+	file_p.ptr = read_object_file(parent_blob, &type, &size);
+	file_p.size = size;
+	file_o.ptr = read_object_file(blob, &type, &size);
+	file_o.size = size;
+	ok = file_p.ptr && file_o.ptr &&
+		!diff_hunks(&file_p, &file_o, prefetch_hunk_cb, d, bp->xdl_opts);
+	free(file_p.ptr);
+	free(file_o.ptr);
+
+	pthread_mutex_lock(&bp->base.mutex);
+	if (ok) {
+		prefetch_done(&bp->base, &d->item, PREFETCH_READY);
+	} else {
+		/* leave it to the main thread */
+		hashmap_remove(&bp->base.items, &d->item.ent, NULL);
+		bp->nr_ahead--;
+		free(d->hunks);
+		free(d);
+		pthread_cond_signal(&bp->base.work_cond);
+		pthread_cond_broadcast(&bp->base.done_cond);
+	}
+	pthread_mutex_unlock(&bp->base.mutex);
+}
+
+/*
+ * Look at the parents of the commit of a job, as pass_blame() will: if
+ * one of them has the same blob, all the blame goes there and we only
+ * follow that one; otherwise each parent that has the path gets its
+ * diff, and is followed in turn.
+ */
+static void prefetch_walk(struct blame_prefetch *bp, struct prefetch_job *job)
+{
+	struct oid_array parents = OID_ARRAY_INIT;
+	struct object_id *blobs = NULL;
+	unsigned short mode;
+	enum object_type type;
+	unsigned long size;
+	const char *p;
+	char *buf;
+	int i, j, *has_path = NULL;
+
+	if (bp->cache && blame_cache_has(bp->cache, &job->commit, job->path))
+		return;
+
+	buf = read_object_file(&job->commit, &type, &size);
+	if (!buf || type != OBJ_COMMIT)
+		goto out;
+	p = buf;
+	if (!skip_prefix(p, "tree ", &p) || !(p = strchr(p, '\n')))
+		goto out;
+	p++;
+	while (skip_prefix(p, "parent ", &p)) {
+		struct object_id oid;
+
+		if (parse_oid_hex(p, &oid, &p) || *p++ != '\n')
+			break;
+		oid_array_append(&parents, &oid);
+		if (bp->first_parent_only)
+			break;
+	}
+
+	CALLOC_ARRAY(blobs, parents.nr);
+	CALLOC_ARRAY(has_path, parents.nr);
+	for (i = 0; i < parents.nr; i++) {
+		if (get_tree_entry(bp->repo, &parents.oid[i], job->path,
+				   &blobs[i], &mode) ||
+		    !(S_ISREG(mode) || S_ISLNK(mode)))
+			continue;
+		if (oideq(&blobs[i], &job->blob)) {
+			prefetch_queue(bp, &parents.oid[i], job->path, &blobs[i]);
+			goto out;
+		}
+		has_path[i] = 1;
+	}
+
+	for (i = 0; i < parents.nr; i++)
+		if (has_path[i])
+			prefetch_queue(bp, &parents.oid[i], job->path, &blobs[i]);
+	for (i = 0; i < parents.nr; i++) {
+		if (!has_path[i])
+			continue;
+		for (j = 0; j < i; j++)
+			if (has_path[j] && oideq(&blobs[j], &blobs[i]))
+				break;
+		if (j == i)
+			prefetch_diff(bp, &blobs[i], &job->blob);
+	}
+
+out:
+	free(buf);
+	free(blobs);
+	free(has_path);
+	oid_array_clear(&parents);
+}
+
+static void *prefetch_next_job(struct prefetch *p)
+{
+	struct blame_prefetch *bp = container_of(p, struct blame_prefetch, base);
+	struct prefetch_job *job = bp->jobs;
+
+	if (!job || bp->nr_ahead >= bp->max_ahead)
+		return NULL;
+	bp->jobs = job->next;
+	if (!bp->jobs)
+		bp->jobs_tail = &bp->jobs;
+	return job;
+}
+
+static void prefetch_run_job(struct prefetch *p, void *job)
+{
+	prefetch_walk(container_of(p, struct blame_prefetch, base), job);
+	free(job);
+}
+
+/* Let the workers start walking from an origin that got suspects. */
+static void prefetch_origin(struct blame_scoreboard *sb, struct blame_origin *o)
+{
+	struct blame_prefetch *bp = sb->prefetch;
+
+	if (!bp || is_null_oid(&o->commit->object.oid) ||
+	    is_null_oid(&o->blob_oid))
+		return;
+
+	/*
+	 * The workers diff the blobs as they are, so leave the paths
+	 * whose contents fill_origin_blob() would convert alone.
+	 */
+	if (sb->revs->diffopt.flags.allow_textconv &&
+	    (!bp->textconv_path || strcmp(bp->textconv_path, o->path))) {
+		struct userdiff_driver *drv;
+
+		drv = userdiff_find_by_path(sb->repo->index, o->path);
+		bp->textconv = drv && drv->textconv;
+		free(bp->textconv_path);
+		bp->textconv_path = xstrdup(o->path);
+	}
+	if (sb->revs->diffopt.flags.allow_textconv && bp->textconv)
+		return;
+
+	prefetch_queue(bp, &o->commit->object.oid, o->path, &o->blob_oid);
+}
+
+static void start_prefetch(struct blame_scoreboard *sb)
+{
+	struct blame_prefetch *bp;
+	int i;
+
+	if (!HAVE_THREADS || sb->num_threads < 2 || sb->reverse ||
+	    has_promisor_remote())
+		return;
+
+	CALLOC_ARRAY(bp, 1);
+	bp->repo = sb->repo;
+	bp->xdl_opts = sb->xdl_opts;
+	bp->first_parent_only = sb->revs->first_parent_only;
+	bp->cache = sb->cache;
+	prefetch_init(&bp->base, prefetch_diff_cmp);
+	bp->base.next_job = prefetch_next_job;
+	bp->base.run_job = prefetch_run_job;
+	bp->jobs_tail = &bp->jobs;
+	hashmap_init(&bp->seen, prefetch_seen_cmp, NULL, 0);
+	bp->max_ahead = PREFETCH_AHEAD * sb->num_threads;
+	sb->prefetch = bp;
+
+	for (i = 0; i < sb->commits.nr; i++) {
+		struct blame_origin *o;
+
+		for (o = get_blame_suspects(sb->commits.array[i].data); o; o = o->next)
+			if (o->suspects)
+				prefetch_origin(sb, o);
+	}
+
+	prefetch_start(&bp->base, sb->num_threads);
+}
+
+static void stop_prefetch(struct blame_scoreboard *sb)
+{
+	struct blame_prefetch *bp = sb->prefetch;
+	struct prefetch_job *job;
+	struct prefetch_diff *d;
+	struct prefetch_seen *seen;
+	struct hashmap_iter iter;
+
+	if (!bp)
+		return;
+
+	prefetch_stop(&bp->base, "blame", sb->repo);
+
+	while ((job = bp->jobs)) {
+		bp->jobs = job->next;
+		free(job);
+	}
+	hashmap_for_each_entry(&bp->base.items, &iter, d, item.ent)
+		free(d->hunks);
+	hashmap_free_entries(&bp->base.items, struct prefetch_diff, item.ent);
+	hashmap_for_each_entry(&bp->seen, &iter, seen, ent)
+		free(seen->path);
+	hashmap_free_entries(&bp->seen, struct prefetch_seen, ent);
+	free(bp->textconv_path);
+	FREE_AND_NULL(sb->prefetch);
+}
+
 /*
  * Merge the given sorted list of blames into a preexisting origin.
  * If there were no previous blames to that commit, it is entered into
@@ -1212,6 +1589,9 @@ static void queue_blames(struct blame_scoreboard *sb, struct blame_origin *porig
 		porigin->suspects = blame_merge(porigin->suspects, sorted);
 	else {
 		struct blame_origin *o;
+
+		if (sorted)
+			prefetch_origin(sb, porigin);
 		for (o = get_blame_suspects(porigin->commit); o; o = o->next) {
 			if (o->suspects) {
 				porigin->suspects = sorted;
@@ -1251,11 +1631,11 @@ static int fill_blob_sha1_and_mode(struct repository *r,
 struct blame_bloom_data {
 	/*
 	 * Changed-path Bloom filter keys. These can help prevent
-	 * computing diffs against first parents, but we need to
-	 * expand the list as code is moved or files are renamed.
+	 * computing diffs against parents, but we need to expand
+	 * the list as code is moved or files are renamed.
 	 */
 	struct bloom_filter_settings *settings;
-	struct bloom_key **keys;
+	struct bloom_keyvec **keys;
 	int nr;
 	int alloc;
 };
@@ -1264,10 +1644,11 @@ static int bloom_count_queries = 0;
 static int bloom_count_no = 0;
 static int maybe_changed_path(struct repository *r,
 			      struct blame_origin *origin,
+			      struct commit *parent,
 			      struct blame_bloom_data *bd)
 {
 	int i;
-	struct bloom_filter *filter;
+	struct bloom_filter filter;
 
 	if (!bd)
 		return 1;
@@ -1275,16 +1656,14 @@ static int maybe_changed_path(struct repository *r,
 	if (origin->commit->generation == GENERATION_NUMBER_INFINITY)
 		return 1;
 
-	filter = get_bloom_filter(r, origin->commit, 0);
-
-	if (!filter)
+	if (!get_bloom_filter_for_parent(r, origin->commit, parent, &filter))
 		return 1;
 
 	bloom_count_queries++;
 	for (i = 0; i < bd->nr; i++) {
-		if (bloom_filter_contains(filter,
-					  bd->keys[i],
-					  bd->settings))
+		if (bloom_filter_contains_vec(&filter,
+					      bd->keys[i],
+					      bd->settings))
 			return 1;
 	}
 
@@ -1303,8 +1682,7 @@ static void add_bloom_key(struct blame_bloom_data *bd,
 		REALLOC_ARRAY(bd->keys, bd->alloc);
 	}
 
-	bd->keys[bd->nr] = xmalloc(sizeof(struct bloom_key));
-	fill_bloom_key(path, strlen(path), bd->keys[bd->nr], bd->settings);
+	bd->keys[bd->nr] = bloom_keyvec_new(path, strlen(path), bd->settings);
 	bd->nr++;
 }
 
@@ -1350,11 +1728,7 @@ static struct blame_origin *find_origin(struct repository *r,
 	if (is_null_oid(&origin->commit->object.oid))
 		do_diff_cache(get_commit_tree_oid(parent), &diff_opts);
 	else {
-		int compute_diff = 1;
-		if (origin->commit->parents &&
-		    !oidcmp(&parent->object.oid,
-			    &origin->commit->parents->item->object.oid))
-			compute_diff = maybe_changed_path(r, origin, bd);
+		int compute_diff = maybe_changed_path(r, origin, parent, bd);
 
 		if (compute_diff)
 			diff_tree_oid(get_commit_tree_oid(parent),
@@ -1929,6 +2303,49 @@ static int blame_chunk_cb(long start_a, long count_a,
 	return 0;
 }
 
+/*
+ * Feed the hunks of the diff from 'parent' to 'target' to
+ * blame_chunk_cb() if a worker thread computed them already, waiting
+ * for it if it is still at it. Return 0 if the diff has to be run.
+ */
+static int replay_prefetched_diff(struct blame_prefetch *bp,
+				  struct blame_origin *parent,
+				  struct blame_origin *target,
+				  struct blame_chunk_cb_data *d)
+{
+	struct prefetch_diff key, *pd;
+	int i;
+
+	prefetch_diff_key(&key, &parent->blob_oid, &target->blob_oid);
+	pthread_mutex_lock(&bp->base.mutex);
+	pd = container_of_or_null(prefetch_wait(&bp->base, &key.item),
+				  struct prefetch_diff, item);
+	if (!pd) {
+		/* make sure no worker starts on it now */
+		pd = xcalloc(1, sizeof(*pd));
+		prefetch_diff_key(pd, &parent->blob_oid, &target->blob_oid);
+		pd->item.state = PREFETCH_TAKEN;
+		hashmap_add(&bp->base.items, &pd->item.ent);
+	} else if (pd->item.state == PREFETCH_READY) {
+		pd->item.state = PREFETCH_TAKEN;
+		bp->nr_ahead--;
+		pthread_cond_signal(&bp->base.work_cond);
+		pthread_mutex_unlock(&bp->base.mutex);
+
+		bp->base.hits++;
+		for (i = 0; i < pd->nr; i++)
+			blame_chunk_cb(pd->hunks[i].start_a, pd->hunks[i].count_a,
+				       pd->hunks[i].start_b, pd->hunks[i].count_b,
+				       d);
+		FREE_AND_NULL(pd->hunks);
+		pd->nr = pd->alloc = 0;
+		return 1;
+	}
+	pthread_mutex_unlock(&bp->base.mutex);
+	bp->base.misses++;
+	return 0;
+}
+
 /*
  * We are looking at the origin 'target' and aiming to pass blame
  * for the lines it is suspected to its parent.  Run diff to find
@@ -1951,16 +2368,19 @@ static void pass_blame_to_parent(struct blame_scoreboard *sb,
 	d.ignore_diffs = ignore_diffs;
 	d.dstq = &newdest; d.srcq = &target->suspects;
 
-	fill_origin_blob(&sb->revs->diffopt, parent, &file_p,
-			 &sb->num_read_blob, ignore_diffs);
-	fill_origin_blob(&sb->revs->diffopt, target, &file_o,
-			 &sb->num_read_blob, ignore_diffs);
 	sb->num_get_patch++;
-
-	if (diff_hunks(&file_p, &file_o, blame_chunk_cb, &d, sb->xdl_opts))
-		die("unable to generate diff (%s -> %s)",
-		    oid_to_hex(&parent->commit->object.oid),
-		    oid_to_hex(&target->commit->object.oid));
+	if (ignore_diffs || !sb->prefetch ||
+	    !replay_prefetched_diff(sb->prefetch, parent, target, &d)) {
+		fill_origin_blob(&sb->revs->diffopt, parent, &file_p,
+				 &sb->num_read_blob, ignore_diffs);
+		fill_origin_blob(&sb->revs->diffopt, target, &file_o,
+				 &sb->num_read_blob, ignore_diffs);
+
+		if (diff_hunks(&file_p, &file_o, blame_chunk_cb, &d, sb->xdl_opts))
+			die("unable to generate diff (%s -> %s)",
+			    oid_to_hex(&parent->commit->object.oid),
+			    oid_to_hex(&target->commit->object.oid));
+	}
 	/* The rest are the same as the parent */
 	blame_chunk(&d.dstq, &d.srcq, INT_MAX, d.offset, INT_MAX, 0,
 		    parent, target, 0);
@@ -2578,6 +2998,179 @@ static void pass_blame(struct blame_scoreboard *sb, struct blame_origin *origin,
 		free(sg_origin);
 }
 
+/*
+ * If the blame of the whole file of an origin is in the cache, map the
+ * lines of its suspects through it instead of passing them to the
+ * parents. Lines the cache attributes to the origin itself stay its
+ * suspects, for the caller to take responsibility for them like it
+ * does after pass_blame(); the others are final.
+ */
+static int splice_cached_blame(struct blame_scoreboard *sb,
+			       struct blame_origin *origin)
+{
+	struct blame_cache_entry entry = { 0 };
+	struct blame_cache_record *rec;
+	struct blame_origin **origins = NULL;
+	struct blame_entry *e, *next, *own = NULL, **own_tail = &own;
+	int i, total, ret = 0;
+
+	if (is_null_oid(&origin->commit->object.oid) ||
+	    blame_cache_read(sb->cache, &origin->commit->object.oid,
+			     origin->path, &entry))
+		return 0;
+	if (!oideq(&entry.blob, &origin->blob_oid))
+		goto out;
+	rec = &entry.records[entry.nr - 1];
+	total = rec->lno + rec->num_lines;
+	for (e = origin->suspects; e; e = e->next)
+		if (e->s_lno + e->num_lines > total)
+			goto out;
+
+	CALLOC_ARRAY(origins, entry.nr);
+	for (i = 0; i < entry.nr; i++) {
+		struct commit *commit;
+
+		rec = &entry.records[i];
+		commit = lookup_commit(sb->repo, &rec->commit);
+		if (!commit || parse_commit(commit))
+			goto out;
+		origins[i] = get_origin(commit, rec->path);
+	}
+
+	for (i = 0; i < entry.nr; i++) {
+		struct commit *commit;
+
+		rec = &entry.records[i];
+		if (!rec->previous_path || origins[i]->previous)
+			continue;
+		commit = lookup_commit(sb->repo, &rec->previous);
+		if (commit)
+			origins[i]->previous = get_origin(commit,
+							  rec->previous_path);
+	}
+
+	for (e = origin->suspects; e; e = next) {
+		int lo = 0, hi = entry.nr;
+		int start = e->s_lno, end = e->s_lno + e->num_lines;
+
+		/* find the first record that ends after the entry starts */
+		while (lo < hi) {
+			int mi = lo + (hi - lo) / 2;
+
+			rec = &entry.records[mi];
+			if (rec->lno + rec->num_lines <= start)
+				lo = mi + 1;
+			else
+				hi = mi;
+		}
+		for (i = lo; start < end; i++) {
+			struct blame_entry *n = xcalloc(1, sizeof(*n));
+			int len;
+
+			rec = &entry.records[i];
+			len = rec->lno + rec->num_lines - start;
+			if (end - start < len)
+				len = end - start;
+			n->lno = e->lno + start - e->s_lno;
+			n->num_lines = len;
+			n->s_lno = rec->s_lno + start - rec->lno;
+			n->suspect = blame_origin_incref(origins[i]);
+			start += len;
+
+			if (origins[i] == origin) {
+				*own_tail = n;
+				own_tail = &n->next;
+				continue;
+			}
+			origins[i]->guilty = 1;
+			if (sb->found_guilty_entry)
+				sb->found_guilty_entry(n, sb->found_guilty_entry_data);
+			n->next = sb->ent;
+			sb->ent = n;
+		}
+		next = e->next;
+		blame_origin_decref(e->suspect);
+		free(e);
+	}
+	*own_tail = NULL;
+	origin->suspects = own;
+
+	/* treat root commits as boundaries, like assign_blame() does */
+	for (i = 0; i < entry.nr; i++)
+		if (!origins[i]->commit->parents && !sb->show_root)
+			origins[i]->commit->object.flags |= UNINTERESTING;
+	ret = 1;
+out:
+	if (origins)
+		for (i = 0; i < entry.nr; i++)
+			blame_origin_decref(origins[i]);
+	free(origins);
+	blame_cache_entry_release(&entry);
+	return ret;
+}
+
+static int compare_blame_entry_lno(const void *a_, const void *b_)
+{
+	const struct blame_entry *a = *(const struct blame_entry **)a_;
+	const struct blame_entry *b = *(const struct blame_entry **)b_;
+
+	return a->lno - b->lno;
+}
+
+/* Store the blame of the final file in the cache if it covers all lines. */
+static void store_cached_blame(struct blame_scoreboard *sb)
+{
+	struct blame_cache_entry entry = { 0 };
+	struct blame_cache_record *rec = NULL;
+	struct blame_entry *e, **ents;
+	const struct object_id *commit_oid = &sb->final->object.oid;
+	unsigned short mode;
+	int i, nr = 0, lno = 0;
+
+	if (is_null_oid(commit_oid) ||
+	    blame_cache_has(sb->cache, commit_oid, sb->path) ||
+	    get_tree_entry(sb->repo, commit_oid, sb->path, &entry.blob, &mode))
+		return;
+
+	for (e = sb->ent; e; e = e->next)
+		nr++;
+	ALLOC_ARRAY(ents, nr);
+	for (i = 0, e = sb->ent; e; e = e->next)
+		ents[i++] = e;
+	QSORT(ents, nr, compare_blame_entry_lno);
+
+	for (i = 0; i < nr; i++) {
+		struct blame_entry *ent = ents[i];
+		struct blame_origin *suspect = ent->suspect;
+
+		if (ent->lno != lno || ent->ignored || ent->unblamable)
+			goto out;
+		lno += ent->num_lines;
+
+		if (rec && ents[i - 1]->suspect == suspect &&
+		    rec->s_lno + rec->num_lines == ent->s_lno) {
+			rec->num_lines += ent->num_lines;
+			continue;
+		}
+		rec = blame_cache_append(&entry);
+		rec->lno = ent->lno;
+		rec->num_lines = ent->num_lines;
+		rec->s_lno = ent->s_lno;
+		oidcpy(&rec->commit, &suspect->commit->object.oid);
+		rec->path = xstrdup(suspect->path);
+		if (suspect->previous) {
+			oidcpy(&rec->previous,
+			       &suspect->previous->commit->object.oid);
+			rec->previous_path = xstrdup(suspect->previous->path);
+		}
+	}
+	if (entry.nr && lno == sb->num_lines)
+		blame_cache_write(sb->cache, commit_oid, sb->path, &entry);
+out:
+	free(ents);
+	blame_cache_entry_release(&entry);
+}
+
 /*
  * The main loop -- while we have blobs with lines whose true origin
  * is still unknown, pick one blob, and allow its lines to pass blames
@@ -2585,8 +3178,10 @@ static void pass_blame(struct blame_scoreboard *sb, struct blame_origin *origin,
 void assign_blame(struct blame_scoreboard *sb, int opt)
 {
 	struct rev_info *revs = sb->revs;
-	struct commit *commit = prio_queue_get(&sb->commits);
+	struct commit *commit;
 
+	start_prefetch(sb);
+	commit = prio_queue_get(&sb->commits);
 	while (commit) {
 		struct blame_entry *ent;
 		struct blame_origin *suspect = get_blame_suspects(commit);
@@ -2608,7 +3203,9 @@ void assign_blame(struct blame_scoreboard *sb, int opt)
 		 */
 		blame_origin_incref(suspect);
 		parse_commit(commit);
-		if (sb->reverse ||
+		if (sb->cache && splice_cached_blame(sb, suspect))
+			; /* the cache took care of the lines */
+		else if (sb->reverse ||
 		    (!(commit->object.flags & UNINTERESTING) &&
 		     !(revs->max_age != -1 && commit->date < revs->max_age)))
 			pass_blame(sb, suspect, opt);
@@ -2644,6 +3241,9 @@ void assign_blame(struct blame_scoreboard *sb, int opt)
 		if (sb->debug) /* sanity */
 			sanity_check_refcnt(sb);
 	}
+	stop_prefetch(sb);
+	if (sb->cache)
+		store_cached_blame(sb);
 }
 
 /*
@@ -2911,14 +3511,70 @@ void setup_blame_bloom_data(struct blame_scoreboard *sb,
 	sb->bloom_data = bd;
 }
 
+void setup_blame_cache(struct blame_scoreboard *sb, int opt)
+{
+	struct rev_info *revs = sb->revs;
+	struct strbuf options = STRBUF_INIT;
+	int i;
+
+	/*
+	 * With plain diffs each line of a file at a commit ends up at
+	 * the same origin no matter where the search started, which is
+	 * what makes a stored result reusable. Looking for moves and
+	 * copies depends on how the lines are grouped, ignoring commits
+	 * and stopping at boundaries on the command line, and a
+	 * shallow history may yet be deepened.
+	 */
+	if (opt || sb->reverse || oidset_size(&sb->ignore_list) ||
+	    revs->max_age != -1 || is_repository_shallow(sb->repo))
+		return;
+	/*
+	 * Results are keyed by the commit, so they must not be computed
+	 * on a history rewritten by replace refs or grafts (which include
+	 * the ones read from "-S").
+	 */
+	if (read_replace_refs) {
+		prepare_replace_object(sb->repo);
+		if (hashmap_get_size(&sb->repo->objects->replace_map->map))
+			return;
+	}
+	prepare_commit_graft(sb->repo);
+	if (sb->repo->parsed_objects->grafts_nr)
+		return;
+	for (i = 0; i < revs->cmdline.nr; i++)
+		if (revs->cmdline.rev[i].flags & UNINTERESTING)
+			return;
+	if (revs->diffopt.flags.allow_textconv) {
+		struct userdiff_driver *drv;
+
+		drv = userdiff_find_by_path(sb->repo->index, sb->path);
+		if (drv && drv->textconv)
+			return;
+	}
+
+	strbuf_addf(&options, "xdl=%d first-parent=%d renames=%d",
+		    sb->xdl_opts, revs->first_parent_only,
+		    !sb->no_whole_file_rename);
+	sb->cache = xmalloc(sizeof(*sb->cache));
+	blame_cache_init(sb->cache, sb->repo, options.buf);
+	strbuf_release(&options);
+}
+
 void cleanup_scoreboard(struct blame_scoreboard *sb)
 {
+	if (sb->cache) {
+		trace2_data_intmax("blame", sb->repo,
+				   "cache/hits", sb->cache->hits);
+		trace2_data_intmax("blame", sb->repo,
+				   "cache/writes", sb->cache->writes);
+		blame_cache_release(sb->cache);
+		FREE_AND_NULL(sb->cache);
+	}
+
 	if (sb->bloom_data) {
 		int i;
-		for (i = 0; i < sb->bloom_data->nr; i++) {
-			free(sb->bloom_data->keys[i]->hashes);
-			free(sb->bloom_data->keys[i]);
-		}
+		for (i = 0; i < sb->bloom_data->nr; i++)
+			bloom_keyvec_free(sb->bloom_data->keys[i]);
 		free(sb->bloom_data->keys);
 		FREE_AND_NULL(sb->bloom_data);
 
@@ -101,6 +101,8 @@ struct blame_entry {
 };
 
 struct blame_bloom_data;
+struct blame_prefetch;
+struct blame_cache;
 
 /*
  * The current state of the blame assignment.
@@ -153,12 +155,17 @@ struct blame_scoreboard {
 	int no_whole_file_rename;
 	int debug;
 
+	/* threads preparing diffs ahead of assign_blame() */
+	int num_threads;
+
 	/* callbacks */
 	void(*on_sanity_fail)(struct blame_scoreboard *, int);
 	void(*found_guilty_entry)(struct blame_entry *, void *);
 
 	void *found_guilty_entry_data;
 	struct blame_bloom_data *bloom_data;
+	struct blame_prefetch *prefetch;
+	struct blame_cache *cache;
 };
 
 /*
@@ -185,6 +192,7 @@ void setup_scoreboard(struct blame_scoreboard *sb,
 		      struct blame_origin **orig);
 void setup_blame_bloom_data(struct blame_scoreboard *sb,
 			    const char *path);
+void setup_blame_cache(struct blame_scoreboard *sb, int opt);
 void cleanup_scoreboard(struct blame_scoreboard *sb);
 
 struct blame_entry *blame_entry_prepend(struct blame_entry *head,
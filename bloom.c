@@ -1,16 +1,20 @@
 #include "git-compat-util.h"
 #include "bloom.h"
 #include "diff.h"
-#include "diffcore.h"
 #include "revision.h"
 #include "hashmap.h"
 #include "commit-graph.h"
 #include "commit.h"
+#include "oid-array.h"
 
 define_commit_slab(bloom_filter_slab, struct bloom_filter);
 
 struct bloom_filter_slab bloom_filters;
 
+define_commit_slab(bloom_parent_filters_slab, struct bloom_parent_filters);
+
+static struct bloom_parent_filters_slab bloom_parent_filters;
+
 struct pathmap_hash_entry {
     struct hashmap_entry entry;
     const char path[FLEX_ARRAY];
@@ -28,18 +32,38 @@ static inline unsigned char get_bitmask(uint32_t pos)
 	return ((unsigned char)1) << (pos & (BITS_PER_WORD - 1));
 }
 
-static int load_bloom_filter_from_graph(struct commit_graph *g,
-				   struct bloom_filter *filter,
-				   struct commit *c)
+/*
+ * Return the commit-graph layer 'c' lives in, if it carries Bloom
+ * filters computed with 'settings' (or, if that is NULL, with the
+ * settings of the top-most layer, which readers query them with).
+ */
+static struct commit_graph *bloom_graph_for(struct repository *r,
+					    struct commit *c,
+					    const struct bloom_filter_settings *settings)
 {
-	uint32_t lex_pos, start_index, end_index;
+	struct commit_graph *g = r->objects->commit_graph;
+
+	if (!g || c->graph_pos == COMMIT_NOT_FROM_GRAPH)
+		return NULL;
+	if (!settings)
+		settings = g->bloom_filter_settings;
+	if (!settings)
+		return NULL;
 
 	while (c->graph_pos < g->num_commits_in_base)
 		g = g->base_graph;
 
-	/* The commit graph commit 'c' lives in doesn't carry bloom filters. */
-	if (!g->chunk_bloom_indexes)
-		return 0;
+	if (!g->chunk_bloom_indexes ||
+	    !bloom_filter_settings_equal(g->bloom_filter_settings, settings))
+		return NULL;
+	return g;
+}
+
+static void load_bloom_filter_from_graph(struct commit_graph *g,
+					 struct bloom_filter *filter,
+					 struct commit *c)
+{
+	uint32_t lex_pos, start_index, end_index;
 
 	lex_pos = c->graph_pos - g->num_commits_in_base;
 
@@ -54,7 +78,47 @@ static int load_bloom_filter_from_graph(struct commit_graph *g,
 	filter->data = (unsigned char *)(g->chunk_bloom_data +
 					sizeof(unsigned char) * start_index +
 					BLOOMDATA_CHUNK_HEADER_SIZE);
+}
 
+static int load_bloom_parent_filters_from_graph(struct commit_graph *g,
+						struct bloom_parent_filters *filters,
+						struct commit *c)
+{
+	uint32_t lex_pos, start_index, end_index;
+	struct oid_array parents = OID_ARRAY_INIT;
+	int nr_parents;
+
+	/* The commit graph commit 'c' lives in doesn't carry them. */
+	if (!g->chunk_bloom_parent_indexes)
+		return 0;
+
+	lex_pos = c->graph_pos - g->num_commits_in_base;
+
+	end_index = get_be32(g->chunk_bloom_parent_indexes + 4 * lex_pos);
+
+	/*
+	 * The filters against the other parents are stored after the
+	 * filters against the first parent of all commits.
+	 */
+	if (lex_pos > 0)
+		start_index = get_be32(g->chunk_bloom_parent_indexes + 4 * (lex_pos - 1));
+	else
+		start_index = get_be32(g->chunk_bloom_indexes + 4 * (g->num_commits - 1));
+
+	if (commit_graph_parents(g, c, &parents) < 0)
+		return 0;
+	nr_parents = parents.nr;
+	oid_array_clear(&parents);
+	if (nr_parents < 2 || end_index < start_index)
+		return 0;
+
+	filters->nr = nr_parents - 1;
+	filters->len = (end_index - start_index) / filters->nr;
+	if (filters->len * filters->nr != end_index - start_index)
+		return 0;
+	filters->data = (unsigned char *)(g->chunk_bloom_data +
+					  sizeof(unsigned char) * start_index +
+					  BLOOMDATA_CHUNK_HEADER_SIZE);
 	return 1;
 }
 
@@ -138,6 +202,43 @@ void fill_bloom_key(const char *data,
 		key->hashes[i] = hash0 + i * hash1;
 }
 
+struct bloom_keyvec *bloom_keyvec_new(const char *path, size_t len,
+				      const struct bloom_filter_settings *settings)
+{
+	struct bloom_keyvec *vec;
+	size_t nr = 1, i;
+
+	for (i = 0; i < len; i++)
+		if (path[i] == '/')
+			nr++;
+
+	vec = xcalloc(1, st_add(sizeof(*vec),
+				st_mult(nr, sizeof(struct bloom_key))));
+	vec->count = nr;
+
+	/*
+	 * The path itself first, so that a filter without it is
+	 * rejected after testing a single key most of the time.
+	 */
+	fill_bloom_key(path, len, &vec->key[0], settings);
+	for (i = 0, nr = 1; i < len; i++)
+		if (path[i] == '/')
+			fill_bloom_key(path, i, &vec->key[nr++], settings);
+
+	return vec;
+}
+
+void bloom_keyvec_free(struct bloom_keyvec *vec)
+{
+	size_t i;
+
+	if (!vec)
+		return;
+	for (i = 0; i < vec->count; i++)
+		free(vec->key[i].hashes);
+	free(vec);
+}
+
 void add_key_to_filter(const struct bloom_key *key,
 					   struct bloom_filter *filter,
 					   const struct bloom_filter_settings *settings)
@@ -156,17 +257,144 @@ void add_key_to_filter(const struct bloom_key *key,
 void init_bloom_filters(void)
 {
 	init_bloom_filter_slab(&bloom_filters);
+	init_bloom_parent_filters_slab(&bloom_parent_filters);
 }
 
-struct bloom_filter *get_bloom_filter(struct repository *r,
-				      struct commit *c,
-					  int compute_if_not_present)
+int bloom_filter_settings_equal(const struct bloom_filter_settings *a,
+				const struct bloom_filter_settings *b)
+{
+	return a->hash_version == b->hash_version &&
+	       a->num_hashes == b->num_hashes &&
+	       a->bits_per_entry == b->bits_per_entry;
+}
+
+struct changed_paths {
+	struct hashmap *pathmap;
+	int nr;
+};
+
+/*
+ * Add 'path' and all its leading directories to the pathmap, i.e. for
+ * 'dir/subdir/file' add 'dir' and 'dir/subdir' as well, so the Bloom
+ * filter could be used to speed up commands like 'git log dir/subdir',
+ * too.
+ *
+ * Note that directories are added without the trailing '/'.
+ */
+static void add_changed_path(struct diff_options *opt, const char *path)
+{
+	struct changed_paths *changed = opt->change_fn_data;
+	size_t len = strlen(path);
+
+	changed->nr++;
+	if (changed->nr > opt->max_changes)
+		return;
+
+	while (len) {
+		struct pathmap_hash_entry *e;
+
+		FLEX_ALLOC_MEM(e, path, path, len);
+		hashmap_entry_init(&e->entry, memhash(path, len));
+		hashmap_add(changed->pathmap, &e->entry);
+
+		while (len && path[len - 1] != '/')
+			len--;
+		if (len)
+			len--;
+	}
+}
+
+static void changed_path_change(struct diff_options *opt,
+				unsigned old_mode, unsigned new_mode,
+				const struct object_id *old_oid,
+				const struct object_id *new_oid,
+				int old_oid_valid, int new_oid_valid,
+				const char *fullpath,
+				unsigned old_dirty_submodule,
+				unsigned new_dirty_submodule)
+{
+	add_changed_path(opt, fullpath);
+}
+
+static void changed_path_add_remove(struct diff_options *opt,
+				    int addremove, unsigned mode,
+				    const struct object_id *oid,
+				    int oid_valid,
+				    const char *fullpath,
+				    unsigned dirty_submodule)
+{
+	add_changed_path(opt, fullpath);
+}
+
+/*
+ * Add the paths changed between 'parent' (NULL for the empty tree) and
+ * 'c', and all their leading directories, to 'pathmap'. Returns -1
+ * if there are more than 'max_changes', in which case the pathmap is
+ * incomplete.
+ *
+ * The changes are collected through the diff callbacks rather than
+ * the global diff queue, so that this can run on several threads at
+ * once as long as object reading is protected with
+ * enable_obj_read_lock(). Submodules are never ignored: an extra path
+ * in a filter only costs a false positive.
+ */
+static int collect_changed_paths(struct repository *r,
+				 const struct object_id *parent,
+				 struct commit *c,
+				 int max_changes,
+				 struct hashmap *pathmap)
 {
-	struct bloom_filter *filter;
-	struct bloom_filter_settings settings = DEFAULT_BLOOM_FILTER_SETTINGS;
-	int i;
 	struct diff_options diffopt;
-	int max_changes = 512;
+	struct changed_paths changed = { pathmap, 0 };
+
+	repo_diff_setup(r, &diffopt);
+	diffopt.flags.recursive = 1;
+	diffopt.detect_rename = 0;
+	diffopt.max_changes = max_changes;
+	diffopt.change = changed_path_change;
+	diffopt.add_remove = changed_path_add_remove;
+	diffopt.change_fn_data = &changed;
+	diff_setup_done(&diffopt);
+
+	diff_tree_oid(parent, &c->object.oid, "", &diffopt);
+
+	return changed.nr > max_changes ? -1 : 0;
+}
+
+static size_t bloom_filter_len(size_t nr_paths,
+			       const struct bloom_filter_settings *settings)
+{
+	return (nr_paths * settings->bits_per_entry + BITS_PER_WORD - 1) / BITS_PER_WORD;
+}
+
+static void add_paths_to_filter(struct hashmap *pathmap,
+				struct bloom_filter *filter,
+				const struct bloom_filter_settings *settings)
+{
+	struct pathmap_hash_entry *e;
+	struct hashmap_iter iter;
+
+	hashmap_for_each_entry(pathmap, &iter, e, entry) {
+		struct bloom_key key;
+		fill_bloom_key(e->path, strlen(e->path), &key, settings);
+		add_key_to_filter(&key, filter, settings);
+		free(key.hashes);
+	}
+}
+
+struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
+						 struct commit *c,
+						 int compute_if_not_present,
+						 const struct bloom_filter_settings *settings,
+						 enum bloom_filter_computed *computed)
+{
+	struct bloom_filter *filter;
+	struct bloom_filter_settings default_settings = DEFAULT_BLOOM_FILTER_SETTINGS;
+	struct commit_graph *g;
+	struct hashmap pathmap;
+
+	if (computed)
+		*computed = 0;
 
 	if (bloom_filters.slab_size == 0)
 		return NULL;
@@ -175,84 +403,186 @@ struct bloom_filter *get_bloom_filter(struct repository *r,
 
 	if (!filter->data) {
 		load_commit_graph_info(r, c);
-		if (c->graph_pos != COMMIT_NOT_FROM_GRAPH &&
-			r->objects->commit_graph->chunk_bloom_indexes) {
-			if (load_bloom_filter_from_graph(r->objects->commit_graph, filter, c))
-				return filter;
-			else
-				return NULL;
+		g = bloom_graph_for(r, c, settings);
+		if (g) {
+			load_bloom_filter_from_graph(g, filter, c);
+			if (computed)
+				*computed |= BLOOM_NOT_COMPUTED;
+			return filter;
 		}
+		if (!compute_if_not_present &&
+		    c->graph_pos != COMMIT_NOT_FROM_GRAPH &&
+		    r->objects->commit_graph->chunk_bloom_indexes)
+			return NULL;
 	}
 
 	if (filter->data || !compute_if_not_present)
 		return filter;
 
-	repo_diff_setup(r, &diffopt);
-	diffopt.flags.recursive = 1;
-	diffopt.detect_rename = 0;
-	diffopt.max_changes = max_changes;
-	diff_setup_done(&diffopt);
+	if (!settings)
+		settings = &default_settings;
+
+	/*
+	 * Neither kind of truncated filter is empty, so that they can be
+	 * told apart from the zero-length filters of older commit-graphs:
+	 * one without any bit set matches no path, and one with all bits
+	 * set matches every path.
+	 */
+	hashmap_init(&pathmap, NULL, NULL, 0);
+	if (!collect_changed_paths(r, c->parents ? &c->parents->item->object.oid : NULL,
+				   c, settings->max_changed_paths, &pathmap)) {
+		filter->len = bloom_filter_len(hashmap_get_size(&pathmap), settings);
+		if (!filter->len) {
+			filter->len = 1;
+			if (computed)
+				*computed |= BLOOM_TRUNC_EMPTY;
+		}
+		filter->data = xcalloc(filter->len, sizeof(unsigned char));
+		add_paths_to_filter(&pathmap, filter, settings);
+	} else {
+		filter->len = 1;
+		filter->data = xmalloc(filter->len);
+		filter->data[0] = 0xff;
+		if (computed)
+			*computed |= BLOOM_TRUNC_LARGE;
+	}
+	hashmap_free_entries(&pathmap, struct pathmap_hash_entry, entry);
 
-	if (c->parents)
-		diff_tree_oid(&c->parents->item->object.oid, &c->object.oid, "", &diffopt);
-	else
-		diff_tree_oid(NULL, &c->object.oid, "", &diffopt);
-	diffcore_std(&diffopt);
+	if (computed)
+		*computed |= BLOOM_COMPUTED;
+	return filter;
+}
 
-	if (diff_queued_diff.nr <= max_changes) {
-		struct hashmap pathmap;
-		struct pathmap_hash_entry *e;
-		struct hashmap_iter iter;
-		hashmap_init(&pathmap, NULL, NULL, 0);
-
-		for (i = 0; i < diff_queued_diff.nr; i++) {
-			const char *path = diff_queued_diff.queue[i]->two->path;
-
-			/*
-			* Add each leading directory of the changed file, i.e. for
-			* 'dir/subdir/file' add 'dir' and 'dir/subdir' as well, so
-			* the Bloom filter could be used to speed up commands like
-			* 'git log dir/subdir', too.
-			*
-			* Note that directories are added without the trailing '/'.
-			*/
-			do {
-				char *last_slash = strrchr(path, '/');
-
-				FLEX_ALLOC_STR(e, path, path);
-				hashmap_entry_init(&e->entry, strhash(path));
-				hashmap_add(&pathmap, &e->entry);
-
-				if (!last_slash)
-					last_slash = (char*)path;
-				*last_slash = '\0';
-
-			} while (*path);
-
-			diff_free_filepair(diff_queued_diff.queue[i]);
-		}
+struct bloom_filter *get_bloom_filter(struct repository *r,
+				      struct commit *c,
+				      int compute_if_not_present)
+{
+	return get_or_compute_bloom_filter(r, c, compute_if_not_present,
+					   NULL, NULL);
+}
 
-		filter->len = (hashmap_get_size(&pathmap) * settings.bits_per_entry + BITS_PER_WORD - 1) / BITS_PER_WORD;
-		filter->data = xcalloc(filter->len, sizeof(unsigned char));
+struct bloom_parent_filters *get_bloom_parent_filters(struct repository *r,
+						      struct commit *c,
+						      int compute_if_not_present,
+						      const struct bloom_filter_settings *settings)
+{
+	struct bloom_parent_filters *filters;
+	struct bloom_filter_settings default_settings = DEFAULT_BLOOM_FILTER_SETTINGS;
+	struct commit_graph *g;
+	struct hashmap *pathmaps;
+	struct commit_list *p;
+	size_t max_len = 0;
+	int nr, i, too_many = 0;
+
+	if (bloom_parent_filters.slab_size == 0)
+		return NULL;
+
+	filters = bloom_parent_filters_slab_at(&bloom_parent_filters, c);
+	if (filters->loaded)
+		return filters;
+
+	load_commit_graph_info(r, c);
+	g = bloom_graph_for(r, c, settings);
+	if (g) {
+		filters->loaded = 1;
+		if (!load_bloom_parent_filters_from_graph(g, filters, c))
+			filters->nr = filters->len = 0;
+		return filters;
+	}
 
-		hashmap_for_each_entry(&pathmap, &iter, e, entry) {
-			struct bloom_key key;
-			fill_bloom_key(e->path, strlen(e->path), &key, &settings);
-			add_key_to_filter(&key, filter, &settings);
+	if (!compute_if_not_present)
+		return filters;
+
+	if (!settings)
+		settings = &default_settings;
+
+	filters->loaded = 1;
+	nr = commit_list_count(c->parents) - 1;
+	if (nr < 1)
+		return filters;
+
+	ALLOC_ARRAY(pathmaps, nr);
+	for (i = 0, p = c->parents->next; i < nr; i++, p = p->next) {
+		hashmap_init(&pathmaps[i], NULL, NULL, 0);
+		if (too_many ||
+		    collect_changed_paths(r, &p->item->object.oid, c,
+					  settings->max_changed_paths, &pathmaps[i])) {
+			too_many = 1;
+			continue;
 		}
+		if (bloom_filter_len(hashmap_get_size(&pathmaps[i]), settings) > max_len)
+			max_len = bloom_filter_len(hashmap_get_size(&pathmaps[i]), settings);
+	}
 
-		hashmap_free_entries(&pathmap, struct pathmap_hash_entry, entry);
-	} else {
-		for (i = 0; i < diff_queued_diff.nr; i++)
-			diff_free_filepair(diff_queued_diff.queue[i]);
-		filter->data = NULL;
-		filter->len = 0;
+	/*
+	 * All filters of a commit have the same length, so that the
+	 * reader can find them from their total size. Unlike the filter
+	 * against the first parent, they are never empty, so that a
+	 * merge that did not change anything against a parent can be
+	 * told apart from one that changed too much.
+	 */
+	if (!too_many) {
+		filters->nr = nr;
+		filters->len = max_len ? max_len : 1;
+		filters->data = xcalloc(st_mult(nr, filters->len), sizeof(unsigned char));
+		for (i = 0; i < nr; i++) {
+			struct bloom_filter filter;
+
+			filter.data = filters->data + i * filters->len;
+			filter.len = filters->len;
+			add_paths_to_filter(&pathmaps[i], &filter, settings);
+		}
 	}
 
-	free(diff_queued_diff.queue);
-	DIFF_QUEUE_CLEAR(&diff_queued_diff);
+	for (i = 0; i < nr; i++)
+		hashmap_free_entries(&pathmaps[i], struct pathmap_hash_entry, entry);
+	free(pathmaps);
 
-	return filter;
+	return filters;
+}
+
+int get_bloom_filter_for_parent(struct repository *r,
+				struct commit *c,
+				struct commit *parent,
+				struct bloom_filter *filter)
+{
+	struct bloom_parent_filters *filters;
+	struct bloom_filter *first;
+	struct oid_array parents = OID_ARRAY_INIT;
+	int nth, nr_parents;
+
+	if (c->graph_pos == COMMIT_NOT_FROM_GRAPH ||
+	    !r->objects->commit_graph)
+		return 0;
+
+	/*
+	 * Find out which parent this is from the commit-graph, as the
+	 * parents of 'c' may have been rewritten by the caller.
+	 */
+	if (commit_graph_parents(r->objects->commit_graph, c, &parents) < 0)
+		return 0;
+	for (nth = 0; nth < parents.nr; nth++)
+		if (oideq(&parents.oid[nth], &parent->object.oid))
+			break;
+	nr_parents = parents.nr;
+	oid_array_clear(&parents);
+	if (nth == nr_parents)
+		return 0;
+
+	if (!nth) {
+		first = get_bloom_filter(r, c, 0);
+		if (!first || !first->len)
+			return 0;
+		*filter = *first;
+		return 1;
+	}
+
+	filters = get_bloom_parent_filters(r, c, 0, NULL);
+	if (!filters || nth > filters->nr || !filters->len)
+		return 0;
+	filter->data = filters->data + (nth - 1) * filters->len;
+	filter->len = filters->len;
+	return 1;
 }
 
 int bloom_filter_contains(const struct bloom_filter *filter,
@@ -273,4 +603,16 @@ int bloom_filter_contains(const struct bloom_filter *filter,
 	}
 
 	return 1;
-}
\ No newline at end of file
+}
+int bloom_filter_contains_vec(const struct bloom_filter *filter,
+			      const struct bloom_keyvec *vec,
+			      const struct bloom_filter_settings *settings)
+{
+	int ret = 1;
+	size_t i;
+
+	for (i = 0; ret > 0 && i < vec->count; i++)
+		ret = bloom_filter_contains(filter, &vec->key[i], settings);
+
+	return ret;
+}
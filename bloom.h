@@ -28,9 +28,19 @@ struct bloom_filter_settings {
 	 * that contain n*b bits.
 	 */
 	uint32_t bits_per_entry;
+
+	/*
+	 * The maximum number of paths a commit may change for
+	 * its Bloom filter to be computed. Commits that change
+	 * more get a filter of a single byte with all bits set,
+	 * which any path may be in. This only matters when
+	 * computing filters and is not written to the
+	 * commit-graph.
+	 */
+	uint32_t max_changed_paths;
 };
 
-#define DEFAULT_BLOOM_FILTER_SETTINGS { 1, 7, 10 }
+#define DEFAULT_BLOOM_FILTER_SETTINGS { 1, 7, 10, 512 }
 #define BITS_PER_WORD 8
 #define BLOOMDATA_CHUNK_HEADER_SIZE 3 * sizeof(uint32_t)
 
@@ -59,6 +69,31 @@ struct bloom_key {
 	uint32_t *hashes;
 };
 
+/*
+ * A bloom_keyvec holds the keys of a path and of all its leading
+ * directories, which are all added to the filter of a commit that
+ * changed the path. A filter that lacks any of them cannot contain the
+ * path, so testing them all rules out more commits than testing the
+ * path alone.
+ */
+struct bloom_keyvec {
+	size_t count;
+	struct bloom_key key[FLEX_ARRAY];
+};
+
+/*
+ * The Bloom filters of the paths changed between a merge commit and
+ * each of its parents but the first, one after the other in 'data'.
+ * All of them have the same length 'len' (which is 0 if there are
+ * none, e.g. because too many paths were changed).
+ */
+struct bloom_parent_filters {
+	unsigned char *data;
+	size_t len;
+	int nr;
+	unsigned loaded : 1;
+};
+
 /*
  * Calculate the murmur3 32-bit hash value for the given data
  * using the given seed.
@@ -73,18 +108,85 @@ void fill_bloom_key(const char *data,
 		    struct bloom_key *key,
 		    const struct bloom_filter_settings *settings);
 
+/*
+ * Compute the keys of the path 'path' of length 'len' (without a
+ * trailing slash) and of its leading directories.
+ */
+struct bloom_keyvec *bloom_keyvec_new(const char *path, size_t len,
+				      const struct bloom_filter_settings *settings);
+void bloom_keyvec_free(struct bloom_keyvec *vec);
+
 void add_key_to_filter(const struct bloom_key *key,
 					   struct bloom_filter *filter,
 					   const struct bloom_filter_settings *settings);
 
 void init_bloom_filters(void);
 
+/*
+ * Whether two sets of settings produce the same filters, so that the
+ * filters computed with one can be queried with the other.
+ */
+int bloom_filter_settings_equal(const struct bloom_filter_settings *a,
+				const struct bloom_filter_settings *b);
+
+enum bloom_filter_computed {
+	BLOOM_NOT_COMPUTED = (1 << 0),
+	BLOOM_COMPUTED     = (1 << 1),
+	BLOOM_TRUNC_LARGE  = (1 << 2),
+	BLOOM_TRUNC_EMPTY  = (1 << 3),
+};
+
+/*
+ * Return the Bloom filter of the paths changed between 'c' and its
+ * first parent. It is loaded from the commit-graph layer 'c' is in if
+ * that layer has filters computed with 'settings', and otherwise, if
+ * 'compute_if_not_present', computed with 'settings'. A NULL
+ * 'settings' accepts the filters of any layer whose settings are those
+ * of the top-most layer, and computes with the default ones.
+ *
+ * If 'computed' is not NULL, the BLOOM_* flags describing how the
+ * filter was obtained are stored in it.
+ */
+struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
+						 struct commit *c,
+						 int compute_if_not_present,
+						 const struct bloom_filter_settings *settings,
+						 enum bloom_filter_computed *computed);
+
 struct bloom_filter *get_bloom_filter(struct repository *r,
 				      struct commit *c,
 				      int compute_if_not_present);
 
+/*
+ * Return the filters of the paths changed between the merge commit 'c'
+ * and its other parents, loading or (if 'compute_if_not_present')
+ * computing them as get_or_compute_bloom_filter() does.
+ */
+struct bloom_parent_filters *get_bloom_parent_filters(struct repository *r,
+						      struct commit *c,
+						      int compute_if_not_present,
+						      const struct bloom_filter_settings *settings);
+
+/*
+ * Point 'filter' at the Bloom filter of the paths changed between 'c'
+ * and its parent 'parent', as stored in the commit-graph. Returns 0 if
+ * there is no usable filter.
+ */
+int get_bloom_filter_for_parent(struct repository *r,
+				struct commit *c,
+				struct commit *parent,
+				struct bloom_filter *filter);
+
 int bloom_filter_contains(const struct bloom_filter *filter,
 			  const struct bloom_key *key,
 			  const struct bloom_filter_settings *settings);
 
+/*
+ * Like bloom_filter_contains(), but for all the keys in 'vec': returns
+ * 0 if any of them is definitely not in the filter.
+ */
+int bloom_filter_contains_vec(const struct bloom_filter *filter,
+			      const struct bloom_keyvec *vec,
+			      const struct bloom_filter_settings *settings);
+
 #endif
\ No newline at end of file
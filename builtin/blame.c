@@ -27,6 +27,7 @@
 #include "object-store.h"
 #include "blame.h"
 #include "refs.h"
+#include "thread-utils.h"
 
 static char blame_usage[] = N_("git blame [<options>] [<rev-opts>] [<rev>] [--] <file>");
 
@@ -55,6 +56,8 @@ static int coloring_mode;
 static struct string_list ignore_revs_file_list = STRING_LIST_INIT_NODUP;
 static int mark_unblamable_lines;
 static int mark_ignored_lines;
+static int num_threads;
+static int use_blame_cache;
 
 static struct date_mode blame_date_mode = { DATE_ISO8601 };
 static size_t blame_date_width;
@@ -724,6 +727,17 @@ static int git_blame_config(const char *var, const char *value, void *cb)
 		mark_ignored_lines = git_config_bool(var, value);
 		return 0;
 	}
+	if (!strcmp(var, "blame.threads")) {
+		num_threads = git_config_int(var, value);
+		if (num_threads < 0)
+			die(_("invalid number of threads specified (%d) for %s"),
+			    num_threads, var);
+		return 0;
+	}
+	if (!strcmp(var, "blame.cache")) {
+		use_blame_cache = git_config_bool(var, value);
+		return 0;
+	}
 	if (!strcmp(var, "color.blame.repeatedlines")) {
 		if (color_parse_mem(value, strlen(value), repeated_meta_color))
 			warning(_("invalid color '%s' in color.blame.repeatedLines"),
@@ -1124,6 +1138,9 @@ int cmd_blame(int argc, const char **argv, const char *prefix)
 	sb.show_root = show_root;
 	sb.xdl_opts = xdl_opts;
 	sb.no_whole_file_rename = no_whole_file_rename;
+	sb.num_threads = num_threads ? num_threads : online_cpus();
+	if (use_blame_cache)
+		setup_blame_cache(&sb, opt);
 
 	read_mailmap(&mailmap, NULL);
 
@@ -16,6 +16,7 @@
 #include "packfile.h"
 #include "object-store.h"
 #include "promisor-remote.h"
+#include "thread-utils.h"
 
 struct batch_options {
 	int enabled;
@@ -24,6 +25,7 @@ struct batch_options {
 	int buffer_output;
 	int all_objects;
 	int unordered;
+	int prefetch;
 	int cmdmode; /* may be 'w' or 'c' for --filters or --textconv */
 	const char *format;
 };
@@ -57,9 +59,41 @@ static int filter_object(const char *path, unsigned mode,
 
 static int stream_blob(const struct object_id *oid)
 {
-	if (stream_blob_to_fd(1, oid, NULL, 0))
-		die("unable to stream %s to stdout", oid_to_hex(oid));
+	struct git_istream *st;
+	enum object_type type;
+	unsigned long sz;
+
+	/*
+	 * Like stream_blob_to_fd(), but only hold the object read lock
+	 * (taken by "--batch --prefetch") while reading from the stream,
+	 * not while writing what we read.
+	 */
+	obj_read_lock();
+	st = open_istream(the_repository, oid, &type, &sz, NULL);
+	obj_read_unlock();
+	if (!st || type != OBJ_BLOB)
+		goto fail;
+	for (;;) {
+		char buf[1024 * 16];
+		ssize_t readlen;
+
+		obj_read_lock();
+		readlen = read_istream(st, buf, sizeof(buf));
+		obj_read_unlock();
+		if (readlen < 0)
+			goto fail;
+		if (!readlen)
+			break;
+		if (write_in_full(1, buf, readlen) < 0)
+			goto fail;
+	}
+	obj_read_lock();
+	close_istream(st);
+	obj_read_unlock();
 	return 0;
+
+fail:
+	die("unable to stream %s to stdout", oid_to_hex(oid));
 }
 
 static int cat_one_file(int opt, const char *exp_type, const char *obj_name,
@@ -389,8 +423,15 @@ static void batch_one_object(const char *obj_name,
 	int flags = opt->follow_symlinks ? GET_OID_FOLLOW_SYMLINKS : 0;
 	enum get_oid_result result;
 
+	/*
+	 * Resolving the name looks into the packs, and reads trees for
+	 * "<rev>:<path>", not all of it under the lock; the lookups and
+	 * reads done below take it themselves.
+	 */
+	obj_read_lock();
 	result = get_oid_with_context(the_repository, obj_name,
 				      flags, &data->oid, &ctx);
+	obj_read_unlock();
 	if (result != FOUND) {
 		switch (result) {
 		case MISSING_OBJECT:
@@ -488,6 +529,104 @@ static int batch_unordered_packed(const struct object_id *oid,
 	return batch_unordered_object(oid, data);
 }
 
+/*
+ * With --prefetch, a separate thread reads stdin ahead of us and warms
+ * the delta base cache for the objects named on the upcoming lines, so
+ * that by the time we get to an object, usually only its final delta is
+ * left to apply. The lines are handed over through a small ring buffer;
+ * object access is serialized by the object read lock, which we do not
+ * hold while formatting and writing our output.
+ */
+#define PREFETCH_WINDOW 64
+
+static struct {
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct strbuf lines[PREFETCH_WINDOW];
+	unsigned int first, nr;
+	int eof;
+} prefetch;
+
+static void *prefetch_thread(void *unused)
+{
+	struct strbuf line = STRBUF_INIT;
+
+	while (strbuf_getline(&line, stdin) != EOF) {
+		struct object_id oid;
+		const char *end;
+		int have_oid = !parse_oid_hex(line.buf, &oid, &end) &&
+			       (!*end || isspace(*end));
+		unsigned int slot;
+
+		pthread_mutex_lock(&prefetch.mutex);
+		while (prefetch.nr == PREFETCH_WINDOW)
+			pthread_cond_wait(&prefetch.cond, &prefetch.mutex);
+		slot = (prefetch.first + prefetch.nr) % PREFETCH_WINDOW;
+		strbuf_swap(&line, &prefetch.lines[slot]);
+		prefetch.nr++;
+		pthread_cond_broadcast(&prefetch.cond);
+		pthread_mutex_unlock(&prefetch.mutex);
+
+		if (have_oid)
+			prefetch_delta_base(the_repository, &oid);
+	}
+
+	pthread_mutex_lock(&prefetch.mutex);
+	prefetch.eof = 1;
+	pthread_cond_broadcast(&prefetch.cond);
+	pthread_mutex_unlock(&prefetch.mutex);
+
+	strbuf_release(&line);
+	return NULL;
+}
+
+static void start_prefetch(void)
+{
+	int i, err;
+
+	for (i = 0; i < PREFETCH_WINDOW; i++)
+		strbuf_init(&prefetch.lines[i], 0);
+	pthread_mutex_init(&prefetch.mutex, NULL);
+	pthread_cond_init(&prefetch.cond, NULL);
+	enable_obj_read_lock();
+
+	err = pthread_create(&prefetch.thread, NULL, prefetch_thread, NULL);
+	if (err)
+		die(_("unable to create prefetch thread: %s"), strerror(err));
+}
+
+static int prefetch_getline(struct strbuf *sb)
+{
+	int ret = EOF;
+
+	pthread_mutex_lock(&prefetch.mutex);
+	while (!prefetch.nr && !prefetch.eof)
+		pthread_cond_wait(&prefetch.cond, &prefetch.mutex);
+	if (prefetch.nr) {
+		strbuf_swap(sb, &prefetch.lines[prefetch.first]);
+		prefetch.first = (prefetch.first + 1) % PREFETCH_WINDOW;
+		prefetch.nr--;
+		pthread_cond_broadcast(&prefetch.cond);
+		ret = 0;
+	}
+	pthread_mutex_unlock(&prefetch.mutex);
+	return ret;
+}
+
+static void finish_prefetch(void)
+{
+	int i;
+
+	/* We only get here after seeing EOF, so the thread is done. */
+	pthread_join(prefetch.thread, NULL);
+	disable_obj_read_lock();
+	pthread_cond_destroy(&prefetch.cond);
+	pthread_mutex_destroy(&prefetch.mutex);
+	for (i = 0; i < PREFETCH_WINDOW; i++)
+		strbuf_release(&prefetch.lines[i]);
+}
+
 static int batch_objects(struct batch_options *opt)
 {
 	struct strbuf input = STRBUF_INIT;
@@ -570,7 +709,11 @@ static int batch_objects(struct batch_options *opt)
 	save_warning = warn_on_object_refname_ambiguity;
 	warn_on_object_refname_ambiguity = 0;
 
-	while (strbuf_getline(&input, stdin) != EOF) {
+	if (opt->prefetch)
+		start_prefetch();
+
+	while ((opt->prefetch ? prefetch_getline(&input) :
+		strbuf_getline(&input, stdin)) != EOF) {
 		if (data.split_on_whitespace) {
 			/*
 			 * Split at first whitespace, tying off the beginning
@@ -588,6 +731,9 @@ static int batch_objects(struct batch_options *opt)
 		batch_one_object(input.buf, &output, opt, &data);
 	}
 
+	if (opt->prefetch)
+		finish_prefetch();
+
 	strbuf_release(&input);
 	strbuf_release(&output);
 	warn_on_object_refname_ambiguity = save_warning;
@@ -664,6 +810,8 @@ int cmd_cat_file(int argc, const char **argv, const char *prefix)
 			 N_("show all objects with --batch or --batch-check")),
 		OPT_BOOL(0, "unordered", &batch.unordered,
 			 N_("do not order --batch-all-objects output")),
+		OPT_BOOL(0, "prefetch", &batch.prefetch,
+			 N_("prefetch delta bases of upcoming objects (with --batch)")),
 		OPT_END()
 	};
 
@@ -699,6 +847,19 @@ int cmd_cat_file(int argc, const char **argv, const char *prefix)
 		usage_with_options(cat_file_usage, options);
 	}
 
+	if (batch.prefetch) {
+		if (!batch.enabled || !batch.print_contents)
+			die(_("--prefetch requires --batch"));
+		if (batch.all_objects)
+			die(_("--prefetch cannot be combined with "
+			      "--batch-all-objects"));
+		if (!HAVE_THREADS) {
+			warning(_("no threads support, ignoring %s"),
+				"--prefetch");
+			batch.prefetch = 0;
+		}
+	}
+
 	if (force_path && opt != 'c' && opt != 'w') {
 		error("--path=<path> needs --textconv or --filters");
 		usage_with_options(cat_file_usage, options);
@@ -0,0 +1,555 @@
+#include "builtin.h"
+#include "config.h"
+#include "parse-options.h"
+#include "fsmonitor.h"
+#include "fsmonitor-ipc.h"
+#ifdef HAVE_FSMONITOR_DAEMON
+#include <sys/inotify.h>
+#include "hashmap.h"
+#include "sigchain.h"
+#include "tempfile.h"
+#include "unix-socket.h"
+#endif
+
+static const char * const builtin_fsmonitor__daemon_usage[] = {
+	N_("git fsmonitor--daemon start"),
+	N_("git fsmonitor--daemon run [--detach]"),
+	N_("git fsmonitor--daemon stop"),
+	N_("git fsmonitor--daemon status"),
+	N_("git fsmonitor--daemon query <token>"),
+	NULL
+};
+
+#ifdef HAVE_FSMONITOR_DAEMON
+
+/*
+ * Forget what we know and make clients rescan once this many distinct
+ * paths have changed, to bound the memory used by a long-running daemon.
+ */
+#define MAX_CHANGED_PATHS (1 << 20)
+
+/*
+ * Clients are served one at a time, so give up on one that does not
+ * send its request or read our answer within this many seconds,
+ * rather than keep all the others waiting.
+ */
+#define CLIENT_TIMEOUT 1
+
+#define WATCH_MASK (IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE | \
+		    IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | \
+		    IN_MOVE_SELF | IN_ONLYDIR | IN_EXCL_UNLINK)
+
+/*
+ * Every path that changed since we started, with the sequence number of
+ * its most recent change. A token handed out to a client is the sequence
+ * number of the most recent change at that time, prefixed by a string
+ * that identifies this instance of the daemon.
+ */
+struct changed_path {
+	struct hashmap_entry ent;
+	uint64_t seq;
+	char path[FLEX_ARRAY];
+};
+
+static struct hashmap changed_paths;
+static uint64_t last_seq;
+/* We know about all changes after this one; older tokens are useless. */
+static uint64_t oldest_seq;
+static char *token_prefix;
+
+static int inotify_fd = -1;
+/*
+ * We watch directories by their absolute path, as the daemon does not
+ * stay in the worktree; this is the length of the "<worktree>/" prefix.
+ */
+static size_t root_len;
+/* Worktree-relative path ("" or "dir/") of each watch descriptor */
+static char **watch_paths;
+static int watch_paths_alloc;
+static int worktree_gone;
+
+static int changed_path_cmp(const void *unused_cmp_data,
+			    const struct hashmap_entry *eptr,
+			    const struct hashmap_entry *entry_or_key,
+			    const void *keydata)
+{
+	const struct changed_path *a, *b;
+
+	a = container_of(eptr, const struct changed_path, ent);
+	b = container_of(entry_or_key, const struct changed_path, ent);
+	return strcmp(a->path, keydata ? keydata : b->path);
+}
+
+static void forget_changes(void)
+{
+	hashmap_free_entries(&changed_paths, struct changed_path, ent);
+	hashmap_init(&changed_paths, changed_path_cmp, NULL, 0);
+	oldest_seq = ++last_seq;
+}
+
+static void record_change(const char *path)
+{
+	struct changed_path *cp;
+	unsigned int hash = strhash(path);
+
+	cp = hashmap_get_entry_from_hash(&changed_paths, hash, path,
+					 struct changed_path, ent);
+	if (!cp) {
+		if (hashmap_get_size(&changed_paths) >= MAX_CHANGED_PATHS)
+			forget_changes();
+		FLEX_ALLOC_STR(cp, path, path);
+		hashmap_entry_init(&cp->ent, hash);
+		hashmap_add(&changed_paths, &cp->ent);
+	}
+	cp->seq = ++last_seq;
+}
+
+static int add_watch(const char *abs)
+{
+	const char *rel = abs + root_len;
+	int wd = inotify_add_watch(inotify_fd, abs, WATCH_MASK);
+
+	if (wd < 0) {
+		if (errno == ENOSPC)
+			die(_("too many directories to watch; consider raising "
+			      "fs.inotify.max_user_watches"));
+		if (errno == ENOENT || errno == ENOTDIR)
+			return -1; /* it went away already */
+		die_errno(_("unable to watch '%s'"), abs);
+	}
+
+	if (wd >= watch_paths_alloc) {
+		int old_alloc = watch_paths_alloc;
+
+		ALLOC_GROW(watch_paths, wd + 1, watch_paths_alloc);
+		memset(watch_paths + old_alloc, 0,
+		       (watch_paths_alloc - old_alloc) * sizeof(*watch_paths));
+	}
+	/* A directory that moved keeps its descriptor; update its path. */
+	free(watch_paths[wd]);
+	watch_paths[wd] = xstrdup(rel);
+	return wd;
+}
+
+/*
+ * Watch the directory "path" (absolute, ending in a slash) and everything
+ * below it. If "report" is set, the directory is new to us and all of
+ * its contents are recorded as changed, as they may have been created
+ * before we started watching.
+ */
+static void watch_directory(struct strbuf *path, int report)
+{
+	size_t len = path->len;
+	struct dirent *de;
+	DIR *dir;
+
+	if (add_watch(path->buf) < 0)
+		return;
+	dir = opendir(path->buf);
+	if (!dir)
+		return;
+
+	while ((de = readdir(dir))) {
+		int dtype = DTYPE(de);
+
+		if (is_dot_or_dotdot(de->d_name) || !strcmp(de->d_name, ".git"))
+			continue;
+
+		strbuf_addstr(path, de->d_name);
+		if (dtype == DT_UNKNOWN) {
+			struct stat st;
+
+			if (!lstat(path->buf, &st) && S_ISDIR(st.st_mode))
+				dtype = DT_DIR;
+		}
+		if (dtype == DT_DIR)
+			strbuf_addch(path, '/');
+		if (report)
+			record_change(path->buf + root_len);
+		if (dtype == DT_DIR)
+			watch_directory(path, report);
+		strbuf_setlen(path, len);
+	}
+	closedir(dir);
+}
+
+static void handle_event(const struct inotify_event *ev, struct strbuf *path)
+{
+	const char *rel;
+
+	if (ev->mask & IN_Q_OVERFLOW) {
+		/* We lost events, so we cannot vouch for any old token. */
+		forget_changes();
+		return;
+	}
+
+	if (ev->wd < 0 || ev->wd >= watch_paths_alloc || !watch_paths[ev->wd])
+		return;
+	rel = watch_paths[ev->wd];
+
+	if (ev->mask & IN_IGNORED) {
+		if (!*rel)
+			worktree_gone = 1;
+		FREE_AND_NULL(watch_paths[ev->wd]);
+		return;
+	}
+
+	/* The worktree was moved away; we would watch the wrong thing. */
+	if (!*rel && (ev->mask & IN_MOVE_SELF)) {
+		worktree_gone = 1;
+		return;
+	}
+
+	/* Events on a watched directory itself are reported by its parent. */
+	if (!ev->len)
+		return;
+	if (!strcmp(ev->name, ".git")) {
+		/*
+		 * The repository is going away. Somebody may still sit in
+		 * the worktree, in which case we would not hear about the
+		 * worktree itself being removed.
+		 */
+		if (!*rel && (ev->mask & (IN_DELETE | IN_MOVED_FROM)))
+			worktree_gone = 1;
+		return;
+	}
+
+	strbuf_setlen(path, root_len);
+	strbuf_addf(path, "%s%s", rel, ev->name);
+	if (ev->mask & IN_ISDIR) {
+		/*
+		 * A trailing slash tells the client that everything below
+		 * the directory may have changed, as is the case when it is
+		 * moved away.
+		 */
+		strbuf_addch(path, '/');
+		record_change(path->buf + root_len);
+		if (ev->mask & (IN_CREATE | IN_MOVED_TO))
+			watch_directory(path, 1);
+	} else {
+		record_change(path->buf + root_len);
+	}
+}
+
+static void handle_events(void)
+{
+	static union {
+		struct inotify_event ev;
+		char buf[64 * 1024];
+	} u;
+	struct strbuf path = STRBUF_INIT;
+
+	strbuf_addf(&path, "%s/", get_git_work_tree());
+	for (;;) {
+		ssize_t len = read(inotify_fd, u.buf, sizeof(u.buf));
+		char *p;
+
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				break;
+			die_errno(_("unable to read filesystem events"));
+		}
+		if (!len)
+			break;
+
+		for (p = u.buf; p < u.buf + len; ) {
+			struct inotify_event *ev = (struct inotify_event *)p;
+
+			handle_event(ev, &path);
+			p += sizeof(*ev) + ev->len;
+		}
+	}
+	strbuf_release(&path);
+}
+
+static void answer_query(const char *token, FILE *out)
+{
+	struct hashmap_iter iter;
+	struct changed_path *cp;
+	uint64_t since = 0;
+	int trivial = 1;
+	const char *p;
+	char *end;
+
+	/*
+	 * The client may have just changed files. The kernel queues
+	 * those events before the write returns, so catch up with the
+	 * queue before answering.
+	 */
+	handle_events();
+
+	fprintf(out, "%s%"PRIu64, token_prefix, last_seq);
+	fputc('\0', out);
+
+	if (skip_prefix(token, token_prefix, &p)) {
+		since = strtoull(p, &end, 10);
+		trivial = end == p || *end ||
+			  since < oldest_seq || since > last_seq;
+	}
+	if (trivial) {
+		/* Not one of our tokens, or too old: assume everything changed */
+		fputc('/', out);
+		fputc('\0', out);
+		return;
+	}
+
+	hashmap_for_each_entry(&changed_paths, &iter, cp, ent) {
+		if (cp->seq <= since)
+			continue;
+		fputs(cp->path, out);
+		fputc('\0', out);
+	}
+}
+
+static void serve_one_client(FILE *in, FILE *out)
+{
+	struct strbuf line = STRBUF_INIT;
+	const char *token;
+
+	if (strbuf_getline_lf(&line, in) == EOF)
+		; /* the client went away */
+	else if (skip_prefix(line.buf, "query ", &token))
+		answer_query(token, out);
+	else if (!strcmp(line.buf, "status"))
+		fprintf(out, "%s\n", get_git_work_tree());
+	else if (!strcmp(line.buf, "quit"))
+		/*
+		 * Our atexit() handler removes the socket before the client
+		 * sees the connection close, just like credential-cache.
+		 */
+		exit(0);
+	else
+		warning("fsmonitor client sent unknown command: %s", line.buf);
+
+	strbuf_release(&line);
+}
+
+static void accept_client(int listen_fd)
+{
+	int client, client2;
+	FILE *in, *out;
+
+	struct timeval timeout = { CLIENT_TIMEOUT, 0 };
+
+	client = accept(listen_fd, NULL, NULL);
+	if (client < 0) {
+		warning_errno("accept failed");
+		return;
+	}
+	if (setsockopt(client, SOL_SOCKET, SO_RCVTIMEO,
+		       &timeout, sizeof(timeout)) < 0 ||
+	    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO,
+		       &timeout, sizeof(timeout)) < 0) {
+		warning_errno("unable to set a timeout on the client socket");
+		close(client);
+		return;
+	}
+	client2 = dup(client);
+	if (client2 < 0) {
+		warning_errno("dup failed");
+		close(client);
+		return;
+	}
+
+	in = xfdopen(client, "r");
+	out = xfdopen(client2, "w");
+	serve_one_client(in, out);
+	fclose(in);
+	fclose(out);
+}
+
+static int run_daemon(int detach)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct tempfile *socket_file;
+	char *socket_path = absolute_pathdup(fsmonitor_ipc_get_path());
+	struct strbuf answer = STRBUF_INIT;
+	int listen_fd;
+
+	if (!fsmonitor_ipc_send_command("status", &answer))
+		die(_("fsmonitor daemon is already watching '%s'"),
+		    get_git_work_tree());
+
+	token_prefix = xstrfmt("builtin:%"PRIuMAX".%"PRIuMAX":",
+			       (uintmax_t)getpid(), (uintmax_t)getnanotime());
+	hashmap_init(&changed_paths, changed_path_cmp, NULL, 0);
+
+	inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (inotify_fd < 0)
+		die_errno(_("unable to initialize inotify"));
+	strbuf_addf(&path, "%s/", get_git_work_tree());
+	root_len = path.len;
+	watch_directory(&path, 0);
+	strbuf_release(&path);
+
+	listen_fd = unix_stream_listen(socket_path);
+	if (listen_fd < 0)
+		die_errno(_("unable to bind to '%s'"), socket_path);
+	sigchain_push(SIGPIPE, SIG_IGN);
+
+	/*
+	 * Do not keep the worktree busy. This also lets the kernel tell
+	 * us when it is removed, which it would not do while it is our
+	 * current directory.
+	 */
+	if (chdir("/"))
+		die_errno("unable to chdir to /");
+
+	printf("ok\n");
+	fclose(stdout);
+	/*
+	 * Do not die with the terminal or the process group that started
+	 * us, and let it reap the process it started right away.
+	 */
+	if (detach && daemonize())
+		die_errno(_("unable to detach"));
+	/* the socket belongs to the process that serves it */
+	socket_file = register_tempfile(socket_path);
+
+	while (!worktree_gone) {
+		struct pollfd pfd[2];
+
+		pfd[0].fd = inotify_fd;
+		pfd[0].events = POLLIN;
+		pfd[1].fd = listen_fd;
+		pfd[1].events = POLLIN;
+		if (poll(pfd, 2, -1) < 0) {
+			if (errno != EINTR)
+				die_errno("poll failed");
+			continue;
+		}
+
+		if (pfd[0].revents & POLLIN)
+			handle_events();
+		if (pfd[1].revents & POLLIN)
+			accept_client(listen_fd);
+	}
+
+	close(listen_fd);
+	delete_tempfile(&socket_file);
+	free(socket_path);
+	return 0;
+}
+
+static int send_command_to_daemon(const char *command, struct strbuf *answer)
+{
+	if (!fsmonitor_ipc_send_command(command, answer))
+		return 0;
+	if (errno != ENOENT && errno != ECONNREFUSED)
+		die_errno(_("unable to connect to fsmonitor daemon"));
+	return -1;
+}
+
+static int do_status(void)
+{
+	struct strbuf answer = STRBUF_INIT;
+
+	if (send_command_to_daemon("status", &answer)) {
+		printf(_("fsmonitor-daemon is not watching '%s'\n"),
+		       get_git_work_tree());
+		return 1;
+	}
+	strbuf_trim_trailing_newline(&answer);
+	printf(_("fsmonitor-daemon is watching '%s'\n"), answer.buf);
+	strbuf_release(&answer);
+	return 0;
+}
+
+static int do_stop(void)
+{
+	struct strbuf answer = STRBUF_INIT;
+
+	if (send_command_to_daemon("quit", &answer))
+		return error(_("fsmonitor daemon is not running"));
+	strbuf_release(&answer);
+	return 0;
+}
+
+static int do_start(void)
+{
+	struct strbuf answer = STRBUF_INIT;
+
+	if (!send_command_to_daemon("status", &answer))
+		return error(_("fsmonitor daemon is already watching '%s'"),
+			     get_git_work_tree());
+	return !!fsmonitor_ipc_spawn_daemon();
+}
+
+static int do_query(const char *token)
+{
+	struct strbuf command = STRBUF_INIT;
+	struct strbuf answer = STRBUF_INIT;
+	size_t i;
+
+	strbuf_addf(&command, "query %s", token);
+	if (send_command_to_daemon(command.buf, &answer))
+		return error(_("fsmonitor daemon is not running"));
+
+	for (i = 0; i < answer.len; i++)
+		if (!answer.buf[i])
+			answer.buf[i] = '\n';
+	fwrite(answer.buf, 1, answer.len, stdout);
+
+	strbuf_release(&command);
+	strbuf_release(&answer);
+	return 0;
+}
+
+int cmd_fsmonitor__daemon(int argc, const char **argv, const char *prefix)
+{
+	int detach = 0;
+	struct option options[] = {
+		OPT_BOOL(0, "detach", &detach,
+			 N_("detach from the terminal (with 'run')")),
+		OPT_END()
+	};
+	const char *subcommand;
+
+	git_config(git_default_config, NULL);
+	argc = parse_options(argc, argv, prefix, options,
+			     builtin_fsmonitor__daemon_usage, 0);
+	if (!argc)
+		usage_with_options(builtin_fsmonitor__daemon_usage, options);
+	subcommand = argv[0];
+
+	if (detach && strcmp(subcommand, "run"))
+		die(_("--detach is only for the 'run' subcommand"));
+
+	if (!strcmp(subcommand, "query")) {
+		if (argc != 2)
+			usage_with_options(builtin_fsmonitor__daemon_usage,
+					   options);
+		return do_query(argv[1]);
+	}
+	if (argc != 1)
+		usage_with_options(builtin_fsmonitor__daemon_usage, options);
+
+	if (!strcmp(subcommand, "run"))
+		return run_daemon(detach);
+	if (!strcmp(subcommand, "start"))
+		return do_start();
+	if (!strcmp(subcommand, "stop"))
+		return !!do_stop();
+	if (!strcmp(subcommand, "status"))
+		return do_status();
+
+	usage_with_options(builtin_fsmonitor__daemon_usage, options);
+}
+
+#else
+
+int cmd_fsmonitor__daemon(int argc, const char **argv, const char *prefix)
+{
+	struct option options[] = {
+		OPT_END()
+	};
+
+	if (argc == 2 && !strcmp(argv[1], "-h"))
+		usage_with_options(builtin_fsmonitor__daemon_usage, options);
+
+	die(_("fsmonitor--daemon is not supported on this platform"));
+}
+
+#endif
@@ -21,6 +21,7 @@
 #endif
 
 #define GIT_DEFAULT_HASH_ENVIRONMENT "GIT_DEFAULT_HASH"
+#define GIT_DEFAULT_REF_FORMAT_ENVIRONMENT "GIT_DEFAULT_REF_FORMAT"
 
 static int init_is_bare_repository = 0;
 static int init_shared_repository = -1;
@@ -178,7 +179,7 @@ static int needs_work_tree_config(const char *git_dir, const char *work_tree)
 	return 1;
 }
 
-void initialize_repository_version(int hash_algo)
+void initialize_repository_version(int hash_algo, const char *ref_format)
 {
 	char repo_version_string[10];
 	int repo_version = GIT_REPO_VERSION;
@@ -188,7 +189,8 @@ void initialize_repository_version(int hash_algo)
 		die(_("The hash algorithm %s is not supported in this build."), hash_algos[hash_algo].name);
 #endif
 
-	if (hash_algo != GIT_HASH_SHA1)
+	if (hash_algo != GIT_HASH_SHA1 ||
+	    (ref_format && strcmp(ref_format, "files")))
 		repo_version = GIT_REPO_VERSION_READ;
 
 	/* This forces creation of new config file */
@@ -199,6 +201,8 @@ void initialize_repository_version(int hash_algo)
 	if (hash_algo != GIT_HASH_SHA1)
 		git_config_set("extensions.objectformat",
 			       hash_algos[hash_algo].name);
+	if (ref_format && strcmp(ref_format, "files"))
+		git_config_set("extensions.refstorage", ref_format);
 }
 
 static int create_default_files(const char *template_path,
@@ -254,6 +258,14 @@ static int create_default_files(const char *template_path,
 	safe_create_dir(git_path("refs"), 1);
 	adjust_shared_perm(git_path("refs"));
 
+	/*
+	 * Look for HEAD before setting up the refs db, which may write
+	 * a placeholder for it.
+	 */
+	path = git_path_buf(&buf, "HEAD");
+	reinit = (!access(path, R_OK)
+		  || readlink(path, junk, sizeof(junk)-1) != -1);
+
 	if (refs_init_db(&err))
 		die("failed to set up refs db: %s", err.buf);
 
@@ -261,15 +273,12 @@ static int create_default_files(const char *template_path,
 	 * Create the default symlink from ".git/HEAD" to the "master"
 	 * branch, if it does not exist yet.
 	 */
-	path = git_path_buf(&buf, "HEAD");
-	reinit = (!access(path, R_OK)
-		  || readlink(path, junk, sizeof(junk)-1) != -1);
 	if (!reinit) {
 		if (create_symref("HEAD", "refs/heads/master", NULL) < 0)
 			exit(1);
 	}
 
-	initialize_repository_version(fmt->hash_algo);
+	initialize_repository_version(fmt->hash_algo, fmt->ref_storage_format);
 
 	/* Check filemode trustability */
 	path = git_path_buf(&buf, "config");
@@ -382,8 +391,36 @@ static void validate_hash_algorithm(struct repository_format *repo_fmt, int hash
 	}
 }
 
+static void validate_ref_format(struct repository_format *repo_fmt,
+				const char *ref_format)
+{
+	const char *env = getenv(GIT_DEFAULT_REF_FORMAT_ENVIRONMENT);
+	const char *current = repo_fmt->ref_storage_format ?
+		repo_fmt->ref_storage_format : "files";
+
+	/*
+	 * Like the hash, the ref storage format of an existing repository
+	 * cannot be changed by reinitializing it.
+	 */
+	if (repo_fmt->version >= 0) {
+		if (ref_format && strcmp(ref_format, current))
+			die(_("attempt to reinitialize repository with different ref format"));
+		return;
+	}
+
+	if (!ref_format)
+		ref_format = env;
+	if (!ref_format)
+		return;
+	if (!ref_storage_backend_exists(ref_format))
+		die(_("unknown ref storage format '%s'"), ref_format);
+	free(repo_fmt->ref_storage_format);
+	repo_fmt->ref_storage_format = xstrdup(ref_format);
+}
+
 int init_db(const char *git_dir, const char *real_git_dir,
-	    const char *template_dir, int hash, unsigned int flags)
+	    const char *template_dir, int hash, const char *ref_format,
+	    unsigned int flags)
 {
 	int reinit;
 	int exist_ok = flags & INIT_DB_EXIST_OK;
@@ -424,6 +461,8 @@ int init_db(const char *git_dir, const char *real_git_dir,
 	check_repository_format(&repo_fmt);
 
 	validate_hash_algorithm(&repo_fmt, hash);
+	validate_ref_format(&repo_fmt, ref_format);
+	repo_set_ref_storage_format(the_repository, repo_fmt.ref_storage_format);
 
 	reinit = create_default_files(template_dir, original_git_dir, &repo_fmt);
 
@@ -465,6 +504,7 @@ int init_db(const char *git_dir, const char *real_git_dir,
 			       git_dir, len && git_dir[len-1] != '/' ? "/" : "");
 	}
 
+	clear_repository_format(&repo_fmt);
 	free(original_git_dir);
 	return 0;
 }
@@ -510,7 +550,7 @@ static int shared_callback(const struct option *opt, const char *arg, int unset)
 }
 
 static const char *const init_db_usage[] = {
-	N_("git init [-q | --quiet] [--bare] [--template=<template-directory>] [--shared[=<permissions>]] [<directory>]"),
+	N_("git init [-q | --quiet] [--bare] [--template=<template-directory>] [--shared[=<permissions>]] [--ref-format=<format>] [<directory>]"),
 	NULL
 };
 
@@ -528,6 +568,7 @@ int cmd_init_db(int argc, const char **argv, const char *prefix)
 	const char *template_dir = NULL;
 	unsigned int flags = 0;
 	const char *object_format = NULL;
+	const char *ref_format = NULL;
 	int hash_algo = GIT_HASH_UNKNOWN;
 	const struct option init_db_options[] = {
 		OPT_STRING(0, "template", &template_dir, N_("template-directory"),
@@ -543,6 +584,8 @@ int cmd_init_db(int argc, const char **argv, const char *prefix)
 			   N_("separate git dir from working tree")),
 		OPT_STRING(0, "object-format", &object_format, N_("hash"),
 			   N_("specify the hash algorithm to use")),
+		OPT_STRING(0, "ref-format", &ref_format, N_("format"),
+			   N_("specify the ref storage format to use")),
 		OPT_END()
 	};
 
@@ -652,5 +695,6 @@ int cmd_init_db(int argc, const char **argv, const char *prefix)
 	UNLEAK(work_tree);
 
 	flags |= INIT_DB_EXIST_OK;
-	return init_db(git_dir, real_git_dir, template_dir, hash_algo, flags);
+	return init_db(git_dir, real_git_dir, template_dir, hash_algo,
+		       ref_format, flags);
 }
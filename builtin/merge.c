@@ -28,6 +28,7 @@
 #include "rerere.h"
 #include "help.h"
 #include "merge-recursive.h"
+#include "merge-ort.h"
 #include "resolve-undo.h"
 #include "remote.h"
 #include "fmt-merge-msg.h"
@@ -92,6 +93,7 @@ static struct strategy all_strategy[] = {
 	{ "resolve",    0 },
 	{ "ours",       NO_FAST_FORWARD | NO_TRIVIAL },
 	{ "subtree",    NO_FAST_FORWARD | NO_TRIVIAL },
+	{ "ort",        NO_TRIVIAL },
 };
 
 static const char *pull_twohead, *pull_octopus;
@@ -705,7 +707,8 @@ static int try_merge_strategy(const char *strategy, struct commit_list *common,
 	if (refresh_and_write_cache(REFRESH_QUIET, SKIP_IF_UNCHANGED, 0) < 0)
 		return error(_("Unable to write index."));
 
-	if (!strcmp(strategy, "recursive") || !strcmp(strategy, "subtree")) {
+	if (!strcmp(strategy, "recursive") || !strcmp(strategy, "subtree") ||
+	    !strcmp(strategy, "ort")) {
 		struct lock_file lock = LOCK_INIT;
 		int clean, x;
 		struct commit *result;
@@ -737,8 +740,21 @@ static int try_merge_strategy(const char *strategy, struct commit_list *common,
 			commit_list_insert(j->item, &reversed);
 
 		hold_locked_index(&lock, LOCK_DIE_ON_ERROR);
-		clean = merge_recursive(&o, head,
-				remoteheads->item, reversed, &result);
+		if (!strcmp(strategy, "ort") ||
+		    (!strcmp(strategy, "recursive") &&
+		     merge_ort_replaces_recursive())) {
+			struct merge_result ort_result = { 0 };
+
+			merge_incore_recursive(&o, reversed, head,
+					       remoteheads->item, &ort_result);
+			merge_switch_to_result(&o, get_commit_tree(head),
+					       &ort_result, 1, 1);
+			merge_finalize(&ort_result);
+			clean = ort_result.clean;
+		} else {
+			clean = merge_recursive(&o, head,
+					remoteheads->item, reversed, &result);
+		}
 		if (clean < 0)
 			exit(128);
 		if (write_locked_index(&the_index, &lock,
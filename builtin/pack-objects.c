@@ -34,6 +34,8 @@
 #include "dir.h"
 #include "midx.h"
 #include "trace2.h"
+#include "oidmap.h"
+#include "pack-mtimes.h"
 
 #define IN_PACK(obj) oe_in_pack(&to_pack, obj)
 #define SIZE(obj) oe_size(&to_pack, obj)
@@ -71,6 +73,8 @@ static int reuse_delta = 1, reuse_object = 1;
 static int keep_unreachable, unpack_unreachable, include_tag;
 static timestamp_t unpack_unreachable_expiration;
 static int pack_loose_unreachable;
+static int cruft;
+static timestamp_t cruft_expiration;
 static int local;
 static int have_non_local_packs;
 static int incremental;
@@ -153,11 +157,13 @@ static void *get_delta(struct object_entry *entry)
 	void *buf, *base_buf, *delta_buf;
 	enum object_type type;
 
+	packing_data_lock(&to_pack);
 	buf = read_object_file(&entry->idx.oid, &type, &size);
 	if (!buf)
 		die(_("unable to read %s"), oid_to_hex(&entry->idx.oid));
 	base_buf = read_object_file(&DELTA(entry)->idx.oid, &type,
 				    &base_size);
+	packing_data_unlock(&to_pack);
 	if (!base_buf)
 		die("unable to read %s",
 		    oid_to_hex(&DELTA(entry)->idx.oid));
@@ -200,6 +206,295 @@ static unsigned long do_compress(void **pptr, unsigned long size)
 	return stream.total_out;
 }
 
+/*
+ * Compressing the objects we cannot reuse from an existing pack is
+ * what the write phase spends most of its time on. Worker threads
+ * deflate the entries ahead of the main thread, in write order, each
+ * into one of a fixed number of slots; the main thread takes the
+ * result when it gets to the entry and writes it out like it would
+ * have written its own, so the pack is the same. Entries the workers
+ * have not got to yet are compressed by the main thread as usual.
+ *
+ * An entry belongs to the worker that claimed it until the result is
+ * in its slot; the main thread waits for it before touching the
+ * entry. All reads from the object database go through
+ * packing_data_lock(). Because a limit on the pack size changes how
+ * entries are written as the pack fills up, there are no workers when
+ * there is one.
+ */
+
+#define COMPRESS_AHEAD_SLOTS_PER_THREAD 4
+
+enum compress_state {
+	COMPRESS_UNCLAIMED = 0,
+	COMPRESS_CLAIMED,	/* by a worker */
+	COMPRESS_INLINE		/* left to the main thread */
+};
+
+struct compress_slot {
+	struct object_entry *entry;
+	uint32_t pos;
+	int running;
+	/* the deflated data, or NULL if there was nothing to prepare */
+	void *buf;
+	unsigned long datalen;
+	/* the delta against DELTA(entry) or the whole object */
+	int delta;
+	enum object_type type;
+	unsigned long size;
+};
+
+static struct compress_ahead {
+	pthread_mutex_t mutex;
+	/* workers wait for free slots, the main thread for results */
+	pthread_cond_t cond;
+	struct object_entry **order;
+	uint32_t nr, next, main_pos;
+	/* enum compress_state, by position in to_pack.objects */
+	unsigned char *state;
+	struct compress_slot *slots;
+	int nr_slots, nr_free;
+	pthread_t *threads;
+	int nr_threads;
+	int stop;
+	uint32_t prepared;
+} *ahead;
+
+/* Deflate an entry like write_no_reuse_object() would. */
+static void compress_entry(struct compress_slot *slot)
+{
+	struct object_entry *entry = slot->entry;
+	void *buf;
+
+	if (entry->preferred_base)
+		return;
+	if (!DELTA(entry)) {
+		int to_reuse = reuse_object && IN_PACK(entry) &&
+			oe_type(entry) == entry->in_pack_type;
+
+		if (to_reuse ||
+		    (oe_type(entry) == OBJ_BLOB &&
+		     oe_size_greater_than(&to_pack, entry, big_file_threshold)))
+			return;
+		packing_data_lock(&to_pack);
+		buf = read_object_file(&entry->idx.oid, &slot->type,
+				       &slot->size);
+		packing_data_unlock(&to_pack);
+		if (!buf)
+			return; /* let the main thread complain */
+	} else {
+		if (reuse_object && IN_PACK(entry) &&
+		    (oe_type(entry) == OBJ_REF_DELTA ||
+		     oe_type(entry) == OBJ_OFS_DELTA))
+			return;
+		if (entry->z_delta_size)
+			return;
+		slot->delta = 1;
+		slot->size = DELTA_SIZE(entry);
+		if (entry->delta_data)
+			buf = xmemdupz(entry->delta_data, slot->size);
+		else
+			buf = get_delta(entry);
+	}
+	slot->datalen = do_compress(&buf, slot->size);
+	slot->buf = buf;
+}
+
+static void *compress_ahead_thread(void *data)
+{
+	pthread_mutex_lock(&ahead->mutex);
+	for (;;) {
+		struct compress_slot *slot;
+		struct object_entry *entry;
+		unsigned char *state;
+		int i;
+
+		while (!ahead->stop &&
+		       (ahead->next >= ahead->nr || !ahead->nr_free))
+			pthread_cond_wait(&ahead->cond, &ahead->mutex);
+		if (ahead->stop)
+			break;
+
+		if (ahead->next < ahead->main_pos)
+			ahead->next = ahead->main_pos;
+		entry = ahead->order[ahead->next];
+		state = &ahead->state[entry - to_pack.objects];
+		if (*state != COMPRESS_UNCLAIMED) {
+			ahead->next++;
+			continue;
+		}
+		*state = COMPRESS_CLAIMED;
+		for (i = 0; ahead->slots[i].entry; i++)
+			; /* there is a free one */
+		slot = &ahead->slots[i];
+		memset(slot, 0, sizeof(*slot));
+		slot->entry = entry;
+		slot->pos = ahead->next++;
+		slot->running = 1;
+		ahead->nr_free--;
+		pthread_mutex_unlock(&ahead->mutex);
+
+		compress_entry(slot);
+
+		pthread_mutex_lock(&ahead->mutex);
+		slot->running = 0;
+		if (slot->buf)
+			ahead->prepared++;
+		pthread_cond_broadcast(&ahead->cond);
+	}
+	pthread_mutex_unlock(&ahead->mutex);
+	return NULL;
+}
+
+static void free_compress_slot(struct compress_slot *slot)
+{
+	FREE_AND_NULL(slot->buf);
+	slot->entry = NULL;
+	ahead->nr_free++;
+}
+
+static void start_compress_ahead(struct object_entry **order, uint32_t nr)
+{
+	int i;
+
+	if (delta_search_threads <= 1 || pack_size_limit)
+		return;
+
+	CALLOC_ARRAY(ahead, 1);
+	pthread_mutex_init(&ahead->mutex, NULL);
+	pthread_cond_init(&ahead->cond, NULL);
+	ahead->order = order;
+	ahead->nr = nr;
+	CALLOC_ARRAY(ahead->state, to_pack.nr_objects);
+	ahead->nr_threads = delta_search_threads;
+	ahead->nr_slots = ahead->nr_free =
+		COMPRESS_AHEAD_SLOTS_PER_THREAD * ahead->nr_threads;
+	CALLOC_ARRAY(ahead->slots, ahead->nr_slots);
+	ALLOC_ARRAY(ahead->threads, ahead->nr_threads);
+	for (i = 0; i < ahead->nr_threads; i++) {
+		int ret = pthread_create(&ahead->threads[i], NULL,
+					 compress_ahead_thread, NULL);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+	}
+}
+
+static void stop_compress_ahead(void)
+{
+	int i;
+
+	if (!ahead)
+		return;
+
+	pthread_mutex_lock(&ahead->mutex);
+	ahead->stop = 1;
+	pthread_cond_broadcast(&ahead->cond);
+	pthread_mutex_unlock(&ahead->mutex);
+	for (i = 0; i < ahead->nr_threads; i++)
+		pthread_join(ahead->threads[i], NULL);
+
+	trace2_data_intmax("pack-objects", the_repository,
+			   "write_pack_file/compressed-ahead", ahead->prepared);
+
+	for (i = 0; i < ahead->nr_slots; i++)
+		free(ahead->slots[i].buf);
+	free(ahead->slots);
+	free(ahead->state);
+	free(ahead->threads);
+	pthread_cond_destroy(&ahead->cond);
+	pthread_mutex_destroy(&ahead->mutex);
+	FREE_AND_NULL(ahead);
+}
+
+/* The main thread is about to write the entry at this position. */
+static void compress_ahead_advance(uint32_t pos)
+{
+	int i;
+
+	if (!ahead)
+		return;
+
+	pthread_mutex_lock(&ahead->mutex);
+	ahead->main_pos = pos;
+	for (i = 0; i < ahead->nr_slots; i++) {
+		struct compress_slot *slot = &ahead->slots[i];
+
+		/*
+		 * Whatever was not taken for an entry we have gone
+		 * past was not needed; write_one() waited for it.
+		 */
+		if (slot->entry && !slot->running && slot->pos < pos)
+			free_compress_slot(slot);
+	}
+	pthread_cond_broadcast(&ahead->cond);
+	pthread_mutex_unlock(&ahead->mutex);
+}
+
+static struct compress_slot *find_compress_slot(struct object_entry *entry)
+{
+	int i;
+
+	for (i = 0; i < ahead->nr_slots; i++)
+		if (ahead->slots[i].entry == entry)
+			return &ahead->slots[i];
+	return NULL;
+}
+
+/*
+ * Make sure no worker is looking at the entry before the main thread
+ * starts changing it: wait for a worker that claimed it, and keep the
+ * others from claiming it.
+ */
+static void compress_ahead_wait(struct object_entry *entry)
+{
+	unsigned char *state;
+
+	if (!ahead)
+		return;
+
+	pthread_mutex_lock(&ahead->mutex);
+	state = &ahead->state[entry - to_pack.objects];
+	if (*state == COMPRESS_UNCLAIMED)
+		*state = COMPRESS_INLINE;
+	else if (*state == COMPRESS_CLAIMED) {
+		struct compress_slot *slot;
+
+		while ((slot = find_compress_slot(entry)) && slot->running)
+			pthread_cond_wait(&ahead->cond, &ahead->mutex);
+	}
+	pthread_mutex_unlock(&ahead->mutex);
+}
+
+/*
+ * Take the deflated data a worker prepared for the entry, if it is what
+ * we are going to write. The caller owns slot->buf afterwards; the
+ * slot itself is only valid until the next call.
+ */
+static int compress_ahead_take(struct object_entry *entry, int usable_delta,
+			       struct compress_slot *out)
+{
+	struct compress_slot *slot;
+	int ret = 0;
+
+	if (!ahead || entry < to_pack.objects ||
+	    entry >= to_pack.objects + to_pack.nr_objects)
+		return 0;
+
+	pthread_mutex_lock(&ahead->mutex);
+	slot = find_compress_slot(entry);
+	if (slot && !slot->running) {
+		if (slot->buf && slot->delta == usable_delta) {
+			*out = *slot;
+			slot->buf = NULL;
+			ret = 1;
+		}
+		free_compress_slot(slot);
+		pthread_cond_broadcast(&ahead->cond);
+	}
+	pthread_mutex_unlock(&ahead->mutex);
+	return ret;
+}
+
 static unsigned long write_large_blob_data(struct git_istream *st, struct hashfile *f,
 					   const struct object_id *oid)
 {
@@ -213,7 +508,9 @@ static unsigned long write_large_blob_data(struct git_istream *st, struct hashfi
 	for (;;) {
 		ssize_t readlen;
 		int zret = Z_OK;
+		packing_data_lock(&to_pack);
 		readlen = read_istream(st, ibuf, sizeof(ibuf));
+		packing_data_unlock(&to_pack);
 		if (readlen == -1)
 			die(_("unable to read %s"), oid_to_hex(oid));
 
@@ -300,8 +597,22 @@ static unsigned long write_no_reuse_object(struct hashfile *f, struct object_ent
 	void *buf;
 	struct git_istream *st = NULL;
 	const unsigned hashsz = the_hash_algo->rawsz;
-
-	if (!usable_delta) {
+	struct compress_slot prepared;
+	int have_prepared = compress_ahead_take(entry, usable_delta, &prepared);
+
+	if (have_prepared) {
+		buf = prepared.buf;
+		datalen = prepared.datalen;
+		size = prepared.size;
+		if (!usable_delta)
+			type = prepared.type;
+		else
+			type = (allow_ofs_delta && DELTA(entry)->idx.offset) ?
+				OBJ_OFS_DELTA : OBJ_REF_DELTA;
+		FREE_AND_NULL(entry->delta_data);
+		entry->z_delta_size = 0;
+	} else if (!usable_delta) {
+		packing_data_lock(&to_pack);
 		if (oe_type(entry) == OBJ_BLOB &&
 		    oe_size_greater_than(&to_pack, entry, big_file_threshold) &&
 		    (st = open_istream(the_repository, &entry->idx.oid, &type,
@@ -313,6 +624,7 @@ static unsigned long write_no_reuse_object(struct hashfile *f, struct object_ent
 				die(_("unable to read %s"),
 				    oid_to_hex(&entry->idx.oid));
 		}
+		packing_data_unlock(&to_pack);
 		/*
 		 * make sure no cached delta data remains from a
 		 * previous attempt before a pack split occurred.
@@ -332,7 +644,9 @@ static unsigned long write_no_reuse_object(struct hashfile *f, struct object_ent
 			OBJ_OFS_DELTA : OBJ_REF_DELTA;
 	}
 
-	if (st)	/* large blob case, just assume we don't compress well */
+	if (have_prepared)
+		; /* deflated already */
+	else if (st)	/* large blob case, just assume we don't compress well */
 		datalen = size;
 	else if (entry->z_delta_size)
 		datalen = entry->z_delta_size;
@@ -406,7 +720,7 @@ static off_t write_reuse_object(struct hashfile *f, struct object_entry *entry,
 {
 	struct packed_git *p = IN_PACK(entry);
 	struct pack_window *w_curs = NULL;
-	struct revindex_entry *revidx;
+	uint32_t pos;
 	off_t offset;
 	enum object_type type = oe_type(entry);
 	off_t datalen;
@@ -423,10 +737,15 @@ static off_t write_reuse_object(struct hashfile *f, struct object_entry *entry,
 					      type, entry_size);
 
 	offset = entry->in_pack_offset;
-	revidx = find_pack_revindex(p, offset);
-	datalen = revidx[1].offset - offset;
+	if (offset_to_pack_pos(p, offset, &pos) < 0)
+		die(_("write_reuse_object: could not locate %s, expected at "
+		      "offset %"PRIuMAX" in pack %s"),
+		    oid_to_hex(&entry->idx.oid), (uintmax_t)offset,
+		    p->pack_name);
+	datalen = pack_pos_to_offset(p, pos + 1) - offset;
 	if (!pack_to_stdout && p->index_version > 1 &&
-	    check_pack_crc(p, &w_curs, offset, datalen, revidx->nr)) {
+	    check_pack_crc(p, &w_curs, offset, datalen,
+			   pack_pos_to_index(p, pos))) {
 		error(_("bad packed object CRC for %s"),
 		      oid_to_hex(&entry->idx.oid));
 		unuse_pack(&w_curs);
@@ -535,8 +854,11 @@ static off_t write_object(struct hashfile *f,
 
 	if (!to_reuse)
 		len = write_no_reuse_object(f, entry, limit, usable_delta);
-	else
+	else {
+		packing_data_lock(&to_pack);
 		len = write_reuse_object(f, entry, limit, usable_delta);
+		packing_data_unlock(&to_pack);
+	}
 	if (!len)
 		return 0;
 
@@ -562,6 +884,8 @@ static enum write_one_status write_one(struct hashfile *f,
 	off_t size;
 	int recursing;
 
+	compress_ahead_wait(e);
+
 	/*
 	 * we set offset to 1 (which is an impossible value) to mark
 	 * the fact that this object is involved in "write its base
@@ -850,8 +1174,8 @@ static void write_reused_pack_one(size_t pos, struct hashfile *out,
 	enum object_type type;
 	unsigned long size;
 
-	offset = reuse_packfile->revindex[pos].offset;
-	next = reuse_packfile->revindex[pos + 1].offset;
+	offset = pack_pos_to_offset(reuse_packfile, pos);
+	next = pack_pos_to_offset(reuse_packfile, pos + 1);
 
 	record_reused_object(offset, offset - hashfile_total(out));
 
@@ -871,11 +1195,17 @@ static void write_reused_pack_one(size_t pos, struct hashfile *out,
 
 		/* Convert to REF_DELTA if we must... */
 		if (!allow_ofs_delta) {
-			int base_pos = find_revindex_position(reuse_packfile, base_offset);
+			uint32_t base_pos;
 			struct object_id base_oid;
 
+			if (offset_to_pack_pos(reuse_packfile, base_offset, &base_pos) < 0)
+				die(_("expected object at offset %"PRIuMAX" "
+				      "in pack %s"),
+				    (uintmax_t)base_offset,
+				    reuse_packfile->pack_name);
+
 			nth_packed_object_id(&base_oid, reuse_packfile,
-					     reuse_packfile->revindex[base_pos].nr);
+					     pack_pos_to_index(reuse_packfile, base_pos));
 
 			len = encode_in_pack_object_header(header, sizeof(header),
 							   OBJ_REF_DELTA, size);
@@ -928,7 +1258,7 @@ static size_t write_reused_pack_verbatim(struct hashfile *out,
 		off_t to_write;
 
 		written = (pos * BITS_IN_EWORD);
-		to_write = reuse_packfile->revindex[written].offset
+		to_write = pack_pos_to_offset(reuse_packfile, written)
 			- sizeof(struct pack_header);
 
 		/* We're recording one chunk, not one object. */
@@ -968,6 +1298,46 @@ static void write_reused_pack(struct hashfile *f)
 	unuse_pack(&w_curs);
 }
 
+static int written_oid_cmp(const void *va, const void *vb)
+{
+	const struct pack_idx_entry *a = *(const struct pack_idx_entry **)va;
+	const struct pack_idx_entry *b = *(const struct pack_idx_entry **)vb;
+	return oidcmp(&a->oid, &b->oid);
+}
+
+/*
+ * Write the ".mtimes" file of a cruft pack next to where its .idx is
+ * about to go; "name_buffer" holds the "<base>-" prefix.
+ */
+static void write_cruft_mtimes(struct strbuf *name_buffer,
+			       const unsigned char *hash)
+{
+	struct pack_idx_entry **sorted;
+	uint32_t *mtimes;
+	const char *mtimes_tmp_name;
+	size_t basename_len = name_buffer->len;
+	uint32_t i;
+
+	ALLOC_ARRAY(sorted, nr_written);
+	COPY_ARRAY(sorted, written_list, nr_written);
+	QSORT(sorted, nr_written, written_oid_cmp);
+
+	ALLOC_ARRAY(mtimes, nr_written);
+	for (i = 0; i < nr_written; i++)
+		mtimes[i] = oe_cruft_mtime(&to_pack,
+					   (struct object_entry *)sorted[i]);
+
+	mtimes_tmp_name = write_mtimes_file(mtimes, nr_written, hash);
+	strbuf_addf(name_buffer, "%s.mtimes", hash_to_hex(hash));
+	if (rename(mtimes_tmp_name, name_buffer->buf))
+		die_errno(_("unable to rename temporary mtimes file"));
+	strbuf_setlen(name_buffer, basename_len);
+
+	free((char *)mtimes_tmp_name);
+	free(mtimes);
+	free(sorted);
+}
+
 static const char no_split_warning[] = N_(
 "disabling bitmap writing, packs are split due to pack.packSizeLimit"
 );
@@ -985,6 +1355,7 @@ static void write_pack_file(void)
 		progress_state = start_progress(_("Writing objects"), nr_result);
 	ALLOC_ARRAY(written_list, to_pack.nr_objects);
 	write_order = compute_write_order();
+	start_compress_ahead(write_order, to_pack.nr_objects);
 
 	do {
 		struct object_id oid;
@@ -1006,10 +1377,12 @@ static void write_pack_file(void)
 		nr_written = 0;
 		for (; i < to_pack.nr_objects; i++) {
 			struct object_entry *e = write_order[i];
+			compress_ahead_advance(i);
 			if (write_one(f, e, &offset) == WRITE_ONE_BREAK)
 				break;
 			display_progress(progress_state, written);
 		}
+		stop_compress_ahead();
 
 		/*
 		 * Did we write the wrong # entries in the header?
@@ -1062,6 +1435,9 @@ static void write_pack_file(void)
 					&to_pack, written_list, nr_written);
 			}
 
+			if (cruft)
+				write_cruft_mtimes(&tmpname, oid.hash);
+
 			finish_tmp_packfile(&tmpname, pack_tmp_name,
 					    written_list, nr_written,
 					    &pack_idx_opts, oid.hash);
@@ -1735,11 +2111,11 @@ static void check_object(struct object_entry *entry)
 				goto give_up;
 			}
 			if (reuse_delta && !entry->preferred_base) {
-				struct revindex_entry *revidx;
-				revidx = find_pack_revindex(p, ofs);
-				if (!revidx)
+				uint32_t pos;
+				if (offset_to_pack_pos(p, ofs, &pos) < 0)
 					goto give_up;
-				if (!nth_packed_object_id(&base_ref, p, revidx->nr))
+				if (!nth_packed_object_id(&base_ref, p,
+							  pack_pos_to_index(p, pos)))
 					have_base = 1;
 			}
 			entry->in_pack_header_size = used + used_0;
@@ -2863,6 +3239,13 @@ static int git_pack_config(const char *k, const char *v, void *cb)
 			    pack_idx_opts.version);
 		return 0;
 	}
+	if (!strcmp(k, "pack.writereverseindex")) {
+		if (git_config_bool(k, v))
+			pack_idx_opts.flags |= WRITE_REV;
+		else
+			pack_idx_opts.flags &= ~WRITE_REV;
+		return 0;
+	}
 	return git_default_config(k, v, cb);
 }
 
@@ -2898,6 +3281,216 @@ static void read_object_list_from_stdin(void)
 	}
 }
 
+/*
+ * In --cruft mode, the unreachable objects we are asked to collect are
+ * the loose ones and those in the packs named with a leading '-' on
+ * stdin. Everything else is in packs that are kept, so it is left out
+ * of the cruft pack by the pack_keep_in_core logic.
+ */
+struct cruft_object {
+	struct oidmap_entry ent;
+	uint32_t mtime;
+	unsigned recent:1;
+};
+
+static struct oidmap cruft_objects = OIDMAP_INIT;
+
+static void add_cruft_candidate(const struct object_id *oid, uint32_t mtime)
+{
+	struct cruft_object *c = oidmap_get(&cruft_objects, oid);
+
+	if (!c) {
+		c = xcalloc(1, sizeof(*c));
+		oidcpy(&c->ent.oid, oid);
+		oidmap_put(&cruft_objects, c);
+	}
+	if (c->mtime < mtime)
+		c->mtime = mtime;
+}
+
+static int add_loose_cruft_candidate(const struct object_id *oid,
+				     const char *path, void *data)
+{
+	struct stat st;
+
+	if (lstat(path, &st) < 0) {
+		if (errno == ENOENT)
+			return 0;
+		return error_errno(_("unable to stat %s"), oid_to_hex(oid));
+	}
+	add_cruft_candidate(oid, st.st_mtime);
+	return 0;
+}
+
+static void add_cruft_pack_candidates(struct packed_git *p)
+{
+	struct object_id oid;
+	uint32_t i;
+
+	if (open_pack_index(p))
+		die(_("cannot open pack index for %s"), p->pack_name);
+	if (p->is_cruft && load_pack_mtimes(p))
+		die(_("could not load cruft pack '%s'"), p->pack_name);
+
+	for (i = 0; i < p->num_objects; i++) {
+		nth_packed_object_id(&oid, p, i);
+		add_cruft_candidate(&oid, p->is_cruft ?
+				    nth_packed_mtime(p, i) : p->mtime);
+	}
+}
+
+static struct packed_git *add_cruft_retained_pack(const char *path)
+{
+	struct strbuf idx = STRBUF_INIT;
+	struct packed_git *p;
+
+	strbuf_addstr(&idx, path);
+	if (!strbuf_strip_suffix(&idx, ".pack"))
+		die(_("pack name '%s' does not end with '.pack'"), path);
+	strbuf_addstr(&idx, ".idx");
+
+	p = add_packed_git(idx.buf, idx.len, 1);
+	if (!p)
+		die(_("could not find pack '%s'"), path);
+	install_packed_git(the_repository, p);
+	strbuf_release(&idx);
+	return p;
+}
+
+static void push_recent_cruft(struct cruft_object ***stack, size_t *nr,
+			      size_t *alloc, const struct object_id *oid)
+{
+	struct cruft_object *c = oidmap_get(&cruft_objects, oid);
+
+	if (!c || c->recent)
+		return;
+	c->recent = 1;
+	ALLOC_GROW(*stack, *nr + 1, *alloc);
+	(*stack)[(*nr)++] = c;
+}
+
+/*
+ * Mark the candidates that are newer than the expiration, and the
+ * candidates they reach, which must survive as long as they do.
+ * Reachable objects are not candidates, so only the edges between
+ * candidates matter here.
+ */
+static void mark_recent_cruft(void)
+{
+	struct cruft_object **stack = NULL;
+	size_t nr = 0, alloc = 0;
+	struct oidmap_iter iter;
+	struct cruft_object *c;
+
+	oidmap_iter_init(&cruft_objects, &iter);
+	while ((c = oidmap_iter_next(&iter)))
+		if (c->mtime > cruft_expiration)
+			push_recent_cruft(&stack, &nr, &alloc, &c->ent.oid);
+
+	while (nr) {
+		enum object_type type;
+		unsigned long size;
+		struct object_id oid;
+		const char *p;
+		void *buf;
+
+		c = stack[--nr];
+		buf = read_object_file(&c->ent.oid, &type, &size);
+		if (!buf)
+			continue;
+
+		if (type == OBJ_TREE) {
+			struct tree_desc desc;
+			struct name_entry entry;
+
+			init_tree_desc(&desc, buf, size);
+			while (tree_entry(&desc, &entry))
+				if (!S_ISGITLINK(entry.mode))
+					push_recent_cruft(&stack, &nr, &alloc,
+							  &entry.oid);
+		} else if (type == OBJ_COMMIT) {
+			p = buf;
+			if (skip_prefix(p, "tree ", &p) &&
+			    !parse_oid_hex(p, &oid, &p) && *p++ == '\n') {
+				push_recent_cruft(&stack, &nr, &alloc, &oid);
+				while (skip_prefix(p, "parent ", &p) &&
+				       !parse_oid_hex(p, &oid, &p) &&
+				       *p++ == '\n')
+					push_recent_cruft(&stack, &nr, &alloc,
+							  &oid);
+			}
+		} else if (type == OBJ_TAG) {
+			p = buf;
+			if (skip_prefix(p, "object ", &p) &&
+			    !parse_oid_hex(p, &oid, &p))
+				push_recent_cruft(&stack, &nr, &alloc, &oid);
+		}
+		free(buf);
+	}
+	free(stack);
+}
+
+static void read_cruft_objects(void)
+{
+	struct strbuf buf = STRBUF_INIT;
+	struct string_list discard = STRING_LIST_INIT_DUP;
+	struct string_list_item *item;
+	struct packed_git *p;
+	struct oidmap_iter iter;
+	struct cruft_object *c;
+
+	while (strbuf_getline(&buf, stdin) != EOF) {
+		if (!buf.len)
+			continue;
+		if (buf.buf[0] == '-')
+			string_list_append(&discard, buf.buf + 1);
+		else if (strchr(buf.buf, '/'))
+			/* a pack written by the caller and not installed yet */
+			add_cruft_retained_pack(buf.buf)->pack_keep_in_core = 1;
+		/* other packs not discarded are kept anyway */
+	}
+	strbuf_release(&buf);
+	string_list_sort(&discard);
+	string_list_remove_duplicates(&discard, 0);
+
+	for (p = get_all_packs(the_repository); p; p = p->next) {
+		if (!p->pack_local)
+			continue;
+		item = string_list_lookup(&discard, basename(p->pack_name));
+		if (!item) {
+			p->pack_keep_in_core = 1;
+			continue;
+		}
+		item->util = p;
+		add_cruft_pack_candidates(p);
+	}
+	ignore_packed_keep_in_core = 1;
+
+	for_each_string_list_item(item, &discard)
+		if (!item->util)
+			die(_("could not find pack '%s'"), item->string);
+	string_list_clear(&discard, 0);
+
+	for_each_loose_object(add_loose_cruft_candidate, NULL,
+			      FOR_EACH_OBJECT_LOCAL_ONLY);
+
+	if (cruft_expiration)
+		mark_recent_cruft();
+
+	oidmap_iter_init(&cruft_objects, &iter);
+	while ((c = oidmap_iter_next(&iter))) {
+		struct object_entry *entry;
+
+		if (cruft_expiration && !c->recent)
+			continue;
+		if (!add_object_entry(&c->ent.oid, OBJ_NONE, NULL, 0))
+			continue;
+		entry = packlist_find(&to_pack, &c->ent.oid);
+		oe_set_cruft_mtime(&to_pack, entry, c->mtime);
+	}
+	oidmap_free(&cruft_objects, 1);
+}
+
 /* Remember to update object flag allocation in object.h */
 #define OBJECT_ADDED (1u<<20)
 
@@ -3157,13 +3750,18 @@ static void loosen_unused_packed_objects(void)
 
 		if (open_pack_index(p))
 			die(_("cannot open pack index"));
+		if (p->is_cruft && load_pack_mtimes(p))
+			die(_("could not load cruft pack '%s'"), p->pack_name);
 
 		for (i = 0; i < p->num_objects; i++) {
+			timestamp_t mtime = p->is_cruft ?
+				nth_packed_mtime(p, i) : p->mtime;
+
 			nth_packed_object_id(&oid, p, i);
 			if (!packlist_find(&to_pack, &oid) &&
 			    !has_sha1_pack_kept_or_nonlocal(&oid) &&
-			    !loosened_object_can_be_discarded(&oid, p->mtime))
-				if (force_object_loose(&oid, p->mtime))
+			    !loosened_object_can_be_discarded(&oid, mtime))
+				if (force_object_loose(&oid, mtime))
 					die(_("unable to force loose object"));
 		}
 	}
@@ -3277,6 +3875,7 @@ static void get_object_list(int ac, const char **av)
 
 	if (!fn_show_object)
 		fn_show_object = show_object;
+	revs.traverse_threads = delta_search_threads;
 	traverse_commit_list_filtered(&filter_options, &revs,
 				      show_commit, fn_show_object, NULL,
 				      NULL);
@@ -3361,6 +3960,16 @@ static int option_parse_unpack_unreachable(const struct option *opt,
 	return 0;
 }
 
+static int option_parse_cruft_expiration(const struct option *opt,
+					 const char *arg, int unset)
+{
+	BUG_ON_OPT_NEG(unset);
+
+	if (parse_expiry_date(arg, &cruft_expiration))
+		die(_("malformed expiration date '%s'"), arg);
+	return 0;
+}
+
 int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 {
 	int use_internal_rev_list = 0;
@@ -3430,6 +4039,11 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 		OPT_CALLBACK_F(0, "unpack-unreachable", NULL, N_("time"),
 		  N_("unpack unreachable objects newer than <time>"),
 		  PARSE_OPT_OPTARG, option_parse_unpack_unreachable),
+		OPT_BOOL(0, "cruft", &cruft,
+			 N_("create a cruft pack")),
+		OPT_CALLBACK_F(0, "cruft-expiration", NULL, N_("time"),
+		  N_("leave out cruft objects older than <time>"),
+		  PARSE_OPT_NONEG, option_parse_cruft_expiration),
 		OPT_BOOL(0, "sparse", &sparse,
 			 N_("use the sparse reachability algorithm")),
 		OPT_BOOL(0, "thin", &thin,
@@ -3476,6 +4090,8 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 
 	reset_pack_idx_option(&pack_idx_opts);
 	git_config(git_pack_config, NULL);
+	if (git_env_bool(GIT_TEST_WRITE_REV_INDEX, 0))
+		pack_idx_opts.flags |= WRITE_REV;
 
 	progress = isatty(2);
 	argc = parse_options(argc, argv, prefix, pack_objects_options,
@@ -3562,6 +4178,13 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	if (!rev_list_all || !rev_list_reflog || !rev_list_index)
 		unpack_unreachable_expiration = 0;
 
+	if (cruft) {
+		if (use_internal_rev_list)
+			die(_("cannot use internal rev list with --cruft"));
+		if (pack_to_stdout)
+			die(_("cannot use --stdout with --cruft"));
+	}
+
 	if (filter_options.choice) {
 		if (!pack_to_stdout)
 			die(_("cannot use --filter without --stdout"));
@@ -3625,7 +4248,9 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 
 	if (progress)
 		progress_state = start_progress(_("Enumerating objects"), 0);
-	if (!use_internal_rev_list)
+	if (cruft)
+		read_cruft_objects();
+	else if (!use_internal_rev_list)
 		read_object_list_from_stdin();
 	else {
 		get_object_list(rp.argc, rp.argv);
@@ -189,7 +189,7 @@ static int write_oid(const struct object_id *oid, struct packed_git *pack,
 
 	if (cmd->in == -1) {
 		if (start_command(cmd))
-			die(_("could not start pack-objects to repack promisor objects"));
+			die(_("could not start pack-objects"));
 	}
 
 	xwrite(cmd->in, oid_to_hex(oid), the_hash_algo->hexsz);
@@ -255,8 +255,228 @@ static void repack_promisor_objects(const struct pack_objects_args *args,
 		die(_("could not finish pack-objects to repack promisor objects"));
 }
 
+/*
+ * Write the unreachable objects that are loose or in the packs about
+ * to be deleted into a cruft pack. "names" are the packs just written,
+ * whose objects are reachable; their names get the cruft pack added.
+ */
+static int write_cruft_pack(const struct pack_objects_args *args,
+			    const char *cruft_expiration,
+			    struct string_list *names,
+			    struct string_list *existing_packs)
+{
+	struct child_process cmd = CHILD_PROCESS_INIT;
+	struct strbuf line = STRBUF_INIT;
+	struct string_list_item *item;
+	FILE *in, *out;
+	int ret;
+
+	prepare_pack_objects(&cmd, args);
+	argv_array_push(&cmd.args, "--cruft");
+	if (cruft_expiration)
+		argv_array_pushf(&cmd.args, "--cruft-expiration=%s",
+				 cruft_expiration);
+	argv_array_push(&cmd.args, "--non-empty");
+	cmd.in = -1;
+
+	ret = start_command(&cmd);
+	if (ret)
+		return ret;
+
+	/*
+	 * The packs written by this repack are not in packdir yet, so
+	 * give their paths; the existing ones are all to be discarded.
+	 */
+	in = xfdopen(cmd.in, "w");
+	for_each_string_list_item(item, names)
+		fprintf(in, "%s-%s.pack\n", packtmp, item->string);
+	for_each_string_list_item(item, existing_packs)
+		fprintf(in, "-%s.pack\n", item->string);
+	fclose(in);
+
+	out = xfdopen(cmd.out, "r");
+	while (strbuf_getline_lf(&line, out) != EOF) {
+		if (line.len != the_hash_algo->hexsz)
+			die(_("repack: Expecting full hex object ID lines only from pack-objects."));
+		string_list_append(names, line.buf);
+	}
+	fclose(out);
+	strbuf_release(&line);
+
+	return finish_command(&cmd);
+}
+
+/*
+ * In geometric mode, the packs that are not kept are ordered by their
+ * number of objects, and those from "split" on are expected to grow by
+ * at least "factor" each. The ones before "split", and the loose
+ * objects, are rolled up into a new pack that does not break that
+ * progression, so that a repack only rewrites about as much as was
+ * added since the previous one.
+ */
+struct pack_geometry {
+	struct packed_git **pack;
+	uint32_t pack_nr, pack_alloc;
+	uint32_t split;
+};
+
+static int geometry_cmp(const void *va, const void *vb)
+{
+	const struct packed_git *a = *(const struct packed_git **)va;
+	const struct packed_git *b = *(const struct packed_git **)vb;
+
+	if (a->num_objects < b->num_objects)
+		return -1;
+	if (a->num_objects > b->num_objects)
+		return 1;
+	return 0;
+}
+
+static void init_pack_geometry(struct pack_geometry *geometry,
+			       const struct string_list *extra_keep)
+{
+	struct packed_git *p;
+
+	for (p = get_all_packs(the_repository); p; p = p->next) {
+		const char *name = basename(p->pack_name);
+		int i;
+
+		/*
+		 * Promisor and cruft packs carry files that a rolled up
+		 * pack would not have, so leave them alone.
+		 */
+		if (!p->pack_local || p->pack_keep || p->pack_promisor ||
+		    p->is_cruft)
+			continue;
+		for (i = 0; i < extra_keep->nr; i++)
+			if (!fspathcmp(name, extra_keep->items[i].string))
+				break;
+		if (i < extra_keep->nr)
+			continue;
+		if (open_pack_index(p))
+			die(_("cannot open pack index for %s"), p->pack_name);
+
+		ALLOC_GROW(geometry->pack, geometry->pack_nr + 1,
+			   geometry->pack_alloc);
+		geometry->pack[geometry->pack_nr++] = p;
+	}
+
+	QSORT(geometry->pack, geometry->pack_nr, geometry_cmp);
+}
+
+static void split_pack_geometry(struct pack_geometry *geometry, int factor)
+{
+	uint32_t i, split;
+	uint64_t rolled_up = 0;
+
+	if (!geometry->pack_nr) {
+		geometry->split = 0;
+		return;
+	}
+
+	/*
+	 * Walk down from the largest pack for as long as each pack is at
+	 * least "factor" times the size of the next smaller one; the
+	 * smaller packs from the first break on have to be rolled up.
+	 */
+	for (split = geometry->pack_nr - 1; split > 0; split--) {
+		uint64_t prev = geometry->pack[split - 1]->num_objects;
+
+		if (geometry->pack[split]->num_objects < factor * prev)
+			break;
+	}
+
+	/*
+	 * The rolled up pack is as large as the packs it replaces
+	 * together, which may in turn break the progression with the
+	 * packs above it; take them in until it does not.
+	 */
+	for (i = 0; i < split; i++)
+		rolled_up += geometry->pack[i]->num_objects;
+	for (; split < geometry->pack_nr; split++) {
+		uint64_t ours = geometry->pack[split]->num_objects;
+
+		if (ours >= factor * rolled_up)
+			break;
+		rolled_up += ours;
+	}
+
+	geometry->split = split;
+}
+
+static int write_loose_oid(const struct object_id *oid, const char *path,
+			   void *data)
+{
+	return write_oid(oid, NULL, 0, data);
+}
+
+static int write_geometric_pack(const struct pack_objects_args *args,
+				const struct pack_geometry *geometry,
+				const struct string_list *extra_keep,
+				struct string_list *names)
+{
+	struct child_process cmd = CHILD_PROCESS_INIT;
+	struct strbuf line = STRBUF_INIT;
+	FILE *out;
+	uint32_t i;
+
+	prepare_pack_objects(&cmd, args);
+	argv_array_push(&cmd.args, "--non-empty");
+	if (!pack_kept_objects)
+		argv_array_push(&cmd.args, "--honor-pack-keep");
+	for (i = 0; i < extra_keep->nr; i++)
+		argv_array_pushf(&cmd.args, "--keep-pack=%s",
+				 extra_keep->items[i].string);
+	/* objects that the packs we keep have need not be written again */
+	for (i = geometry->split; i < geometry->pack_nr; i++)
+		argv_array_pushf(&cmd.args, "--keep-pack=%s",
+				 basename(geometry->pack[i]->pack_name));
+	cmd.in = -1;
+
+	for (i = 0; i < geometry->split; i++)
+		for_each_object_in_pack(geometry->pack[i], write_oid, &cmd, 0);
+	for_each_loose_object(write_loose_oid, &cmd,
+			      FOR_EACH_OBJECT_LOCAL_ONLY);
+
+	if (cmd.in == -1)
+		/* nothing to roll up; cmd was never started */
+		return 0;
+
+	close(cmd.in);
+
+	out = xfdopen(cmd.out, "r");
+	while (strbuf_getline_lf(&line, out) != EOF) {
+		if (line.len != the_hash_algo->hexsz)
+			die(_("repack: Expecting full hex object ID lines only from pack-objects."));
+		string_list_append(names, line.buf);
+	}
+	fclose(out);
+	strbuf_release(&line);
+
+	return finish_command(&cmd);
+}
+
+static void write_geometric_midx(int write_bitmaps)
+{
+	struct packed_git *p, *largest = NULL;
+
+	for (p = get_all_packs(the_repository); p; p = p->next) {
+		if (!p->pack_local || open_pack_index(p))
+			continue;
+		if (!largest || p->num_objects > largest->num_objects)
+			largest = p;
+	}
+	if (!largest)
+		return;
+
+	if (write_midx_file(get_object_directory(), basename(largest->pack_name),
+			    write_bitmaps > 0 ? MIDX_WRITE_BITMAP : 0))
+		die(_("could not write multi-pack-index"));
+}
+
 #define ALL_INTO_ONE 1
 #define LOOSEN_UNREACHABLE 2
+#define PACK_CRUFT 4
 
 int cmd_repack(int argc, const char **argv, const char *prefix)
 {
@@ -265,9 +485,11 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 		unsigned optional:1;
 	} exts[] = {
 		{".pack"},
+		{".rev", 1},
 		{".idx"},
 		{".bitmap", 1},
 		{".promisor", 1},
+		{".mtimes", 1},
 	};
 	struct child_process cmd = CHILD_PROCESS_INIT;
 	struct string_list_item *item;
@@ -282,10 +504,13 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	int pack_everything = 0;
 	int delete_redundant = 0;
 	const char *unpack_unreachable = NULL;
+	const char *cruft_expiration = NULL;
 	int keep_unreachable = 0;
 	struct string_list keep_pack_list = STRING_LIST_INIT_NODUP;
 	int no_update_server_info = 0;
 	int midx_cleared = 0;
+	int geometric_factor = 0;
+	struct pack_geometry geometry = { 0 };
 	struct pack_objects_args po_args = {NULL};
 
 	struct option builtin_repack_options[] = {
@@ -294,6 +519,11 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 		OPT_BIT('A', NULL, &pack_everything,
 				N_("same as -a, and turn unreachable objects loose"),
 				   LOOSEN_UNREACHABLE | ALL_INTO_ONE),
+		OPT_BIT(0, "cruft", &pack_everything,
+				N_("same as -a, and pack unreachable objects into a cruft pack"),
+				   PACK_CRUFT | ALL_INTO_ONE),
+		OPT_STRING(0, "cruft-expiration", &cruft_expiration, N_("approxidate"),
+				N_("with --cruft, expire objects older than this")),
 		OPT_BOOL('d', NULL, &delete_redundant,
 				N_("remove redundant packs, and run git-prune-packed")),
 		OPT_BOOL('f', NULL, &po_args.no_reuse_delta,
@@ -327,6 +557,8 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 				N_("repack objects in packs marked with .keep")),
 		OPT_STRING_LIST(0, "keep-pack", &keep_pack_list, N_("name"),
 				N_("do not repack this pack")),
+		OPT_INTEGER('g', "geometric", &geometric_factor,
+				N_("find a geometric progression with factor <n>")),
 		OPT_END()
 	};
 
@@ -342,6 +574,20 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	    (unpack_unreachable || (pack_everything & LOOSEN_UNREACHABLE)))
 		die(_("--keep-unreachable and -A are incompatible"));
 
+	if (pack_everything & PACK_CRUFT) {
+		if (unpack_unreachable || (pack_everything & LOOSEN_UNREACHABLE))
+			die(_("--cruft and -A are incompatible"));
+		if (keep_unreachable)
+			die(_("--cruft and --keep-unreachable are incompatible"));
+	}
+
+	if (geometric_factor) {
+		if (geometric_factor < 2)
+			die(_("--geometric factor must be at least 2"));
+		if (pack_everything)
+			die(_("--geometric is incompatible with -a, -A and --cruft"));
+	}
+
 	if (write_bitmaps < 0) {
 		if (!(pack_everything & ALL_INTO_ONE) ||
 		    !is_bare_repository())
@@ -350,7 +596,9 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	if (pack_kept_objects < 0)
 		pack_kept_objects = write_bitmaps > 0;
 
-	if (write_bitmaps && !(pack_everything & ALL_INTO_ONE))
+	/* a geometric repack writes a bitmap for the multi-pack-index */
+	if (write_bitmaps && !(pack_everything & ALL_INTO_ONE) &&
+	    !geometric_factor)
 		die(_(incremental_bitmap_conflict_error));
 
 	packdir = mkpathdup("%s/pack", get_object_directory());
@@ -385,7 +633,9 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 		repack_promisor_objects(&po_args, &names);
 
 		if (existing_packs.nr && delete_redundant) {
-			if (unpack_unreachable) {
+			if (pack_everything & PACK_CRUFT) {
+				argv_array_push(&cmd.env_array, "GIT_REF_PARANOIA=1");
+			} else if (unpack_unreachable) {
 				argv_array_pushf(&cmd.args,
 						"--unpack-unreachable=%s",
 						unpack_unreachable);
@@ -405,26 +655,52 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 		argv_array_push(&cmd.args, "--incremental");
 	}
 
-	cmd.no_stdin = 1;
+	if (geometric_factor) {
+		init_pack_geometry(&geometry, &keep_pack_list);
+		split_pack_geometry(&geometry, geometric_factor);
+		for (i = 0; i < geometry.split; i++) {
+			const char *name = basename(geometry.pack[i]->pack_name);
+			size_t len;
 
-	ret = start_command(&cmd);
-	if (ret)
-		return ret;
+			if (strip_suffix(name, ".pack", &len))
+				string_list_append_nodup(&existing_packs,
+							 xmemdupz(name, len));
+		}
 
-	out = xfdopen(cmd.out, "r");
-	while (strbuf_getline_lf(&line, out) != EOF) {
-		if (line.len != the_hash_algo->hexsz)
-			die(_("repack: Expecting full hex object ID lines only from pack-objects."));
-		string_list_append(&names, line.buf);
+		child_process_clear(&cmd);
+		ret = write_geometric_pack(&po_args, &geometry,
+					   &keep_pack_list, &names);
+		if (ret)
+			return ret;
+	} else {
+		cmd.no_stdin = 1;
+
+		ret = start_command(&cmd);
+		if (ret)
+			return ret;
+
+		out = xfdopen(cmd.out, "r");
+		while (strbuf_getline_lf(&line, out) != EOF) {
+			if (line.len != the_hash_algo->hexsz)
+				die(_("repack: Expecting full hex object ID lines only from pack-objects."));
+			string_list_append(&names, line.buf);
+		}
+		fclose(out);
+		ret = finish_command(&cmd);
+		if (ret)
+			return ret;
 	}
-	fclose(out);
-	ret = finish_command(&cmd);
-	if (ret)
-		return ret;
 
 	if (!names.nr && !po_args.quiet)
 		printf_ln(_("Nothing new to pack."));
 
+	if (pack_everything & PACK_CRUFT) {
+		ret = write_cruft_pack(&po_args, cruft_expiration, &names,
+				       &existing_packs);
+		if (ret)
+			return ret;
+	}
+
 	close_object_store(the_repository->objects);
 
 	/*
@@ -539,6 +815,12 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 
 	/* End of pack replacement. */
 
+	/* the packs rolled up below may be in the multi-pack-index */
+	if (geometry.split && delete_redundant && !midx_cleared) {
+		clear_midx_file(the_repository);
+		midx_cleared = 1;
+	}
+
 	reprepare_packed_git(the_repository);
 
 	if (delete_redundant) {
@@ -569,12 +851,15 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 		update_server_info(0);
 	remove_temporary_files();
 
-	if (git_env_bool(GIT_TEST_MULTI_PACK_INDEX, 0))
-		write_midx_file(get_object_directory(), 0);
+	if (geometric_factor)
+		write_geometric_midx(write_bitmaps);
+	else if (git_env_bool(GIT_TEST_MULTI_PACK_INDEX, 0))
+		write_midx_file(get_object_directory(), NULL, 0);
 
 	string_list_clear(&names, 0);
 	string_list_clear(&rollback, 0);
 	string_list_clear(&existing_packs, 0);
+	free(geometry.pack);
 	strbuf_release(&line);
 
 	return 0;
@@ -18,6 +18,7 @@
 #include "reflog-walk.h"
 #include "oidset.h"
 #include "packfile.h"
+#include "thread-utils.h"
 
 static const char rev_list_usage[] =
 "git rev-list [OPTION] <commit-id>... [ -- paths... ]\n"
@@ -46,6 +47,7 @@ static const char rev_list_usage[] =
 "    --parents\n"
 "    --children\n"
 "    --objects | --objects-edge\n"
+"    --threads=<n>\n"
 "    --unpacked\n"
 "    --header | --pretty\n"
 "    --[no-]object-names\n"
@@ -553,6 +555,15 @@ int cmd_rev_list(int argc, const char **argv, const char *prefix)
 			show_progress = arg;
 			continue;
 		}
+		if (skip_prefix(arg, "--threads=", &arg)) {
+			if (strtol_i(arg, 10, &revs.traverse_threads) ||
+			    revs.traverse_threads < 0)
+				die(_("invalid number of threads specified (%s)"),
+				    arg);
+			if (!revs.traverse_threads)
+				revs.traverse_threads = online_cpus();
+			continue;
+		}
 
 		if (skip_prefix(arg, ("--" CL_ARG__FILTER "="), &arg)) {
 			parse_list_objects_filter(&filter_options, arg);
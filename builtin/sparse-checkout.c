@@ -122,9 +122,15 @@ static int update_working_directory(struct pattern_list *pl)
 		 * files in the way or dirty entries that can't be removed.
 		 */
 		result = UPDATE_SPARSITY_SUCCESS;
-	if (result == UPDATE_SPARSITY_SUCCESS)
+	if (result == UPDATE_SPARSITY_SUCCESS) {
+		/*
+		 * The patterns may not have been written out yet; collapse
+		 * the index against the ones we were given.
+		 */
+		r->index->sparse_checkout_patterns = pl;
 		write_locked_index(r->index, &lock_file, COMMIT_LOCK);
-	else
+		r->index->sparse_checkout_patterns = NULL;
+	} else
 		rollback_lock_file(&lock_file);
 
 	return result;
@@ -266,13 +272,28 @@ static int set_config(enum sparse_checkout_mode mode)
 	return 0;
 }
 
+static int set_sparse_index_config(int enable)
+{
+	if (git_config_set_in_file_gently(git_path("config.worktree"),
+					  "index.sparse",
+					  enable ? "true" : NULL) < 0) {
+		error(_("failed to set index.sparse setting"));
+		return 1;
+	}
+
+	prepare_repo_settings(the_repository);
+	the_repository->settings.sparse_index = enable;
+	return 0;
+}
+
 static char const * const builtin_sparse_checkout_init_usage[] = {
-	N_("git sparse-checkout init [--cone]"),
+	N_("git sparse-checkout init [--cone] [--[no-]sparse-index]"),
 	NULL
 };
 
 static struct sparse_checkout_init_opts {
 	int cone_mode;
+	int sparse_index;
 } init_opts;
 
 static int sparse_checkout_init(int argc, const char **argv)
@@ -287,11 +308,15 @@ static int sparse_checkout_init(int argc, const char **argv)
 	static struct option builtin_sparse_checkout_init_options[] = {
 		OPT_BOOL(0, "cone", &init_opts.cone_mode,
 			 N_("initialize the sparse-checkout in cone mode")),
+		OPT_BOOL(0, "sparse-index", &init_opts.sparse_index,
+			 N_("toggle the use of a sparse index")),
 		OPT_END(),
 	};
 
 	repo_read_index(the_repository);
 
+	init_opts.sparse_index = -1;
+
 	argc = parse_options(argc, argv, NULL,
 			     builtin_sparse_checkout_init_options,
 			     builtin_sparse_checkout_init_usage, 0);
@@ -304,6 +329,9 @@ static int sparse_checkout_init(int argc, const char **argv)
 
 	if (set_config(mode))
 		return 1;
+	if (init_opts.sparse_index >= 0 &&
+	    set_sparse_index_config(init_opts.sparse_index))
+		return 1;
 
 	memset(&pl, 0, sizeof(pl));
 
@@ -573,6 +601,9 @@ static int sparse_checkout_disable(int argc, const char **argv)
 	pl.use_cone_patterns = 0;
 	core_apply_sparse_checkout = 1;
 
+	/* everything is checked out again; nothing is left to collapse */
+	set_sparse_index_config(0);
+
 	strbuf_addstr(&match_all, "/*");
 	add_pattern(strbuf_detach(&match_all, NULL), empty_base, 0, &pl, 0);
 
@@ -45,7 +45,7 @@ static int subtree_name_cmp(const char *one, int onelen,
 	return memcmp(one, two, onelen);
 }
 
-static int subtree_pos(struct cache_tree *it, const char *path, int pathlen)
+int cache_tree_subtree_pos(struct cache_tree *it, const char *path, int pathlen)
 {
 	struct cache_tree_sub **down = it->down;
 	int lo, hi;
@@ -72,7 +72,7 @@ static struct cache_tree_sub *find_subtree(struct cache_tree *it,
 					   int create)
 {
 	struct cache_tree_sub *down;
-	int pos = subtree_pos(it, path, pathlen);
+	int pos = cache_tree_subtree_pos(it, path, pathlen);
 	if (0 <= pos)
 		return it->down[pos];
 	if (!create)
@@ -123,7 +123,7 @@ static int do_invalidate_path(struct cache_tree *it, const char *path)
 	it->entry_count = -1;
 	if (!*slash) {
 		int pos;
-		pos = subtree_pos(it, path, namelen);
+		pos = cache_tree_subtree_pos(it, path, namelen);
 		if (0 <= pos) {
 			cache_tree_free(&it->down[pos]->cache_tree);
 			free(it->down[pos]);
@@ -257,6 +257,22 @@ static int update_one(struct cache_tree *it,
 	if (0 <= it->entry_count && has_object_file(&it->oid))
 		return it->entry_count;
 
+	/*
+	 * A sparse directory entry for "base" stands for the whole tree,
+	 * which makes this a leaf of the cache tree.
+	 */
+	if (entries > 0) {
+		const struct cache_entry *ce = cache[0];
+
+		if (S_ISSPARSEDIR(ce->ce_mode) &&
+		    ce_namelen(ce) == baselen &&
+		    !memcmp(ce->name, base, baselen)) {
+			it->entry_count = 1;
+			oidcpy(&it->oid, &ce->oid);
+			return 1;
+		}
+	}
+
 	/*
 	 * We first scan for subtrees and update them; we start by
 	 * marking existing subtrees -- the ones that are unmarked
@@ -729,6 +745,44 @@ static void prime_cache_tree_rec(struct repository *r,
 	it->entry_count = cnt;
 }
 
+void cache_tree_expand_sparse_dir(struct repository *r,
+				  struct cache_tree *root,
+				  const char *path, struct tree *tree)
+{
+	struct cache_tree *it = root;
+	const char *p = path, *slash;
+	int i, delta;
+
+	while (it && (slash = strchr(p, '/'))) {
+		struct cache_tree_sub *sub = find_subtree(it, p, slash - p, 0);
+
+		it = sub ? sub->cache_tree : NULL;
+		p = slash + 1;
+	}
+	if (!it || it->entry_count < 0) {
+		do_invalidate_path(root, path);
+		return;
+	}
+
+	for (i = 0; i < it->subtree_nr; i++) {
+		cache_tree_free(&it->down[i]->cache_tree);
+		free(it->down[i]);
+	}
+	it->subtree_nr = 0;
+	delta = -it->entry_count;
+	prime_cache_tree_rec(r, it, tree);
+	delta += it->entry_count;
+
+	/* The parents of a valid node may be invalid, but never missing */
+	for (it = root, p = path; (slash = strchr(p, '/')); p = slash + 1) {
+		if (it->entry_count >= 0)
+			it->entry_count += delta;
+		if (!slash[1])
+			break;
+		it = find_subtree(it, p, slash - p, 0)->cache_tree;
+	}
+}
+
 void prime_cache_tree(struct repository *r,
 		      struct index_state *istate,
 		      struct tree *tree)
@@ -793,6 +847,16 @@ static void verify_one(struct repository *r,
 
 	if (path->len) {
 		pos = index_name_pos(istate, path->buf, path->len);
+		if (pos >= 0) {
+			/* a sparse directory entry stands for the whole tree */
+			struct cache_entry *ce = istate->cache[pos];
+
+			if (!S_ISSPARSEDIR(ce->ce_mode) ||
+			    !oideq(&ce->oid, &it->oid))
+				BUG("cache-tree for path %.*s does not match "
+				    "its sparse directory entry", len, path->buf);
+			return;
+		}
 		pos = -pos - 1;
 	} else {
 		pos = 0;
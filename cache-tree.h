@@ -27,6 +27,12 @@ void cache_tree_free(struct cache_tree **);
 void cache_tree_invalidate_path(struct index_state *, const char *);
 struct cache_tree_sub *cache_tree_sub(struct cache_tree *, const char *);
 
+/*
+ * Return the position of the subtree "path" (not NUL-terminated) in
+ * it->down, or a negative value if there is no such subtree.
+ */
+int cache_tree_subtree_pos(struct cache_tree *it, const char *path, int pathlen);
+
 void cache_tree_write(struct strbuf *, struct cache_tree *root);
 struct cache_tree *cache_tree_read(const char *buffer, unsigned long size);
 
@@ -50,6 +56,15 @@ struct tree* write_in_core_index_as_tree(struct repository *repo);
 int write_index_as_tree(struct object_id *oid, struct index_state *index_state, const char *index_path, int flags, const char *prefix);
 void prime_cache_tree(struct repository *, struct index_state *, struct tree *);
 
+/*
+ * The sparse directory entry "path" (ending in a slash) of the index
+ * was replaced by the entries of "tree": turn its leaf into a full
+ * subtree again and fix up the entry counts of its parents.
+ */
+void cache_tree_expand_sparse_dir(struct repository *r,
+				  struct cache_tree *root,
+				  const char *path, struct tree *tree);
+
 int cache_tree_matches_traversal(struct cache_tree *, struct name_entry *ent, struct traverse_info *info);
 
 #ifdef USE_THE_INDEX_COMPATIBILITY_MACROS
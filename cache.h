@@ -69,6 +69,12 @@ unsigned long git_deflate_bound(git_zstream *, unsigned long);
 #define S_IFGITLINK	0160000
 #define S_ISGITLINK(m)	(((m) & S_IFMT) == S_IFGITLINK)
 
+/*
+ * A "sparse directory" entry of a sparse index stands for a whole tree
+ * outside of the sparse-checkout cone; see sparse-index.h.
+ */
+#define S_ISSPARSEDIR(m) ((m) == S_IFDIR)
+
 /*
  * Some mode bits are also used internally for computations.
  *
@@ -319,7 +325,8 @@ struct index_state {
 		 drop_cache_tree : 1,
 		 updated_workdir : 1,
 		 updated_skipworktree : 1,
-		 fsmonitor_has_run_once : 1;
+		 fsmonitor_has_run_once : 1,
+		 sparse_index : 1;
 	struct hashmap name_hash;
 	struct hashmap dir_hash;
 	struct object_id oid;
@@ -328,6 +335,9 @@ struct index_state {
 	struct ewah_bitmap *fsmonitor_dirty;
 	struct mem_pool *ce_mem_pool;
 	struct progress *progress;
+	struct repository *repo;
+	/* cone-mode patterns to collapse against, if not the file's */
+	struct pattern_list *sparse_checkout_patterns;
 };
 
 /* Name hashing */
@@ -628,8 +638,8 @@ int path_inside_repo(const char *prefix, const char *path);
 
 int init_db(const char *git_dir, const char *real_git_dir,
 	    const char *template_dir, int hash_algo,
-	    unsigned int flags);
-void initialize_repository_version(int hash_algo);
+	    const char *ref_format, unsigned int flags);
+void initialize_repository_version(int hash_algo, const char *ref_format);
 
 void sanitize_stdfds(void);
 int daemonize(void);
@@ -959,6 +969,7 @@ extern int precomposed_unicode;
 extern int protect_hfs;
 extern int protect_ntfs;
 extern const char *core_fsmonitor;
+extern int core_use_builtin_fsmonitor;
 
 extern int core_apply_sparse_checkout;
 extern int core_sparse_checkout_cone;
@@ -1042,6 +1053,7 @@ struct repository_format {
 	int worktree_config;
 	int is_bare;
 	int hash_algo;
+	char *ref_storage_format; /* value of extensions.refstorage */
 	char *work_tree;
 	struct string_list unknown_extensions;
 };
@@ -1711,6 +1723,16 @@ struct checkout {
 int checkout_entry(struct cache_entry *ce, const struct checkout *state, char *topath, int *nr_checkouts);
 void enable_delayed_checkout(struct checkout *state);
 int finish_delayed_checkout(struct checkout *state, int *nr_checkouts);
+
+/*
+ * fstat() the just-written checkout output "fd" into "st" when its stat
+ * data can be used for the index; returns 1 if it did so.
+ */
+int fstat_checkout_output(int fd, const struct checkout *state, struct stat *st);
+
+/* Record the stat data of the just-written "ce" in the index. */
+void update_ce_after_write(const struct checkout *state, struct cache_entry *ce,
+			   struct stat *st);
 /*
  * Unlink the last component and schedule the leading directories for
  * removal, such that empty directories get removed.
@@ -1733,6 +1755,7 @@ int has_symlink_leading_path(const char *name, int len);
 int threaded_has_symlink_leading_path(struct cache_def *, const char *, int);
 int check_leading_path(const char *name, int len);
 int has_dirs_only_path(const char *name, int len, int prefix_len);
+int threaded_has_dirs_only_path(struct cache_def *, const char *, int, int);
 void schedule_dir_for_removal(const char *name, int len);
 void remove_scheduled_dirs(void);
 
@@ -18,6 +18,7 @@
 #include "progress.h"
 #include "bloom.h"
 #include "commit-slab.h"
+#include "thread-utils.h"
 
 void git_test_write_commit_graph_or_die(void)
 {
@@ -37,11 +38,14 @@ void git_test_write_commit_graph_or_die(void)
 #define GRAPH_CHUNKID_OIDFANOUT 0x4f494446 /* "OIDF" */
 #define GRAPH_CHUNKID_OIDLOOKUP 0x4f49444c /* "OIDL" */
 #define GRAPH_CHUNKID_DATA 0x43444154 /* "CDAT" */
+#define GRAPH_CHUNKID_GENERATION_DATA 0x47444154 /* "GDAT" */
+#define GRAPH_CHUNKID_GENERATION_DATA_OVERFLOW 0x47444f56 /* "GDOV" */
 #define GRAPH_CHUNKID_EXTRAEDGES 0x45444745 /* "EDGE" */
 #define GRAPH_CHUNKID_BLOOMINDEXES 0x42494458 /* "BIDX" */
 #define GRAPH_CHUNKID_BLOOMDATA 0x42444154 /* "BDAT" */
+#define GRAPH_CHUNKID_BLOOMPARENTINDEXES 0x42504152 /* "BPAR" */
 #define GRAPH_CHUNKID_BASE 0x42415345 /* "BASE" */
-#define MAX_NUM_CHUNKS 7
+#define MAX_NUM_CHUNKS 10
 
 #define GRAPH_DATA_WIDTH (the_hash_algo->rawsz + 16)
 
@@ -54,6 +58,8 @@ void git_test_write_commit_graph_or_die(void)
 
 #define GRAPH_LAST_EDGE 0x80000000
 
+#define CORRECTED_COMMIT_DATE_OFFSET_OVERFLOW 0x80000000
+
 #define GRAPH_HEADER_SIZE 8
 #define GRAPH_FANOUT_SIZE (4 * 256)
 #define GRAPH_CHUNKLOOKUP_WIDTH 12
@@ -317,6 +323,20 @@ struct commit_graph *parse_commit_graph(void *graph_map, size_t graph_size)
 				graph->chunk_commit_data = data + chunk_offset;
 			break;
 
+		case GRAPH_CHUNKID_GENERATION_DATA:
+			if (graph->chunk_generation_data)
+				chunk_repeated = 1;
+			else
+				graph->chunk_generation_data = data + chunk_offset;
+			break;
+
+		case GRAPH_CHUNKID_GENERATION_DATA_OVERFLOW:
+			if (graph->chunk_generation_data_overflow)
+				chunk_repeated = 1;
+			else
+				graph->chunk_generation_data_overflow = data + chunk_offset;
+			break;
+
 		case GRAPH_CHUNKID_EXTRAEDGES:
 			if (graph->chunk_extra_edges)
 				chunk_repeated = 1;
@@ -338,6 +358,13 @@ struct commit_graph *parse_commit_graph(void *graph_map, size_t graph_size)
 				graph->chunk_bloom_indexes = data + chunk_offset;
 			break;
 
+		case GRAPH_CHUNKID_BLOOMPARENTINDEXES:
+			if (graph->chunk_bloom_parent_indexes)
+				chunk_repeated = 1;
+			else
+				graph->chunk_bloom_parent_indexes = data + chunk_offset;
+			break;
+
 		case GRAPH_CHUNKID_BLOOMDATA:
 			if (graph->chunk_bloom_data)
 				chunk_repeated = 1;
@@ -378,9 +405,12 @@ struct commit_graph *parse_commit_graph(void *graph_map, size_t graph_size)
 		/* We need both the bloom chunks to exist together. Else ignore the data */
 		graph->chunk_bloom_indexes = NULL;
 		graph->chunk_bloom_data = NULL;
+		graph->chunk_bloom_parent_indexes = NULL;
 		FREE_AND_NULL(graph->bloom_filter_settings);
 	}
 
+	graph->read_generation_data = !!graph->chunk_generation_data;
+
 	hashcpy(graph->oid.hash, graph->data + graph->data_len - graph->hash_len);
 
 	if (verify_commit_graph_lite(graph))
@@ -526,6 +556,54 @@ static struct commit_graph *load_commit_graph_chain(struct repository *r,
 	return graph_chain;
 }
 
+static int get_configured_generation_version(struct repository *r)
+{
+	int version = 2;
+	repo_config_get_int(r, "commitgraph.generationversion", &version);
+	return version;
+}
+
+static int get_configured_bloom_settings(struct repository *r,
+					 struct bloom_filter_settings *settings)
+{
+	int value;
+
+	if (!repo_config_get_int(r, "commitgraph.bloomnumhashes", &value)) {
+		if (value < 1 || value > 32)
+			return error(_("commitGraph.bloomNumHashes must be between 1 and 32"));
+		settings->num_hashes = value;
+	}
+	if (!repo_config_get_int(r, "commitgraph.bloombitsperentry", &value)) {
+		if (value < 1 || value > 64)
+			return error(_("commitGraph.bloomBitsPerEntry must be between 1 and 64"));
+		settings->bits_per_entry = value;
+	}
+	if (!repo_config_get_int(r, "commitgraph.maxchangedpaths", &value)) {
+		if (value < 0)
+			return error(_("commitGraph.maxChangedPaths cannot be negative"));
+		settings->max_changed_paths = value;
+	}
+	return 0;
+}
+
+/*
+ * Corrected commit dates can only be compared with each other, so use
+ * them only if every layer of the chain has them; otherwise fall back
+ * to the topological levels, which all layers carry.
+ */
+static void validate_mixed_generation_chain(struct repository *r,
+					    struct commit_graph *g)
+{
+	int read_generation_data = get_configured_generation_version(r) >= 2;
+	struct commit_graph *p;
+
+	for (p = g; read_generation_data && p; p = p->base_graph)
+		read_generation_data = p->read_generation_data;
+
+	for (p = g; p; p = p->base_graph)
+		p->read_generation_data = read_generation_data;
+}
+
 struct commit_graph *read_commit_graph_one(struct repository *r,
 					   struct object_directory *odb)
 {
@@ -534,6 +612,8 @@ struct commit_graph *read_commit_graph_one(struct repository *r,
 	if (!g)
 		g = load_commit_graph_chain(r, odb);
 
+	validate_mixed_generation_chain(r, g);
+
 	return g;
 }
 
@@ -613,6 +693,14 @@ int generation_numbers_enabled(struct repository *r)
 	return !!first_generation;
 }
 
+int corrected_commit_dates_enabled(struct repository *r)
+{
+	if (!prepare_commit_graph(r))
+		return 0;
+
+	return r->objects->commit_graph->read_generation_data;
+}
+
 static void close_commit_graph_one(struct commit_graph *g)
 {
 	if (!g)
@@ -673,6 +761,56 @@ static struct commit_list **insert_parent_or_die(struct repository *r,
 	return &commit_list_insert(c, pptr)->next;
 }
 
+static timestamp_t graph_commit_date(struct commit_graph *g,
+				     const unsigned char *commit_data)
+{
+	uint64_t date_high, date_low;
+
+	date_high = get_be32(commit_data + g->hash_len + 8) & 0x3;
+	date_low = get_be32(commit_data + g->hash_len + 12);
+	return (timestamp_t)((date_high << 32) | date_low);
+}
+
+static uint32_t graph_topo_level(struct commit_graph *g,
+				 const unsigned char *commit_data)
+{
+	return get_be32(commit_data + g->hash_len + 8) >> 2;
+}
+
+/*
+ * The generation data chunk stores the corrected commit date of each
+ * commit as an offset from its commit date. Offsets that do not fit
+ * in 31 bits point into the generation data overflow chunk instead.
+ */
+static timestamp_t graph_corrected_commit_date(struct commit_graph *g,
+					       uint32_t lex_index,
+					       timestamp_t date)
+{
+	uint32_t offset = get_be32(g->chunk_generation_data +
+				   sizeof(uint32_t) * lex_index);
+
+	if (offset & CORRECTED_COMMIT_DATE_OFFSET_OVERFLOW) {
+		uint64_t overflow_pos = offset ^ CORRECTED_COMMIT_DATE_OFFSET_OVERFLOW;
+
+		if (!g->chunk_generation_data_overflow)
+			die(_("commit-graph requires overflow generation data but has none"));
+
+		return date + get_be64(g->chunk_generation_data_overflow +
+				       8 * overflow_pos);
+	}
+
+	return date + offset;
+}
+
+static timestamp_t graph_generation(struct commit_graph *g, uint32_t lex_index,
+				    const unsigned char *commit_data)
+{
+	if (g->read_generation_data)
+		return graph_corrected_commit_date(g, lex_index,
+						   graph_commit_date(g, commit_data));
+	return graph_topo_level(g, commit_data);
+}
+
 static void fill_commit_graph_info(struct commit *item, struct commit_graph *g, uint32_t pos)
 {
 	const unsigned char *commit_data;
@@ -684,7 +822,7 @@ static void fill_commit_graph_info(struct commit *item, struct commit_graph *g,
 	lex_index = pos - g->num_commits_in_base;
 	commit_data = g->chunk_commit_data + GRAPH_DATA_WIDTH * lex_index;
 	item->graph_pos = pos;
-	item->generation = get_be32(commit_data + g->hash_len + 8) >> 2;
+	item->generation = graph_generation(g, lex_index, commit_data);
 }
 
 static inline void set_commit_tree(struct commit *c, struct tree *t)
@@ -698,7 +836,6 @@ static int fill_commit_in_graph(struct repository *r,
 {
 	uint32_t edge_value;
 	uint32_t *parent_data_ptr;
-	uint64_t date_low, date_high;
 	struct commit_list **pptr;
 	const unsigned char *commit_data;
 	uint32_t lex_index;
@@ -722,11 +859,8 @@ static int fill_commit_in_graph(struct repository *r,
 
 	set_commit_tree(item, NULL);
 
-	date_high = get_be32(commit_data + g->hash_len + 8) & 0x3;
-	date_low = get_be32(commit_data + g->hash_len + 12);
-	item->date = (timestamp_t)((date_high << 32) | date_low);
-
-	item->generation = get_be32(commit_data + g->hash_len + 8) >> 2;
+	item->date = graph_commit_date(g, commit_data);
+	item->generation = graph_generation(g, lex_index, commit_data);
 
 	pptr = &item->parents;
 
@@ -808,6 +942,50 @@ void load_commit_graph_info(struct repository *r, struct commit *item)
 		fill_commit_graph_info(item, r->objects->commit_graph, pos);
 }
 
+int commit_graph_parents(struct commit_graph *g, const struct commit *c,
+			 struct oid_array *parents)
+{
+	const unsigned char *commit_data;
+	uint32_t edge_value;
+	uint32_t *parent_data_ptr;
+	struct object_id oid;
+
+	if (c->graph_pos == COMMIT_NOT_FROM_GRAPH)
+		return -1;
+
+	while (c->graph_pos < g->num_commits_in_base)
+		g = g->base_graph;
+
+	commit_data = g->chunk_commit_data +
+			GRAPH_DATA_WIDTH * (c->graph_pos - g->num_commits_in_base);
+
+	edge_value = get_be32(commit_data + g->hash_len);
+	if (edge_value == GRAPH_PARENT_NONE)
+		return 0;
+	load_oid_from_graph(g, edge_value, &oid);
+	oid_array_append(parents, &oid);
+
+	edge_value = get_be32(commit_data + g->hash_len + 4);
+	if (edge_value == GRAPH_PARENT_NONE)
+		return 0;
+	if (!(edge_value & GRAPH_EXTRA_EDGES_NEEDED)) {
+		load_oid_from_graph(g, edge_value, &oid);
+		oid_array_append(parents, &oid);
+		return 0;
+	}
+
+	parent_data_ptr = (uint32_t*)(g->chunk_extra_edges +
+			  4 * (uint64_t)(edge_value & GRAPH_EDGE_LAST_MASK));
+	do {
+		edge_value = get_be32(parent_data_ptr);
+		load_oid_from_graph(g, edge_value & GRAPH_EDGE_LAST_MASK, &oid);
+		oid_array_append(parents, &oid);
+		parent_data_ptr++;
+	} while (!(edge_value & GRAPH_LAST_EDGE));
+
+	return 0;
+}
+
 static struct tree *load_tree_for_commit(struct repository *r,
 					 struct commit_graph *g,
 					 struct commit *c)
@@ -850,6 +1028,17 @@ struct packed_commit_list {
 	int alloc;
 };
 
+/*
+ * Both generation numbers of a commit being written: the topological
+ * level stored in the commit data chunk, and the corrected commit date
+ * stored in the generation data chunk.
+ */
+struct commit_graph_generation {
+	uint32_t topo_level;
+	timestamp_t corrected_commit_date;
+};
+define_commit_slab(generation_slab, struct commit_graph_generation);
+
 struct packed_oid_list {
 	struct object_id *list;
 	int nr;
@@ -877,15 +1066,26 @@ struct write_commit_graph_context {
 	uint32_t new_num_commits_in_base;
 	struct commit_graph *new_base_graph;
 
+	struct generation_slab generations;
+	int num_generation_data_overflows;
+
 	unsigned append:1,
 		 report_progress:1,
 		 split:1,
 		 check_oids:1,
 		 changed_paths:1,
-		 order_by_pack:1;
+		 order_by_pack:1,
+		 write_generation_data:1;
 
 	const struct split_commit_graph_opts *split_opts;
 	size_t total_bloom_filter_data_size;
+	size_t total_bloom_parent_filter_data_size;
+	struct bloom_filter_settings bloom_settings;
+
+	int count_bloom_filter_computed;
+	int count_bloom_filter_not_computed;
+	int count_bloom_filter_trunc_empty;
+	int count_bloom_filter_trunc_large;
 };
 
 static void write_graph_chunk_fanout(struct hashfile *f,
@@ -1020,7 +1220,7 @@ static void write_graph_chunk_data(struct hashfile *f, int hash_len,
 		else
 			packedDate[0] = 0;
 
-		packedDate[0] |= htonl((*list)->generation << 2);
+		packedDate[0] |= htonl(generation_slab_at(&ctx->generations, *list)->topo_level << 2);
 
 		packedDate[1] = htonl((*list)->date);
 		hashwrite(f, packedDate, 8);
@@ -1029,6 +1229,46 @@ static void write_graph_chunk_data(struct hashfile *f, int hash_len,
 	}
 }
 
+static void write_graph_chunk_generation_data(struct hashfile *f,
+					      struct write_commit_graph_context *ctx)
+{
+	int i, num_generation_data_overflows = 0;
+
+	for (i = 0; i < ctx->commits.nr; i++) {
+		struct commit *c = ctx->commits.list[i];
+		timestamp_t offset;
+
+		display_progress(ctx->progress, ++ctx->progress_cnt);
+
+		offset = generation_slab_at(&ctx->generations, c)->corrected_commit_date - c->date;
+		if (offset > GENERATION_NUMBER_V2_OFFSET_MAX) {
+			offset = CORRECTED_COMMIT_DATE_OFFSET_OVERFLOW | num_generation_data_overflows;
+			num_generation_data_overflows++;
+		}
+
+		hashwrite_be32(f, offset);
+	}
+}
+
+static void write_graph_chunk_generation_data_overflow(struct hashfile *f,
+						       struct write_commit_graph_context *ctx)
+{
+	int i;
+
+	for (i = 0; i < ctx->commits.nr; i++) {
+		struct commit *c = ctx->commits.list[i];
+		timestamp_t offset;
+
+		display_progress(ctx->progress, ++ctx->progress_cnt);
+
+		offset = generation_slab_at(&ctx->generations, c)->corrected_commit_date - c->date;
+		if (offset > GENERATION_NUMBER_V2_OFFSET_MAX) {
+			hashwrite_be32(f, offset >> 32);
+			hashwrite_be32(f, (uint32_t) offset);
+		}
+	}
+}
+
 static void write_graph_chunk_extra_edges(struct hashfile *f,
 					  struct write_commit_graph_context *ctx)
 {
@@ -1096,7 +1336,10 @@ static void write_graph_chunk_bloom_indexes(struct hashfile *f,
 			ctx->commits.nr);
 
 	while (list < last) {
-		struct bloom_filter *filter = get_bloom_filter(ctx->r, *list, 0);
+		struct bloom_filter *filter;
+
+		filter = get_or_compute_bloom_filter(ctx->r, *list, 0,
+						     &ctx->bloom_settings, NULL);
 		cur_pos += filter->len;
 		display_progress(progress, ++i);
 		hashwrite_be32(f, cur_pos);
@@ -1106,10 +1349,28 @@ static void write_graph_chunk_bloom_indexes(struct hashfile *f,
 	stop_progress(&progress);
 }
 
+static void write_graph_chunk_bloom_parent_indexes(struct hashfile *f,
+						   struct write_commit_graph_context *ctx)
+{
+	struct commit **list = ctx->commits.list;
+	struct commit **last = ctx->commits.list + ctx->commits.nr;
+	uint32_t cur_pos = ctx->total_bloom_filter_data_size;
+
+	while (list < last) {
+		struct bloom_parent_filters *filters;
+
+		filters = get_bloom_parent_filters(ctx->r, *list, 0,
+						   &ctx->bloom_settings);
+		cur_pos += filters->nr * filters->len;
+		hashwrite_be32(f, cur_pos);
+		list++;
+	}
+}
+
 static void write_graph_chunk_bloom_data(struct hashfile *f,
-					 struct write_commit_graph_context *ctx,
-					 const struct bloom_filter_settings *settings)
+					 struct write_commit_graph_context *ctx)
 {
+	const struct bloom_filter_settings *settings = &ctx->bloom_settings;
 	struct commit **list = ctx->commits.list;
 	struct commit **last = ctx->commits.list + ctx->commits.nr;
 	struct progress *progress = NULL;
@@ -1125,12 +1386,26 @@ static void write_graph_chunk_bloom_data(struct hashfile *f,
 	hashwrite_be32(f, settings->bits_per_entry);
 
 	while (list < last) {
-		struct bloom_filter *filter = get_bloom_filter(ctx->r, *list, 0);
+		struct bloom_filter *filter;
+
+		filter = get_or_compute_bloom_filter(ctx->r, *list, 0,
+						     settings, NULL);
 		display_progress(progress, ++i);
 		hashwrite(f, filter->data, filter->len * sizeof(unsigned char));
 		list++;
 	}
 
+	/*
+	 * The filters against the other parents of merges follow, so
+	 * that readers that do not know about them never see them.
+	 */
+	for (list = ctx->commits.list; list < last; list++) {
+		struct bloom_parent_filters *filters;
+
+		filters = get_bloom_parent_filters(ctx->r, *list, 0, settings);
+		hashwrite(f, filters->data, filters->nr * filters->len);
+	}
+
 	stop_progress(&progress);
 }
 
@@ -1241,6 +1516,40 @@ static void close_reachable(struct write_commit_graph_context *ctx)
 	stop_progress(&ctx->progress);
 }
 
+/*
+ * Fill the generation numbers of a commit stored in a commit-graph layer
+ * that the new file is written on top of. Returns 0 if "c" is not in
+ * one of these layers (or has no usable generation number there), in
+ * which case it has to be computed.
+ */
+static int load_base_generation(struct write_commit_graph_context *ctx,
+				struct commit *c,
+				struct commit_graph_generation *gen)
+{
+	struct commit_graph *g = ctx->new_base_graph;
+	const unsigned char *commit_data;
+	uint32_t pos, lex_index;
+
+	if (!g || !find_commit_in_graph(c, g, &pos) ||
+	    pos >= ctx->new_num_commits_in_base)
+		return 0;
+
+	while (pos < g->num_commits_in_base)
+		g = g->base_graph;
+	lex_index = pos - g->num_commits_in_base;
+	commit_data = g->chunk_commit_data + GRAPH_DATA_WIDTH * lex_index;
+
+	gen->topo_level = graph_topo_level(g, commit_data);
+	if (gen->topo_level == GENERATION_NUMBER_ZERO)
+		return 0;
+
+	if (ctx->write_generation_data)
+		gen->corrected_commit_date =
+			graph_corrected_commit_date(g, lex_index,
+						    graph_commit_date(g, commit_data));
+	return 1;
+}
+
 static void compute_generation_numbers(struct write_commit_graph_context *ctx)
 {
 	int i;
@@ -1252,50 +1561,142 @@ static void compute_generation_numbers(struct write_commit_graph_context *ctx)
 					ctx->commits.nr);
 	for (i = 0; i < ctx->commits.nr; i++) {
 		display_progress(ctx->progress, i + 1);
-		if (ctx->commits.list[i]->generation != GENERATION_NUMBER_INFINITY &&
-		    ctx->commits.list[i]->generation != GENERATION_NUMBER_ZERO)
+		if (generation_slab_at(&ctx->generations, ctx->commits.list[i])->topo_level)
 			continue;
 
 		commit_list_insert(ctx->commits.list[i], &list);
 		while (list) {
 			struct commit *current = list->item;
+			struct commit_graph_generation *gen;
 			struct commit_list *parent;
 			int all_parents_computed = 1;
-			uint32_t max_generation = 0;
+			uint32_t max_level = 0;
+			timestamp_t max_corrected_commit_date = 0;
 
 			for (parent = current->parents; parent; parent = parent->next) {
-				if (parent->item->generation == GENERATION_NUMBER_INFINITY ||
-				    parent->item->generation == GENERATION_NUMBER_ZERO) {
+				struct commit_graph_generation *pgen =
+					generation_slab_at(&ctx->generations, parent->item);
+
+				if (!pgen->topo_level &&
+				    !load_base_generation(ctx, parent->item, pgen)) {
 					all_parents_computed = 0;
 					commit_list_insert(parent->item, &list);
 					break;
-				} else if (parent->item->generation > max_generation) {
-					max_generation = parent->item->generation;
 				}
+
+				if (pgen->topo_level > max_level)
+					max_level = pgen->topo_level;
+				if (pgen->corrected_commit_date > max_corrected_commit_date)
+					max_corrected_commit_date = pgen->corrected_commit_date;
 			}
 
 			if (all_parents_computed) {
-				current->generation = max_generation + 1;
+				gen = generation_slab_at(&ctx->generations, current);
 				pop_commit(&list);
 
-				if (current->generation > GENERATION_NUMBER_MAX)
-					current->generation = GENERATION_NUMBER_MAX;
+				gen->topo_level = max_level + 1;
+				if (gen->topo_level > GENERATION_NUMBER_V1_MAX)
+					gen->topo_level = GENERATION_NUMBER_V1_MAX;
+
+				/*
+				 * The corrected commit date is the commit date,
+				 * bumped to one more than that of any parent if
+				 * the clock went backwards.
+				 */
+				if (current->date && current->date > max_corrected_commit_date)
+					max_corrected_commit_date = current->date - 1;
+				gen->corrected_commit_date = max_corrected_commit_date + 1;
 			}
 		}
 	}
+
+	for (i = 0; i < ctx->commits.nr; i++) {
+		struct commit *c = ctx->commits.list[i];
+		if (generation_slab_at(&ctx->generations, c)->corrected_commit_date - c->date >
+		    GENERATION_NUMBER_V2_OFFSET_MAX)
+			ctx->num_generation_data_overflows++;
+	}
 	stop_progress(&ctx->progress);
 }
 
+struct bloom_compute_data {
+	struct write_commit_graph_context *ctx;
+	struct commit **commits;
+	enum bloom_filter_computed *computed;
+	int nr, next;
+	struct progress *progress;
+	int progress_nr;
+	pthread_mutex_t mutex;
+};
+
+/* Number of commits a thread takes at a time. */
+#define BLOOM_THREAD_BATCH 64
+
+/*
+ * Compute the filters of the commits not handed out yet, a batch at a
+ * time. Each filter goes to the slab entry of its commit, which was
+ * allocated before the threads were started, so the result does not
+ * depend on which thread computed what.
+ */
+static void *compute_bloom_filters_batch(void *data)
+{
+	struct bloom_compute_data *d = data;
+	struct write_commit_graph_context *ctx = d->ctx;
+	int done = 0;
+
+	for (;;) {
+		int i, first, end;
+
+		pthread_mutex_lock(&d->mutex);
+		d->progress_nr += done;
+		display_progress(d->progress, d->progress_nr);
+		first = d->next;
+		end = first + BLOOM_THREAD_BATCH;
+		if (end > d->nr)
+			end = d->nr;
+		d->next = end;
+		pthread_mutex_unlock(&d->mutex);
+
+		if (first >= end)
+			break;
+
+		for (i = first; i < end; i++) {
+			get_or_compute_bloom_filter(ctx->r, d->commits[i], 1,
+						    &ctx->bloom_settings,
+						    &d->computed[i]);
+			get_bloom_parent_filters(ctx->r, d->commits[i], 1,
+						 &ctx->bloom_settings);
+		}
+		done = end - first;
+	}
+	return NULL;
+}
+
+static int bloom_filter_threads(struct write_commit_graph_context *ctx)
+{
+	int nr_threads = 0;
+
+	if (!HAVE_THREADS)
+		return 1;
+
+	repo_config_get_int(ctx->r, "commitgraph.threads", &nr_threads);
+	if (nr_threads <= 0)
+		nr_threads = online_cpus();
+	if (nr_threads > ctx->commits.nr / BLOOM_THREAD_BATCH)
+		nr_threads = ctx->commits.nr / BLOOM_THREAD_BATCH;
+	return nr_threads < 1 ? 1 : nr_threads;
+}
+
 static void compute_bloom_filters(struct write_commit_graph_context *ctx)
 {
-	int i;
-	struct progress *progress = NULL;
+	int i, nr_threads;
+	struct bloom_compute_data data = { ctx };
 	struct commit **sorted_commits;
 
 	init_bloom_filters();
 
 	if (ctx->report_progress)
-		progress = start_delayed_progress(
+		data.progress = start_delayed_progress(
 			_("Computing commit changed paths Bloom filters"),
 			ctx->commits.nr);
 
@@ -1307,15 +1708,83 @@ static void compute_bloom_filters(struct write_commit_graph_context *ctx)
 	else
 		QSORT(sorted_commits, ctx->commits.nr, commit_gen_cmp);
 
+	/*
+	 * Load the filters that can be reused from the commit-graph, and
+	 * allocate the slab entries of the others, before any thread
+	 * looks at them.
+	 */
+	for (i = 0; i < ctx->commits.nr; i++) {
+		get_or_compute_bloom_filter(ctx->r, sorted_commits[i], 0,
+					    &ctx->bloom_settings, NULL);
+		get_bloom_parent_filters(ctx->r, sorted_commits[i], 0,
+					 &ctx->bloom_settings);
+	}
+
+	data.commits = sorted_commits;
+	data.nr = ctx->commits.nr;
+	CALLOC_ARRAY(data.computed, data.nr);
+	pthread_mutex_init(&data.mutex, NULL);
+
+	nr_threads = bloom_filter_threads(ctx);
+	trace2_data_intmax("commit-graph", ctx->r, "filter-threads", nr_threads);
+	if (nr_threads == 1) {
+		compute_bloom_filters_batch(&data);
+	} else {
+		pthread_t *threads;
+
+		ALLOC_ARRAY(threads, nr_threads);
+		enable_obj_read_lock();
+		for (i = 0; i < nr_threads; i++) {
+			int err = pthread_create(&threads[i], NULL,
+						 compute_bloom_filters_batch,
+						 &data);
+			if (err)
+				die(_("unable to create thread: %s"),
+				    strerror(err));
+		}
+		for (i = 0; i < nr_threads; i++)
+			if (pthread_join(threads[i], NULL))
+				die("unable to join thread");
+		disable_obj_read_lock();
+		free(threads);
+	}
+	pthread_mutex_destroy(&data.mutex);
+
 	for (i = 0; i < ctx->commits.nr; i++) {
 		struct commit *c = sorted_commits[i];
-		struct bloom_filter *filter = get_bloom_filter(ctx->r, c, 1);
+		struct bloom_filter *filter;
+		struct bloom_parent_filters *filters;
+		enum bloom_filter_computed computed = data.computed[i];
+
+		if (computed & BLOOM_COMPUTED)
+			ctx->count_bloom_filter_computed++;
+		else
+			ctx->count_bloom_filter_not_computed++;
+		if (computed & BLOOM_TRUNC_EMPTY)
+			ctx->count_bloom_filter_trunc_empty++;
+		if (computed & BLOOM_TRUNC_LARGE)
+			ctx->count_bloom_filter_trunc_large++;
+
+		filter = get_or_compute_bloom_filter(ctx->r, c, 0,
+						     &ctx->bloom_settings, NULL);
+		filters = get_bloom_parent_filters(ctx->r, c, 0,
+						   &ctx->bloom_settings);
 		ctx->total_bloom_filter_data_size += sizeof(unsigned char) * filter->len;
-		display_progress(progress, i + 1);
+		ctx->total_bloom_parent_filter_data_size += filters->nr * filters->len;
 	}
 
+	trace2_data_intmax("commit-graph", ctx->r, "filter-computed",
+			   ctx->count_bloom_filter_computed);
+	trace2_data_intmax("commit-graph", ctx->r, "filter-not-computed",
+			   ctx->count_bloom_filter_not_computed);
+	trace2_data_intmax("commit-graph", ctx->r, "filter-trunc-empty",
+			   ctx->count_bloom_filter_trunc_empty);
+	trace2_data_intmax("commit-graph", ctx->r, "filter-trunc-large",
+			   ctx->count_bloom_filter_trunc_large);
+
+	free(data.computed);
 	free(sorted_commits);
-	stop_progress(&progress);
+	stop_progress(&data.progress);
 }
 
 static int add_ref_to_set(const char *refname,
@@ -1553,7 +2022,6 @@ static int write_commit_graph_file(struct write_commit_graph_context *ctx)
 	struct strbuf progress_title = STRBUF_INIT;
 	int num_chunks = 3;
 	struct object_id file_hash;
-	const struct bloom_filter_settings bloom_settings = DEFAULT_BLOOM_FILTER_SETTINGS;
 
 	if (ctx->split) {
 		struct strbuf tmp_file = STRBUF_INIT;
@@ -1602,6 +2070,14 @@ static int write_commit_graph_file(struct write_commit_graph_context *ctx)
 	chunk_ids[0] = GRAPH_CHUNKID_OIDFANOUT;
 	chunk_ids[1] = GRAPH_CHUNKID_OIDLOOKUP;
 	chunk_ids[2] = GRAPH_CHUNKID_DATA;
+	if (ctx->write_generation_data) {
+		chunk_ids[num_chunks] = GRAPH_CHUNKID_GENERATION_DATA;
+		num_chunks++;
+	}
+	if (ctx->write_generation_data && ctx->num_generation_data_overflows) {
+		chunk_ids[num_chunks] = GRAPH_CHUNKID_GENERATION_DATA_OVERFLOW;
+		num_chunks++;
+	}
 	if (ctx->num_extra_edges) {
 		chunk_ids[num_chunks] = GRAPH_CHUNKID_EXTRAEDGES;
 		num_chunks++;
@@ -1609,6 +2085,8 @@ static int write_commit_graph_file(struct write_commit_graph_context *ctx)
 	if (ctx->changed_paths) {
 		chunk_ids[num_chunks] = GRAPH_CHUNKID_BLOOMINDEXES;
 		num_chunks++;
+		chunk_ids[num_chunks] = GRAPH_CHUNKID_BLOOMPARENTINDEXES;
+		num_chunks++;
 		chunk_ids[num_chunks] = GRAPH_CHUNKID_BLOOMDATA;
 		num_chunks++;
 	}
@@ -1625,6 +2103,16 @@ static int write_commit_graph_file(struct write_commit_graph_context *ctx)
 	chunk_offsets[3] = chunk_offsets[2] + (hashsz + 16) * ctx->commits.nr;
 
 	num_chunks = 3;
+	if (ctx->write_generation_data) {
+		chunk_offsets[num_chunks + 1] = chunk_offsets[num_chunks] +
+						sizeof(uint32_t) * ctx->commits.nr;
+		num_chunks++;
+	}
+	if (ctx->write_generation_data && ctx->num_generation_data_overflows) {
+		chunk_offsets[num_chunks + 1] = chunk_offsets[num_chunks] +
+						sizeof(uint64_t) * ctx->num_generation_data_overflows;
+		num_chunks++;
+	}
 	if (ctx->num_extra_edges) {
 		chunk_offsets[num_chunks + 1] = chunk_offsets[num_chunks] +
 						4 * ctx->num_extra_edges;
@@ -1636,7 +2124,12 @@ static int write_commit_graph_file(struct write_commit_graph_context *ctx)
 		num_chunks++;
 
 		chunk_offsets[num_chunks + 1] = chunk_offsets[num_chunks] +
-						sizeof(uint32_t) * 3 + ctx->total_bloom_filter_data_size;
+						sizeof(uint32_t) * ctx->commits.nr;
+		num_chunks++;
+
+		chunk_offsets[num_chunks + 1] = chunk_offsets[num_chunks] +
+						sizeof(uint32_t) * 3 + ctx->total_bloom_filter_data_size +
+						ctx->total_bloom_parent_filter_data_size;
 		num_chunks++;
 	}
 	if (ctx->num_commit_graphs_after > 1) {
@@ -1674,11 +2167,16 @@ static int write_commit_graph_file(struct write_commit_graph_context *ctx)
 	write_graph_chunk_fanout(f, ctx);
 	write_graph_chunk_oids(f, hashsz, ctx);
 	write_graph_chunk_data(f, hashsz, ctx);
+	if (ctx->write_generation_data)
+		write_graph_chunk_generation_data(f, ctx);
+	if (ctx->write_generation_data && ctx->num_generation_data_overflows)
+		write_graph_chunk_generation_data_overflow(f, ctx);
 	if (ctx->num_extra_edges)
 		write_graph_chunk_extra_edges(f, ctx);
 	if (ctx->changed_paths) {
 		write_graph_chunk_bloom_indexes(f, ctx);
-		write_graph_chunk_bloom_data(f, ctx, &bloom_settings);
+		write_graph_chunk_bloom_parent_indexes(f, ctx);
+		write_graph_chunk_bloom_data(f, ctx);
 	}
 	if (ctx->num_commit_graphs_after > 1 &&
 	    write_graph_chunk_base(f, ctx)) {
@@ -1996,6 +2494,26 @@ static void expire_commit_graphs(struct write_commit_graph_context *ctx)
 	strbuf_release(&path);
 }
 
+/*
+ * All layers of a chain must use the same Bloom filter settings, as
+ * readers query all of them with those of the top-most layer, so a
+ * new layer takes the settings of the layers it is written on top of.
+ * Filters of the layers it replaces are reused if they match.
+ */
+static void inherit_bloom_settings(struct write_commit_graph_context *ctx)
+{
+	struct commit_graph *g;
+
+	for (g = ctx->new_base_graph; g; g = g->base_graph) {
+		if (!g->bloom_filter_settings)
+			continue;
+		ctx->bloom_settings.hash_version = g->bloom_filter_settings->hash_version;
+		ctx->bloom_settings.num_hashes = g->bloom_filter_settings->num_hashes;
+		ctx->bloom_settings.bits_per_entry = g->bloom_filter_settings->bits_per_entry;
+		return;
+	}
+}
+
 int write_commit_graph(struct object_directory *odb,
 		       struct string_list *pack_indexes,
 		       struct oidset *commits,
@@ -2020,6 +2538,20 @@ int write_commit_graph(struct object_directory *odb,
 	ctx->split_opts = split_opts;
 	ctx->changed_paths = flags & COMMIT_GRAPH_WRITE_BLOOM_FILTERS ? 1 : 0;
 	ctx->total_bloom_filter_data_size = 0;
+	ctx->total_bloom_parent_filter_data_size = 0;
+	ctx->write_generation_data = (get_configured_generation_version(ctx->r) == 2) &&
+				     !git_env_bool(GIT_TEST_COMMIT_GRAPH_NO_GDAT, 0);
+	init_generation_slab(&ctx->generations);
+
+	if (ctx->changed_paths) {
+		struct bloom_filter_settings defaults = DEFAULT_BLOOM_FILTER_SETTINGS;
+
+		ctx->bloom_settings = defaults;
+		if (get_configured_bloom_settings(ctx->r, &ctx->bloom_settings)) {
+			res = -1;
+			goto cleanup;
+		}
+	}
 
 	if (ctx->split) {
 		struct commit_graph *g;
@@ -2119,10 +2651,27 @@ int write_commit_graph(struct object_directory *odb,
 	} else
 		ctx->num_commit_graphs_after = 1;
 
+	/*
+	 * Corrected commit dates are computed on top of those of the
+	 * layers we keep; without them in every such layer, stick to
+	 * topological levels.
+	 */
+	if (ctx->write_generation_data) {
+		struct commit_graph *g;
+		for (g = ctx->new_base_graph; g; g = g->base_graph) {
+			if (!g->chunk_generation_data) {
+				ctx->write_generation_data = 0;
+				break;
+			}
+		}
+	}
+
 	compute_generation_numbers(ctx);
 
-	if (ctx->changed_paths)
+	if (ctx->changed_paths) {
+		inherit_bloom_settings(ctx);
 		compute_bloom_filters(ctx);
+	}
 
 	res = write_commit_graph_file(ctx);
 
@@ -2133,6 +2682,7 @@ int write_commit_graph(struct object_directory *odb,
 
 cleanup:
 	free(ctx->graph_name);
+	clear_generation_slab(&ctx->generations);
 	free(ctx->commits.list);
 	free(ctx->oids.list);
 
@@ -2172,6 +2722,15 @@ static void graph_report(const char *fmt, ...)
 #define GENERATION_ZERO_EXISTS 1
 #define GENERATION_NUMBER_EXISTS 2
 
+static uint32_t graph_topo_level_at(struct commit_graph *g, uint32_t pos)
+{
+	while (pos < g->num_commits_in_base)
+		g = g->base_graph;
+
+	return graph_topo_level(g, g->chunk_commit_data +
+			GRAPH_DATA_WIDTH * (pos - g->num_commits_in_base));
+}
+
 int verify_commit_graph(struct repository *r, struct commit_graph *g, int flags)
 {
 	uint32_t i, cur_fanout_pos = 0;
@@ -2247,7 +2806,8 @@ int verify_commit_graph(struct repository *r, struct commit_graph *g, int flags)
 	for (i = 0; i < g->num_commits; i++) {
 		struct commit *graph_commit, *odb_commit;
 		struct commit_list *graph_parents, *odb_parents;
-		uint32_t max_generation = 0;
+		timestamp_t max_generation = 0;
+		uint32_t level, max_level = 0;
 
 		display_progress(progress, i + 1);
 		hashcpy(cur_oid.hash, g->chunk_oid_lookup + g->hash_len * i);
@@ -2289,6 +2849,15 @@ int verify_commit_graph(struct repository *r, struct commit_graph *g, int flags)
 			if (graph_parents->item->generation > max_generation)
 				max_generation = graph_parents->item->generation;
 
+			if (!g->read_generation_data)
+				level = graph_parents->item->generation;
+			else if (graph_parents->item->graph_pos != COMMIT_NOT_FROM_GRAPH)
+				level = graph_topo_level_at(g, graph_parents->item->graph_pos);
+			else
+				level = 0;
+			if (level > max_level)
+				max_level = level;
+
 			graph_parents = graph_parents->next;
 			odb_parents = odb_parents->next;
 		}
@@ -2297,7 +2866,9 @@ int verify_commit_graph(struct repository *r, struct commit_graph *g, int flags)
 			graph_report(_("commit-graph parent list for commit %s terminates early"),
 				     oid_to_hex(&cur_oid));
 
-		if (!graph_commit->generation) {
+		level = graph_topo_level_at(g, graph_commit->graph_pos);
+
+		if (!level) {
 			if (generation_zero == GENERATION_NUMBER_EXISTS)
 				graph_report(_("commit-graph has generation number zero for commit %s, but non-zero elsewhere"),
 					     oid_to_hex(&cur_oid));
@@ -2310,18 +2881,30 @@ int verify_commit_graph(struct repository *r, struct commit_graph *g, int flags)
 			continue;
 
 		/*
-		 * If one of our parents has generation GENERATION_NUMBER_MAX, then
-		 * our generation is also GENERATION_NUMBER_MAX. Decrement to avoid
-		 * extra logic in the following condition.
+		 * If one of our parents has topological level
+		 * GENERATION_NUMBER_V1_MAX, then our level is also
+		 * GENERATION_NUMBER_V1_MAX. Decrement to avoid extra logic
+		 * in the following condition.
 		 */
-		if (max_generation == GENERATION_NUMBER_MAX)
-			max_generation--;
+		if (max_level == GENERATION_NUMBER_V1_MAX)
+			max_level--;
 
-		if (graph_commit->generation != max_generation + 1)
+		if (level != max_level + 1)
 			graph_report(_("commit-graph generation for commit %s is %u != %u"),
 				     oid_to_hex(&cur_oid),
-				     graph_commit->generation,
-				     max_generation + 1);
+				     level, max_level + 1);
+
+		if (g->read_generation_data) {
+			timestamp_t expected = graph_commit->date;
+
+			if (max_generation + 1 > expected)
+				expected = max_generation + 1;
+			if (graph_commit->generation != expected)
+				graph_report(_("commit-graph corrected commit date for commit %s is %"PRItime" != %"PRItime),
+					     oid_to_hex(&cur_oid),
+					     graph_commit->generation,
+					     expected);
+		}
 
 		if (graph_commit->date != odb_commit->date)
 			graph_report(_("commit date for commit %s in commit-graph is %"PRItime" != %"PRItime),
@@ -11,6 +11,7 @@
 #define GIT_TEST_COMMIT_GRAPH "GIT_TEST_COMMIT_GRAPH"
 #define GIT_TEST_COMMIT_GRAPH_DIE_ON_LOAD "GIT_TEST_COMMIT_GRAPH_DIE_ON_LOAD"
 #define GIT_TEST_COMMIT_GRAPH_CHANGED_PATHS "GIT_TEST_COMMIT_GRAPH_CHANGED_PATHS"
+#define GIT_TEST_COMMIT_GRAPH_NO_GDAT "GIT_TEST_COMMIT_GRAPH_NO_GDAT"
 
 /*
  * This method is only used to enhance coverage of the commit-graph
@@ -50,6 +51,17 @@ void load_commit_graph_info(struct repository *r, struct commit *item);
 struct tree *get_commit_tree_in_graph(struct repository *r,
 				      const struct commit *c);
 
+struct oid_array;
+
+/*
+ * Append the parents of 'c', which must have been loaded from the
+ * commit-graph 'g' or one of its bases, to 'parents' in the order they
+ * are recorded there, regardless of what c->parents says now. Returns
+ * -1 if 'c' is not in the commit-graph.
+ */
+int commit_graph_parents(struct commit_graph *g, const struct commit *c,
+			 struct oid_array *parents);
+
 struct commit_graph {
 	const unsigned char *data;
 	size_t data_len;
@@ -67,12 +79,23 @@ struct commit_graph {
 	const uint32_t *chunk_oid_fanout;
 	const unsigned char *chunk_oid_lookup;
 	const unsigned char *chunk_commit_data;
+	const unsigned char *chunk_generation_data;
+	const unsigned char *chunk_generation_data_overflow;
 	const unsigned char *chunk_extra_edges;
 	const unsigned char *chunk_base_graphs;
 	const unsigned char *chunk_bloom_indexes;
 	const unsigned char *chunk_bloom_data;
+	const unsigned char *chunk_bloom_parent_indexes;
 
 	struct bloom_filter_settings *bloom_filter_settings;
+
+	/*
+	 * Whether commit->generation is filled from the generation data
+	 * chunk (corrected commit dates) rather than the topological
+	 * levels in the commit data chunk. Only set when every layer of
+	 * the chain carries generation data.
+	 */
+	int read_generation_data;
 };
 
 struct commit_graph *load_commit_graph_one_fd_st(int fd, struct stat *st,
@@ -87,6 +110,13 @@ struct commit_graph *parse_commit_graph(void *graph_map, size_t graph_size);
  */
 int generation_numbers_enabled(struct repository *r);
 
+/*
+ * Return 1 if and only if the repository has a commit-graph file
+ * whose generation numbers are corrected commit dates (see
+ * Documentation/technical/commit-graph.txt).
+ */
+int corrected_commit_dates_enabled(struct repository *r);
+
 enum commit_graph_write_flags {
 	COMMIT_GRAPH_WRITE_APPEND     = (1 << 0),
 	COMMIT_GRAPH_WRITE_PROGRESS   = (1 << 1),
@@ -11,8 +11,9 @@
 #include "commit-slab.h"
 
 #define COMMIT_NOT_FROM_GRAPH 0xFFFFFFFF
-#define GENERATION_NUMBER_INFINITY 0xFFFFFFFF
-#define GENERATION_NUMBER_MAX 0x3FFFFFFF
+#define GENERATION_NUMBER_INFINITY ((1ULL << 63) - 1)
+#define GENERATION_NUMBER_V1_MAX 0x3FFFFFFF
+#define GENERATION_NUMBER_V2_OFFSET_MAX ((1ULL << 31) - 1)
 #define GENERATION_NUMBER_ZERO 0
 
 struct commit_list {
@@ -36,8 +37,15 @@ struct commit {
 	 * or get_commit_tree_oid().
 	 */
 	struct tree *maybe_tree;
+
+	/*
+	 * Either the topological level or the corrected commit date of
+	 * the commit, depending on what the commit-graph provides (see
+	 * corrected_commit_dates_enabled()); GENERATION_NUMBER_INFINITY
+	 * for commits not in the commit-graph.
+	 */
+	timestamp_t generation;
 	uint32_t graph_pos;
-	uint32_t generation;
 	unsigned int index;
 };
 
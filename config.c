@@ -19,6 +19,7 @@
 #include "utf8.h"
 #include "dir.h"
 #include "color.h"
+#include "fsmonitor-ipc.h"
 #include "refs.h"
 
 struct config_source {
@@ -2334,6 +2335,17 @@ int git_config_get_max_percent_split_change(void)
 
 int git_config_get_fsmonitor(void)
 {
+	if (!git_config_get_bool("core.usebuiltinfsmonitor",
+				 &core_use_builtin_fsmonitor) &&
+	    core_use_builtin_fsmonitor) {
+		if (fsmonitor_ipc_is_supported()) {
+			core_fsmonitor = "git fsmonitor--daemon";
+			return 1;
+		}
+		warning(_("core.useBuiltinFSMonitor is not supported on this platform"));
+		core_use_builtin_fsmonitor = 0;
+	}
+
 	if (git_config_get_pathname("core.fsmonitor", &core_fsmonitor))
 		core_fsmonitor = getenv("GIT_TEST_FSMONITOR");
 
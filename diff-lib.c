@@ -377,6 +377,33 @@ static int show_modified(struct rev_info *revs,
 	return 0;
 }
 
+/*
+ * A sparse directory entry of the index stands for a whole tree: diff
+ * it against the tree at the same path (either may be missing) as the
+ * files it would have been expanded to.
+ */
+static void diff_sparse_directory(struct rev_info *revs,
+				  const struct cache_entry *idx,
+				  const struct cache_entry *tree)
+{
+	struct diff_options *opt = &revs->diffopt;
+	const struct object_id *old_oid = tree ? &tree->oid : NULL;
+	const struct object_id *new_oid = idx ? &idx->oid : NULL;
+	const char *base = idx ? idx->name : tree->name;
+	struct pathspec saved_pathspec = opt->pathspec;
+	int saved_recursive = opt->flags.recursive;
+
+	if (old_oid && new_oid && oideq(old_oid, new_oid) &&
+	    !opt->flags.find_copies_harder)
+		return;
+
+	opt->pathspec = revs->prune_data;
+	opt->flags.recursive = 1;
+	diff_tree_oid(old_oid, new_oid, base, opt);
+	opt->pathspec = saved_pathspec;
+	opt->flags.recursive = saved_recursive;
+}
+
 /*
  * This gets a mix of an existing index and a tree, one pathname entry
  * at a time. The index entry may be a single stage-0 one, but it could
@@ -475,6 +502,20 @@ static int oneway_diff(const struct cache_entry * const *src,
 	if (tree == o->df_conflict_entry)
 		tree = NULL;
 
+	/*
+	 * A sparse directory is diffed as the tree it stands for; the
+	 * pathspec is matched against the paths inside of it.
+	 */
+	if ((idx && S_ISSPARSEDIR(idx->ce_mode)) ||
+	    (tree && S_ISSPARSEDIR(tree->ce_mode))) {
+		diff_sparse_directory(revs, idx, tree);
+		if (diff_can_quit_early(&revs->diffopt)) {
+			o->exiting_early = 1;
+			return -1;
+		}
+		return 0;
+	}
+
 	if (ce_path_match(revs->diffopt.repo->index,
 			  idx ? idx : tree,
 			  &revs->prune_data, NULL)) {
@@ -163,6 +163,12 @@ static struct spanhash_top *hash_chars(struct repository *r,
 	return hash;
 }
 
+void diffcore_prepare_count(struct repository *r, struct diff_filespec *one)
+{
+	if (!one->cnt_data)
+		one->cnt_data = hash_chars(r, one);
+}
+
 int diffcore_count_changes(struct repository *r,
 			   struct diff_filespec *src,
 			   struct diff_filespec *dst,
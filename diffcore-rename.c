@@ -3,12 +3,14 @@
  * Copyright (C) 2005 Junio C Hamano
  */
 #include "cache.h"
+#include "config.h"
 #include "diff.h"
 #include "diffcore.h"
 #include "object-store.h"
 #include "hashmap.h"
 #include "progress.h"
 #include "promisor-remote.h"
+#include "thread-utils.h"
 
 /* Table of rename/copy destinations */
 
@@ -165,6 +167,59 @@ static void prefetch(void *prefetch_options)
 	oid_array_clear(&to_fetch);
 }
 
+/*
+ * We would not consider edits that change the file size so
+ * drastically.  delta_size must be smaller than
+ * (MAX_SCORE-minimum_score)/MAX_SCORE * min(src->size, dst->size).
+ *
+ * Note that base_size == 0 case is handled here already
+ * and the final score computation in counted_similarity() would
+ * not have a divide-by-zero issue.
+ */
+static int sizes_compatible(unsigned long src_size, unsigned long dst_size,
+			    int minimum_score)
+{
+	unsigned long max_size, delta_size, base_size;
+
+	max_size = ((src_size > dst_size) ? src_size : dst_size);
+	base_size = ((src_size < dst_size) ? src_size : dst_size);
+	delta_size = max_size - base_size;
+
+	return !(max_size * (MAX_SCORE-minimum_score) < delta_size * MAX_SCORE);
+}
+
+/*
+ * How similar are src and dst, i.e. what percentage of material in
+ * dst is from src, once their signatures are known (or their contents
+ * loaded).
+ */
+static int counted_similarity(struct repository *r,
+			      struct diff_filespec *src,
+			      struct diff_filespec *dst)
+{
+	unsigned long max_size, src_copied, literal_added;
+
+	if (diffcore_count_changes(r, src, dst,
+				   &src->cnt_data, &dst->cnt_data,
+				   &src_copied, &literal_added))
+		return 0;
+
+	max_size = ((src->size > dst->size) ? src->size : dst->size);
+	if (!dst->size)
+		return 0; /* should not happen */
+	return (int)(src_copied * MAX_SCORE / max_size);
+}
+
+static void init_similarity_populate_options(struct repository *r,
+					     struct diff_populate_filespec_options *dpf_options,
+					     struct prefetch_options *prefetch_options)
+{
+	if (r == the_repository && has_promisor_remote()) {
+		dpf_options->missing_object_cb = prefetch;
+		dpf_options->missing_object_data = prefetch_options;
+	}
+}
+
 static int estimate_similarity(struct repository *r,
 			       struct diff_filespec *src,
 			       struct diff_filespec *dst,
@@ -184,17 +239,12 @@ static int estimate_similarity(struct repository *r,
 	 * match than anything else; the destination does not even
 	 * call into this function in that case.
 	 */
-	unsigned long max_size, delta_size, base_size, src_copied, literal_added;
-	int score;
 	struct diff_populate_filespec_options dpf_options = {
 		.check_size_only = 1
 	};
 	struct prefetch_options prefetch_options = {r, skip_unmodified};
 
-	if (r == the_repository && has_promisor_remote()) {
-		dpf_options.missing_object_cb = prefetch;
-		dpf_options.missing_object_data = &prefetch_options;
-	}
+	init_similarity_populate_options(r, &dpf_options, &prefetch_options);
 
 	/* We deal only with regular files.  Symlink renames are handled
 	 * only when they are exact matches --- in other words, no edits
@@ -219,19 +269,7 @@ static int estimate_similarity(struct repository *r,
 	    diff_populate_filespec(r, dst, &dpf_options))
 		return 0;
 
-	max_size = ((src->size > dst->size) ? src->size : dst->size);
-	base_size = ((src->size < dst->size) ? src->size : dst->size);
-	delta_size = max_size - base_size;
-
-	/* We would not consider edits that change the file size so
-	 * drastically.  delta_size must be smaller than
-	 * (MAX_SCORE-minimum_score)/MAX_SCORE * min(src->size, dst->size).
-	 *
-	 * Note that base_size == 0 case is handled here already
-	 * and the final score computation below would not have a
-	 * divide-by-zero issue.
-	 */
-	if (max_size * (MAX_SCORE-minimum_score) < delta_size * MAX_SCORE)
+	if (!sizes_compatible(src->size, dst->size, minimum_score))
 		return 0;
 
 	dpf_options.check_size_only = 0;
@@ -241,19 +279,7 @@ static int estimate_similarity(struct repository *r,
 	if (!dst->cnt_data && diff_populate_filespec(r, dst, &dpf_options))
 		return 0;
 
-	if (diffcore_count_changes(r, src, dst,
-				   &src->cnt_data, &dst->cnt_data,
-				   &src_copied, &literal_added))
-		return 0;
-
-	/* How similar are they?
-	 * what percentage of material in dst are from source?
-	 */
-	if (!dst->size)
-		score = 0; /* should not happen */
-	else
-		score = (int)(src_copied * MAX_SCORE / max_size);
-	return score;
+	return counted_similarity(r, src, dst);
 }
 
 static void record_rename_pair(int dst_index, int src_index, int score)
@@ -412,6 +438,326 @@ static int find_exact_renames(struct diff_options *options)
 	return renames;
 }
 
+static const char *get_basename(const char *path)
+{
+	const char *slash = strrchr(path, '/');
+	return slash ? slash + 1 : path;
+}
+
+/* The leading directory of path, without the trailing slash. */
+static char *get_dirname(const char *path)
+{
+	const char *slash = strrchr(path, '/');
+	return xstrndup(path, slash ? slash - path : 0);
+}
+
+/*
+ * Similarity a pair found without looking at all the other candidates
+ * (because of their names, or the renames of their directories) must
+ * have to be taken as a rename: halfway between the minimum score and
+ * an exact match, so that such a guess does not preempt a pair the full
+ * matrix would have preferred only because it barely meets the minimum.
+ */
+static int guessed_rename_score(int minimum_score)
+{
+	return minimum_score + (MAX_SCORE - minimum_score) / 2;
+}
+
+struct basename_entry {
+	const char *basename;
+	int index;
+};
+
+static int basename_entry_cmp(const void *a_, const void *b_)
+{
+	const struct basename_entry *a = a_, *b = b_;
+	int cmp = strcmp(a->basename, b->basename);
+
+	return cmp ? cmp : a->index - b->index;
+}
+
+/* Number of entries starting at `i` that have the same basename. */
+static int basename_run(struct basename_entry *e, int nr, int i)
+{
+	int end = i + 1;
+
+	while (end < nr && !strcmp(e[end].basename, e[i].basename))
+		end++;
+	return end - i;
+}
+
+/*
+ * Pair up the sources and destinations whose basename is unique among
+ * both the remaining sources and the remaining destinations, if they
+ * are similar enough. Files are often moved without being renamed, so
+ * this finds most renames with one comparison per destination.
+ */
+static int find_basename_matches(struct diff_options *options,
+				 int minimum_score)
+{
+	struct basename_entry *src, *dst;
+	int src_nr = 0, dst_nr = 0, i, j, renames = 0;
+	int score_needed = guessed_rename_score(minimum_score);
+
+	ALLOC_ARRAY(src, rename_src_nr);
+	for (i = 0; i < rename_src_nr; i++) {
+		struct diff_filespec *one = rename_src[i].p->one;
+
+		if (one->rename_used)
+			continue;
+		src[src_nr].basename = get_basename(one->path);
+		src[src_nr++].index = i;
+	}
+	ALLOC_ARRAY(dst, rename_dst_nr);
+	for (i = 0; i < rename_dst_nr; i++) {
+		if (rename_dst[i].pair)
+			continue;
+		dst[dst_nr].basename = get_basename(rename_dst[i].two->path);
+		dst[dst_nr++].index = i;
+	}
+	QSORT(src, src_nr, basename_entry_cmp);
+	QSORT(dst, dst_nr, basename_entry_cmp);
+
+	i = j = 0;
+	while (i < src_nr && j < dst_nr) {
+		int cmp = strcmp(src[i].basename, dst[j].basename);
+		int src_run, dst_run;
+
+		if (cmp < 0) {
+			i++;
+			continue;
+		}
+		if (cmp > 0) {
+			j++;
+			continue;
+		}
+		src_run = basename_run(src, src_nr, i);
+		dst_run = basename_run(dst, dst_nr, j);
+		if (src_run == 1 && dst_run == 1) {
+			struct diff_filespec *one = rename_src[src[i].index].p->one;
+			struct diff_filespec *two = rename_dst[dst[j].index].two;
+			int score = estimate_similarity(options->repo, one, two,
+							score_needed, 0);
+
+			if (score >= score_needed) {
+				record_rename_pair(dst[j].index, src[i].index,
+						   score);
+				renames++;
+			}
+			diff_free_filespec_blob(one);
+			diff_free_filespec_blob(two);
+		}
+		i += src_run;
+		j += dst_run;
+	}
+
+	free(src);
+	free(dst);
+	return renames;
+}
+
+struct dir_rename {
+	char *src, *dst;
+	int count;
+};
+
+static int dir_rename_cmp(const void *a_, const void *b_)
+{
+	const struct dir_rename *a = a_, *b = b_;
+	int cmp = strcmp(a->src, b->src);
+
+	return cmp ? cmp : strcmp(a->dst, b->dst);
+}
+
+/*
+ * Infer the directory renames from the renames found so far: a
+ * directory is taken to be renamed to the directory most of the files
+ * renamed out of it went to. Returns a list of the destination
+ * directories, each with a string_list of the directories renamed to
+ * it as its util.
+ */
+static void infer_dir_renames(struct string_list *targets)
+{
+	struct dir_rename *renames;
+	int nr = 0, i, j;
+
+	ALLOC_ARRAY(renames, rename_dst_nr);
+	for (i = 0; i < rename_dst_nr; i++) {
+		struct diff_filepair *p = rename_dst[i].pair;
+		char *src, *dst;
+
+		if (!p)
+			continue;
+		src = get_dirname(p->one->path);
+		dst = get_dirname(p->two->path);
+		if (!strcmp(src, dst)) {
+			free(src);
+			free(dst);
+			continue;
+		}
+		renames[nr].src = src;
+		renames[nr].dst = dst;
+		renames[nr++].count = 1;
+	}
+	QSORT(renames, nr, dir_rename_cmp);
+
+	for (i = 0; i < nr; i = j) {
+		int best = -1, best_count = 0, tie = 0;
+
+		for (j = i; j < nr && !strcmp(renames[j].src, renames[i].src); ) {
+			int k = j + 1;
+
+			while (k < nr && !dir_rename_cmp(&renames[k], &renames[j]))
+				k++;
+			if (k - j > best_count) {
+				best = j;
+				best_count = k - j;
+				tie = 0;
+			} else if (k - j == best_count) {
+				tie = 1;
+			}
+			j = k;
+		}
+		if (best >= 0 && !tie) {
+			struct string_list_item *item;
+
+			item = string_list_insert(targets, renames[best].dst);
+			if (!item->util) {
+				item->util = xcalloc(1, sizeof(struct string_list));
+				string_list_init(item->util, 1);
+			}
+			string_list_append(item->util, renames[best].src);
+		}
+	}
+
+	for (i = 0; i < nr; i++) {
+		free(renames[i].src);
+		free(renames[i].dst);
+	}
+	free(renames);
+}
+
+struct src_dir {
+	int nr, alloc;
+	int *index;
+};
+
+/*
+ * Match the remaining destinations in a directory another directory was
+ * renamed to against the remaining sources in that other directory
+ * only, so that when a whole subtree moved, the files that were also
+ * renamed or that share their basename with others do not need to be
+ * compared against every source.
+ */
+static int find_dir_rename_matches(struct diff_options *options,
+				   int minimum_score)
+{
+	struct string_list targets = STRING_LIST_INIT_DUP;
+	struct string_list src_dirs = STRING_LIST_INIT_DUP;
+	int score_needed = guessed_rename_score(minimum_score);
+	int i, j, k, renames = 0;
+
+	infer_dir_renames(&targets);
+	if (!targets.nr)
+		return 0;
+
+	for (i = 0; i < rename_src_nr; i++) {
+		struct diff_filespec *one = rename_src[i].p->one;
+		struct string_list_item *item;
+		struct src_dir *dir;
+		char *dirname;
+
+		if (one->rename_used)
+			continue;
+		dirname = get_dirname(one->path);
+		item = string_list_insert(&src_dirs, dirname);
+		free(dirname);
+		if (!item->util)
+			item->util = xcalloc(1, sizeof(struct src_dir));
+		dir = item->util;
+		ALLOC_GROW(dir->index, dir->nr + 1, dir->alloc);
+		dir->index[dir->nr++] = i;
+	}
+
+	for (i = 0; i < rename_dst_nr; i++) {
+		struct diff_filespec *two = rename_dst[i].two;
+		struct string_list_item *target;
+		struct string_list *sources;
+		int best = -1, best_score = 0, best_name_score = 0;
+		char *dirname;
+
+		if (rename_dst[i].pair)
+			continue;
+		dirname = get_dirname(two->path);
+		target = string_list_lookup(&targets, dirname);
+		free(dirname);
+		if (!target)
+			continue;
+
+		sources = target->util;
+		for (j = 0; j < sources->nr; j++) {
+			struct string_list_item *item;
+			struct src_dir *dir;
+
+			item = string_list_lookup(&src_dirs,
+						  sources->items[j].string);
+			if (!item)
+				continue;
+			dir = item->util;
+			for (k = 0; k < dir->nr; k++) {
+				struct diff_filespec *one;
+				int score, name_score;
+
+				one = rename_src[dir->index[k]].p->one;
+				if (one->rename_used)
+					continue;
+				score = estimate_similarity(options->repo,
+							    one, two,
+							    score_needed, 0);
+				name_score = basename_same(one, two);
+				if (score > best_score ||
+				    (score == best_score &&
+				     name_score > best_name_score)) {
+					best = dir->index[k];
+					best_score = score;
+					best_name_score = name_score;
+				}
+				diff_free_filespec_blob(one);
+			}
+		}
+		diff_free_filespec_blob(two);
+		if (best >= 0 && best_score >= score_needed) {
+			record_rename_pair(i, best, best_score);
+			renames++;
+		}
+	}
+
+	for (i = 0; i < targets.nr; i++)
+		string_list_clear(targets.items[i].util, 0);
+	string_list_clear(&targets, 1);
+	for (i = 0; i < src_dirs.nr; i++)
+		free(((struct src_dir *)src_dirs.items[i].util)->index);
+	string_list_clear(&src_dirs, 1);
+	return renames;
+}
+
+/*
+ * Drop the sources that were renamed already from the candidates for
+ * the full similarity matrix: without copy detection, they cannot be
+ * used again.
+ */
+static void cull_used_rename_srcs(void)
+{
+	int i, nr = 0;
+
+	for (i = 0; i < rename_src_nr; i++) {
+		if (rename_src[i].p->one->rename_used)
+			continue;
+		rename_src[nr++] = rename_src[i];
+	}
+	rename_src_nr = nr;
+}
+
 #define NUM_CANDIDATE_PER_DST 4
 static void record_if_better(struct diff_score m[], struct diff_score *o)
 {
@@ -497,6 +843,304 @@ static int find_renames(struct diff_score *mx, int dst_cnt, int minimum_score, i
 	return count;
 }
 
+/*
+ * A source or a destination in the similarity matrix, with its index
+ * in rename_src or rename_dst.
+ */
+struct similarity_candidate {
+	struct diff_filespec *spec;
+	int index;
+	/*
+	 * Whether it is a regular file whose signature could be computed,
+	 * and for a source whether some destination is close enough in
+	 * size to need it.
+	 */
+	int ok;
+};
+
+static int candidate_size_cmp(const void *a_, const void *b_)
+{
+	const struct similarity_candidate *a = *(const struct similarity_candidate **)a_;
+	const struct similarity_candidate *b = *(const struct similarity_candidate **)b_;
+
+	if (a->spec->size != b->spec->size)
+		return a->spec->size < b->spec->size ? -1 : 1;
+	return a->index - b->index;
+}
+
+/* Fill in the size of a candidate; returns 0 if it is not one. */
+static int populate_candidate_size(struct repository *r,
+				   struct diff_filespec *spec,
+				   struct diff_populate_filespec_options *dpf_options)
+{
+	if (!S_ISREG(spec->mode))
+		return 0;
+	return spec->cnt_data || !diff_populate_filespec(r, spec, dpf_options);
+}
+
+/* Compute the signature of a candidate; returns 0 on failure. */
+static int prepare_candidate(struct repository *r,
+			     struct diff_filespec *spec,
+			     struct diff_populate_filespec_options *dpf_options)
+{
+	if (!spec->cnt_data) {
+		if (diff_populate_filespec(r, spec, dpf_options))
+			return 0;
+		diffcore_prepare_count(r, spec);
+		/*
+		 * Once we have the signature, we do not need the text
+		 * anymore.
+		 */
+		diff_free_filespec_blob(spec);
+	}
+	return 1;
+}
+
+/*
+ * Find the sources whose size is compatible with a destination of
+ * size dst_size: as the sources are sorted by size, and a source is
+ * compatible as long as it is neither too small nor too large, this
+ * is a contiguous range.
+ */
+static void find_candidate_range(struct similarity_candidate **src, int src_nr,
+				 unsigned long dst_size, int minimum_score,
+				 int *begin, int *end)
+{
+	int lo = 0, hi = src_nr;
+
+	/* first source that is not too small */
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		unsigned long size = src[mid]->spec->size;
+
+		if (size >= dst_size ||
+		    sizes_compatible(size, dst_size, minimum_score))
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	*begin = lo;
+
+	/* first source after that which is too large */
+	hi = src_nr;
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		unsigned long size = src[mid]->spec->size;
+
+		if (size > dst_size &&
+		    !sizes_compatible(size, dst_size, minimum_score))
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	*end = lo;
+}
+
+struct similarity_matrix {
+	struct repository *repo;
+	struct diff_score *mx;
+	struct similarity_candidate *src, *dst;
+	int src_nr, dst_nr;
+	int minimum_score;
+
+	struct progress *progress;
+	uint64_t progress_nr;
+	pthread_mutex_t mutex;
+};
+
+static void score_matrix_row(struct similarity_matrix *mat, int row)
+{
+	struct similarity_candidate *dst = &mat->dst[row];
+	struct diff_score *m = &mat->mx[row * NUM_CANDIDATE_PER_DST];
+	int j;
+
+	for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
+		m[j].dst = -1;
+
+	if (!dst->ok)
+		return;
+
+	/*
+	 * Record every source in the order of rename_src, even those
+	 * that cannot match: which slot of the row each pair lands in
+	 * decides which of equally good pairs wins a tie.
+	 */
+	for (j = 0; j < mat->src_nr; j++) {
+		struct similarity_candidate *src = &mat->src[j];
+		struct diff_score this_src;
+
+		if (src->ok &&
+		    sizes_compatible(src->spec->size, dst->spec->size,
+				     mat->minimum_score))
+			this_src.score = counted_similarity(mat->repo,
+							    src->spec, dst->spec);
+		else
+			this_src.score = 0;
+		this_src.name_score = basename_same(src->spec, dst->spec);
+		this_src.dst = dst->index;
+		this_src.src = src->index;
+		record_if_better(m, &this_src);
+	}
+}
+
+struct similarity_thread {
+	pthread_t pthread;
+	struct similarity_matrix *mat;
+	int first, step;
+};
+
+static void *score_matrix_rows(void *data)
+{
+	struct similarity_thread *p = data;
+	struct similarity_matrix *mat = p->mat;
+	int row;
+
+	for (row = p->first; row < mat->dst_nr; row += p->step) {
+		score_matrix_row(mat, row);
+		if (mat->progress) {
+			pthread_mutex_lock(&mat->mutex);
+			mat->progress_nr += rename_src_nr;
+			display_progress(mat->progress, mat->progress_nr);
+			pthread_mutex_unlock(&mat->mutex);
+		}
+	}
+	return NULL;
+}
+
+/* Number of pairs to compare that make another thread worthwhile. */
+#define RENAME_THREAD_COST 4096
+
+/*
+ * Fill in the NUM_CANDIDATE_PER_DST best sources for each destination
+ * that is not matched yet, one row of mx per destination, and return
+ * the number of rows.
+ *
+ * The sources and destinations are first read serially, to compute the
+ * signature of each file once, and only for the files whose size is
+ * close enough to the size of some file on the other side. The pairs
+ * are then compared in parallel: each thread fills its own rows, and
+ * each row is filled exactly as the serial loop would.
+ */
+static int fill_similarity_matrix(struct diff_options *options,
+				  struct diff_score *mx,
+				  int minimum_score, int skip_unmodified,
+				  struct progress *progress)
+{
+	struct repository *r = options->repo;
+	struct similarity_matrix mat;
+	struct similarity_thread *threads;
+	struct diff_populate_filespec_options dpf_options = {
+		.check_size_only = 1
+	};
+	struct prefetch_options prefetch_options = {r, skip_unmodified};
+	struct similarity_candidate **by_size;
+	int *needed;
+	int i, nr_threads, nr_sized = 0;
+	uint64_t nr_pairs = 0;
+
+	init_similarity_populate_options(r, &dpf_options, &prefetch_options);
+	memset(&mat, 0, sizeof(mat));
+	mat.repo = r;
+	mat.mx = mx;
+	mat.minimum_score = minimum_score;
+	mat.progress = progress;
+
+	CALLOC_ARRAY(mat.src, rename_src_nr);
+	for (i = 0; i < rename_src_nr; i++) {
+		struct diff_filepair *p = rename_src[i].p;
+
+		if (skip_unmodified && diff_unmodified_pair(p))
+			continue;
+		mat.src[mat.src_nr].spec = p->one;
+		mat.src[mat.src_nr].index = i;
+		mat.src_nr++;
+	}
+	ALLOC_ARRAY(by_size, mat.src_nr);
+	for (i = 0; i < mat.src_nr; i++)
+		if (populate_candidate_size(r, mat.src[i].spec, &dpf_options))
+			by_size[nr_sized++] = &mat.src[i];
+	QSORT(by_size, nr_sized, candidate_size_cmp);
+
+	CALLOC_ARRAY(needed, nr_sized + 1);
+	ALLOC_ARRAY(mat.dst, rename_dst_nr);
+	for (i = 0; i < rename_dst_nr; i++) {
+		struct similarity_candidate *dst = &mat.dst[mat.dst_nr];
+		int begin, end;
+
+		if (rename_dst[i].pair)
+			continue; /* dealt with exact match already. */
+		mat.dst_nr++;
+		dst->spec = rename_dst[i].two;
+		dst->index = i;
+		dst->ok = 0;
+		if (!populate_candidate_size(r, dst->spec, &dpf_options))
+			continue;
+		find_candidate_range(by_size, nr_sized, dst->spec->size,
+				     minimum_score, &begin, &end);
+		if (begin == end)
+			continue;
+		dpf_options.check_size_only = 0;
+		dst->ok = prepare_candidate(r, dst->spec, &dpf_options);
+		if (dst->ok) {
+			needed[begin]++;
+			needed[end]--;
+			nr_pairs += end - begin;
+		}
+		dpf_options.check_size_only = 1;
+	}
+
+	dpf_options.check_size_only = 0;
+	for (i = 0; i < nr_sized; i++) {
+		if (i)
+			needed[i] += needed[i - 1];
+		if (needed[i])
+			by_size[i]->ok = prepare_candidate(r, by_size[i]->spec,
+							   &dpf_options);
+	}
+	free(needed);
+	free(by_size);
+
+	nr_threads = HAVE_THREADS ? online_cpus() : 1;
+	if (nr_threads > nr_pairs / RENAME_THREAD_COST)
+		nr_threads = nr_pairs / RENAME_THREAD_COST;
+	if (nr_threads < 2 && HAVE_THREADS && mat.dst_nr > 1 &&
+	    git_env_bool("GIT_TEST_RENAME_THREADS", 0))
+		nr_threads = 2;
+	if (nr_threads < 1)
+		nr_threads = 1;
+	if (nr_threads > mat.dst_nr)
+		nr_threads = mat.dst_nr;
+
+	pthread_mutex_init(&mat.mutex, NULL);
+	CALLOC_ARRAY(threads, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		threads[i].mat = &mat;
+		threads[i].first = i;
+		threads[i].step = nr_threads;
+	}
+	if (nr_threads < 2) {
+		if (nr_threads)
+			score_matrix_rows(&threads[0]);
+	} else {
+		for (i = 0; i < nr_threads; i++) {
+			int err = pthread_create(&threads[i].pthread, NULL,
+						 score_matrix_rows, &threads[i]);
+			if (err)
+				die(_("unable to create thread: %s"),
+				    strerror(err));
+		}
+		for (i = 0; i < nr_threads; i++)
+			if (pthread_join(threads[i].pthread, NULL))
+				die("unable to join thread");
+	}
+	pthread_mutex_destroy(&mat.mutex);
+
+	free(threads);
+	free(mat.src);
+	free(mat.dst);
+	return mat.dst_nr;
+}
+
 void diffcore_rename(struct diff_options *options)
 {
 	int detect_rename = options->detect_rename;
@@ -504,7 +1148,7 @@ void diffcore_rename(struct diff_options *options)
 	struct diff_queue_struct *q = &diff_queued_diff;
 	struct diff_queue_struct outq;
 	struct diff_score *mx;
-	int i, j, rename_count, skip_unmodified = 0;
+	int i, rename_count, skip_unmodified = 0;
 	int num_create, dst_cnt;
 	struct progress *progress = NULL;
 
@@ -576,6 +1220,22 @@ void diffcore_rename(struct diff_options *options)
 	if (!num_create)
 		goto cleanup;
 
+	/*
+	 * Without copy detection, try to pair up the remaining files by
+	 * their names and the directories that were renamed before
+	 * resorting to comparing every destination with every source.
+	 */
+	if (detect_rename != DIFF_DETECT_COPY) {
+		rename_count += find_basename_matches(options, minimum_score);
+		rename_count += find_dir_rename_matches(options, minimum_score);
+		num_create = rename_dst_nr - rename_count;
+		if (!num_create)
+			goto cleanup;
+		cull_used_rename_srcs();
+		if (!rename_src_nr)
+			goto cleanup;
+	}
+
 	switch (too_many_rename_candidates(num_create, options)) {
 	case 1:
 		goto cleanup;
@@ -590,47 +1250,12 @@ void diffcore_rename(struct diff_options *options)
 	if (options->show_rename_progress) {
 		progress = start_delayed_progress(
 				_("Performing inexact rename detection"),
-				(uint64_t)rename_dst_nr * (uint64_t)rename_src_nr);
+				(uint64_t)num_create * (uint64_t)rename_src_nr);
 	}
 
 	mx = xcalloc(st_mult(NUM_CANDIDATE_PER_DST, num_create), sizeof(*mx));
-	for (dst_cnt = i = 0; i < rename_dst_nr; i++) {
-		struct diff_filespec *two = rename_dst[i].two;
-		struct diff_score *m;
-
-		if (rename_dst[i].pair)
-			continue; /* dealt with exact match already. */
-
-		m = &mx[dst_cnt * NUM_CANDIDATE_PER_DST];
-		for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
-			m[j].dst = -1;
-
-		for (j = 0; j < rename_src_nr; j++) {
-			struct diff_filespec *one = rename_src[j].p->one;
-			struct diff_score this_src;
-
-			if (skip_unmodified &&
-			    diff_unmodified_pair(rename_src[j].p))
-				continue;
-
-			this_src.score = estimate_similarity(options->repo,
-							     one, two,
-							     minimum_score,
-							     skip_unmodified);
-			this_src.name_score = basename_same(one, two);
-			this_src.dst = i;
-			this_src.src = j;
-			record_if_better(m, &this_src);
-			/*
-			 * Once we run estimate_similarity,
-			 * We do not need the text anymore.
-			 */
-			diff_free_filespec_blob(one);
-			diff_free_filespec_blob(two);
-		}
-		dst_cnt++;
-		display_progress(progress, (uint64_t)(i+1)*(uint64_t)rename_src_nr);
-	}
+	dst_cnt = fill_similarity_matrix(options, mx, minimum_score,
+					 skip_unmodified, progress);
 	stop_progress(&progress);
 
 	/* cost matrix sorted by most to least similar pair */
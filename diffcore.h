@@ -198,6 +198,15 @@ int diffcore_count_changes(struct repository *r,
 			   unsigned long *src_copied,
 			   unsigned long *literal_added);
 
+/*
+ * Compute the signature of the contents of "one" that
+ * diffcore_count_changes() compares into one->cnt_data. Once it is
+ * there for both files, diffcore_count_changes() does not look at the
+ * contents or the repository any more, and can be called from several
+ * threads at once.
+ */
+void diffcore_prepare_count(struct repository *r, struct diff_filespec *one);
+
 /*
  * If filespec contains an OID and if that object is missing from the given
  * repository, add that OID to to_fetch.
@@ -18,6 +18,7 @@
 #include "ewah/ewok.h"
 #include "fsmonitor.h"
 #include "submodule-config.h"
+#include "sparse-index.h"
 
 /*
  * Tells read_directory_recursive how a file or directory should be treated.
@@ -1668,6 +1669,21 @@ static enum exist_status directory_exists_in_index(struct index_state *istate,
 {
 	int pos;
 
+	/*
+	 * Paths on disk inside of a sparse directory entry have to be
+	 * looked up among the entries it stands for.
+	 */
+	if (istate->sparse_index) {
+		struct strbuf sb = STRBUF_INIT;
+
+		strbuf_add(&sb, dirname, len);
+		strbuf_addch(&sb, '/');
+		pos = index_name_pos(istate, sb.buf, sb.len);
+		if (pos >= 0 && S_ISSPARSEDIR(istate->cache[pos]->ce_mode))
+			ensure_full_index(istate);
+		strbuf_release(&sb);
+	}
+
 	if (ignore_case)
 		return directory_exists_in_index_icase(istate, dirname, len);
 
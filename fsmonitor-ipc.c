@@ -0,0 +1,127 @@
+#include "cache.h"
+#include "fsmonitor.h"
+#include "fsmonitor-ipc.h"
+#include "run-command.h"
+#include "strbuf.h"
+#ifdef HAVE_FSMONITOR_DAEMON
+#include "unix-socket.h"
+#endif
+
+#ifdef HAVE_FSMONITOR_DAEMON
+
+int fsmonitor_ipc_is_supported(void)
+{
+	return 1;
+}
+
+const char *fsmonitor_ipc_get_path(void)
+{
+	static char *path;
+
+	if (!path)
+		path = git_pathdup("fsmonitor--daemon.ipc");
+	return path;
+}
+
+int fsmonitor_ipc_send_command(const char *command, struct strbuf *answer)
+{
+	struct strbuf request = STRBUF_INIT;
+	int fd;
+
+	fd = unix_stream_connect(fsmonitor_ipc_get_path());
+	if (fd < 0)
+		return -1;
+
+	strbuf_addf(&request, "%s\n", command);
+	if (write_in_full(fd, request.buf, request.len) < 0 ||
+	    strbuf_read(answer, fd, 0) < 0) {
+		int saved_errno = errno;
+
+		close(fd);
+		strbuf_release(&request);
+		errno = saved_errno;
+		return -1;
+	}
+
+	close(fd);
+	strbuf_release(&request);
+	return 0;
+}
+
+int fsmonitor_ipc_spawn_daemon(void)
+{
+	struct child_process daemon = CHILD_PROCESS_INIT;
+	char buf[128];
+	int r, ret = 0;
+
+	argv_array_pushl(&daemon.args, "fsmonitor--daemon", "run", "--detach",
+			 NULL);
+	daemon.git_cmd = 1;
+	daemon.no_stdin = 1;
+	daemon.out = -1;
+	daemon.dir = get_git_work_tree();
+
+	if (start_command(&daemon))
+		return error_errno(_("unable to start fsmonitor daemon"));
+	r = read_in_full(daemon.out, buf, sizeof(buf));
+	if (r < 0)
+		ret = error_errno(_("unable to read result code from fsmonitor daemon"));
+	else if (r != 3 || memcmp(buf, "ok\n", 3))
+		ret = error(_("fsmonitor daemon did not start: %.*s"), r, buf);
+	close(daemon.out);
+	/*
+	 * With --detach, the process we started exits as soon as the
+	 * daemon it forked is ready, so this does not wait for long.
+	 */
+	if (finish_command(&daemon) && !ret)
+		ret = error(_("fsmonitor daemon did not start"));
+	return ret;
+}
+
+int fsmonitor_ipc_query(const char *token, struct strbuf *answer)
+{
+	struct strbuf command = STRBUF_INIT;
+	int ret;
+
+	strbuf_addf(&command, "query %s", token);
+	ret = fsmonitor_ipc_send_command(command.buf, answer);
+	if (ret < 0 && (errno == ENOENT || errno == ECONNREFUSED)) {
+		trace_printf_key(&trace_fsmonitor,
+				 "fsmonitor daemon not running; starting it");
+		if (!fsmonitor_ipc_spawn_daemon())
+			ret = fsmonitor_ipc_send_command(command.buf, answer);
+	}
+	strbuf_release(&command);
+	return ret;
+}
+
+#else
+
+int fsmonitor_ipc_is_supported(void)
+{
+	return 0;
+}
+
+const char *fsmonitor_ipc_get_path(void)
+{
+	return NULL;
+}
+
+int fsmonitor_ipc_send_command(const char *command, struct strbuf *answer)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+int fsmonitor_ipc_spawn_daemon(void)
+{
+	return error(_("fsmonitor daemon is not supported on this platform"));
+}
+
+int fsmonitor_ipc_query(const char *token, struct strbuf *answer)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+#endif
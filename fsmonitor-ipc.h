@@ -0,0 +1,50 @@
+#ifndef FSMONITOR_IPC_H
+#define FSMONITOR_IPC_H
+
+struct strbuf;
+
+/*
+ * Client side of the protocol spoken by the builtin filesystem monitor
+ * daemon ("git fsmonitor--daemon").
+ *
+ * The daemon listens on a Unix domain socket in the per-worktree git
+ * directory. A client sends a single command line and reads the answer
+ * until the daemon closes the connection. The commands are:
+ *
+ *   query <token>  answer the changes since <token>, in the format of
+ *                  the version 2 fsmonitor hook: a new token and a NUL,
+ *                  followed by the NUL-terminated paths that changed. A
+ *                  path ending in '/' stands for everything below that
+ *                  directory; a lone "/" means "assume everything
+ *                  changed" and is sent for tokens the daemon does not
+ *                  know.
+ *   status         answer the path of the watched worktree.
+ *   quit           make the daemon exit.
+ */
+
+/* Is the daemon available on this platform? */
+int fsmonitor_ipc_is_supported(void);
+
+/* The path of the daemon's socket for the current repository. */
+const char *fsmonitor_ipc_get_path(void);
+
+/*
+ * Send "command" to the daemon and store its answer in "answer".
+ * Returns 0 on success, and -1 with errno set if the daemon could not be
+ * reached (ENOENT or ECONNREFUSED when it is not running).
+ */
+int fsmonitor_ipc_send_command(const char *command, struct strbuf *answer);
+
+/*
+ * Start the daemon for the current worktree in the background and wait
+ * until it is ready to accept queries. Returns 0 on success.
+ */
+int fsmonitor_ipc_spawn_daemon(void);
+
+/*
+ * Ask the daemon for the changes since "token", starting it if it is not
+ * running yet. Returns 0 on success.
+ */
+int fsmonitor_ipc_query(const char *token, struct strbuf *answer);
+
+#endif /* FSMONITOR_IPC_H */
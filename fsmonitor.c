@@ -3,6 +3,7 @@
 #include "dir.h"
 #include "ewah/ewok.h"
 #include "fsmonitor.h"
+#include "fsmonitor-ipc.h"
 #include "run-command.h"
 #include "strbuf.h"
 
@@ -137,7 +138,8 @@ void write_fsmonitor_extension(struct strbuf *sb, struct index_state *istate)
 }
 
 /*
- * Call the query-fsmonitor hook passing the last update token of the saved results.
+ * Call the query-fsmonitor hook passing the last update token of the saved results,
+ * or ask the builtin daemon.
  */
 static int query_fsmonitor(int version, const char *last_update, struct strbuf *query_result)
 {
@@ -146,6 +148,9 @@ static int query_fsmonitor(int version, const char *last_update, struct strbuf *
 	if (!core_fsmonitor)
 		return -1;
 
+	if (core_use_builtin_fsmonitor)
+		return fsmonitor_ipc_query(last_update, query_result);
+
 	argv_array_push(&cp.args, core_fsmonitor);
 	argv_array_pushf(&cp.args, "%d", version);
 	argv_array_pushf(&cp.args, "%s", last_update);
@@ -157,7 +162,36 @@ static int query_fsmonitor(int version, const char *last_update, struct strbuf *
 
 static void fsmonitor_refresh_callback(struct index_state *istate, const char *name)
 {
-	int pos = index_name_pos(istate, name, strlen(name));
+	int len = strlen(name);
+	char *name_without_slash;
+	int pos;
+
+	if (len && name[len - 1] == '/') {
+		/*
+		 * Everything below the directory may have changed (e.g.
+		 * it was renamed); invalidate all the entries in it.
+		 */
+		pos = index_name_pos(istate, name, len);
+		if (pos < 0)
+			pos = -pos - 1;
+		for (; pos < istate->cache_nr; pos++) {
+			struct cache_entry *ce = istate->cache[pos];
+
+			if (strncmp(ce->name, name, len))
+				break;
+			ce->ce_flags &= ~CE_FSMONITOR_VALID;
+		}
+		trace_printf_key(&trace_fsmonitor,
+				 "fsmonitor_refresh_callback '%s'", name);
+
+		/* the untracked cache wants the directory without the slash */
+		name_without_slash = xmemdupz(name, len - 1);
+		untracked_cache_invalidate_path(istate, name_without_slash, 0);
+		free(name_without_slash);
+		return;
+	}
+
+	pos = index_name_pos(istate, name, len);
 
 	if (pos >= 0) {
 		struct cache_entry *ce = istate->cache[pos];
@@ -185,7 +219,11 @@ void refresh_fsmonitor(struct index_state *istate)
 	if (!core_fsmonitor || istate->fsmonitor_has_run_once)
 		return;
 
-	hook_version = fsmonitor_hook_version();
+	/* the builtin daemon speaks the version 2 protocol */
+	if (core_use_builtin_fsmonitor)
+		hook_version = HOOK_INTERFACE_VERSION2;
+	else
+		hook_version = fsmonitor_hook_version();
 
 	istate->fsmonitor_has_run_once = 1;
 
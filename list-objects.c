@@ -12,6 +12,10 @@
 #include "packfile.h"
 #include "object-store.h"
 #include "trace.h"
+#include "oidset.h"
+#include "list.h"
+#include "prefetch.h"
+#include "promisor-remote.h"
 
 struct traversal_context {
 	struct rev_info *revs;
@@ -19,8 +23,382 @@ struct traversal_context {
 	show_commit_fn show_commit;
 	void *show_data;
 	struct filter *filter;
+	struct tree_prefetch *prefetch;
 };
 
+/*
+ * With several threads, workers read and inflate trees ahead of the
+ * walk. The walk itself, and the order in which objects are shown,
+ * stay on the main thread; it takes the buffers the workers have
+ * read instead of reading them itself.
+ *
+ * Each tree a worker reads has its subtrees queued in front of the
+ * ones already queued, so that the workers go depth first like
+ * process_tree() does; root trees of new commits go to the back.
+ *
+ * A tree is forgotten once the walk took it, and only its name is
+ * kept, so that the workers do not read it again when other trees
+ * share it.
+ */
+#define TREE_PREFETCH_MEMORY (64 * 1024 * 1024)
+/* how far behind the walk a tree that was read but not taken may fall */
+#define TREE_PREFETCH_SLACK 4096
+
+struct prefetch_tree {
+	struct prefetch_item item;
+	struct object_id oid;
+	void *buf;
+	unsigned long size;
+	/* while ready, in the order the trees were read */
+	struct list_head list;
+	uint64_t seq;
+};
+
+struct tree_prefetch {
+	struct prefetch base;
+	struct repository *repo;
+	/* trees that are not going to be walked; read-only once started */
+	struct oidset uninteresting;
+	/* trees the walk took or left behind */
+	struct oidset taken;
+
+	/*
+	 * Queued trees: subtrees are taken from the end of the stack,
+	 * root trees from the start of their array. A tree the walk took
+	 * before a worker got to it stays there, in PREFETCH_TAKEN state,
+	 * until it is freed by the worker that gets to it.
+	 */
+	struct prefetch_tree **stack;
+	size_t stack_nr, stack_alloc;
+	struct prefetch_tree **roots;
+	size_t roots_nr, roots_alloc, roots_pos;
+
+	struct list_head ready;
+	size_t ready_bytes;
+	uint64_t seq;
+};
+
+static int prefetch_tree_cmp(const void *unused_cmp_data,
+			     const struct hashmap_entry *eptr,
+			     const struct hashmap_entry *entry_or_key,
+			     const void *unused_keydata)
+{
+	const struct prefetch_tree *a, *b;
+
+	a = container_of(eptr, const struct prefetch_tree, item.ent);
+	b = container_of(entry_or_key, const struct prefetch_tree, item.ent);
+	return !oideq(&a->oid, &b->oid);
+}
+
+/* Queue a tree, unless it is known already. */
+static struct prefetch_tree *prefetch_tree_add(struct tree_prefetch *tp,
+					       const struct object_id *oid)
+{
+	struct prefetch_tree key, *t;
+
+	if (oidset_contains(&tp->uninteresting, oid) ||
+	    oidset_contains(&tp->taken, oid))
+		return NULL;
+	hashmap_entry_init(&key.item.ent, oidhash(oid));
+	oidcpy(&key.oid, oid);
+	if (hashmap_get(&tp->base.items, &key.item.ent, NULL))
+		return NULL;
+	t = xcalloc(1, sizeof(*t));
+	hashmap_entry_init(&t->item.ent, key.item.ent.hash);
+	oidcpy(&t->oid, oid);
+	t->item.state = PREFETCH_QUEUED;
+	INIT_LIST_HEAD(&t->list);
+	hashmap_add(&tp->base.items, &t->item.ent);
+	return t;
+}
+
+/*
+ * Forget a tree the walk took or left behind. Called with the mutex
+ * held.
+ */
+static void prefetch_tree_forget(struct tree_prefetch *tp,
+				 struct prefetch_tree *t)
+{
+	hashmap_remove(&tp->base.items, &t->item.ent, NULL);
+	oidset_insert(&tp->taken, &t->oid);
+	FREE_AND_NULL(t->buf);
+	if (t->item.state == PREFETCH_QUEUED)
+		/* still on the stack or the roots; the worker frees it */
+		t->item.state = PREFETCH_TAKEN;
+	else
+		free(t);
+}
+
+/*
+ * Queue the subtrees of a tree, last one first so that the first one
+ * is read first. Called with the mutex held.
+ */
+static void prefetch_subtrees(struct tree_prefetch *tp,
+			      struct object_id *subtrees, int nr)
+{
+	while (nr--) {
+		struct prefetch_tree *t;
+
+		t = prefetch_tree_add(tp, &subtrees[nr]);
+		if (!t)
+			continue;
+		ALLOC_GROW(tp->stack, tp->stack_nr + 1, tp->stack_alloc);
+		tp->stack[tp->stack_nr++] = t;
+	}
+}
+
+static int collect_subtrees(const void *buf, unsigned long size,
+			    struct oid_array *subtrees)
+{
+	struct tree_desc desc;
+	struct name_entry entry;
+
+	if (init_tree_desc_gently(&desc, buf, size))
+		return -1;
+	while (tree_entry_gently(&desc, &entry))
+		if (S_ISDIR(entry.mode))
+			oid_array_append(subtrees, &entry.oid);
+	return 0;
+}
+
+static void *prefetch_next_tree(struct prefetch *p)
+{
+	struct tree_prefetch *tp = container_of(p, struct tree_prefetch, base);
+
+	while (tp->ready_bytes < TREE_PREFETCH_MEMORY) {
+		struct prefetch_tree *t;
+
+		if (tp->stack_nr) {
+			t = tp->stack[--tp->stack_nr];
+		} else if (tp->roots_pos < tp->roots_nr) {
+			t = tp->roots[tp->roots_pos++];
+			if (tp->roots_pos == tp->roots_nr)
+				tp->roots_pos = tp->roots_nr = 0;
+		} else {
+			break;
+		}
+		if (t->item.state == PREFETCH_QUEUED) {
+			t->item.state = PREFETCH_RUNNING;
+			return t;
+		}
+		free(t);
+	}
+	return NULL;
+}
+
+static void prefetch_read_tree(struct prefetch *p, void *job)
+{
+	struct tree_prefetch *tp = container_of(p, struct tree_prefetch, base);
+	struct prefetch_tree *t = job;
+	struct oid_array subtrees = OID_ARRAY_INIT;
+	enum object_type type;
+	unsigned long size;
+	void *buf;
+
+	buf = repo_read_object_file(tp->repo, &t->oid, &type, &size);
+	if (buf && (type != OBJ_TREE || collect_subtrees(buf, size, &subtrees)))
+		FREE_AND_NULL(buf);
+
+	pthread_mutex_lock(&p->mutex);
+	if (buf) {
+		t->buf = buf;
+		t->size = size;
+		t->seq = tp->seq++;
+		list_add_tail(&t->list, &tp->ready);
+		tp->ready_bytes += size;
+		prefetch_subtrees(tp, subtrees.oid, subtrees.nr);
+		prefetch_done(p, &t->item, PREFETCH_READY);
+	} else {
+		/* leave it, and the errors, to the main thread */
+		prefetch_done(p, &t->item, PREFETCH_TAKEN);
+	}
+	pthread_mutex_unlock(&p->mutex);
+	oid_array_clear(&subtrees);
+}
+
+/* Queue the root tree of a commit that is about to be walked. */
+static void prefetch_root_tree(struct tree_prefetch *tp, struct tree *tree)
+{
+	struct prefetch_tree *t;
+
+	if (tree->object.flags & (UNINTERESTING | SEEN))
+		return;
+	pthread_mutex_lock(&tp->base.mutex);
+	t = prefetch_tree_add(tp, &tree->object.oid);
+	if (t) {
+		ALLOC_GROW(tp->roots, tp->roots_nr + 1, tp->roots_alloc);
+		tp->roots[tp->roots_nr++] = t;
+		pthread_cond_signal(&tp->base.work_cond);
+	}
+	pthread_mutex_unlock(&tp->base.mutex);
+}
+
+/*
+ * Parse the tree from the buffer a worker read for it, if there is
+ * one. Otherwise return -1; the caller then reads the tree itself,
+ * and should hand its subtrees to prefetch_parsed_tree().
+ */
+static int prefetch_take_tree(struct tree_prefetch *tp, struct tree *tree)
+{
+	struct prefetch_tree key, *t;
+	void *buf = NULL;
+	unsigned long size = 0;
+
+	hashmap_entry_init(&key.item.ent, oidhash(&tree->object.oid));
+	oidcpy(&key.oid, &tree->object.oid);
+
+	pthread_mutex_lock(&tp->base.mutex);
+	t = container_of_or_null(prefetch_wait(&tp->base, &key.item),
+				 struct prefetch_tree, item);
+	if (t && t->item.state == PREFETCH_READY) {
+		struct list_head *pos, *tmp;
+
+		buf = t->buf;
+		size = t->size;
+		t->buf = NULL;
+		list_del(&t->list);
+		tp->ready_bytes -= size;
+
+		/* drop what the walk has left behind */
+		list_for_each_safe(pos, tmp, &tp->ready) {
+			struct prefetch_tree *old;
+
+			old = list_entry(pos, struct prefetch_tree, list);
+			if (old->seq + TREE_PREFETCH_SLACK >= t->seq)
+				break;
+			list_del(&old->list);
+			tp->ready_bytes -= old->size;
+			prefetch_tree_forget(tp, old);
+		}
+		pthread_cond_broadcast(&tp->base.work_cond);
+	}
+	if (t)
+		prefetch_tree_forget(tp, t);
+	else
+		oidset_insert(&tp->taken, &tree->object.oid);
+	pthread_mutex_unlock(&tp->base.mutex);
+
+	if (!buf) {
+		tp->base.misses++;
+		return -1;
+	}
+	tp->base.hits++;
+	parse_tree_buffer(tree, buf, size);
+	return 0;
+}
+
+/* Let the workers go on below a tree the main thread has read itself. */
+static void prefetch_parsed_tree(struct tree_prefetch *tp, struct tree *tree)
+{
+	struct oid_array subtrees = OID_ARRAY_INIT;
+
+	if (collect_subtrees(tree->buffer, tree->size, &subtrees))
+		return;
+	if (subtrees.nr) {
+		pthread_mutex_lock(&tp->base.mutex);
+		prefetch_subtrees(tp, subtrees.oid, subtrees.nr);
+		pthread_cond_broadcast(&tp->base.work_cond);
+		pthread_mutex_unlock(&tp->base.mutex);
+	}
+	oid_array_clear(&subtrees);
+}
+
+static void start_prefetch(struct traversal_context *ctx)
+{
+	struct rev_info *revs = ctx->revs;
+	struct tree_prefetch *tp;
+	unsigned int i, max;
+	int nr_threads = revs->traverse_threads;
+
+	/*
+	 * The workers read every tree below the ones they are given, so
+	 * leave walks that only look at some of them alone.
+	 */
+	if (!HAVE_THREADS || nr_threads < 2 || !revs->tree_objects ||
+	    ctx->filter || revs->diffopt.pathspec.nr ||
+	    revs->exclude_promisor_objects || has_promisor_remote())
+		return;
+
+	CALLOC_ARRAY(tp, 1);
+	tp->repo = revs->repo;
+	oidset_init(&tp->uninteresting, 0);
+	oidset_init(&tp->taken, 0);
+	max = get_max_object_index();
+	for (i = 0; i < max; i++) {
+		struct object *obj = get_indexed_object(i);
+
+		if (obj && obj->type == OBJ_TREE &&
+		    (obj->flags & UNINTERESTING))
+			oidset_insert(&tp->uninteresting, &obj->oid);
+	}
+	prefetch_init(&tp->base, prefetch_tree_cmp);
+	tp->base.next_job = prefetch_next_tree;
+	tp->base.run_job = prefetch_read_tree;
+	INIT_LIST_HEAD(&tp->ready);
+	ctx->prefetch = tp;
+
+	for (i = 0; i < revs->pending.nr; i++) {
+		struct object *obj = revs->pending.objects[i].item;
+
+		if (obj->type == OBJ_TREE)
+			prefetch_root_tree(tp, (struct tree *)obj);
+	}
+
+	prefetch_start(&tp->base, nr_threads);
+}
+
+static void stop_prefetch(struct traversal_context *ctx)
+{
+	struct tree_prefetch *tp = ctx->prefetch;
+	struct prefetch_tree *t;
+	struct hashmap_iter iter;
+	size_t i;
+
+	if (!tp)
+		return;
+
+	prefetch_stop(&tp->base, "traverse", tp->repo);
+
+	/* the trees still queued that the walk took are only here */
+	for (i = 0; i < tp->stack_nr; i++)
+		if (tp->stack[i]->item.state == PREFETCH_TAKEN)
+			free(tp->stack[i]);
+	for (i = tp->roots_pos; i < tp->roots_nr; i++)
+		if (tp->roots[i]->item.state == PREFETCH_TAKEN)
+			free(tp->roots[i]);
+	hashmap_for_each_entry(&tp->base.items, &iter, t, item.ent)
+		free(t->buf);
+	hashmap_free_entries(&tp->base.items, struct prefetch_tree, item.ent);
+	free(tp->stack);
+	free(tp->roots);
+	oidset_clear(&tp->uninteresting);
+	oidset_clear(&tp->taken);
+	FREE_AND_NULL(ctx->prefetch);
+}
+
+/*
+ * pack-objects looks objects up in its callbacks, which the workers
+ * may be doing at the same time.
+ */
+static void show_object(struct traversal_context *ctx, struct object *obj,
+			const char *name)
+{
+	if (ctx->prefetch)
+		obj_read_lock();
+	ctx->show_object(obj, name, ctx->show_data);
+	if (ctx->prefetch)
+		obj_read_unlock();
+}
+
+static void show_commit(struct traversal_context *ctx, struct commit *commit)
+{
+	if (ctx->prefetch)
+		obj_read_lock();
+	ctx->show_commit(commit, ctx->show_data);
+	if (ctx->prefetch)
+		obj_read_unlock();
+}
+
 static void process_blob(struct traversal_context *ctx,
 			 struct blob *blob,
 			 struct strbuf *path,
@@ -60,7 +438,7 @@ static void process_blob(struct traversal_context *ctx,
 	if (r & LOFR_MARK_SEEN)
 		obj->flags |= SEEN;
 	if (r & LOFR_DO_SHOW)
-		ctx->show_object(obj, path->buf, ctx->show_data);
+		show_object(ctx, obj, path->buf);
 	strbuf_setlen(path, pathlen);
 }
 
@@ -165,7 +543,13 @@ static void process_tree(struct traversal_context *ctx,
 	if (obj->flags & (UNINTERESTING | SEEN))
 		return;
 
-	failed_parse = parse_tree_gently(tree, 1);
+	if (ctx->prefetch && !obj->parsed &&
+	    prefetch_take_tree(ctx->prefetch, tree)) {
+		failed_parse = parse_tree_gently(tree, 1);
+		if (!failed_parse)
+			prefetch_parsed_tree(ctx->prefetch, tree);
+	} else
+		failed_parse = parse_tree_gently(tree, 1);
 	if (failed_parse) {
 		if (revs->ignore_missing_links)
 			return;
@@ -191,7 +575,7 @@ static void process_tree(struct traversal_context *ctx,
 	if (r & LOFR_MARK_SEEN)
 		obj->flags |= SEEN;
 	if (r & LOFR_DO_SHOW)
-		ctx->show_object(obj, base->buf, ctx->show_data);
+		show_object(ctx, obj, base->buf);
 	if (base->len)
 		strbuf_addch(base, '/');
 
@@ -207,7 +591,7 @@ static void process_tree(struct traversal_context *ctx,
 	if (r & LOFR_MARK_SEEN)
 		obj->flags |= SEEN;
 	if (r & LOFR_DO_SHOW)
-		ctx->show_object(obj, base->buf, ctx->show_data);
+		show_object(ctx, obj, base->buf);
 
 	strbuf_setlen(base, baselen);
 	free_tree_buffer(tree);
@@ -335,7 +719,7 @@ static void traverse_trees_and_blobs(struct traversal_context *ctx,
 			continue;
 		if (obj->type == OBJ_TAG) {
 			obj->flags |= SEEN;
-			ctx->show_object(obj, name, ctx->show_data);
+			show_object(ctx, obj, name);
 			continue;
 		}
 		if (!path)
@@ -359,6 +743,7 @@ static void do_traverse(struct traversal_context *ctx)
 	struct commit *commit;
 	struct strbuf csp; /* callee's scratch pad */
 	strbuf_init(&csp, PATH_MAX);
+	start_prefetch(ctx);
 
 	while ((commit = get_revision(ctx->revs)) != NULL) {
 		/*
@@ -371,11 +756,13 @@ static void do_traverse(struct traversal_context *ctx)
 			struct tree *tree = get_commit_tree(commit);
 			tree->object.flags |= NOT_USER_GIVEN;
 			add_pending_tree(ctx->revs, tree);
+			if (ctx->prefetch)
+				prefetch_root_tree(ctx->prefetch, tree);
 		} else if (commit->object.parsed) {
 			die(_("unable to load root tree for commit %s"),
 			      oid_to_hex(&commit->object.oid));
 		}
-		ctx->show_commit(commit, ctx->show_data);
+		show_commit(ctx, commit);
 
 		if (ctx->revs->tree_blobs_in_commit_order)
 			/*
@@ -386,6 +773,7 @@ static void do_traverse(struct traversal_context *ctx)
 			traverse_trees_and_blobs(ctx, &csp);
 	}
 	traverse_trees_and_blobs(ctx, &csp);
+	stop_prefetch(ctx);
 	strbuf_release(&csp);
 }
 
@@ -400,6 +788,7 @@ void traverse_commit_list(struct rev_info *revs,
 	ctx.show_object = show_object;
 	ctx.show_data = show_data;
 	ctx.filter = NULL;
+	ctx.prefetch = NULL;
 	do_traverse(&ctx);
 }
 
@@ -418,6 +807,7 @@ void traverse_commit_list_filtered(
 	ctx.show_commit = show_commit;
 	ctx.show_data = show_data;
 	ctx.filter = list_objects_filter__init(omitted, filter_options);
+	ctx.prefetch = NULL;
 	do_traverse(&ctx);
 	list_objects_filter__free(ctx.filter);
 }
@@ -28,6 +28,41 @@ static int ref_match(const struct argv_array *prefixes, const char *refname)
 	return 0;
 }
 
+/*
+ * Iterate over the namespaced refs under "refs/" that may match one of
+ * the prefixes, seeking to each prefix separately instead of looking at
+ * all refs, unless there are no prefixes or one of them matches
+ * everything anyway.
+ */
+static int for_each_namespaced_ref_in_prefixes(const struct argv_array *prefixes,
+					       each_ref_fn fn, void *cb_data)
+{
+	struct argv_array refs_prefixes = ARGV_ARRAY_INIT;
+	int i, ret = 0;
+
+	if (!prefixes->argc)
+		return for_each_namespaced_ref(fn, cb_data);
+
+	for (i = 0; i < prefixes->argc; i++) {
+		const char *prefix = prefixes->argv[i];
+
+		if (starts_with("refs/", prefix)) {
+			argv_array_clear(&refs_prefixes);
+			return for_each_namespaced_ref(fn, cb_data);
+		}
+		/* other prefixes can only match HEAD */
+		if (starts_with(prefix, "refs/"))
+			argv_array_push(&refs_prefixes, prefix);
+	}
+
+	if (refs_prefixes.argc)
+		ret = for_each_fullref_in_prefixes(get_git_namespace(),
+						   refs_prefixes.argv,
+						   fn, cb_data, 0);
+	argv_array_clear(&refs_prefixes);
+	return ret;
+}
+
 struct ls_refs_data {
 	unsigned peel;
 	unsigned symrefs;
@@ -109,7 +144,7 @@ int ls_refs(struct repository *r, struct argv_array *keys,
 		die(_("expected flush after ls-refs arguments"));
 
 	head_ref_namespaced(send_ref, &data);
-	for_each_namespaced_ref(send_ref, &data);
+	for_each_namespaced_ref_in_prefixes(&data.prefixes, send_ref, &data);
 	packet_flush(1);
 	argv_array_clear(&data.prefixes);
 	return 0;
@@ -0,0 +1,1472 @@
+/*
+ * "Ostensibly Recursive's Twin" merge strategy: a three-way merge of
+ * trees that is computed purely in memory.
+ *
+ * The three trees are walked together, and whole subtrees that are
+ * identical on both sides, or changed on one side only, are resolved
+ * without being opened. Rename detection is limited to the files that
+ * were deleted on one side and changed on the other, as only those can
+ * change the outcome of the merge, and the renames found are cached in
+ * the merge result for the next merge of a rebase or cherry-pick
+ * sequence. The merged blobs and trees are written to the object
+ * database, and the index and working tree are only touched once,
+ * when the caller switches to the result.
+ */
+
+#include "cache.h"
+#include "merge-ort.h"
+
+#include "alloc.h"
+#include "attr.h"
+#include "blob.h"
+#include "cache-tree.h"
+#include "commit.h"
+#include "commit-reach.h"
+#include "convert.h"
+#include "diff.h"
+#include "diffcore.h"
+#include "dir.h"
+#include "ll-merge.h"
+#include "object-store.h"
+#include "repository.h"
+#include "string-list.h"
+#include "tree.h"
+#include "tree-walk.h"
+#include "unpack-trees.h"
+#include "xdiff-interface.h"
+
+struct version_info {
+	struct object_id oid;
+	unsigned short mode; /* 0 if there is no file */
+};
+
+enum rename_conflict {
+	RENAME_CONFLICT_NONE = 0,
+	RENAME_CONFLICT_DELETE,	/* renamed on one side, deleted on the other */
+	RENAME_CONFLICT_ONE_TO_TWO, /* renamed differently on both sides */
+	RENAME_CONFLICT_ADD,	/* renamed onto a file added on the other side */
+	RENAME_CONFLICT_SOURCE	/* renamed differently; only the base is kept */
+};
+
+/*
+ * A path that could not be resolved while walking the trees: the
+ * versions of the file at this path in the merge base (0) and on both
+ * sides (1 and 2), and what became of it.
+ */
+struct merge_entry {
+	struct hashmap_entry ent;
+
+	struct version_info stages[3];
+	/* the path of each version, which differs for renamed files */
+	const char *pathnames[3];
+	/* the sides having a directory at this path */
+	unsigned dirmask : 3;
+	unsigned clean : 1;
+	unsigned processed : 1;
+
+	enum rename_conflict rename_conflict;
+	int rename_side;
+
+	struct version_info result;
+	char *result_path; /* if the result is not at `path` */
+
+	char path[FLEX_ARRAY];
+};
+
+/*
+ * A directory that one side left alone and the other changed: unless
+ * it has to be opened to look for rename destinations, the version of
+ * `side` is taken as a whole.
+ */
+struct pending_dir {
+	char *path;
+	int side;
+	struct version_info versions[3];
+};
+
+struct merge_ort_state {
+	struct merge_options *opt;
+	int call_depth;
+
+	/* the unresolved paths, see struct merge_entry */
+	struct hashmap paths;
+	struct pending_dir *pending;
+	size_t pending_nr, pending_alloc;
+
+	/*
+	 * The entries of the result: paths of files, and paths of
+	 * directories taken as a whole with a trailing slash, with a
+	 * struct version_info as util.
+	 */
+	struct string_list result_entries;
+
+	/* detected renames per side, source path -> destination path */
+	struct string_list renames[3];
+
+	/*
+	 * Renames detected by the previous merge, including the sources
+	 * without a destination (with a NULL util), and the trees of that
+	 * merge, to decide whether they apply to the next one.
+	 */
+	struct string_list cached_pairs[3];
+	int cached_pairs_valid_side;
+	int have_previous;
+	struct object_id previous_trees[3];
+	struct object_id previous_result;
+
+	/*
+	 * With opt->renormalize, an index holding the merged top-level
+	 * .gitattributes, for the attributes of the files being merged.
+	 */
+	struct index_state attr_index;
+	int use_attr_index;
+
+	int needed_rename_limit;
+	int clean;
+};
+
+static int show(struct merge_ort_state *st, int v)
+{
+	return (!st->call_depth && st->opt->verbosity >= v) ||
+		st->opt->verbosity >= 5;
+}
+
+static void flush_output(struct merge_options *opt)
+{
+	if (opt->buffer_output < 2 && opt->obuf.len) {
+		fputs(opt->obuf.buf, stdout);
+		strbuf_reset(&opt->obuf);
+	}
+}
+
+__attribute__((format (printf, 3, 4)))
+static void output(struct merge_ort_state *st, int v, const char *fmt, ...)
+{
+	va_list ap;
+
+	if (!show(st, v))
+		return;
+
+	strbuf_addchars(&st->opt->obuf, ' ', st->call_depth * 2);
+
+	va_start(ap, fmt);
+	strbuf_vaddf(&st->opt->obuf, fmt, ap);
+	va_end(ap);
+
+	strbuf_addch(&st->opt->obuf, '\n');
+	if (!st->opt->buffer_output)
+		flush_output(st->opt);
+}
+
+static int merge_entry_cmp(const void *unused_cmp_data,
+			   const struct hashmap_entry *eptr,
+			   const struct hashmap_entry *entry_or_key,
+			   const void *keydata)
+{
+	const struct merge_entry *a, *b;
+
+	a = container_of(eptr, const struct merge_entry, ent);
+	b = container_of(entry_or_key, const struct merge_entry, ent);
+	return strcmp(a->path, keydata ? keydata : b->path);
+}
+
+static struct merge_entry *find_entry(struct merge_ort_state *st,
+				      const char *path)
+{
+	return hashmap_get_entry_from_hash(&st->paths, strhash(path), path,
+					   struct merge_entry, ent);
+}
+
+static struct merge_entry *add_entry(struct merge_ort_state *st,
+				     const char *path)
+{
+	struct merge_entry *e;
+	int i;
+
+	FLEX_ALLOC_STR(e, path, path);
+	hashmap_entry_init(&e->ent, strhash(path));
+	for (i = 0; i < 3; i++)
+		e->pathnames[i] = e->path;
+	hashmap_add(&st->paths, &e->ent);
+	return e;
+}
+
+static void add_result_entry(struct merge_ort_state *st, const char *path,
+			     int is_dir, const struct version_info *vi)
+{
+	struct string_list_item *item;
+
+	if (is_dir) {
+		char *key = xstrfmt("%s/", path);
+		item = string_list_append_nodup(&st->result_entries, key);
+	} else {
+		item = string_list_append(&st->result_entries, path);
+	}
+	item->util = xmemdupz(vi, sizeof(*vi));
+}
+
+static void version_from_name_entry(struct version_info *vi,
+				    const struct name_entry *n)
+{
+	if (n->mode) {
+		oidcpy(&vi->oid, &n->oid);
+		vi->mode = n->mode;
+	} else {
+		oidclr(&vi->oid);
+		vi->mode = 0;
+	}
+}
+
+static int same_version(const struct version_info *a,
+			const struct version_info *b)
+{
+	if (!a->mode || !b->mode)
+		return a->mode == b->mode;
+	return a->mode == b->mode && oideq(&a->oid, &b->oid);
+}
+
+static int same_name_entry(const struct name_entry *a,
+			   const struct name_entry *b)
+{
+	if (!a->mode || !b->mode)
+		return a->mode == b->mode;
+	return a->mode == b->mode && oideq(&a->oid, &b->oid);
+}
+
+static int collect_merge_info_callback(int n, unsigned long mask,
+				       unsigned long dirmask,
+				       struct name_entry *names,
+				       struct traverse_info *info);
+
+static int traverse_directory(struct merge_ort_state *st,
+			      struct traverse_info *info,
+			      const struct object_id **oids)
+{
+	struct tree_desc t[3];
+	void *buf[3];
+	int i, ret;
+
+	info->fn = collect_merge_info_callback;
+	info->data = st;
+	for (i = 0; i < 3; i++)
+		buf[i] = fill_tree_descriptor(st->opt->repo, t + i, oids[i]);
+	ret = traverse_trees(st->opt->repo->index, 3, t, info);
+	for (i = 0; i < 3; i++)
+		free(buf[i]);
+	return ret;
+}
+
+static int collect_merge_info_callback(int n, unsigned long mask,
+				       unsigned long dirmask,
+				       struct name_entry *names,
+				       struct traverse_info *info)
+{
+	struct merge_ort_state *st = info->data;
+	unsigned long filemask = mask & ~dirmask;
+	struct name_entry *p = names;
+	struct strbuf path = STRBUF_INIT;
+	int i;
+
+	while (!p->mode)
+		p++;
+	strbuf_make_traverse_path(&path, info, p->path, p->pathlen);
+
+	if (!filemask) {
+		struct version_info vi;
+		int side = 0;
+
+		/*
+		 * Directories that are the same on both sides, or that
+		 * only one side changed, need not be opened.
+		 */
+		if (same_name_entry(names + 1, names + 2)) {
+			if (names[1].mode) {
+				version_from_name_entry(&vi, names + 1);
+				add_result_entry(st, path.buf, 1, &vi);
+			}
+			goto out;
+		}
+		if (same_name_entry(names, names + 1))
+			side = 2;
+		else if (same_name_entry(names, names + 2))
+			side = 1;
+		if (side) {
+			struct pending_dir *pd;
+
+			ALLOC_GROW(st->pending, st->pending_nr + 1,
+				   st->pending_alloc);
+			pd = &st->pending[st->pending_nr++];
+			pd->path = strbuf_detach(&path, NULL);
+			pd->side = side;
+			for (i = 0; i < 3; i++)
+				version_from_name_entry(&pd->versions[i],
+							names + i);
+			goto out;
+		}
+	}
+
+	if (filemask) {
+		struct merge_entry *e = add_entry(st, path.buf);
+
+		for (i = 0; i < 3; i++)
+			if (filemask & (1ul << i))
+				version_from_name_entry(&e->stages[i], names + i);
+		e->dirmask = dirmask;
+	}
+
+	if (dirmask) {
+		struct traverse_info newinfo = *info;
+		const struct object_id *oids[3];
+
+		newinfo.prev = info;
+		newinfo.name = p->path;
+		newinfo.namelen = p->pathlen;
+		newinfo.mode = p->mode;
+		newinfo.pathlen = st_add3(newinfo.pathlen, tree_entry_len(p), 1);
+		for (i = 0; i < 3; i++)
+			oids[i] = (dirmask & (1ul << i)) ? &names[i].oid : NULL;
+		if (traverse_directory(st, &newinfo, oids) < 0) {
+			strbuf_release(&path);
+			return -1;
+		}
+	}
+
+out:
+	strbuf_release(&path);
+	return mask;
+}
+
+static int collect_merge_info(struct merge_ort_state *st,
+			      struct tree *merge_base,
+			      struct tree *side1, struct tree *side2)
+{
+	struct traverse_info info;
+	const struct object_id *oids[3];
+
+	oids[0] = &merge_base->object.oid;
+	oids[1] = &side1->object.oid;
+	oids[2] = &side2->object.oid;
+
+	setup_traverse_info(&info, "");
+	return traverse_directory(st, &info, oids);
+}
+
+/*
+ * A file deleted on `side` can only have been renamed in a way that
+ * matters if the other side changed it.
+ */
+static int is_relevant_source(const struct merge_entry *e, int side)
+{
+	return e->stages[0].mode && !e->stages[side].mode &&
+		!same_version(&e->stages[0], &e->stages[3 - side]);
+}
+
+static int has_relevant_sources(struct merge_ort_state *st, int side)
+{
+	struct hashmap_iter iter;
+	struct merge_entry *e;
+
+	hashmap_for_each_entry(&st->paths, &iter, e, ent)
+		if (is_relevant_source(e, side))
+			return 1;
+	return 0;
+}
+
+/*
+ * Open the directories taken from one side as a whole if that side may
+ * have renamed files into them, and take the others.
+ */
+static int resolve_pending_dirs(struct merge_ort_state *st)
+{
+	int expand[3] = { 0 };
+	size_t i;
+	int ret = 0;
+
+	expand[1] = has_relevant_sources(st, 1);
+	expand[2] = has_relevant_sources(st, 2);
+
+	for (i = 0; i < st->pending_nr; i++) {
+		struct pending_dir *pd = &st->pending[i];
+		struct version_info *taken = &pd->versions[pd->side];
+
+		if (!ret && expand[pd->side] && taken->mode) {
+			struct traverse_info info;
+			const struct object_id *oids[3];
+			struct strbuf base = STRBUF_INIT;
+			int j;
+
+			for (j = 0; j < 3; j++)
+				oids[j] = pd->versions[j].mode ?
+					&pd->versions[j].oid : NULL;
+			strbuf_addf(&base, "%s/", pd->path);
+			setup_traverse_info(&info, base.buf);
+			if (traverse_directory(st, &info, oids) < 0)
+				ret = -1;
+			strbuf_release(&base);
+		} else if (taken->mode) {
+			add_result_entry(st, pd->path, 1, taken);
+		}
+		free(pd->path);
+	}
+	FREE_AND_NULL(st->pending);
+	st->pending_nr = st->pending_alloc = 0;
+	return ret;
+}
+
+static void add_rename(struct merge_ort_state *st, int side,
+		       const char *source, const char *dest)
+{
+	string_list_append(&st->renames[side], source)->util = xstrdup(dest);
+}
+
+static void detect_renames(struct merge_ort_state *st, int side)
+{
+	struct merge_options *opt = st->opt;
+	struct string_list sources = STRING_LIST_INIT_NODUP;
+	struct string_list dests = STRING_LIST_INIT_NODUP;
+	struct string_list cache = STRING_LIST_INIT_DUP;
+	struct hashmap_iter iter;
+	struct merge_entry *e;
+	struct diff_options diff_opts;
+	struct diff_queue_struct *q = &diff_queued_diff;
+	int i;
+
+	hashmap_for_each_entry(&st->paths, &iter, e, ent) {
+		if (is_relevant_source(e, side) && !S_ISGITLINK(e->stages[0].mode))
+			string_list_append(&sources, e->path)->util = e;
+		else if (!e->stages[0].mode && e->stages[side].mode &&
+			 !S_ISGITLINK(e->stages[side].mode))
+			string_list_append(&dests, e->path)->util = e;
+	}
+	string_list_sort(&sources);
+	string_list_sort(&dests);
+
+	/* reuse the renames of the previous merge */
+	if (st->cached_pairs_valid_side == side) {
+		struct string_list_item *item;
+		int j = 0;
+
+		for (i = 0; i < sources.nr; i++) {
+			struct string_list_item *dest;
+			const char *dest_path;
+
+			item = string_list_lookup(&st->cached_pairs[side],
+						  sources.items[i].string);
+			if (!item) {
+				sources.items[j++] = sources.items[i];
+				continue;
+			}
+			dest_path = item->util;
+			if (!dest_path) {
+				string_list_append(&cache, item->string);
+				continue;
+			}
+			dest = string_list_lookup(&dests, dest_path);
+			if (!dest || !dest->util) {
+				sources.items[j++] = sources.items[i];
+				continue;
+			}
+			dest->util = NULL; /* claimed */
+			add_rename(st, side, item->string, dest_path);
+			string_list_append(&cache, item->string)->util =
+				xstrdup(dest_path);
+		}
+		sources.nr = j;
+	}
+
+	if (sources.nr && dests.nr) {
+		repo_diff_setup(opt->repo, &diff_opts);
+		diff_opts.flags.rename_empty = 0;
+		diff_opts.detect_rename = DIFF_DETECT_RENAME;
+		diff_opts.rename_limit = (opt->rename_limit >= 0) ?
+			opt->rename_limit : 1000;
+		diff_opts.rename_score = opt->rename_score;
+		diff_opts.show_rename_progress = opt->show_rename_progress;
+		diff_opts.output_format = DIFF_FORMAT_NO_OUTPUT;
+		diff_setup_done(&diff_opts);
+
+		for (i = 0; i < sources.nr; i++) {
+			struct merge_entry *s = sources.items[i].util;
+			struct diff_filespec *one, *two;
+
+			one = alloc_filespec(s->path);
+			fill_filespec(one, &s->stages[0].oid, 1,
+				      s->stages[0].mode);
+			two = alloc_filespec(s->path);
+			diff_queue(q, one, two);
+		}
+		for (i = 0; i < dests.nr; i++) {
+			struct merge_entry *d = dests.items[i].util;
+			struct diff_filespec *one, *two;
+
+			if (!d)
+				continue;
+			one = alloc_filespec(d->path);
+			two = alloc_filespec(d->path);
+			fill_filespec(two, &d->stages[side].oid, 1,
+				      d->stages[side].mode);
+			diff_queue(q, one, two);
+		}
+		diffcore_std(&diff_opts);
+		if (diff_opts.needed_rename_limit > st->needed_rename_limit)
+			st->needed_rename_limit = diff_opts.needed_rename_limit;
+
+		for (i = 0; i < q->nr; i++) {
+			struct diff_filepair *pair = q->queue[i];
+
+			if (pair->status != 'R')
+				continue;
+			add_rename(st, side, pair->one->path, pair->two->path);
+			string_list_append(&cache, pair->one->path)->util =
+				xstrdup(pair->two->path);
+		}
+		for (i = 0; i < q->nr; i++)
+			diff_free_filepair(q->queue[i]);
+		free(q->queue);
+		DIFF_QUEUE_CLEAR(q);
+	}
+
+	/* remember the sources without a destination, too */
+	string_list_sort(&cache);
+	for (i = 0; i < sources.nr; i++)
+		if (!string_list_lookup(&cache, sources.items[i].string))
+			string_list_insert(&cache, sources.items[i].string);
+
+	string_list_clear(&st->cached_pairs[side], 1);
+	st->cached_pairs[side] = cache;
+	string_list_sort(&st->renames[side]);
+
+	string_list_clear(&sources, 0);
+	string_list_clear(&dests, 0);
+}
+
+static struct index_state *attr_index(struct merge_ort_state *st)
+{
+	return st->use_attr_index ? &st->attr_index : st->opt->repo->index;
+}
+
+static int read_blob(const struct object_id *oid, struct strbuf *dst)
+{
+	enum object_type type;
+	unsigned long size;
+	void *buf = read_object_file(oid, &type, &size);
+
+	if (!buf)
+		return error(_("cannot read object %s"), oid_to_hex(oid));
+	if (type != OBJ_BLOB) {
+		free(buf);
+		return error(_("object %s is not a blob"), oid_to_hex(oid));
+	}
+	strbuf_attach(dst, buf, size, size + 1);
+	return 0;
+}
+
+/*
+ * Whether `a` is the same as `o`, possibly after renormalizing both of
+ * them.
+ */
+static int blob_unchanged(struct merge_ort_state *st, const char *path,
+			  const struct version_info *o,
+			  const struct version_info *a)
+{
+	struct strbuf obuf = STRBUF_INIT;
+	struct strbuf abuf = STRBUF_INIT;
+	int ret = 0; /* assume changed for safety */
+
+	if (a->mode != o->mode)
+		return 0;
+	if (oideq(&o->oid, &a->oid))
+		return 1;
+	if (!st->opt->renormalize)
+		return 0;
+
+	if (read_blob(&o->oid, &obuf) || read_blob(&a->oid, &abuf))
+		goto out;
+	/*
+	 * Note: binary | is used so that both renormalizations are
+	 * performed.
+	 */
+	if (renormalize_buffer(attr_index(st), path, obuf.buf, obuf.len, &obuf) |
+	    renormalize_buffer(attr_index(st), path, abuf.buf, abuf.len, &abuf))
+		ret = (obuf.len == abuf.len && !memcmp(obuf.buf, abuf.buf, obuf.len));
+
+out:
+	strbuf_release(&obuf);
+	strbuf_release(&abuf);
+	return ret;
+}
+
+static int merge_3way(struct merge_ort_state *st, mmbuffer_t *result_buf,
+		      const char *path,
+		      const struct version_info *o, const char *o_path,
+		      const struct version_info *a, const char *a_path,
+		      const struct version_info *b, const char *b_path)
+{
+	struct merge_options *opt = st->opt;
+	mmfile_t orig, src1, src2;
+	struct ll_merge_options ll_opts = { 0 };
+	char *base, *name1, *name2;
+	int merge_status;
+
+	ll_opts.renormalize = opt->renormalize;
+	ll_opts.extra_marker_size = st->call_depth * 2;
+	ll_opts.xdl_opts = opt->xdl_opts;
+
+	if (st->call_depth) {
+		ll_opts.virtual_ancestor = 1;
+		ll_opts.variant = 0;
+	} else {
+		switch (opt->recursive_variant) {
+		case MERGE_VARIANT_OURS:
+			ll_opts.variant = XDL_MERGE_FAVOR_OURS;
+			break;
+		case MERGE_VARIANT_THEIRS:
+			ll_opts.variant = XDL_MERGE_FAVOR_THEIRS;
+			break;
+		default:
+			ll_opts.variant = 0;
+			break;
+		}
+	}
+
+	if (strcmp(a_path, b_path) || strcmp(a_path, o_path)) {
+		base  = mkpathdup("%s:%s", opt->ancestor, o_path);
+		name1 = mkpathdup("%s:%s", opt->branch1, a_path);
+		name2 = mkpathdup("%s:%s", opt->branch2, b_path);
+	} else {
+		base  = mkpathdup("%s", opt->ancestor);
+		name1 = mkpathdup("%s", opt->branch1);
+		name2 = mkpathdup("%s", opt->branch2);
+	}
+
+	if (o->mode) {
+		read_mmblob(&orig, &o->oid);
+	} else {
+		orig.ptr = xstrdup("");
+		orig.size = 0;
+	}
+	read_mmblob(&src1, &a->oid);
+	read_mmblob(&src2, &b->oid);
+
+	merge_status = ll_merge(result_buf, path, &orig, base,
+				&src1, name1, &src2, name2,
+				attr_index(st), &ll_opts);
+
+	free(base);
+	free(name1);
+	free(name2);
+	free(orig.ptr);
+	free(src1.ptr);
+	free(src2.ptr);
+	return merge_status;
+}
+
+/*
+ * Merge the three versions of a file present on both sides into
+ * `result`. Returns 1 if the merge is clean, 0 if it has conflicts and
+ * -1 on errors.
+ */
+static int merge_file(struct merge_ort_state *st, struct merge_entry *e,
+		      struct version_info *result)
+{
+	const struct version_info *o = &e->stages[0];
+	const struct version_info *a = &e->stages[1];
+	const struct version_info *b = &e->stages[2];
+	int clean = 1;
+
+	/* modes */
+	if (o->mode && a->mode == o->mode)
+		result->mode = b->mode;
+	else if (o->mode && b->mode == o->mode)
+		result->mode = a->mode;
+	else if (a->mode == b->mode)
+		result->mode = a->mode;
+	else {
+		result->mode = a->mode;
+		clean = 0;
+	}
+
+	if ((a->mode & S_IFMT) != (b->mode & S_IFMT)) {
+		/* a file replaced by a symlink or submodule, or vice versa */
+		*result = st->call_depth && o->mode ? *o : *a;
+		return 0;
+	}
+
+	if (oideq(&a->oid, &b->oid)) {
+		oidcpy(&result->oid, &a->oid);
+	} else if (o->mode && oideq(&o->oid, &a->oid)) {
+		oidcpy(&result->oid, &b->oid);
+	} else if (o->mode && oideq(&o->oid, &b->oid)) {
+		oidcpy(&result->oid, &a->oid);
+	} else if (S_ISREG(a->mode)) {
+		mmbuffer_t result_buf;
+		int merge_status;
+
+		output(st, 2, _("Auto-merging %s"), e->path);
+		merge_status = merge_3way(st, &result_buf, e->path,
+					  o, e->pathnames[0],
+					  a, e->pathnames[1],
+					  b, e->pathnames[2]);
+		if (merge_status < 0 ||
+		    write_object_file(result_buf.ptr, result_buf.size,
+				      blob_type, &result->oid)) {
+			free(result_buf.ptr);
+			return error(_("unable to merge '%s'"), e->path);
+		}
+		free(result_buf.ptr);
+		if (merge_status)
+			clean = 0;
+	} else if (S_ISLNK(a->mode) && !st->call_depth &&
+		   st->opt->recursive_variant != MERGE_VARIANT_NORMAL) {
+		oidcpy(&result->oid,
+		       st->opt->recursive_variant == MERGE_VARIANT_OURS ?
+		       &a->oid : &b->oid);
+	} else {
+		/* symlinks and submodules changed differently on both sides */
+		oidcpy(&result->oid,
+		       st->call_depth && o->mode ? &o->oid : &a->oid);
+		clean = 0;
+	}
+	return clean;
+}
+
+static void apply_renames(struct merge_ort_state *st, int side)
+{
+	struct merge_options *opt = st->opt;
+	int other = 3 - side;
+	const char *side_name = side == 1 ? opt->branch1 : opt->branch2;
+	const char *other_name = side == 1 ? opt->branch2 : opt->branch1;
+	int i;
+
+	for (i = 0; i < st->renames[side].nr; i++) {
+		const char *source = st->renames[side].items[i].string;
+		const char *dest = st->renames[side].items[i].util;
+		struct merge_entry *src = find_entry(st, source);
+		struct merge_entry *dst = find_entry(st, dest);
+		struct string_list_item *other_rename;
+
+		other_rename = string_list_lookup(&st->renames[other], source);
+		if (other_rename) {
+			struct merge_entry *dst2;
+
+			/* renamed on both sides; handled with side 1 */
+			if (side == 2)
+				continue;
+			if (!strcmp(other_rename->util, dest)) {
+				dst->stages[0] = src->stages[0];
+				dst->pathnames[0] = src->path;
+				continue;
+			}
+			dst2 = find_entry(st, other_rename->util);
+			dst->rename_conflict = RENAME_CONFLICT_ONE_TO_TWO;
+			dst->rename_side = side;
+			dst2->rename_conflict = RENAME_CONFLICT_ONE_TO_TWO;
+			dst2->rename_side = other;
+			src->rename_conflict = RENAME_CONFLICT_SOURCE;
+			output(st, 1, _("CONFLICT (rename/rename): %s renamed to "
+					"%s in %s and to %s in %s."),
+			       source, dest, side_name, dst2->path, other_name);
+			continue;
+		}
+
+		if (!src->stages[other].mode) {
+			dst->rename_conflict = RENAME_CONFLICT_DELETE;
+			dst->rename_side = side;
+			output(st, 1, _("CONFLICT (rename/delete): %s deleted in %s "
+					"and renamed to %s in %s. Version %s of %s "
+					"left in tree."),
+			       source, other_name, dest, side_name,
+			       side_name, dest);
+			continue;
+		}
+
+		if (dst->stages[other].mode) {
+			/*
+			 * The other side added a file where this side renamed
+			 * one to: merge the changes of the other side into
+			 * the renamed file, which then conflicts with the
+			 * added one.
+			 */
+			struct version_info merged;
+			struct merge_entry *renamed;
+
+			FLEX_ALLOC_STR(renamed, path, dest);
+			renamed->stages[0] = src->stages[0];
+			renamed->stages[side] = dst->stages[side];
+			renamed->stages[other] = src->stages[other];
+			renamed->pathnames[0] = src->path;
+			renamed->pathnames[side] = renamed->path;
+			renamed->pathnames[other] = src->path;
+			if (merge_file(st, renamed, &merged) < 0)
+				st->clean = -1;
+			dst->stages[side] = merged;
+			free(renamed);
+
+			dst->rename_conflict = RENAME_CONFLICT_ADD;
+			dst->rename_side = side;
+			output(st, 1, _("CONFLICT (rename/add): %s renamed to %s "
+					"in %s, and %s added in %s."),
+			       source, dest, side_name, dest, other_name);
+		} else {
+			dst->stages[0] = src->stages[0];
+			dst->stages[other] = src->stages[other];
+			dst->pathnames[0] = src->path;
+			dst->pathnames[other] = src->path;
+		}
+		/* the changes of the other side moved with the file */
+		src->stages[other].mode = 0;
+		oidclr(&src->stages[other].oid);
+	}
+}
+
+static void process_entry(struct merge_ort_state *st, struct merge_entry *e)
+{
+	struct merge_options *opt = st->opt;
+	struct version_info *v = e->stages;
+	const char *branch[3] = { opt->ancestor, opt->branch1, opt->branch2 };
+	int clean = 1;
+
+	if (e->processed)
+		return;
+	e->processed = 1;
+
+	switch (e->rename_conflict) {
+	case RENAME_CONFLICT_DELETE:
+	case RENAME_CONFLICT_ONE_TO_TWO:
+		/* the messages were shown when the renames were applied */
+		e->result = v[e->rename_side];
+		e->clean = 0;
+		return;
+	case RENAME_CONFLICT_SOURCE:
+		e->clean = 0;
+		return;
+	case RENAME_CONFLICT_NONE:
+	case RENAME_CONFLICT_ADD:
+		break;
+	}
+
+	if (same_version(&v[1], &v[2])) {
+		e->result = v[1];
+	} else if (same_version(&v[0], &v[1])) {
+		e->result = v[2];
+	} else if (same_version(&v[0], &v[2])) {
+		e->result = v[1];
+	} else if (!v[1].mode || !v[2].mode) {
+		int deleted = v[1].mode ? 2 : 1;
+		int modified = 3 - deleted;
+
+		if (blob_unchanged(st, e->path, &v[0], &v[modified])) {
+			/* only renormalized on the other side */
+			e->result = v[deleted];
+			e->clean = 1;
+			return;
+		}
+		output(st, 1, _("CONFLICT (%s/delete): %s deleted in %s and %s "
+				"in %s. Version %s of %s left in tree."),
+		       "modify", e->path, branch[deleted], "modified",
+		       branch[modified], branch[modified], e->path);
+		e->result = st->call_depth ? v[0] : v[modified];
+		clean = 0;
+	} else {
+		clean = merge_file(st, e, &e->result);
+		if (clean < 0) {
+			st->clean = -1;
+			return;
+		}
+		if (!clean && !v[0].mode)
+			output(st, 1, _("CONFLICT (%s): Merge conflict in %s"),
+			       "add/add", e->path);
+		else if (!clean)
+			output(st, 1, _("CONFLICT (%s): Merge conflict in %s"),
+			       "content", e->path);
+	}
+
+	if (e->rename_conflict == RENAME_CONFLICT_ADD)
+		clean = 0;
+	e->clean = clean;
+}
+
+/*
+ * Merge the top-level .gitattributes first, so that the other files are
+ * merged with the attributes they will have after the merge.
+ */
+static void init_attr_index(struct merge_ort_state *st)
+{
+	struct merge_entry *e = find_entry(st, GITATTRIBUTES_FILE);
+	struct cache_entry *ce;
+
+	if (!st->opt->renormalize || !e)
+		return;
+
+	process_entry(st, e);
+	if (!e->result.mode || !S_ISREG(e->result.mode))
+		return;
+
+	ce = make_cache_entry(&st->attr_index, e->result.mode,
+			      &e->result.oid, GITATTRIBUTES_FILE, 0, 0);
+	if (!ce || add_index_entry(&st->attr_index, ce, ADD_CACHE_OK_TO_ADD))
+		return;
+	st->use_attr_index = 1;
+	git_attr_set_direction(GIT_ATTR_INDEX);
+}
+
+static void release_attr_index(struct merge_ort_state *st)
+{
+	if (!st->use_attr_index)
+		return;
+	git_attr_set_direction(GIT_ATTR_CHECKIN);
+	discard_index(&st->attr_index);
+	st->use_attr_index = 0;
+}
+
+static int has_directory(const struct string_list *entries, const char *path)
+{
+	struct strbuf prefix = STRBUF_INIT;
+	int pos, ret;
+
+	strbuf_addf(&prefix, "%s/", path);
+	pos = string_list_find_insert_index(entries, prefix.buf, 0);
+	ret = pos < entries->nr &&
+		starts_with(entries->items[pos].string, prefix.buf);
+	strbuf_release(&prefix);
+	return ret;
+}
+
+/* add a string to a strbuf, but converting "/" to "_" */
+static void add_flattened_path(struct strbuf *out, const char *s)
+{
+	size_t i = out->len;
+	strbuf_addstr(out, s);
+	for (; i < out->len; i++)
+		if (out->buf[i] == '/')
+			out->buf[i] = '_';
+}
+
+static char *unique_path(const struct string_list *entries,
+			 const char *path, const char *branch)
+{
+	struct strbuf newpath = STRBUF_INIT;
+	int suffix = 0;
+	size_t base_len;
+
+	strbuf_addf(&newpath, "%s~", path);
+	add_flattened_path(&newpath, branch);
+
+	base_len = newpath.len;
+	while (string_list_has_string(entries, newpath.buf) ||
+	       has_directory(entries, newpath.buf)) {
+		strbuf_setlen(&newpath, base_len);
+		strbuf_addf(&newpath, "_%d", suffix++);
+	}
+
+	return strbuf_detach(&newpath, NULL);
+}
+
+/*
+ * Move the files whose path is needed for a directory out of the way,
+ * to <path>~<branch>.
+ */
+static void resolve_df_conflicts(struct merge_ort_state *st,
+				 struct merge_entry **entries, size_t nr)
+{
+	struct merge_options *opt = st->opt;
+	size_t i;
+
+	for (i = 0; i < nr; i++) {
+		struct merge_entry *e = entries[i];
+		const char *branch;
+		struct string_list_item *item;
+		void *util;
+
+		if (!e->dirmask || !e->result.mode ||
+		    !has_directory(&st->result_entries, e->path))
+			continue;
+
+		branch = (e->dirmask & 2) ? opt->branch2 : opt->branch1;
+		e->result_path = unique_path(&st->result_entries, e->path,
+					     branch);
+		output(st, 1, _("CONFLICT (file/directory): directory in the "
+				"way of %s from %s; moving it to %s instead."),
+		       e->path, branch, e->result_path);
+		e->clean = 0;
+
+		item = string_list_lookup(&st->result_entries, e->path);
+		util = item->util;
+		string_list_remove(&st->result_entries, e->path, 0);
+		string_list_insert(&st->result_entries, e->result_path)->util =
+			util;
+	}
+}
+
+static int write_tree(struct merge_ort_state *st, size_t *pos,
+		      const char *prefix, struct object_id *oid)
+{
+	struct string_list *entries = &st->result_entries;
+	size_t prefix_len = strlen(prefix);
+	struct strbuf buf = STRBUF_INIT;
+	int ret = 0;
+
+	while (*pos < entries->nr &&
+	       starts_with(entries->items[*pos].string, prefix)) {
+		const char *path = entries->items[*pos].string;
+		const char *name = path + prefix_len;
+		const char *slash = strchr(name, '/');
+		struct version_info *vi = entries->items[*pos].util;
+
+		if (slash && slash[1]) {
+			char *subprefix = xmemdupz(path, slash + 1 - path);
+			struct object_id subtree;
+			int empty;
+
+			empty = write_tree(st, pos, subprefix, &subtree);
+			free(subprefix);
+			if (empty < 0) {
+				ret = -1;
+				break;
+			}
+			if (!empty) {
+				strbuf_addf(&buf, "%o %.*s%c", S_IFDIR,
+					    (int)(slash - name), name, '\0');
+				strbuf_add(&buf, subtree.hash,
+					   st->opt->repo->hash_algo->rawsz);
+			}
+			continue;
+		}
+
+		if (slash)
+			strbuf_addf(&buf, "%o %.*s%c", S_IFDIR,
+				    (int)(slash - name), name, '\0');
+		else
+			strbuf_addf(&buf, "%o %s%c", vi->mode, name, '\0');
+		strbuf_add(&buf, vi->oid.hash, st->opt->repo->hash_algo->rawsz);
+		(*pos)++;
+	}
+
+	if (!ret && !buf.len && *prefix)
+		ret = 1; /* an empty subtree is left out */
+	else if (!ret && write_object_file(buf.buf, buf.len, tree_type, oid))
+		ret = error(_("unable to write tree for '%s'"), prefix);
+	strbuf_release(&buf);
+	return ret;
+}
+
+static int entry_path_cmp(const void *a_, const void *b_)
+{
+	const struct merge_entry *a = *(const struct merge_entry **)a_;
+	const struct merge_entry *b = *(const struct merge_entry **)b_;
+
+	return strcmp(a->path, b->path);
+}
+
+static void clear_merge_state(struct merge_ort_state *st)
+{
+	size_t i;
+
+	hashmap_free_entries(&st->paths, struct merge_entry, ent);
+	for (i = 0; i < st->pending_nr; i++)
+		free(st->pending[i].path);
+	FREE_AND_NULL(st->pending);
+	st->pending_nr = st->pending_alloc = 0;
+	string_list_clear(&st->result_entries, 1);
+	string_list_clear(&st->renames[1], 1);
+	string_list_clear(&st->renames[2], 1);
+}
+
+static void free_merge_entries(struct merge_ort_state *st)
+{
+	struct hashmap_iter iter;
+	struct merge_entry *e;
+
+	hashmap_for_each_entry(&st->paths, &iter, e, ent)
+		free(e->result_path);
+}
+
+static struct merge_ort_state *init_merge_state(struct merge_options *opt,
+						struct merge_result *result,
+						int call_depth)
+{
+	struct merge_ort_state *st = result->priv;
+
+	if (!st) {
+		st = xcalloc(1, sizeof(*st));
+		string_list_init(&st->cached_pairs[1], 1);
+		string_list_init(&st->cached_pairs[2], 1);
+		result->priv = st;
+	} else {
+		free_merge_entries(st);
+		clear_merge_state(st);
+	}
+	st->opt = opt;
+	st->call_depth = call_depth;
+	hashmap_init(&st->paths, merge_entry_cmp, NULL, 0);
+	string_list_init(&st->result_entries, 1);
+	string_list_init(&st->renames[1], 1);
+	string_list_init(&st->renames[2], 1);
+	st->clean = 1;
+	st->needed_rename_limit = 0;
+	return st;
+}
+
+static struct tree *shift_tree_object(struct repository *repo,
+				      struct tree *one, struct tree *two,
+				      const char *subtree_shift)
+{
+	struct object_id shifted;
+
+	if (!*subtree_shift) {
+		shift_tree(repo, &one->object.oid, &two->object.oid, &shifted, 0);
+	} else {
+		shift_tree_by(repo, &one->object.oid, &two->object.oid, &shifted,
+			      subtree_shift);
+	}
+	if (oideq(&two->object.oid, &shifted))
+		return two;
+	return lookup_tree(repo, &shifted);
+}
+
+static void merge_ort_nonrecursive_internal(struct merge_options *opt,
+					    struct tree *merge_base,
+					    struct tree *side1,
+					    struct tree *side2,
+					    struct merge_result *result,
+					    int call_depth)
+{
+	struct merge_ort_state *st;
+	struct merge_entry **entries;
+	struct hashmap_iter iter;
+	struct merge_entry *e;
+	struct object_id oid;
+	size_t nr = 0, i, pos = 0;
+	int side;
+
+	if (opt->subtree_shift) {
+		side2 = shift_tree_object(opt->repo, side1, side2,
+					  opt->subtree_shift);
+		merge_base = shift_tree_object(opt->repo, side1, merge_base,
+					       opt->subtree_shift);
+	}
+
+	st = init_merge_state(opt, result, call_depth);
+
+	st->cached_pairs_valid_side = 0;
+	if (st->have_previous) {
+		if (oideq(&merge_base->object.oid, &st->previous_trees[2]) &&
+		    oideq(&side1->object.oid, &st->previous_result))
+			st->cached_pairs_valid_side = 1;
+		else if (oideq(&merge_base->object.oid, &st->previous_trees[1]) &&
+			 oideq(&side2->object.oid, &st->previous_result))
+			st->cached_pairs_valid_side = 2;
+	}
+
+	if (oideq(&merge_base->object.oid, &side2->object.oid)) {
+		output(st, 0, _("Already up to date!"));
+		result->tree = side1;
+		result->clean = 1;
+		goto done;
+	}
+
+	if (collect_merge_info(st, merge_base, side1, side2) < 0 ||
+	    resolve_pending_dirs(st) < 0) {
+		result->clean = error(_("collecting merge info failed for "
+					"trees %s, %s, %s"),
+				      oid_to_hex(&merge_base->object.oid),
+				      oid_to_hex(&side1->object.oid),
+				      oid_to_hex(&side2->object.oid));
+		result->tree = NULL;
+		st->have_previous = 0;
+		return;
+	}
+
+	for (side = 1; side <= 2; side++) {
+		if (opt->detect_renames == 0) {
+			string_list_clear(&st->cached_pairs[side], 1);
+			continue;
+		}
+		detect_renames(st, side);
+	}
+	for (side = 1; side <= 2; side++)
+		apply_renames(st, side);
+
+	ALLOC_ARRAY(entries, hashmap_get_size(&st->paths));
+	hashmap_for_each_entry(&st->paths, &iter, e, ent)
+		entries[nr++] = e;
+	QSORT(entries, nr, entry_path_cmp);
+
+	init_attr_index(st);
+	for (i = 0; i < nr && st->clean >= 0; i++) {
+		process_entry(st, entries[i]);
+		if (entries[i]->result.mode)
+			add_result_entry(st, entries[i]->path, 0,
+					 &entries[i]->result);
+	}
+	release_attr_index(st);
+	string_list_sort(&st->result_entries);
+	if (st->clean >= 0)
+		resolve_df_conflicts(st, entries, nr);
+	free(entries);
+
+	if (st->clean < 0 || write_tree(st, &pos, "", &oid) < 0) {
+		result->clean = -1;
+		result->tree = NULL;
+		st->have_previous = 0;
+		return;
+	}
+
+	result->tree = lookup_tree(opt->repo, &oid);
+	result->clean = st->clean;
+	hashmap_for_each_entry(&st->paths, &iter, e, ent)
+		if (!e->clean)
+			result->clean = 0;
+
+done:
+	st->have_previous = 1;
+	oidcpy(&st->previous_trees[0], &merge_base->object.oid);
+	oidcpy(&st->previous_trees[1], &side1->object.oid);
+	oidcpy(&st->previous_trees[2], &side2->object.oid);
+	oidcpy(&st->previous_result, &result->tree->object.oid);
+}
+
+void merge_incore_nonrecursive(struct merge_options *opt,
+			       struct tree *merge_base,
+			       struct tree *side1,
+			       struct tree *side2,
+			       struct merge_result *result)
+{
+	assert(opt->ancestor && opt->branch1 && opt->branch2);
+	assert(!opt->priv);
+
+	merge_ort_nonrecursive_internal(opt, merge_base, side1, side2,
+					result, 0);
+}
+
+static struct commit *make_virtual_commit(struct repository *repo,
+					  struct tree *tree,
+					  const char *comment)
+{
+	struct commit *commit = alloc_commit_node(repo);
+
+	set_merge_remote_desc(commit, comment, (struct object *)commit);
+	commit->maybe_tree = tree;
+	commit->object.parsed = 1;
+	return commit;
+}
+
+static struct commit_list *reverse_commit_list(struct commit_list *list)
+{
+	struct commit_list *next = NULL, *current, *backup;
+	for (current = list; current; current = backup) {
+		backup = current->next;
+		current->next = next;
+		next = current;
+	}
+	return next;
+}
+
+static void merge_ort_internal(struct merge_options *opt,
+			       struct commit_list *merge_bases,
+			       struct commit *h1,
+			       struct commit *h2,
+			       struct merge_result *result,
+			       int call_depth)
+{
+	struct commit_list *iter;
+	struct commit *merged_merge_bases;
+	const char *ancestor_name;
+	struct strbuf merge_base_abbrev = STRBUF_INIT;
+
+	if (!merge_bases) {
+		merge_bases = get_merge_bases(h1, h2);
+		merge_bases = reverse_commit_list(merge_bases);
+	}
+
+	merged_merge_bases = pop_commit(&merge_bases);
+	if (!merged_merge_bases) {
+		/* if there is no common ancestor, use an empty tree */
+		struct tree *tree;
+
+		tree = lookup_tree(opt->repo, opt->repo->hash_algo->empty_tree);
+		merged_merge_bases = make_virtual_commit(opt->repo, tree,
+							 "ancestor");
+		ancestor_name = "empty tree";
+	} else if (opt->ancestor && !call_depth) {
+		ancestor_name = opt->ancestor;
+	} else if (merge_bases) {
+		ancestor_name = "merged common ancestors";
+	} else {
+		strbuf_add_unique_abbrev(&merge_base_abbrev,
+					 &merged_merge_bases->object.oid,
+					 DEFAULT_ABBREV);
+		ancestor_name = merge_base_abbrev.buf;
+	}
+
+	for (iter = merge_bases; iter; iter = iter->next) {
+		const char *saved_b1, *saved_b2;
+		struct merge_result inner = { 0 };
+		struct commit *prev = merged_merge_bases;
+
+		/*
+		 * The conflicts of the merged merge bases are committed
+		 * with their conflict markers; only errors matter.
+		 */
+		saved_b1 = opt->branch1;
+		saved_b2 = opt->branch2;
+		opt->branch1 = "Temporary merge branch 1";
+		opt->branch2 = "Temporary merge branch 2";
+		merge_ort_internal(opt, NULL, prev, iter->item, &inner,
+				   call_depth + 1);
+		opt->branch1 = saved_b1;
+		opt->branch2 = saved_b2;
+		merge_finalize(&inner);
+		if (inner.clean < 0) {
+			result->clean = -1;
+			result->tree = NULL;
+			strbuf_release(&merge_base_abbrev);
+			return;
+		}
+
+		merged_merge_bases = make_virtual_commit(opt->repo, inner.tree,
+							 "merged tree");
+		commit_list_insert(prev, &merged_merge_bases->parents);
+		commit_list_insert(iter->item,
+				   &merged_merge_bases->parents->next);
+	}
+	free_commit_list(merge_bases);
+
+	opt->ancestor = ancestor_name;
+	merge_ort_nonrecursive_internal(opt,
+					repo_get_commit_tree(opt->repo,
+							     merged_merge_bases),
+					repo_get_commit_tree(opt->repo, h1),
+					repo_get_commit_tree(opt->repo, h2),
+					result, call_depth);
+	strbuf_release(&merge_base_abbrev);
+	opt->ancestor = NULL;  /* avoid accidental re-use of opt->ancestor */
+}
+
+void merge_incore_recursive(struct merge_options *opt,
+			    struct commit_list *merge_bases,
+			    struct commit *side1,
+			    struct commit *side2,
+			    struct merge_result *result)
+{
+	assert(opt->branch1 && opt->branch2);
+	assert(!opt->priv);
+
+	merge_ort_internal(opt, merge_bases, side1, side2, result, 0);
+}
+
+static int checkout(struct merge_options *opt,
+		    struct tree *prev, struct tree *next)
+{
+	struct unpack_trees_options unpack_opts;
+	struct tree_desc trees[2];
+	struct strbuf sb = STRBUF_INIT;
+	int ret;
+
+	/* Sanity check on repo state; index must match head */
+	if (repo_index_has_changes(opt->repo, prev, &sb)) {
+		error(_("Your local changes to the following files would be "
+			"overwritten by merge:\n  %s"), sb.buf);
+		strbuf_release(&sb);
+		return -1;
+	}
+
+	memset(&unpack_opts, 0, sizeof(unpack_opts));
+	unpack_opts.head_idx = -1;
+	unpack_opts.src_index = opt->repo->index;
+	unpack_opts.dst_index = opt->repo->index;
+	setup_unpack_trees_porcelain(&unpack_opts, "merge");
+	unpack_opts.initial_checkout = is_index_unborn(opt->repo->index);
+	unpack_opts.update = 1;
+	unpack_opts.merge = 1;
+	unpack_opts.verbose_update = (opt->verbosity > 2);
+	unpack_opts.fn = twoway_merge;
+
+	parse_tree(prev);
+	init_tree_desc(&trees[0], prev->buffer, prev->size);
+	parse_tree(next);
+	init_tree_desc(&trees[1], next->buffer, next->size);
+
+	ret = unpack_trees(2, trees, &unpack_opts);
+	clear_unpack_trees_porcelain(&unpack_opts);
+	return ret;
+}
+
+static int record_conflicted_index_entries(struct merge_ort_state *st)
+{
+	struct index_state *istate = st->opt->repo->index;
+	struct hashmap_iter iter;
+	struct merge_entry *e;
+
+	hashmap_for_each_entry(&st->paths, &iter, e, ent) {
+		const char *path = e->result_path ? e->result_path : e->path;
+		int i;
+
+		if (e->clean)
+			continue;
+
+		remove_file_from_index(istate, path);
+		for (i = 0; i < 3; i++) {
+			struct cache_entry *ce;
+
+			if (!e->stages[i].mode)
+				continue;
+			ce = make_cache_entry(istate, e->stages[i].mode,
+					      &e->stages[i].oid, path, i + 1, 0);
+			if (!ce)
+				return error(_("add_cacheinfo failed for path '%s'"),
+					     path);
+			if (add_index_entry(istate, ce,
+					    ADD_CACHE_OK_TO_ADD |
+					    ADD_CACHE_OK_TO_REPLACE |
+					    ADD_CACHE_SKIP_DFCHECK))
+				return error(_("add_cacheinfo failed for path '%s'"),
+					     path);
+		}
+	}
+	return 0;
+}
+
+void merge_switch_to_result(struct merge_options *opt,
+			    struct tree *head,
+			    struct merge_result *result,
+			    int update_worktree_and_index,
+			    int display_update_msgs)
+{
+	struct merge_ort_state *st = result->priv;
+
+	if (result->clean >= 0 && update_worktree_and_index) {
+		if (checkout(opt, head, result->tree) ||
+		    record_conflicted_index_entries(st))
+			result->clean = -1;
+	}
+
+	if (display_update_msgs) {
+		if (st && st->needed_rename_limit && show(st, 2))
+			diff_warn_rename_limit("merge.renamelimit",
+					       st->needed_rename_limit, 0);
+		flush_output(opt);
+		if (opt->buffer_output < 2)
+			strbuf_release(&opt->obuf);
+	}
+}
+
+void merge_finalize(struct merge_result *result)
+{
+	struct merge_ort_state *st = result->priv;
+
+	if (!st)
+		return;
+	free_merge_entries(st);
+	clear_merge_state(st);
+	string_list_clear(&st->cached_pairs[1], 1);
+	string_list_clear(&st->cached_pairs[2], 1);
+	FREE_AND_NULL(result->priv);
+}
+
+int merge_ort_replaces_recursive(void)
+{
+	const char *algo = getenv("GIT_TEST_MERGE_ALGORITHM");
+
+	return algo && !strcmp(algo, "ort");
+}
@@ -0,0 +1,93 @@
+#ifndef MERGE_ORT_H
+#define MERGE_ORT_H
+
+#include "merge-recursive.h"
+
+struct commit;
+struct commit_list;
+struct tree;
+
+/*
+ * A merge strategy that works on trees alone: the merge is computed in
+ * memory, writing only the merged blobs and trees to the object
+ * database, and the index and working tree are updated once at the end
+ * (if at all), by switching from the tree of HEAD to the result.
+ *
+ * It takes the same options as merge-recursive (see merge-recursive.h),
+ * except that directory renames are not detected.
+ */
+
+struct merge_result {
+	/*
+	 * Whether the merge is clean; see the RETURN VALUES in
+	 * merge-recursive.h.
+	 */
+	int clean;
+
+	/*
+	 * Result of the merge. If there were conflicts, the conflicted
+	 * files contain conflict markers (or are renamed out of the way),
+	 * as they will be checked out.
+	 */
+	struct tree *tree;
+
+	/*
+	 * Data needed by merge_switch_to_result(), and data that can be
+	 * reused by the next merge: when a merge result is passed again to
+	 * merge_incore_nonrecursive(), the renames detected by the
+	 * previous merge are reused where they are still valid, as they
+	 * are when picking consecutive commits onto the result of the
+	 * previous pick. Released by merge_finalize().
+	 */
+	void *priv;
+};
+
+/*
+ * rename-detecting three-way merge of trees, no recursion.
+ *
+ * `result` must be zero-initialized, or hold the result of a previous
+ * merge, which is then replaced.
+ */
+void merge_incore_nonrecursive(struct merge_options *opt,
+			       struct tree *merge_base,
+			       struct tree *side1,
+			       struct tree *side2,
+			       struct merge_result *result);
+
+/*
+ * merge_incore_nonrecursive() with recursive ancestor consolidation.
+ * As with merge_recursive(), `merge_bases` should be ordered from the
+ * oldest to the newest commit, and is consumed; if it is NULL, the
+ * merge bases of `side1` and `side2` are used.
+ */
+void merge_incore_recursive(struct merge_options *opt,
+			    struct commit_list *merge_bases,
+			    struct commit *side1,
+			    struct commit *side2,
+			    struct merge_result *result);
+
+/*
+ * Switch the index and working tree from `head`, which the index must
+ * match, to the result of the merge, recording the conflicted paths as
+ * unmerged entries, and show the messages of the merge (unless
+ * opt->buffer_output is 2, in which case they are left in opt->obuf for
+ * the caller). The caller writes out opt->repo->index.
+ *
+ * Sets result->clean to -1 if the working tree cannot be updated.
+ */
+void merge_switch_to_result(struct merge_options *opt,
+			    struct tree *head,
+			    struct merge_result *result,
+			    int update_worktree_and_index,
+			    int display_update_msgs);
+
+/* Release the data held by `result`, except for result->tree. */
+void merge_finalize(struct merge_result *result);
+
+/*
+ * Whether the "recursive" strategy should use this merge instead, as
+ * requested by GIT_TEST_MERGE_ALGORITHM=ort when running the tests.
+ */
+int merge_ort_replaces_recursive(void);
+
+#endif
@@ -10,6 +10,11 @@
 #include "progress.h"
 #include "trace2.h"
 #include "run-command.h"
+#include "refs.h"
+#include "revision.h"
+#include "list-objects.h"
+#include "pack-objects.h"
+#include "pack-bitmap.h"
 
 #define MIDX_SIGNATURE 0x4d494458 /* "MIDX" */
 #define MIDX_VERSION 1
@@ -21,17 +26,19 @@
 #define MIDX_HEADER_SIZE 12
 #define MIDX_MIN_SIZE (MIDX_HEADER_SIZE + the_hash_algo->rawsz)
 
-#define MIDX_MAX_CHUNKS 5
+#define MIDX_MAX_CHUNKS 6
 #define MIDX_CHUNK_ALIGNMENT 4
 #define MIDX_CHUNKID_PACKNAMES 0x504e414d /* "PNAM" */
 #define MIDX_CHUNKID_OIDFANOUT 0x4f494446 /* "OIDF" */
 #define MIDX_CHUNKID_OIDLOOKUP 0x4f49444c /* "OIDL" */
 #define MIDX_CHUNKID_OBJECTOFFSETS 0x4f4f4646 /* "OOFF" */
 #define MIDX_CHUNKID_LARGEOFFSETS 0x4c4f4646 /* "LOFF" */
+#define MIDX_CHUNKID_REVINDEX 0x52494458 /* "RIDX" */
 #define MIDX_CHUNKLOOKUP_WIDTH (sizeof(uint32_t) + sizeof(uint64_t))
 #define MIDX_CHUNK_FANOUT_SIZE (sizeof(uint32_t) * 256)
 #define MIDX_CHUNK_OFFSET_WIDTH (2 * sizeof(uint32_t))
 #define MIDX_CHUNK_LARGE_OFFSET_WIDTH (sizeof(uint64_t))
+#define MIDX_CHUNK_REVINDEX_WIDTH (sizeof(uint32_t))
 #define MIDX_LARGE_OFFSET_NEEDED 0x80000000
 
 #define PACK_EXPIRED UINT_MAX
@@ -41,6 +48,13 @@ static char *get_midx_filename(const char *object_dir)
 	return xstrfmt("%s/pack/multi-pack-index", object_dir);
 }
 
+static char *midx_bitmap_filename(const char *object_dir,
+				  const unsigned char *hash)
+{
+	return xstrfmt("%s/pack/multi-pack-index-%s.bitmap",
+		       object_dir, hash_to_hex(hash));
+}
+
 struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local)
 {
 	struct multi_pack_index *m = NULL;
@@ -128,6 +142,10 @@ struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local
 				m->chunk_large_offsets = m->data + chunk_offset;
 				break;
 
+			case MIDX_CHUNKID_REVINDEX:
+				m->chunk_revindex = m->data + chunk_offset;
+				break;
+
 			case 0:
 				die(_("terminating multi-pack-index chunk id appears earlier than expected"));
 				break;
@@ -245,7 +263,7 @@ struct object_id *nth_midxed_object_oid(struct object_id *oid,
 	return oid;
 }
 
-static off_t nth_midxed_offset(struct multi_pack_index *m, uint32_t pos)
+off_t nth_midxed_offset(struct multi_pack_index *m, uint32_t pos)
 {
 	const unsigned char *offset_data;
 	uint32_t offset32;
@@ -264,11 +282,86 @@ static off_t nth_midxed_offset(struct multi_pack_index *m, uint32_t pos)
 	return offset32;
 }
 
-static uint32_t nth_midxed_pack_int_id(struct multi_pack_index *m, uint32_t pos)
+uint32_t nth_midxed_pack_int_id(struct multi_pack_index *m, uint32_t pos)
 {
 	return get_be32(m->chunk_object_offsets + pos * MIDX_CHUNK_OFFSET_WIDTH);
 }
 
+/*
+ * Objects of the preferred pack sort before all others in pseudo-pack
+ * order; the remaining packs follow in pack-int-id order.
+ */
+static uint32_t midx_pack_order_key(uint32_t pack_int_id, uint32_t preferred)
+{
+	return pack_int_id == preferred ? 0 : pack_int_id + 1;
+}
+
+int midx_has_revindex(struct multi_pack_index *m)
+{
+	return m->chunk_revindex && m->num_objects;
+}
+
+uint32_t pack_pos_to_midx(struct multi_pack_index *m, uint32_t pos)
+{
+	if (!m->chunk_revindex)
+		BUG("pack_pos_to_midx: multi-pack-index has no reverse index");
+	if (pos >= m->num_objects)
+		BUG("pack_pos_to_midx: out-of-bounds object at %"PRIu32, pos);
+
+	return get_be32(m->chunk_revindex + pos * MIDX_CHUNK_REVINDEX_WIDTH);
+}
+
+uint32_t midx_preferred_pack(struct multi_pack_index *m)
+{
+	return nth_midxed_pack_int_id(m, pack_pos_to_midx(m, 0));
+}
+
+int midx_to_pack_pos(struct multi_pack_index *m, uint32_t at, uint32_t *pos)
+{
+	uint32_t preferred, key, lo = 0, hi = m->num_objects;
+	off_t offset;
+
+	if (!midx_has_revindex(m) || at >= m->num_objects)
+		return -1;
+
+	preferred = midx_preferred_pack(m);
+	key = midx_pack_order_key(nth_midxed_pack_int_id(m, at), preferred);
+	offset = nth_midxed_offset(m, at);
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		uint32_t n = pack_pos_to_midx(m, mi);
+		uint32_t mi_key;
+		off_t mi_offset;
+
+		if (n == at) {
+			*pos = mi;
+			return 0;
+		}
+
+		mi_key = midx_pack_order_key(nth_midxed_pack_int_id(m, n),
+					     preferred);
+		mi_offset = nth_midxed_offset(m, n);
+
+		if (key < mi_key || (key == mi_key && offset < mi_offset))
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+
+	return -1;
+}
+
+const unsigned char *get_midx_checksum(struct multi_pack_index *m)
+{
+	return m->data + m->data_len - the_hash_algo->rawsz;
+}
+
+char *get_midx_bitmap_filename(struct multi_pack_index *m)
+{
+	return midx_bitmap_filename(m->object_dir, get_midx_checksum(m));
+}
+
 static int nth_midxed_pack_entry(struct repository *r,
 				 struct multi_pack_index *m,
 				 struct pack_entry *e,
@@ -492,6 +585,7 @@ struct pack_midx_entry {
 	uint32_t pack_int_id;
 	time_t pack_mtime;
 	uint64_t offset;
+	unsigned preferred : 1;
 };
 
 static int midx_oid_compare(const void *_a, const void *_b)
@@ -503,6 +597,12 @@ static int midx_oid_compare(const void *_a, const void *_b)
 	if (cmp)
 		return cmp;
 
+	/* the preferred pack wins all ties, regardless of its mtime */
+	if (a->preferred > b->preferred)
+		return -1;
+	else if (a->preferred < b->preferred)
+		return 1;
+
 	if (a->pack_mtime > b->pack_mtime)
 		return -1;
 	else if (a->pack_mtime < b->pack_mtime)
@@ -524,13 +624,15 @@ static int nth_midxed_pack_midx_entry(struct multi_pack_index *m,
 
 	/* consider objects in midx to be from "old" packs */
 	e->pack_mtime = 0;
+	e->preferred = 0;
 	return 0;
 }
 
 static void fill_pack_entry(uint32_t pack_int_id,
 			    struct packed_git *p,
 			    uint32_t cur_object,
-			    struct pack_midx_entry *entry)
+			    struct pack_midx_entry *entry,
+			    int preferred)
 {
 	if (nth_packed_object_id(&entry->oid, p, cur_object) < 0)
 		die(_("failed to locate object %d in packfile"), cur_object);
@@ -539,6 +641,7 @@ static void fill_pack_entry(uint32_t pack_int_id,
 	entry->pack_mtime = p->mtime;
 
 	entry->offset = nth_packed_object_offset(p, cur_object);
+	entry->preferred = !!preferred;
 }
 
 /*
@@ -550,12 +653,14 @@ static void fill_pack_entry(uint32_t pack_int_id,
  * tables to group the data, copy to a local array, then sort.
  *
  * Copy only the de-duplicated entries (selected by most-recent modified time
- * of a packfile containing the object).
+ * of a packfile containing the object, unless it is also found in the
+ * preferred pack, which always wins).
  */
 static struct pack_midx_entry *get_sorted_entries(struct multi_pack_index *m,
 						  struct pack_info *info,
 						  uint32_t nr_packs,
-						  uint32_t *nr_objects)
+						  uint32_t *nr_objects,
+						  int preferred_pack)
 {
 	uint32_t cur_fanout, cur_pack, cur_object;
 	uint32_t alloc_fanout, alloc_objects, total_objects = 0;
@@ -605,7 +710,9 @@ static struct pack_midx_entry *get_sorted_entries(struct multi_pack_index *m,
 
 			for (cur_object = start; cur_object < end; cur_object++) {
 				ALLOC_GROW(entries_by_fanout, nr_fanout + 1, alloc_fanout);
-				fill_pack_entry(cur_pack, info[cur_pack].p, cur_object, &entries_by_fanout[nr_fanout]);
+				fill_pack_entry(cur_pack, info[cur_pack].p, cur_object,
+						&entries_by_fanout[nr_fanout],
+						preferred_pack == cur_pack);
 				nr_fanout++;
 			}
 		}
@@ -785,8 +892,278 @@ static size_t write_midx_large_offsets(struct hashfile *f, uint32_t nr_large_off
 	return written;
 }
 
+struct midx_pack_order_data {
+	uint32_t nr;
+	uint32_t key;
+	uint64_t offset;
+};
+
+static int midx_pack_order_cmp(const void *va, const void *vb)
+{
+	const struct midx_pack_order_data *a = va, *b = vb;
+
+	if (a->key != b->key)
+		return a->key < b->key ? -1 : 1;
+	if (a->offset != b->offset)
+		return a->offset < b->offset ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Compute the pseudo-pack order of the objects in "entries": the result
+ * maps each position in that order to the object's position in the MIDX.
+ */
+static uint32_t *midx_pack_order(struct pack_midx_entry *entries,
+				 uint32_t nr_entries,
+				 uint32_t *pack_perm,
+				 uint32_t preferred)
+{
+	struct midx_pack_order_data *data;
+	uint32_t *pack_order;
+	uint32_t i;
+
+	ALLOC_ARRAY(data, nr_entries);
+	for (i = 0; i < nr_entries; i++) {
+		struct pack_midx_entry *e = &entries[i];
+		data[i].nr = i;
+		data[i].key = midx_pack_order_key(pack_perm[e->pack_int_id],
+						  preferred);
+		data[i].offset = e->offset;
+	}
+
+	QSORT(data, nr_entries, midx_pack_order_cmp);
+
+	ALLOC_ARRAY(pack_order, nr_entries);
+	for (i = 0; i < nr_entries; i++)
+		pack_order[i] = data[i].nr;
+
+	free(data);
+	return pack_order;
+}
+
+static size_t write_midx_revindex(struct hashfile *f, uint32_t *pack_order,
+				  uint32_t nr_objects)
+{
+	uint32_t i;
+
+	for (i = 0; i < nr_objects; i++)
+		hashwrite_be32(f, pack_order[i]);
+
+	return nr_objects * MIDX_CHUNK_REVINDEX_WIDTH;
+}
+
+struct midx_bitmap_data {
+	struct packing_data *pdata;
+	struct commit **commits;
+	uint32_t commits_nr, commits_alloc;
+	int missing;
+};
+
+static void midx_bitmap_show_commit(struct commit *commit, void *_data)
+{
+	struct midx_bitmap_data *data = _data;
+
+	if (!packlist_find(data->pdata, &commit->object.oid)) {
+		if (!data->missing)
+			error(_("commit %s is not in the multi-pack-index"),
+			      oid_to_hex(&commit->object.oid));
+		data->missing = 1;
+		return;
+	}
+
+	ALLOC_GROW(data->commits, data->commits_nr + 1, data->commits_alloc);
+	data->commits[data->commits_nr++] = commit;
+}
+
+static void midx_bitmap_show_object(struct object *obj, const char *name,
+				    void *_data)
+{
+	struct midx_bitmap_data *data = _data;
+	struct object_entry *entry = packlist_find(data->pdata, &obj->oid);
+
+	if (!entry) {
+		if (!data->missing)
+			error(_("object %s is not in the multi-pack-index"),
+			      oid_to_hex(&obj->oid));
+		data->missing = 1;
+		return;
+	}
+
+	if (name && !entry->hash)
+		entry->hash = pack_name_hash(name);
+}
+
+static int add_ref_to_midx_bitmap_walk(const char *refname,
+				       const struct object_id *oid,
+				       int flag, void *cb_data)
+{
+	struct rev_info *revs = cb_data;
+	struct object *object;
+
+	if ((flag & REF_ISSYMREF) && (flag & REF_ISBROKEN))
+		return 0;
+
+	object = parse_object_or_die(oid, refname);
+	add_pending_object(revs, object, refname);
+	return 0;
+}
+
+/*
+ * Write a reachability bitmap whose bit positions follow the
+ * pseudo-pack order of the MIDX we just wrote. Like a single-pack
+ * bitmap, this requires that every object reachable from our refs is
+ * contained in the MIDX.
+ */
+static int write_midx_bitmap(const char *object_dir,
+			     const unsigned char *midx_hash,
+			     struct pack_midx_entry *entries,
+			     uint32_t nr_entries,
+			     uint32_t *pack_order,
+			     unsigned flags)
+{
+	struct packing_data pdata;
+	struct pack_idx_entry **index;
+	uint32_t *midx_to_pack;
+	struct midx_bitmap_data data;
+	struct rev_info revs;
+	uint16_t options = 0;
+	char *bitmap_name;
+	int hash_cache = 1;
+	uint32_t i;
+	int result = 0;
+
+	memset(&pdata, 0, sizeof(pdata));
+	prepare_packing_data(the_repository, &pdata);
+
+	/*
+	 * Allocate the entries in pseudo-pack order, so that their
+	 * positions in "pdata" are the bit positions of the bitmap.
+	 */
+	for (i = 0; i < nr_entries; i++)
+		packlist_alloc(&pdata, &entries[pack_order[i]].oid);
+
+	memset(&data, 0, sizeof(data));
+	data.pdata = &pdata;
+
+	repo_init_revisions(the_repository, &revs, NULL);
+	revs.tag_objects = 1;
+	revs.tree_objects = 1;
+	revs.blob_objects = 1;
+	for_each_ref(add_ref_to_midx_bitmap_walk, &revs);
+
+	if (prepare_revision_walk(&revs))
+		die(_("revision walk setup failed"));
+	traverse_commit_list(&revs, midx_bitmap_show_commit,
+			     midx_bitmap_show_object, &data);
+	reset_revision_walk();
+
+	if (data.missing) {
+		result = error(_("could not write multi-pack bitmap: "
+				 "reachable objects are missing from the "
+				 "multi-pack-index"));
+		goto cleanup;
+	}
+
+	ALLOC_ARRAY(midx_to_pack, nr_entries);
+	ALLOC_ARRAY(index, nr_entries);
+	for (i = 0; i < nr_entries; i++) {
+		midx_to_pack[pack_order[i]] = i;
+		index[i] = &pdata.objects[i].idx;
+	}
+
+	bitmap_writer_show_progress(flags & MIDX_PROGRESS);
+	bitmap_writer_build_type_index(&pdata, index, nr_entries);
+
+	/* the bitmap file itself refers to objects in MIDX order */
+	for (i = 0; i < nr_entries; i++)
+		index[i] = &pdata.objects[midx_to_pack[i]].idx;
+
+	bitmap_writer_select_commits(data.commits, data.commits_nr, -1);
+	bitmap_writer_build(&pdata);
+
+	git_config_get_bool("pack.writebitmaphashcache", &hash_cache);
+	if (hash_cache)
+		options |= BITMAP_OPT_HASH_CACHE;
+
+	bitmap_name = midx_bitmap_filename(object_dir, midx_hash);
+	bitmap_writer_set_checksum((unsigned char *)midx_hash);
+	bitmap_writer_finish(index, nr_entries, bitmap_name, options);
+
+	free(bitmap_name);
+	free(index);
+	free(midx_to_pack);
+
+cleanup:
+	free(data.commits);
+	free(pdata.objects);
+	free(pdata.index);
+	free(pdata.in_pack_by_idx);
+	free(pdata.in_pack);
+	free(pdata.in_pack_pos);
+	return result;
+}
+
+struct clear_midx_data {
+	char *keep;
+	const char *ext;
+};
+
+static void clear_midx_file_ext(const char *full_path, size_t full_path_len,
+				const char *file_name, void *_data)
+{
+	struct clear_midx_data *data = _data;
+
+	if (!(starts_with(file_name, "multi-pack-index-") &&
+	      ends_with(file_name, data->ext)))
+		return;
+	if (data->keep && !strcmp(data->keep, file_name))
+		return;
+
+	if (unlink(full_path))
+		die_errno(_("failed to remove %s"), full_path);
+}
+
+/*
+ * Remove the "multi-pack-index-<hash><ext>" files in the pack directory
+ * of "object_dir", except for the one belonging to "keep_hash", if any.
+ */
+static void clear_midx_files_ext(const char *object_dir, const char *ext,
+				 const unsigned char *keep_hash)
+{
+	struct clear_midx_data data;
+	memset(&data, 0, sizeof(struct clear_midx_data));
+
+	if (keep_hash)
+		data.keep = xstrfmt("multi-pack-index-%s%s",
+				    hash_to_hex(keep_hash), ext);
+	data.ext = ext;
+
+	for_each_file_in_pack_dir(object_dir, clear_midx_file_ext, &data);
+
+	free(data.keep);
+}
+
+static struct packed_git *open_pack_for_midx_write(const char *object_dir,
+						   const char *pack_name)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct packed_git *p;
+
+	strbuf_addf(&path, "%s/pack/%s", object_dir, pack_name);
+	p = add_packed_git(path.buf, path.len, 0);
+	if (p && open_pack_index(p)) {
+		close_pack(p);
+		FREE_AND_NULL(p);
+	}
+	strbuf_release(&path);
+
+	return p;
+}
+
 static int write_midx_internal(const char *object_dir, struct multi_pack_index *m,
-			       struct string_list *packs_to_drop, unsigned flags)
+			       struct string_list *packs_to_drop,
+			       const char *preferred_pack_name,
+			       unsigned flags)
 {
 	unsigned char cur_chunk, num_chunks = 0;
 	char *midx_name;
@@ -805,6 +1182,10 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 	int pack_name_concat_len = 0;
 	int dropped_packs = 0;
 	int result = 0;
+	int reuse_midx = !(flags & MIDX_WRITE_BITMAP) && !preferred_pack_name;
+	int preferred_pack = -1;
+	uint32_t *pack_order = NULL;
+	unsigned char midx_hash[GIT_MAX_RAWSZ];
 
 	midx_name = get_midx_filename(object_dir);
 	if (safe_create_leading_directories(midx_name)) {
@@ -831,6 +1212,20 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 			packs.info[packs.nr].pack_name = xstrdup(packs.m->pack_names[i]);
 			packs.info[packs.nr].p = NULL;
 			packs.info[packs.nr].expired = 0;
+
+			/*
+			 * Honoring a preferred pack requires seeing all of its
+			 * objects, including those the existing MIDX resolved
+			 * to other packs, so read every pack from scratch.
+			 */
+			if (!reuse_midx) {
+				packs.info[packs.nr].p =
+					open_pack_for_midx_write(object_dir,
+								 packs.m->pack_names[i]);
+				if (!packs.info[packs.nr].p)
+					die(_("could not load pack %s"),
+					    packs.m->pack_names[i]);
+			}
 			packs.nr++;
 		}
 	}
@@ -844,10 +1239,53 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 	for_each_file_in_pack_dir(object_dir, add_pack_to_midx, &packs);
 	stop_progress(&packs.progress);
 
-	if (packs.m && packs.nr == packs.m->num_packs && !packs_to_drop)
+	if (packs.m && packs.nr == packs.m->num_packs && !packs_to_drop &&
+	    reuse_midx)
 		goto cleanup;
 
-	entries = get_sorted_entries(packs.m, packs.info, packs.nr, &nr_entries);
+	if (preferred_pack_name) {
+		for (i = 0; i < packs.nr; i++) {
+			if (!cmp_idx_or_pack_name(preferred_pack_name,
+						  packs.info[i].pack_name)) {
+				preferred_pack = i;
+				break;
+			}
+		}
+
+		if (preferred_pack < 0)
+			warning(_("unknown preferred pack: '%s'"),
+				preferred_pack_name);
+	}
+
+	if (preferred_pack < 0 && (flags & MIDX_WRITE_BITMAP)) {
+		/*
+		 * A bitmap needs every object of the first pack in
+		 * pseudo-pack order to be selected from that pack, so pick
+		 * one: the oldest non-empty pack is most likely to be the
+		 * largest one, too.
+		 */
+		for (i = 0; i < packs.nr; i++) {
+			struct packed_git *p = packs.info[i].p;
+
+			if (!p->num_objects)
+				continue;
+			if (preferred_pack < 0 ||
+			    p->mtime < packs.info[preferred_pack].p->mtime)
+				preferred_pack = i;
+		}
+	}
+
+	if (preferred_pack >= 0 && (flags & MIDX_WRITE_BITMAP) &&
+	    !packs.info[preferred_pack].p->num_objects) {
+		error(_("cannot select preferred pack %s with no objects"),
+		      packs.info[preferred_pack].pack_name);
+		result = 1;
+		goto cleanup;
+	}
+
+	entries = get_sorted_entries(reuse_midx ? packs.m : NULL,
+				     packs.info, packs.nr, &nr_entries,
+				     preferred_pack);
 
 	for (i = 0; i < nr_entries; i++) {
 		if (entries[i].offset > 0x7fffffff)
@@ -907,6 +1345,10 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 			pack_name_concat_len += strlen(packs.info[i].pack_name) + 1;
 	}
 
+	if ((flags & MIDX_WRITE_BITMAP) && nr_entries)
+		pack_order = midx_pack_order(entries, nr_entries, pack_perm,
+					     pack_perm[preferred_pack]);
+
 	if (pack_name_concat_len % MIDX_CHUNK_ALIGNMENT)
 		pack_name_concat_len += MIDX_CHUNK_ALIGNMENT -
 					(pack_name_concat_len % MIDX_CHUNK_ALIGNMENT);
@@ -919,7 +1361,11 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 		close_midx(packs.m);
 
 	cur_chunk = 0;
-	num_chunks = large_offsets_needed ? 5 : 4;
+	num_chunks = 4;
+	if (large_offsets_needed)
+		num_chunks++;
+	if (pack_order)
+		num_chunks++;
 
 	if (packs.nr - dropped_packs == 0) {
 		error(_("no pack files to index."));
@@ -954,6 +1400,14 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 					   num_large_offsets * MIDX_CHUNK_LARGE_OFFSET_WIDTH;
 	}
 
+	if (pack_order) {
+		chunk_ids[cur_chunk] = MIDX_CHUNKID_REVINDEX;
+
+		cur_chunk++;
+		chunk_offsets[cur_chunk] = chunk_offsets[cur_chunk - 1] +
+					   nr_entries * MIDX_CHUNK_REVINDEX_WIDTH;
+	}
+
 	chunk_ids[cur_chunk] = 0;
 
 	for (i = 0; i <= num_chunks; i++) {
@@ -1004,6 +1458,10 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 				written += write_midx_large_offsets(f, num_large_offsets, entries, nr_entries);
 				break;
 
+			case MIDX_CHUNKID_REVINDEX:
+				written += write_midx_revindex(f, pack_order, nr_entries);
+				break;
+
 			default:
 				BUG("trying to write unknown chunk id %"PRIx32,
 				    chunk_ids[i]);
@@ -1018,9 +1476,18 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 		    written,
 		    chunk_offsets[num_chunks]);
 
-	finalize_hashfile(f, NULL, CSUM_FSYNC | CSUM_HASH_IN_STREAM);
+	finalize_hashfile(f, midx_hash, CSUM_FSYNC | CSUM_HASH_IN_STREAM);
 	commit_lock_file(&lk);
 
+	if (pack_order &&
+	    write_midx_bitmap(object_dir, midx_hash, entries, nr_entries,
+			      pack_order, flags))
+		result = 1;
+
+	/* bitmaps of any earlier MIDX no longer match its object order */
+	clear_midx_files_ext(object_dir, ".bitmap",
+			     pack_order && !result ? midx_hash : NULL);
+
 cleanup:
 	for (i = 0; i < packs.nr; i++) {
 		if (packs.info[i].p) {
@@ -1033,13 +1500,16 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 	free(packs.info);
 	free(entries);
 	free(pack_perm);
+	free(pack_order);
 	free(midx_name);
 	return result;
 }
 
-int write_midx_file(const char *object_dir, unsigned flags)
+int write_midx_file(const char *object_dir, const char *preferred_pack_name,
+		    unsigned flags)
 {
-	return write_midx_internal(object_dir, NULL, NULL, flags);
+	return write_midx_internal(object_dir, NULL, NULL, preferred_pack_name,
+				   flags);
 }
 
 void clear_midx_file(struct repository *r)
@@ -1056,6 +1526,8 @@ void clear_midx_file(struct repository *r)
 		die(_("failed to clear multi-pack-index at %s"), midx);
 	}
 
+	clear_midx_files_ext(r->objects->odb->path, ".bitmap", NULL);
+
 	free(midx);
 }
 
@@ -1214,6 +1686,38 @@ int verify_midx_file(struct repository *r, const char *object_dir, unsigned flag
 
 	free(pairs);
 
+	if (midx_has_revindex(m)) {
+		uint32_t preferred = midx_preferred_pack(m);
+
+		if (flags & MIDX_PROGRESS)
+			progress = start_sparse_progress(_("Verifying reverse index"),
+							 m->num_objects - 1);
+		for (i = 0; i < m->num_objects - 1; i++) {
+			uint32_t a = pack_pos_to_midx(m, i);
+			uint32_t b = pack_pos_to_midx(m, i + 1);
+			uint32_t a_key, b_key;
+
+			if (a >= m->num_objects || b >= m->num_objects) {
+				midx_report(_("reverse index entry out of range at position %d"),
+					    i);
+				break;
+			}
+
+			a_key = midx_pack_order_key(nth_midxed_pack_int_id(m, a),
+						    preferred);
+			b_key = midx_pack_order_key(nth_midxed_pack_int_id(m, b),
+						    preferred);
+			if (a_key > b_key ||
+			    (a_key == b_key &&
+			     nth_midxed_offset(m, a) >= nth_midxed_offset(m, b)))
+				midx_report(_("reverse index out of order at position %d"),
+					    i);
+
+			midx_display_sparse_progress(progress, i + 1);
+		}
+		stop_progress(&progress);
+	}
+
 	return verify_midx_error;
 }
 
@@ -1267,7 +1771,7 @@ int expire_midx_packs(struct repository *r, const char *object_dir, unsigned fla
 	free(count);
 
 	if (packs_to_drop.nr)
-		result = write_midx_internal(object_dir, m, &packs_to_drop, flags);
+		result = write_midx_internal(object_dir, m, &packs_to_drop, NULL, flags);
 
 	string_list_clear(&packs_to_drop, 0);
 	return result;
@@ -1422,7 +1926,7 @@ int midx_repack(struct repository *r, const char *object_dir, size_t batch_size,
 		goto cleanup;
 	}
 
-	result = write_midx_internal(object_dir, m, NULL, flags);
+	result = write_midx_internal(object_dir, m, NULL, NULL, flags);
 	m = NULL;
 
 cleanup:
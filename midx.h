@@ -29,6 +29,7 @@ struct multi_pack_index {
 	const unsigned char *chunk_oid_lookup;
 	const unsigned char *chunk_object_offsets;
 	const unsigned char *chunk_large_offsets;
+	const unsigned char *chunk_revindex;
 
 	const char **pack_names;
 	struct packed_git **packs;
@@ -36,6 +37,7 @@ struct multi_pack_index {
 };
 
 #define MIDX_PROGRESS     (1 << 0)
+#define MIDX_WRITE_BITMAP (1 << 1)
 
 struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local);
 int prepare_midx_pack(struct repository *r, struct multi_pack_index *m, uint32_t pack_int_id);
@@ -43,11 +45,27 @@ int bsearch_midx(const struct object_id *oid, struct multi_pack_index *m, uint32
 struct object_id *nth_midxed_object_oid(struct object_id *oid,
 					struct multi_pack_index *m,
 					uint32_t n);
+off_t nth_midxed_offset(struct multi_pack_index *m, uint32_t pos);
+uint32_t nth_midxed_pack_int_id(struct multi_pack_index *m, uint32_t pos);
 int fill_midx_entry(struct repository *r, const struct object_id *oid, struct pack_entry *e, struct multi_pack_index *m);
 int midx_contains_pack(struct multi_pack_index *m, const char *idx_or_pack_name);
 int prepare_multi_pack_index_one(struct repository *r, const char *object_dir, int local);
 
-int write_midx_file(const char *object_dir, unsigned flags);
+/*
+ * The "pseudo-pack" order of a multi-pack-index lists its objects as if
+ * all of its packs were concatenated, preferred pack first and the rest
+ * by pack-int-id, each of them in offset order. It is only available
+ * when the MIDX carries a reverse index chunk (see midx_has_revindex()),
+ * which is written along with a MIDX bitmap.
+ */
+int midx_has_revindex(struct multi_pack_index *m);
+uint32_t pack_pos_to_midx(struct multi_pack_index *m, uint32_t pos);
+int midx_to_pack_pos(struct multi_pack_index *m, uint32_t at, uint32_t *pos);
+uint32_t midx_preferred_pack(struct multi_pack_index *m);
+const unsigned char *get_midx_checksum(struct multi_pack_index *m);
+char *get_midx_bitmap_filename(struct multi_pack_index *m);
+
+int write_midx_file(const char *object_dir, const char *preferred_pack_name, unsigned flags);
 void clear_midx_file(struct repository *r);
 int verify_midx_file(struct repository *r, const char *object_dir, unsigned flags);
 int expire_midx_packs(struct repository *r, const char *object_dir, unsigned flags);
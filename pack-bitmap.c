@@ -10,6 +10,7 @@
 #include "pack-revindex.h"
 #include "pack-objects.h"
 #include "packfile.h"
+#include "midx.h"
 #include "repository.h"
 #include "object-store.h"
 #include "list-objects-filter-options.h"
@@ -28,15 +29,26 @@ struct stored_bitmap {
 /*
  * The active bitmap index for a repository. By design, repositories only have
  * a single bitmap index available (the index for the biggest packfile in
- * the repository), since bitmap indexes need full closure.
+ * the repository, or for its multi-pack-index), since bitmap indexes need
+ * full closure.
  *
  * If there is more than one bitmap index available (e.g. because of alternates),
  * the active bitmap index is the largest one.
  */
 struct bitmap_index {
-	/* Packfile to which this bitmap index belongs to */
+	/*
+	 * Packfile to which this bitmap index belongs to, or NULL if it
+	 * belongs to `midx` instead.
+	 */
 	struct packed_git *pack;
 
+	/*
+	 * Multi-pack-index to which this bitmap index belongs to. Bit
+	 * positions then follow the MIDX "pseudo-pack" order, i.e. its
+	 * preferred pack first, then the others, each in offset order.
+	 */
+	struct multi_pack_index *midx;
+
 	/*
 	 * Mark the first `reuse_objects` in the packfile as reused:
 	 * they will be sent as-is without using them for repacking
@@ -92,8 +104,66 @@ struct bitmap_index {
 
 	/* Version of the bitmap index */
 	unsigned int version;
+
+	/* Checksum of the pack or MIDX this bitmap belongs to; points into map */
+	const unsigned char *checksum;
 };
 
+static int bitmap_is_midx(struct bitmap_index *bitmap_git)
+{
+	return !!bitmap_git->midx;
+}
+
+static uint32_t bitmap_num_objects(struct bitmap_index *bitmap_git)
+{
+	if (bitmap_is_midx(bitmap_git))
+		return bitmap_git->midx->num_objects;
+	return bitmap_git->pack->num_objects;
+}
+
+/*
+ * Find the object at bit position "pos" (which must be less than
+ * bitmap_num_objects()), filling in its name, pack and offset for the
+ * non-NULL out-parameters. Returns the position of the object in the
+ * pack or MIDX index, which is how the name-hash cache is ordered.
+ */
+static uint32_t bitmap_nth_object(struct bitmap_index *bitmap_git,
+				  uint32_t pos,
+				  struct object_id *oid,
+				  struct packed_git **pack,
+				  off_t *offset)
+{
+	uint32_t index_pos;
+
+	if (bitmap_is_midx(bitmap_git)) {
+		struct multi_pack_index *m = bitmap_git->midx;
+		uint32_t midx_pos = pack_pos_to_midx(m, pos);
+
+		if (oid)
+			nth_midxed_object_oid(oid, m, midx_pos);
+		if (pack) {
+			uint32_t pack_int_id = nth_midxed_pack_int_id(m, midx_pos);
+
+			if (prepare_midx_pack(the_repository, m, pack_int_id))
+				die(_("could not open pack %s"),
+				    m->pack_names[pack_int_id]);
+			*pack = m->packs[pack_int_id];
+		}
+		if (offset)
+			*offset = nth_midxed_offset(m, midx_pos);
+		return midx_pos;
+	}
+
+	index_pos = pack_pos_to_index(bitmap_git->pack, pos);
+	if (oid)
+		nth_packed_object_id(oid, bitmap_git->pack, index_pos);
+	if (pack)
+		*pack = bitmap_git->pack;
+	if (offset)
+		*offset = pack_pos_to_offset(bitmap_git->pack, pos);
+	return index_pos;
+}
+
 static struct ewah_bitmap *lookup_stored_bitmap(struct stored_bitmap *st)
 {
 	struct ewah_bitmap *parent;
@@ -159,11 +229,12 @@ static int load_bitmap_header(struct bitmap_index *index)
 
 		if (flags & BITMAP_OPT_HASH_CACHE) {
 			unsigned char *end = index->map + index->map_size - the_hash_algo->rawsz;
-			index->hashes = ((uint32_t *)end) - index->pack->num_objects;
+			index->hashes = ((uint32_t *)end) - bitmap_num_objects(index);
 		}
 	}
 
 	index->entry_count = ntohl(header->entry_count);
+	index->checksum = header->checksum;
 	index->map_pos += sizeof(*header) - GIT_MAX_RAWSZ + the_hash_algo->rawsz;
 	return 0;
 }
@@ -228,7 +299,10 @@ static int load_bitmap_entries_v1(struct bitmap_index *index)
 		xor_offset = read_u8(index->map, &index->map_pos);
 		flags = read_u8(index->map, &index->map_pos);
 
-		nth_packed_object_id(&oid, index->pack, commit_idx_pos);
+		if (bitmap_is_midx(index))
+			nth_midxed_object_oid(&oid, index->midx, commit_idx_pos);
+		else
+			nth_packed_object_id(&oid, index->pack, commit_idx_pos);
 
 		bitmap = read_bitmap_1(index);
 		if (!bitmap)
@@ -260,6 +334,62 @@ static char *pack_bitmap_filename(struct packed_git *p)
 	return xstrfmt("%.*s.bitmap", (int)len, p->pack_name);
 }
 
+static int open_midx_bitmap_1(struct bitmap_index *bitmap_git,
+			      struct multi_pack_index *midx)
+{
+	int fd;
+	struct stat st;
+	char *idx_name;
+
+	idx_name = get_midx_bitmap_filename(midx);
+	fd = git_open(idx_name);
+	free(idx_name);
+
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st)) {
+		close(fd);
+		return -1;
+	}
+
+	if (bitmap_git->pack || bitmap_git->midx) {
+		warning("ignoring extra bitmap file for multi-pack-index in %s",
+			midx->object_dir);
+		close(fd);
+		return -1;
+	}
+
+	bitmap_git->midx = midx;
+	bitmap_git->map_size = xsize_t(st.st_size);
+	bitmap_git->map = xmmap(NULL, bitmap_git->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	bitmap_git->map_pos = 0;
+	close(fd);
+
+	if (load_bitmap_header(bitmap_git) < 0)
+		goto cleanup;
+
+	if (!hasheq(get_midx_checksum(midx), bitmap_git->checksum)) {
+		error("checksum doesn't match in multi-pack-index and bitmap");
+		goto cleanup;
+	}
+
+	if (!midx_has_revindex(midx)) {
+		error("multi-pack-index bitmap without a reverse index");
+		goto cleanup;
+	}
+
+	return 0;
+
+cleanup:
+	munmap(bitmap_git->map, bitmap_git->map_size);
+	bitmap_git->map = NULL;
+	bitmap_git->map_size = 0;
+	bitmap_git->midx = NULL;
+	bitmap_git->hashes = NULL;
+	return -1;
+}
+
 static int open_pack_bitmap_1(struct bitmap_index *bitmap_git, struct packed_git *packfile)
 {
 	int fd;
@@ -281,7 +411,7 @@ static int open_pack_bitmap_1(struct bitmap_index *bitmap_git, struct packed_git
 		return -1;
 	}
 
-	if (bitmap_git->pack) {
+	if (bitmap_git->pack || bitmap_git->midx) {
 		warning("ignoring extra bitmap file: %s", packfile->pack_name);
 		close(fd);
 		return -1;
@@ -309,7 +439,7 @@ static int load_pack_bitmap(struct bitmap_index *bitmap_git)
 
 	bitmap_git->bitmaps = kh_init_oid_map();
 	bitmap_git->ext_index.positions = kh_init_oid_pos();
-	if (load_pack_revindex(bitmap_git->pack))
+	if (!bitmap_is_midx(bitmap_git) && load_pack_revindex(bitmap_git->pack))
 		goto failed;
 
 	if (!(bitmap_git->commits = read_bitmap_1(bitmap_git)) ||
@@ -353,11 +483,40 @@ static int open_pack_bitmap(struct repository *r,
 	return ret;
 }
 
+static int open_midx_bitmap(struct repository *r,
+			    struct bitmap_index *bitmap_git)
+{
+	struct multi_pack_index *midx;
+
+	assert(!bitmap_git->map);
+
+	for (midx = get_multi_pack_index(r); midx; midx = midx->next) {
+		if (!open_midx_bitmap_1(bitmap_git, midx))
+			return 0;
+	}
+
+	return -1;
+}
+
+/*
+ * Open the bitmap of the multi-pack-index if there is one, and fall back
+ * to the bitmap of a single pack otherwise.
+ */
+static int open_bitmap(struct repository *r,
+		       struct bitmap_index *bitmap_git)
+{
+	assert(!bitmap_git->map);
+
+	if (!open_midx_bitmap(r, bitmap_git))
+		return 0;
+	return open_pack_bitmap(r, bitmap_git);
+}
+
 struct bitmap_index *prepare_bitmap_git(struct repository *r)
 {
 	struct bitmap_index *bitmap_git = xcalloc(1, sizeof(*bitmap_git));
 
-	if (!open_pack_bitmap(r, bitmap_git) && !load_pack_bitmap(bitmap_git))
+	if (!open_bitmap(r, bitmap_git) && !load_pack_bitmap(bitmap_git))
 		return bitmap_git;
 
 	free_bitmap_index(bitmap_git);
@@ -378,7 +537,7 @@ static inline int bitmap_position_extended(struct bitmap_index *bitmap_git,
 
 	if (pos < kh_end(positions)) {
 		int bitmap_pos = kh_value(positions, pos);
-		return bitmap_pos + bitmap_git->pack->num_objects;
+		return bitmap_pos + bitmap_num_objects(bitmap_git);
 	}
 
 	return -1;
@@ -394,10 +553,28 @@ static inline int bitmap_position_packfile(struct bitmap_index *bitmap_git,
 	return find_revindex_position(bitmap_git->pack, offset);
 }
 
+static inline int bitmap_position_midx(struct bitmap_index *bitmap_git,
+				       const struct object_id *oid)
+{
+	uint32_t want, got;
+
+	if (!bsearch_midx(oid, bitmap_git->midx, &want))
+		return -1;
+	if (midx_to_pack_pos(bitmap_git->midx, want, &got) < 0)
+		return -1;
+
+	return got;
+}
+
 static int bitmap_position(struct bitmap_index *bitmap_git,
 			   const struct object_id *oid)
 {
-	int pos = bitmap_position_packfile(bitmap_git, oid);
+	int pos;
+
+	if (bitmap_is_midx(bitmap_git))
+		pos = bitmap_position_midx(bitmap_git, oid);
+	else
+		pos = bitmap_position_packfile(bitmap_git, oid);
 	return (pos >= 0) ? pos : bitmap_position_extended(bitmap_git, oid);
 }
 
@@ -427,7 +604,7 @@ static int ext_index_add_object(struct bitmap_index *bitmap_git,
 		bitmap_pos = kh_value(eindex->positions, hash_pos);
 	}
 
-	return bitmap_pos + bitmap_git->pack->num_objects;
+	return bitmap_pos + bitmap_num_objects(bitmap_git);
 }
 
 struct bitmap_show_data {
@@ -617,7 +794,7 @@ static void show_extended_objects(struct bitmap_index *bitmap_git,
 	for (i = 0; i < eindex->count; ++i) {
 		struct object *obj;
 
-		if (!bitmap_get(objects, bitmap_git->pack->num_objects + i))
+		if (!bitmap_get(objects, bitmap_num_objects(bitmap_git) + i))
 			continue;
 
 		obj = eindex->objects[i];
@@ -682,21 +859,22 @@ static void show_objects_for_type(
 
 		for (offset = 0; offset < BITS_IN_EWORD; ++offset) {
 			struct object_id oid;
-			struct revindex_entry *entry;
-			uint32_t hash = 0;
+			struct packed_git *pack;
+			off_t ofs;
+			uint32_t index_pos, hash = 0;
 
 			if ((word >> offset) == 0)
 				break;
 
 			offset += ewah_bit_ctz64(word >> offset);
 
-			entry = &bitmap_git->pack->revindex[pos + offset];
-			nth_packed_object_id(&oid, bitmap_git->pack, entry->nr);
+			index_pos = bitmap_nth_object(bitmap_git, pos + offset,
+						      &oid, &pack, &ofs);
 
 			if (bitmap_git->hashes)
-				hash = get_be32(bitmap_git->hashes + entry->nr);
+				hash = get_be32(bitmap_git->hashes + index_pos);
 
-			show_reach(&oid, object_type, 0, hash, bitmap_git->pack, entry->offset);
+			show_reach(&oid, object_type, 0, hash, pack, ofs);
 		}
 	}
 }
@@ -708,7 +886,12 @@ static int in_bitmapped_pack(struct bitmap_index *bitmap_git,
 		struct object *object = roots->item;
 		roots = roots->next;
 
-		if (find_pack_entry_one(object->oid.hash, bitmap_git->pack) > 0)
+		if (bitmap_is_midx(bitmap_git)) {
+			uint32_t pos;
+
+			if (bsearch_midx(&object->oid, bitmap_git->midx, &pos))
+				return 1;
+		} else if (find_pack_entry_one(object->oid.hash, bitmap_git->pack) > 0)
 			return 1;
 	}
 
@@ -772,7 +955,7 @@ static void filter_bitmap_blob_none(struct bitmap_index *bitmap_git,
 	 * individually.
 	 */
 	for (i = 0; i < eindex->count; i++) {
-		uint32_t pos = i + bitmap_git->pack->num_objects;
+		uint32_t pos = i + bitmap_num_objects(bitmap_git);
 		if (eindex->objects[i]->type == OBJ_BLOB &&
 		    bitmap_get(to_filter, pos) &&
 		    !bitmap_get(tips, pos))
@@ -785,23 +968,25 @@ static void filter_bitmap_blob_none(struct bitmap_index *bitmap_git,
 static unsigned long get_size_by_pos(struct bitmap_index *bitmap_git,
 				     uint32_t pos)
 {
-	struct packed_git *pack = bitmap_git->pack;
+	uint32_t num_objects = bitmap_num_objects(bitmap_git);
 	unsigned long size;
 	struct object_info oi = OBJECT_INFO_INIT;
 
 	oi.sizep = &size;
 
-	if (pos < pack->num_objects) {
-		struct revindex_entry *entry = &pack->revindex[pos];
-		if (packed_object_info(the_repository, pack,
-				       entry->offset, &oi) < 0) {
+	if (pos < num_objects) {
+		struct packed_git *pack;
+		off_t offset;
+
+		bitmap_nth_object(bitmap_git, pos, NULL, &pack, &offset);
+		if (packed_object_info(the_repository, pack, offset, &oi) < 0) {
 			struct object_id oid;
-			nth_packed_object_id(&oid, pack, entry->nr);
+			bitmap_nth_object(bitmap_git, pos, &oid, NULL, NULL);
 			die(_("unable to get size of %s"), oid_to_hex(&oid));
 		}
 	} else {
 		struct eindex *eindex = &bitmap_git->ext_index;
-		struct object *obj = eindex->objects[pos - pack->num_objects];
+		struct object *obj = eindex->objects[pos - num_objects];
 		if (oid_object_info_extended(the_repository, &obj->oid, &oi, 0) < 0)
 			die(_("unable to get size of %s"), oid_to_hex(&obj->oid));
 	}
@@ -843,7 +1028,7 @@ static void filter_bitmap_blob_limit(struct bitmap_index *bitmap_git,
 	}
 
 	for (i = 0; i < eindex->count; i++) {
-		uint32_t pos = i + bitmap_git->pack->num_objects;
+		uint32_t pos = i + bitmap_num_objects(bitmap_git);
 		if (eindex->objects[i]->type == OBJ_BLOB &&
 		    bitmap_get(to_filter, pos) &&
 		    !bitmap_get(tips, pos) &&
@@ -913,7 +1098,7 @@ struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs,
 	/* try to open a bitmapped pack, but don't parse it yet
 	 * because we may not need to use it */
 	bitmap_git = xcalloc(1, sizeof(*bitmap_git));
-	if (open_pack_bitmap(revs->repo, bitmap_git) < 0)
+	if (open_bitmap(revs->repo, bitmap_git) < 0)
 		goto cleanup;
 
 	for (i = 0; i < revs->pending.nr; ++i) {
@@ -996,22 +1181,20 @@ struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs,
 	return NULL;
 }
 
-static void try_partial_reuse(struct bitmap_index *bitmap_git,
+static void try_partial_reuse(struct packed_git *pack,
 			      size_t pos,
 			      struct bitmap *reuse,
 			      struct pack_window **w_curs)
 {
-	struct revindex_entry *revidx;
-	off_t offset;
+	off_t offset, header;
 	enum object_type type;
 	unsigned long size;
 
-	if (pos >= bitmap_git->pack->num_objects)
+	if (pos >= pack->num_objects)
 		return; /* not actually in the pack */
 
-	revidx = &bitmap_git->pack->revindex[pos];
-	offset = revidx->offset;
-	type = unpack_object_header(bitmap_git->pack, w_curs, &offset, &size);
+	offset = header = pack_pos_to_offset(pack, pos);
+	type = unpack_object_header(pack, w_curs, &offset, &size);
 	if (type < 0)
 		return; /* broken packfile, punt */
 
@@ -1027,11 +1210,11 @@ static void try_partial_reuse(struct bitmap_index *bitmap_git,
 		 * and the normal slow path will complain about it in
 		 * more detail.
 		 */
-		base_offset = get_delta_base(bitmap_git->pack, w_curs,
-					     &offset, type, revidx->offset);
+		base_offset = get_delta_base(pack, w_curs,
+					     &offset, type, header);
 		if (!base_offset)
 			return;
-		base_pos = find_revindex_position(bitmap_git->pack, base_offset);
+		base_pos = find_revindex_position(pack, base_offset);
 		if (base_pos < 0)
 			return;
 
@@ -1070,6 +1253,7 @@ int reuse_partial_packfile_from_bitmap(struct bitmap_index *bitmap_git,
 				       uint32_t *entries,
 				       struct bitmap **reuse_out)
 {
+	struct packed_git *pack;
 	struct bitmap *result = bitmap_git->result;
 	struct bitmap *reuse;
 	struct pack_window *w_curs = NULL;
@@ -1078,12 +1262,29 @@ int reuse_partial_packfile_from_bitmap(struct bitmap_index *bitmap_git,
 
 	assert(result);
 
+	if (bitmap_is_midx(bitmap_git)) {
+		/*
+		 * The preferred pack comes first in pseudo-pack order, and
+		 * none of its objects were resolved to another pack, so its
+		 * bit positions are exactly its own pack positions.
+		 */
+		struct multi_pack_index *m = bitmap_git->midx;
+		uint32_t preferred = midx_preferred_pack(m);
+
+		if (prepare_midx_pack(the_repository, m, preferred))
+			return -1;
+		pack = m->packs[preferred];
+		if (load_pack_revindex(pack))
+			return -1;
+	} else
+		pack = bitmap_git->pack;
+
 	while (i < result->word_alloc && result->words[i] == (eword_t)~0)
 		i++;
 
 	/* Don't mark objects not in the packfile */
-	if (i > bitmap_git->pack->num_objects / BITS_IN_EWORD)
-		i = bitmap_git->pack->num_objects / BITS_IN_EWORD;
+	if (i > pack->num_objects / BITS_IN_EWORD)
+		i = pack->num_objects / BITS_IN_EWORD;
 
 	reuse = bitmap_word_alloc(i);
 	memset(reuse->words, 0xFF, i * sizeof(eword_t));
@@ -1097,7 +1298,7 @@ int reuse_partial_packfile_from_bitmap(struct bitmap_index *bitmap_git,
 				break;
 
 			offset += ewah_bit_ctz64(word >> offset);
-			try_partial_reuse(bitmap_git, pos + offset, reuse, &w_curs);
+			try_partial_reuse(pack, pos + offset, reuse, &w_curs);
 		}
 	}
 
@@ -1114,7 +1315,7 @@ int reuse_partial_packfile_from_bitmap(struct bitmap_index *bitmap_git,
 	 * need to be handled separately.
 	 */
 	bitmap_and_not(result, reuse);
-	*packfile_out = bitmap_git->pack;
+	*packfile_out = pack;
 	*reuse_out = reuse;
 	return 0;
 }
@@ -1167,7 +1368,7 @@ static uint32_t count_object_type(struct bitmap_index *bitmap_git,
 
 	for (i = 0; i < eindex->count; ++i) {
 		if (eindex->objects[i]->type == type &&
-			bitmap_get(objects, bitmap_git->pack->num_objects + i))
+			bitmap_get(objects, bitmap_num_objects(bitmap_git) + i))
 			count++;
 	}
 
@@ -1333,16 +1534,14 @@ int rebuild_existing_bitmaps(struct bitmap_index *bitmap_git,
 	khiter_t hash_pos;
 	int hash_ret;
 
-	num_objects = bitmap_git->pack->num_objects;
+	num_objects = bitmap_num_objects(bitmap_git);
 	reposition = xcalloc(num_objects, sizeof(uint32_t));
 
 	for (i = 0; i < num_objects; ++i) {
 		struct object_id oid;
-		struct revindex_entry *entry;
 		struct object_entry *oe;
 
-		entry = &bitmap_git->pack->revindex[i];
-		nth_packed_object_id(&oid, bitmap_git->pack, entry->nr);
+		bitmap_nth_object(bitmap_git, i, &oid, NULL, NULL);
 		oe = packlist_find(mapping, &oid);
 
 		if (oe)
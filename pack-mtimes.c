@@ -0,0 +1,122 @@
+#include "cache.h"
+#include "pack-mtimes.h"
+#include "object-store.h"
+#include "packfile.h"
+
+static char *pack_mtimes_filename(struct packed_git *p)
+{
+	size_t len;
+	if (!strip_suffix(p->pack_name, ".pack", &len))
+		BUG("pack_name does not end in .pack");
+	return xstrfmt("%.*s.mtimes", (int)len, p->pack_name);
+}
+
+#define MTIMES_HEADER_SIZE (12)
+#define MTIMES_MIN_SIZE (MTIMES_HEADER_SIZE + (2 * the_hash_algo->rawsz))
+
+struct mtimes_header {
+	uint32_t signature;
+	uint32_t version;
+	uint32_t hash_id;
+};
+
+static int load_mtimes_from_disk(struct packed_git *p, const char *mtimes_name)
+{
+	int fd, ret = 0;
+	struct stat st;
+	void *data = NULL;
+	size_t mtimes_size = 0;
+	struct mtimes_header *hdr;
+	const unsigned char *pack_hash;
+
+	fd = git_open(mtimes_name);
+	if (fd < 0) {
+		ret = error_errno(_("failed to open %s"), mtimes_name);
+		goto cleanup;
+	}
+	if (fstat(fd, &st)) {
+		ret = error_errno(_("failed to read %s"), mtimes_name);
+		goto cleanup;
+	}
+
+	mtimes_size = xsize_t(st.st_size);
+
+	if (mtimes_size < MTIMES_MIN_SIZE) {
+		ret = error(_("mtimes file %s is too small"), mtimes_name);
+		goto cleanup;
+	}
+
+	if (mtimes_size - MTIMES_MIN_SIZE != st_mult(sizeof(uint32_t), p->num_objects)) {
+		ret = error(_("mtimes file %s is corrupt"), mtimes_name);
+		goto cleanup;
+	}
+
+	data = xmmap(NULL, mtimes_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	hdr = data;
+
+	if (ntohl(hdr->signature) != MTIMES_SIGNATURE) {
+		ret = error(_("mtimes file %s has unknown signature"), mtimes_name);
+		goto cleanup;
+	}
+	if (ntohl(hdr->version) != MTIMES_VERSION) {
+		ret = error(_("mtimes file %s has unsupported version %"PRIu32),
+			    mtimes_name, ntohl(hdr->version));
+		goto cleanup;
+	}
+	if (ntohl(hdr->hash_id) != hash_algo_by_ptr(the_hash_algo)) {
+		ret = error(_("mtimes file %s has unsupported hash id %"PRIu32),
+			    mtimes_name, ntohl(hdr->hash_id));
+		goto cleanup;
+	}
+
+	pack_hash = (const unsigned char *)p->index_data + p->index_size -
+		    2 * the_hash_algo->rawsz;
+	if (!hasheq(pack_hash, (const unsigned char *)data + mtimes_size -
+			       2 * the_hash_algo->rawsz)) {
+		ret = error(_("mtimes file %s does not match its pack"),
+			    mtimes_name);
+		goto cleanup;
+	}
+
+cleanup:
+	if (ret) {
+		if (data)
+			munmap(data, mtimes_size);
+	} else {
+		p->mtimes_size = mtimes_size;
+		p->mtimes_map = (const uint32_t *)data;
+	}
+
+	if (fd >= 0)
+		close(fd);
+	return ret;
+}
+
+int load_pack_mtimes(struct packed_git *p)
+{
+	char *mtimes_name;
+	int ret;
+
+	if (!p->is_cruft)
+		BUG("load_pack_mtimes() called on a pack that is not cruft");
+	if (p->mtimes_map)
+		return 0;
+	if (open_pack_index(p))
+		return -1;
+
+	mtimes_name = pack_mtimes_filename(p);
+	ret = load_mtimes_from_disk(p, mtimes_name);
+	free(mtimes_name);
+	return ret;
+}
+
+uint32_t nth_packed_mtime(struct packed_git *p, uint32_t pos)
+{
+	if (!p->mtimes_map)
+		BUG("pack .mtimes file not loaded for %s", p->pack_name);
+	if (p->num_objects <= pos)
+		BUG("pack .mtimes out-of-bounds (%"PRIu32" vs %"PRIu32")",
+		    pos, p->num_objects);
+
+	return get_be32(p->mtimes_map + pos + MTIMES_HEADER_SIZE / sizeof(uint32_t));
+}
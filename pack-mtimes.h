@@ -0,0 +1,30 @@
+#ifndef PACK_MTIMES_H
+#define PACK_MTIMES_H
+
+/**
+ * A cruft pack holds objects that are not reachable, which used to be
+ * left loose so that their file's mtime would tell when they may be
+ * pruned. Instead, a ".mtimes" file next to the pack records such a
+ * time for each of its objects, in the order of the .idx.
+ *
+ * Packs that have a ".mtimes" file are marked with "is_cruft".
+ */
+
+#define MTIMES_SIGNATURE 0x4d544d45 /* "MTME" */
+#define MTIMES_VERSION 1
+
+struct packed_git;
+
+/*
+ * Map the ".mtimes" file of a cruft pack. Return 0 on success and -1
+ * (with an error) if it is missing or does not match the pack.
+ */
+int load_pack_mtimes(struct packed_git *p);
+
+/*
+ * Return the mtime of the object at index position "pos" of a cruft
+ * pack whose mtimes are loaded.
+ */
+uint32_t nth_packed_mtime(struct packed_git *p, uint32_t pos);
+
+#endif
@@ -17,6 +17,7 @@
 #include "midx.h"
 #include "commit-graph.h"
 #include "promisor-remote.h"
+#include "json-writer.h"
 
 char *odb_pack_name(struct strbuf *buf,
 		    const unsigned char *hash,
@@ -323,11 +324,32 @@ void close_pack_index(struct packed_git *p)
 	}
 }
 
+static void close_pack_mtimes(struct packed_git *p)
+{
+	if (!p->mtimes_map)
+		return;
+
+	munmap((void *)p->mtimes_map, p->mtimes_size);
+	p->mtimes_map = NULL;
+}
+
+static void close_pack_revindex(struct packed_git *p)
+{
+	if (!p->revindex_map)
+		return;
+
+	munmap((void *)p->revindex_map, p->revindex_size);
+	p->revindex_map = NULL;
+	p->revindex_data = NULL;
+}
+
 void close_pack(struct packed_git *p)
 {
 	close_pack_windows(p);
 	close_pack_fd(p);
 	close_pack_index(p);
+	close_pack_revindex(p);
+	close_pack_mtimes(p);
 }
 
 void close_object_store(struct raw_object_store *o)
@@ -350,7 +372,8 @@ void close_object_store(struct raw_object_store *o)
 
 void unlink_pack_path(const char *pack_name, int force_delete)
 {
-	static const char *exts[] = {".pack", ".idx", ".keep", ".bitmap", ".promisor"};
+	static const char *exts[] = {".pack", ".idx", ".rev", ".keep", ".bitmap", ".promisor",
+				     ".mtimes"};
 	int i;
 	struct strbuf buf = STRBUF_INIT;
 	size_t plen;
@@ -720,6 +743,10 @@ struct packed_git *add_packed_git(const char *path, size_t path_len, int local)
 	if (!access(p->pack_name, F_OK))
 		p->pack_promisor = 1;
 
+	xsnprintf(p->pack_name + path_len, alloc - path_len, ".mtimes");
+	if (!access(p->pack_name, F_OK))
+		p->is_cruft = 1;
+
 	xsnprintf(p->pack_name + path_len, alloc - path_len, ".pack");
 	if (stat(p->pack_name, &st) || !S_ISREG(st.st_mode)) {
 		free(p);
@@ -864,13 +891,15 @@ static void prepare_pack(const char *full_name, size_t full_name_len,
 	if (!report_garbage)
 		return;
 
-	if (!strcmp(file_name, "multi-pack-index"))
+	if (starts_with(file_name, "multi-pack-index"))
 		return;
 	if (ends_with(file_name, ".idx") ||
+	    ends_with(file_name, ".rev") ||
 	    ends_with(file_name, ".pack") ||
 	    ends_with(file_name, ".bitmap") ||
 	    ends_with(file_name, ".keep") ||
-	    ends_with(file_name, ".promisor"))
+	    ends_with(file_name, ".promisor") ||
+	    ends_with(file_name, ".mtimes"))
 		string_list_append(data->garbage, full_name);
 	else
 		report_garbage(PACKDIR_FILE_GARBAGE, full_name);
@@ -1237,18 +1266,18 @@ static int get_delta_base_oid(struct packed_git *p,
 		oidread(oid, base);
 		return 0;
 	} else if (type == OBJ_OFS_DELTA) {
-		struct revindex_entry *revidx;
+		uint32_t base_pos;
 		off_t base_offset = get_delta_base(p, w_curs, &curpos,
 						   type, delta_obj_offset);
 
 		if (!base_offset)
 			return -1;
 
-		revidx = find_pack_revindex(p, base_offset);
-		if (!revidx)
+		if (offset_to_pack_pos(p, base_offset, &base_pos) < 0)
 			return -1;
 
-		return nth_packed_object_id(oid, p, revidx->nr);
+		return nth_packed_object_id(oid, p,
+					    pack_pos_to_index(p, base_pos));
 	} else
 		return -1;
 }
@@ -1258,12 +1287,11 @@ static int retry_bad_packed_offset(struct repository *r,
 				   off_t obj_offset)
 {
 	int type;
-	struct revindex_entry *revidx;
+	uint32_t pos;
 	struct object_id oid;
-	revidx = find_pack_revindex(p, obj_offset);
-	if (!revidx)
+	if (offset_to_pack_pos(p, obj_offset, &pos) < 0)
 		return OBJ_BAD;
-	nth_packed_object_id(&oid, p, revidx->nr);
+	nth_packed_object_id(&oid, p, pack_pos_to_index(p, pos));
 	mark_bad_packed_object(p, oid.hash);
 	type = oid_object_info(r, &oid, NULL);
 	if (type <= OBJ_NONE)
@@ -1346,6 +1374,36 @@ static size_t delta_base_cached;
 
 static LIST_HEAD(delta_base_cache_lru);
 
+/*
+ * Number of least recently used entries considered when picking an entry
+ * to evict from the delta base cache.
+ */
+#define DELTA_BASE_CACHE_EVICT_WINDOW 8
+
+static int delta_base_cache_atexit_registered;
+static unsigned int count_delta_base_cache_hit;
+static unsigned int count_delta_base_cache_miss;
+static unsigned int count_delta_base_cache_evicted;
+static unsigned int count_delta_base_cache_prefetched;
+static size_t delta_base_cache_peak;
+
+static void trace2_delta_base_cache_statistics_atexit(void)
+{
+	struct json_writer jw = JSON_WRITER_INIT;
+
+	jw_object_begin(&jw, 0);
+	jw_object_intmax(&jw, "hit", count_delta_base_cache_hit);
+	jw_object_intmax(&jw, "miss", count_delta_base_cache_miss);
+	jw_object_intmax(&jw, "evicted", count_delta_base_cache_evicted);
+	jw_object_intmax(&jw, "prefetched", count_delta_base_cache_prefetched);
+	jw_object_intmax(&jw, "peak_bytes", delta_base_cache_peak);
+	jw_end(&jw);
+
+	trace2_data_json("delta_base_cache", the_repository, "statistics", &jw);
+
+	jw_release(&jw);
+}
+
 struct delta_base_cache_key {
 	struct packed_git *p;
 	off_t base_offset;
@@ -1358,6 +1416,15 @@ struct delta_base_cache_entry {
 	void *data;
 	unsigned long size;
 	enum object_type type;
+
+	/*
+	 * "depth" is the number of deltas that were applied to build
+	 * "data", and hence what it would cost to rebuild it once evicted.
+	 * "credit" starts out from it and decreases as the entry survives
+	 * evictions; see evict_delta_base_cache_entry().
+	 */
+	unsigned int depth;
+	unsigned int credit;
 };
 
 static unsigned int pack_entry_hash(struct packed_git *p, off_t base_offset)
@@ -1433,8 +1500,16 @@ static void *cache_or_unpack_entry(struct repository *r, struct packed_git *p,
 	struct delta_base_cache_entry *ent;
 
 	ent = get_delta_base_cache_entry(p, base_offset);
-	if (!ent)
+	if (!ent) {
+		count_delta_base_cache_miss++;
 		return unpack_entry(r, p, base_offset, type, base_size);
+	}
+	count_delta_base_cache_hit++;
+
+	/* a hit makes the entry the most recently used one again */
+	list_del(&ent->lru);
+	list_add_tail(&ent->lru, &delta_base_cache_lru);
+	ent->credit = ent->depth + 1;
 
 	if (type)
 		*type = ent->type;
@@ -1459,11 +1534,54 @@ void clear_delta_base_cache(void)
 	}
 }
 
+/*
+ * Evict one entry, picked among the DELTA_BASE_CACHE_EVICT_WINDOW least
+ * recently used ones.
+ *
+ * Rebuilding an entry of depth "d" means inflating and applying "d"
+ * deltas of roughly its size, so the cost of rebuilding it per byte
+ * freed is about "d + 1". Following the GreedyDual-Size policy, each
+ * entry holds that much credit; we evict the candidate with the least
+ * credit (the oldest one on ties) and charge the other candidates the
+ * same amount. Cheap bases thus go first, while expensive bases that are
+ * no longer used still age out after a few rounds.
+ */
+static void evict_delta_base_cache_entry(void)
+{
+	struct delta_base_cache_entry *victim = NULL;
+	struct list_head *lru;
+	int nr = 0;
+
+	list_for_each(lru, &delta_base_cache_lru) {
+		struct delta_base_cache_entry *f =
+			list_entry(lru, struct delta_base_cache_entry, lru);
+		if (!victim || f->credit < victim->credit)
+			victim = f;
+		if (++nr >= DELTA_BASE_CACHE_EVICT_WINDOW)
+			break;
+	}
+	if (!victim)
+		return;
+
+	nr = 0;
+	list_for_each(lru, &delta_base_cache_lru) {
+		struct delta_base_cache_entry *f =
+			list_entry(lru, struct delta_base_cache_entry, lru);
+		if (f != victim)
+			f->credit -= victim->credit;
+		if (++nr >= DELTA_BASE_CACHE_EVICT_WINDOW)
+			break;
+	}
+
+	count_delta_base_cache_evicted++;
+	release_delta_base_cache(victim);
+}
+
 static void add_delta_base_cache(struct packed_git *p, off_t base_offset,
-	void *base, unsigned long base_size, enum object_type type)
+	void *base, unsigned long base_size, enum object_type type,
+	unsigned int depth)
 {
-	struct delta_base_cache_entry *ent = xmalloc(sizeof(*ent));
-	struct list_head *lru, *tmp;
+	struct delta_base_cache_entry *ent;
 
 	/*
 	 * Check required to avoid redundant entries when more than one thread
@@ -1473,23 +1591,29 @@ static void add_delta_base_cache(struct packed_git *p, off_t base_offset,
 	if (in_delta_base_cache(p, base_offset))
 		return;
 
-	delta_base_cached += base_size;
-
-	list_for_each_safe(lru, tmp, &delta_base_cache_lru) {
-		struct delta_base_cache_entry *f =
-			list_entry(lru, struct delta_base_cache_entry, lru);
-		if (delta_base_cached <= delta_base_cache_limit)
-			break;
-		release_delta_base_cache(f);
+	if (!delta_base_cache_atexit_registered && trace2_is_enabled()) {
+		atexit(trace2_delta_base_cache_statistics_atexit);
+		delta_base_cache_atexit_registered = 1;
 	}
 
+	delta_base_cached += base_size;
+	while (delta_base_cached > delta_base_cache_limit &&
+	       !list_empty(&delta_base_cache_lru))
+		evict_delta_base_cache_entry();
+
+	ent = xmalloc(sizeof(*ent));
 	ent->key.p = p;
 	ent->key.base_offset = base_offset;
 	ent->type = type;
 	ent->data = base;
 	ent->size = base_size;
+	ent->depth = depth;
+	ent->credit = depth + 1;
 	list_add_tail(&ent->lru, &delta_base_cache_lru);
 
+	if (delta_base_cached > delta_base_cache_peak)
+		delta_base_cache_peak = delta_base_cached;
+
 	if (!delta_base_cache.cmpfn)
 		hashmap_init(&delta_base_cache, delta_base_cache_hash_cmp, NULL, 0);
 	hashmap_entry_init(&ent->ent, pack_entry_hash(p, base_offset));
@@ -1537,8 +1661,15 @@ int packed_object_info(struct repository *r, struct packed_git *p,
 	}
 
 	if (oi->disk_sizep) {
-		struct revindex_entry *revidx = find_pack_revindex(p, obj_offset);
-		*oi->disk_sizep = revidx[1].offset - obj_offset;
+		uint32_t pos;
+		if (offset_to_pack_pos(p, obj_offset, &pos) < 0) {
+			error("could not find object at offset %"PRIuMAX" "
+			      "in pack %s", (uintmax_t)obj_offset, p->pack_name);
+			type = OBJ_BAD;
+			goto out;
+		}
+
+		*oi->disk_sizep = pack_pos_to_offset(p, pos + 1) - obj_offset;
 	}
 
 	if (oi->typep || oi->type_name) {
@@ -1655,8 +1786,16 @@ static void *read_object(struct repository *r,
 	return content;
 }
 
-void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
-		   enum object_type *final_type, unsigned long *final_size)
+/*
+ * Like unpack_entry(), but also return in "final_depth" the number of
+ * deltas the object was rebuilt from, including those that went into a
+ * base found in the delta base cache.
+ */
+static void *unpack_entry_with_depth(struct repository *r, struct packed_git *p,
+				     off_t obj_offset,
+				     enum object_type *final_type,
+				     unsigned long *final_size,
+				     unsigned int *final_depth)
 {
 	struct pack_window *w_curs = NULL;
 	off_t curpos = obj_offset;
@@ -1667,6 +1806,7 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 	struct unpack_entry_stack_ent *delta_stack = small_delta_stack;
 	int delta_stack_nr = 0, delta_stack_alloc = UNPACK_ENTRY_STACK_PREALLOC;
 	int base_from_cache = 0;
+	unsigned int depth = 0;
 
 	write_pack_access_log(p, obj_offset);
 
@@ -1678,20 +1818,33 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 
 		ent = get_delta_base_cache_entry(p, curpos);
 		if (ent) {
+			count_delta_base_cache_hit++;
 			type = ent->type;
 			data = ent->data;
 			size = ent->size;
+			depth = ent->depth;
 			detach_delta_base_cache_entry(ent);
 			base_from_cache = 1;
 			break;
 		}
+		count_delta_base_cache_miss++;
 
 		if (do_check_packed_object_crc && p->index_version > 1) {
-			struct revindex_entry *revidx = find_pack_revindex(p, obj_offset);
-			off_t len = revidx[1].offset - obj_offset;
-			if (check_pack_crc(p, &w_curs, obj_offset, len, revidx->nr)) {
+			uint32_t pack_pos, index_pos;
+			off_t len;
+
+			if (offset_to_pack_pos(p, obj_offset, &pack_pos) < 0) {
+				error("could not find object at offset %"PRIuMAX" in pack %s",
+				      (uintmax_t)obj_offset, p->pack_name);
+				data = NULL;
+				goto out;
+			}
+
+			len = pack_pos_to_offset(p, pack_pos + 1) - obj_offset;
+			index_pos = pack_pos_to_index(p, pack_pos);
+			if (check_pack_crc(p, &w_curs, obj_offset, len, index_pos)) {
 				struct object_id oid;
-				nth_packed_object_id(&oid, p, revidx->nr);
+				nth_packed_object_id(&oid, p, index_pos);
 				error("bad packed object CRC for %s",
 				      oid_to_hex(&oid));
 				mark_bad_packed_object(p, oid.hash);
@@ -1767,7 +1920,8 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 		data = NULL;
 
 		if (base)
-			add_delta_base_cache(p, obj_offset, base, base_size, type);
+			add_delta_base_cache(p, obj_offset, base, base_size, type,
+					     depth);
 
 		if (!base) {
 			/*
@@ -1776,11 +1930,11 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 			 * This is costly but should happen only in the presence
 			 * of a corrupted pack, and is better than failing outright.
 			 */
-			struct revindex_entry *revidx;
+			uint32_t pos;
 			struct object_id base_oid;
-			revidx = find_pack_revindex(p, obj_offset);
-			if (revidx) {
-				nth_packed_object_id(&base_oid, p, revidx->nr);
+			if (!(offset_to_pack_pos(p, obj_offset, &pos))) {
+				nth_packed_object_id(&base_oid, p,
+						     pack_pos_to_index(p, pos));
 				error("failed to read delta base object %s"
 				      " at offset %"PRIuMAX" from %s",
 				      oid_to_hex(&base_oid), (uintmax_t)obj_offset,
@@ -1813,6 +1967,7 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 		data = patch_delta(base, base_size,
 				   delta_data, delta_size,
 				   &size);
+		depth++;
 
 		/*
 		 * We could not apply the delta; warn the user, but keep going.
@@ -1833,6 +1988,8 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 		*final_type = type;
 	if (final_size)
 		*final_size = size;
+	if (final_depth)
+		*final_depth = depth;
 
 out:
 	unuse_pack(&w_curs);
@@ -1843,6 +2000,50 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 	return data;
 }
 
+void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
+		   enum object_type *final_type, unsigned long *final_size)
+{
+	return unpack_entry_with_depth(r, p, obj_offset,
+				       final_type, final_size, NULL);
+}
+
+void prefetch_delta_base(struct repository *r, const struct object_id *oid)
+{
+	struct pack_window *w_curs = NULL;
+	struct pack_entry e;
+	off_t curpos, base_offset;
+	unsigned long size;
+	enum object_type type;
+	unsigned int depth;
+	void *base;
+
+	obj_read_lock();
+
+	if (!find_pack_entry(r, oid, &e))
+		goto out;
+
+	curpos = e.offset;
+	type = unpack_object_header(e.p, &w_curs, &curpos, &size);
+	if (type != OBJ_OFS_DELTA && type != OBJ_REF_DELTA)
+		goto out;
+	base_offset = get_delta_base(e.p, &w_curs, &curpos, type, e.offset);
+	unuse_pack(&w_curs);
+	if (!base_offset || in_delta_base_cache(e.p, base_offset))
+		goto out;
+
+	base = unpack_entry_with_depth(r, e.p, base_offset, &type, &size, &depth);
+	/* the cache may have been filled while we were inflating */
+	if (base && !in_delta_base_cache(e.p, base_offset)) {
+		add_delta_base_cache(e.p, base_offset, base, size, type, depth);
+		count_delta_base_cache_prefetched++;
+	} else
+		free(base);
+
+out:
+	unuse_pack(&w_curs);
+	obj_read_unlock();
+}
+
 int bsearch_pack(const struct object_id *oid, const struct packed_git *p, uint32_t *result)
 {
 	const unsigned char *index_fanout = p->index_data;
@@ -2062,7 +2263,7 @@ int for_each_object_in_pack(struct packed_git *p,
 		struct object_id oid;
 
 		if (flags & FOR_EACH_OBJECT_PACK_ORDER)
-			pos = p->revindex[i].nr;
+			pos = pack_pos_to_index(p, i);
 		else
 			pos = i;
 
@@ -141,6 +141,14 @@ off_t find_pack_entry_one(const unsigned char *sha1, struct packed_git *);
 
 int is_pack_valid(struct packed_git *);
 void *unpack_entry(struct repository *r, struct packed_git *, off_t, enum object_type *, unsigned long *);
+
+/*
+ * If "oid" is stored as a delta in a pack, make sure that its delta base
+ * is in the delta base cache, so that reading the object later only has
+ * to apply its last delta. This may be called ahead of time from another
+ * thread, as long as the object read lock is enabled.
+ */
+void prefetch_delta_base(struct repository *r, const struct object_id *oid);
 unsigned long unpack_object_header_buffer(const unsigned char *buf, unsigned long len, enum object_type *type, unsigned long *sizep);
 unsigned long get_size_from_delta(struct packed_git *, struct pack_window **, off_t);
 int unpack_object_header(struct packed_git *, struct pack_window **, off_t *, unsigned long *);
@@ -0,0 +1,385 @@
+#include "cache.h"
+#include "config.h"
+#include "convert.h"
+#include "object-store.h"
+#include "parallel-checkout.h"
+#include "progress.h"
+#include "streaming.h"
+#include "thread-utils.h"
+
+enum pc_item_status {
+	PC_ITEM_PENDING = 0,
+	PC_ITEM_WRITTEN,
+	/*
+	 * The path could not be created because something else (usually
+	 * another entry of this checkout, on a case-insensitive file
+	 * system) is already there. Such entries are retried sequentially.
+	 */
+	PC_ITEM_COLLIDED,
+	PC_ITEM_FAILED,
+};
+
+struct parallel_checkout_item {
+	struct cache_entry *ce;
+	char *path; /* NULL if the entry is written to ce->name */
+	struct conv_attrs ca;
+	enum pc_item_status status;
+	int fstat_done;
+	struct stat st;
+};
+
+static struct parallel_checkout {
+	enum pc_status status;
+	struct parallel_checkout_item *items;
+	size_t nr, alloc;
+
+	/* Shared with the worker threads while running */
+	const struct checkout *state;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	size_t next, done;
+} parallel_checkout;
+
+enum pc_status parallel_checkout_status(void)
+{
+	return parallel_checkout.status;
+}
+
+static const int DEFAULT_THRESHOLD_FOR_PARALLELISM = 100;
+
+void get_parallel_checkout_configs(int *num_workers, int *threshold)
+{
+	char *env_workers = getenv("GIT_TEST_CHECKOUT_WORKERS");
+
+	if (env_workers && *env_workers) {
+		if (strtol_i(env_workers, 10, num_workers))
+			die(_("invalid value for '%s': '%s'"),
+			    "GIT_TEST_CHECKOUT_WORKERS", env_workers);
+		*threshold = 0;
+	} else {
+		if (git_config_get_int("checkout.workers", num_workers))
+			*num_workers = 1;
+		if (git_config_get_int("checkout.thresholdForParallelism",
+				       threshold))
+			*threshold = DEFAULT_THRESHOLD_FOR_PARALLELISM;
+	}
+
+	if (*num_workers < 1)
+		*num_workers = online_cpus();
+	if (!HAVE_THREADS)
+		*num_workers = 1;
+}
+
+void init_parallel_checkout(void)
+{
+	if (parallel_checkout.status != PC_UNINITIALIZED)
+		BUG("parallel checkout already initialized");
+
+	parallel_checkout.status = PC_ACCEPTING_ENTRIES;
+}
+
+static void finish_parallel_checkout(void)
+{
+	size_t i;
+
+	if (parallel_checkout.status == PC_UNINITIALIZED)
+		BUG("cannot finish parallel checkout: not initialized yet");
+
+	for (i = 0; i < parallel_checkout.nr; i++)
+		free(parallel_checkout.items[i].path);
+	free(parallel_checkout.items);
+	memset(&parallel_checkout, 0, sizeof(parallel_checkout));
+}
+
+size_t parallel_checkout_pending(void)
+{
+	if (parallel_checkout.status != PC_ACCEPTING_ENTRIES)
+		return 0;
+	return parallel_checkout.nr;
+}
+
+int enqueue_checkout(struct cache_entry *ce, const struct checkout *state,
+		     const char *path)
+{
+	struct parallel_checkout_item *pc_item;
+	struct delayed_checkout *dco = state->delayed_checkout;
+	struct conv_attrs ca;
+
+	if (parallel_checkout.status != PC_ACCEPTING_ENTRIES ||
+	    !S_ISREG(ce->ce_mode))
+		return -1;
+
+	/*
+	 * Entries that go through a smudge filter or a filter process
+	 * (and with it, delayed checkout) are written sequentially.
+	 */
+	if (dco && dco->state == CE_RETRY)
+		return -1;
+	convert_attrs(state->istate, &ca, ce->name);
+	if (conv_attrs_have_smudge_filter(&ca))
+		return -1;
+
+	ALLOC_GROW(parallel_checkout.items, parallel_checkout.nr + 1,
+		   parallel_checkout.alloc);
+	pc_item = &parallel_checkout.items[parallel_checkout.nr++];
+	memset(pc_item, 0, sizeof(*pc_item));
+	pc_item->ce = ce;
+	pc_item->ca = ca;
+	if (state->base_dir_len)
+		pc_item->path = xstrdup(path);
+	return 0;
+}
+
+static int reset_fd(int fd, const char *path)
+{
+	if (lseek(fd, 0, SEEK_SET) != 0)
+		return error_errno("failed to rewind descriptor of '%s'", path);
+	if (ftruncate(fd, 0))
+		return error_errno("failed to truncate file '%s'", path);
+	return 0;
+}
+
+/*
+ * Write one queued entry. This runs in the worker threads, so it must not
+ * touch the index, the attribute machinery or any other global state that
+ * is not protected by the object read lock. "cache" is the lstat cache of
+ * the calling thread.
+ */
+static void write_pc_item(struct parallel_checkout_item *pc_item,
+			  const struct checkout *state,
+			  struct cache_def *cache)
+{
+	struct cache_entry *ce = pc_item->ce;
+	const char *path = pc_item->path ? pc_item->path : ce->name;
+	unsigned int mode = (ce->ce_mode & 0100) ? 0777 : 0666;
+	struct stream_filter *filter;
+	struct strbuf buf = STRBUF_INIT;
+	struct checkout_metadata meta;
+	enum object_type type;
+	unsigned long size;
+	void *blob;
+	size_t newsize;
+	const char *dir_sep;
+	int fd;
+
+	/*
+	 * The leading directories were created when the entry was queued,
+	 * but on a case-insensitive file system one of them may since have
+	 * been replaced by a colliding symlink, which is checked out right
+	 * away. Do not write through it: leave the entry to the sequential
+	 * retry, which checks the path again.
+	 */
+	dir_sep = find_last_dir_sep(path);
+	if (dir_sep &&
+	    !threaded_has_dirs_only_path(cache, path, dir_sep - path,
+					 state->base_dir_len)) {
+		pc_item->status = PC_ITEM_COLLIDED;
+		return;
+	}
+
+	fd = open(path, O_WRONLY | O_CREAT | O_EXCL, mode);
+	if (fd < 0) {
+		if (errno == EEXIST || errno == EISDIR || errno == ENOENT ||
+		    errno == ENOTDIR) {
+			pc_item->status = PC_ITEM_COLLIDED;
+			return;
+		}
+		error_errno("failed to open file '%s'", path);
+		pc_item->status = PC_ITEM_FAILED;
+		return;
+	}
+
+	filter = get_stream_filter_ca(&pc_item->ca, &ce->oid);
+	if (filter) {
+		int ret;
+
+		/* streaming reads the pack directly, so hold the lock */
+		obj_read_lock();
+		ret = stream_blob_to_fd(fd, &ce->oid, filter, 1);
+		obj_read_unlock();
+		if (!ret)
+			goto done;
+		/* Retry without streaming from the start of the file */
+		if (reset_fd(fd, path))
+			goto fail;
+	}
+
+	blob = read_object_file(&ce->oid, &type, &size);
+	if (!blob || type != OBJ_BLOB) {
+		free(blob);
+		error("unable to read sha1 file of %s (%s)",
+		      path, oid_to_hex(&ce->oid));
+		goto fail;
+	}
+
+	clone_checkout_metadata(&meta, &state->meta, &ce->oid);
+	if (convert_to_working_tree_ca(&pc_item->ca, ce->name, blob, size,
+				       &buf, &meta)) {
+		free(blob);
+		blob = strbuf_detach(&buf, &newsize);
+		size = newsize;
+	}
+
+	if (write_in_full(fd, blob, size) < 0) {
+		free(blob);
+		error_errno("unable to write file %s", path);
+		goto fail;
+	}
+	free(blob);
+
+done:
+	pc_item->fstat_done = fstat_checkout_output(fd, state, &pc_item->st);
+	if (close(fd)) {
+		error_errno("unable to close file %s", path);
+		pc_item->status = PC_ITEM_FAILED;
+		unlink(path);
+		return;
+	}
+	pc_item->status = PC_ITEM_WRITTEN;
+	return;
+
+fail:
+	close(fd);
+	unlink(path);
+	pc_item->status = PC_ITEM_FAILED;
+}
+
+static void *checkout_worker(void *unused)
+{
+	struct cache_def cache = CACHE_DEF_INIT;
+
+	for (;;) {
+		struct parallel_checkout_item *pc_item;
+
+		pthread_mutex_lock(&parallel_checkout.mutex);
+		if (parallel_checkout.next == parallel_checkout.nr) {
+			pthread_mutex_unlock(&parallel_checkout.mutex);
+			break;
+		}
+		pc_item = &parallel_checkout.items[parallel_checkout.next++];
+		pthread_mutex_unlock(&parallel_checkout.mutex);
+
+		write_pc_item(pc_item, parallel_checkout.state, &cache);
+
+		pthread_mutex_lock(&parallel_checkout.mutex);
+		parallel_checkout.done++;
+		pthread_cond_signal(&parallel_checkout.cond);
+		pthread_mutex_unlock(&parallel_checkout.mutex);
+	}
+	cache_def_clear(&cache);
+	return NULL;
+}
+
+static void write_items_in_parallel(int num_workers, struct progress *progress,
+				    unsigned progress_base)
+{
+	pthread_t *workers;
+	int i, err;
+
+	pthread_mutex_init(&parallel_checkout.mutex, NULL);
+	pthread_cond_init(&parallel_checkout.cond, NULL);
+	enable_obj_read_lock();
+
+	ALLOC_ARRAY(workers, num_workers);
+	for (i = 0; i < num_workers; i++) {
+		err = pthread_create(&workers[i], NULL, checkout_worker, NULL);
+		if (err)
+			die(_("unable to create checkout worker thread: %s"),
+			    strerror(err));
+	}
+
+	pthread_mutex_lock(&parallel_checkout.mutex);
+	while (parallel_checkout.done < parallel_checkout.nr) {
+		pthread_cond_wait(&parallel_checkout.cond,
+				  &parallel_checkout.mutex);
+		display_progress(progress,
+				 progress_base + parallel_checkout.done);
+	}
+	pthread_mutex_unlock(&parallel_checkout.mutex);
+
+	for (i = 0; i < num_workers; i++)
+		pthread_join(workers[i], NULL);
+	free(workers);
+
+	disable_obj_read_lock();
+	pthread_cond_destroy(&parallel_checkout.cond);
+	pthread_mutex_destroy(&parallel_checkout.mutex);
+}
+
+static void write_items_sequentially(const struct checkout *state,
+				     struct progress *progress,
+				     unsigned progress_base)
+{
+	struct cache_def cache = CACHE_DEF_INIT;
+	size_t i;
+
+	for (i = 0; i < parallel_checkout.nr; i++) {
+		write_pc_item(&parallel_checkout.items[i], state, &cache);
+		display_progress(progress, progress_base + i + 1);
+	}
+	cache_def_clear(&cache);
+}
+
+int run_parallel_checkout(struct checkout *state, int num_workers,
+			  int threshold, struct progress *progress,
+			  unsigned progress_base)
+{
+	int errs = 0;
+	size_t i;
+
+	if (parallel_checkout.status != PC_ACCEPTING_ENTRIES)
+		BUG("cannot run parallel checkout: uninitialized or already running");
+
+	parallel_checkout.status = PC_RUNNING;
+	parallel_checkout.state = state;
+
+	if (parallel_checkout.nr < threshold)
+		num_workers = 1;
+	if (num_workers > parallel_checkout.nr)
+		num_workers = parallel_checkout.nr;
+
+	trace2_region_enter("checkout", "parallel", NULL);
+	trace2_data_intmax("checkout", NULL, "parallel/entries",
+			   parallel_checkout.nr);
+	trace2_data_intmax("checkout", NULL, "parallel/workers", num_workers);
+
+	if (num_workers > 1)
+		write_items_in_parallel(num_workers, progress, progress_base);
+	else
+		write_items_sequentially(state, progress, progress_base);
+
+	/* Back in the main thread: update the index and retry collisions */
+	for (i = 0; i < parallel_checkout.nr; i++) {
+		struct parallel_checkout_item *pc_item = &parallel_checkout.items[i];
+		struct cache_entry *ce = pc_item->ce;
+
+		switch (pc_item->status) {
+		case PC_ITEM_WRITTEN:
+			if (!state->refresh_cache)
+				break;
+			if (!pc_item->fstat_done && lstat(ce->name, &pc_item->st)) {
+				errs |= error_errno("unable to stat just-written file %s",
+						    ce->name);
+				break;
+			}
+			update_ce_after_write(state, ce, &pc_item->st);
+			break;
+		case PC_ITEM_COLLIDED:
+			/*
+			 * checkout_entry() will not queue the entry again,
+			 * since we are no longer accepting entries.
+			 */
+			errs |= checkout_entry(ce, state, NULL, NULL);
+			break;
+		case PC_ITEM_FAILED:
+			errs = 1;
+			break;
+		default:
+			BUG("parallel checkout item with unexpected status");
+		}
+	}
+
+	trace2_region_leave("checkout", "parallel", NULL);
+	finish_parallel_checkout();
+	return errs;
+}
@@ -0,0 +1,58 @@
+#ifndef PARALLEL_CHECKOUT_H
+#define PARALLEL_CHECKOUT_H
+
+struct cache_entry;
+struct checkout;
+struct progress;
+
+/*
+ * Parallel checkout writes the regular files of a checkout from several
+ * threads. Entries are queued by checkout_entry() while parallel
+ * checkout is accepting them, and written out by run_parallel_checkout().
+ * Everything that is not safe to do from a thread (attribute lookup,
+ * directory creation, removal of existing files, smudge filters and
+ * delayed checkout, updating the index) stays in the main thread.
+ */
+
+enum pc_status {
+	PC_UNINITIALIZED = 0,
+	PC_ACCEPTING_ENTRIES,
+	PC_RUNNING,
+};
+
+enum pc_status parallel_checkout_status(void);
+
+/*
+ * Read the "checkout.workers" and "checkout.thresholdForParallelism"
+ * settings. A worker count of one means sequential checkout.
+ */
+void get_parallel_checkout_configs(int *num_workers, int *threshold);
+
+/*
+ * Start accepting entries. The caller must call run_parallel_checkout()
+ * before doing anything else with the entries passed to checkout_entry().
+ */
+void init_parallel_checkout(void);
+
+/*
+ * Queue the regular file "ce", to be written to "path" (which was already
+ * cleared by the caller). Returns 0 if the entry was queued, and -1 if it
+ * is not eligible for parallel checkout and must be written right away.
+ */
+int enqueue_checkout(struct cache_entry *ce, const struct checkout *state,
+		     const char *path);
+
+/* The number of entries queued but not yet written. */
+size_t parallel_checkout_pending(void);
+
+/*
+ * Write all queued entries using up to "num_workers" threads, or in the
+ * main thread if fewer than "threshold" entries were queued, and update
+ * their stat data in the index. "progress" is advanced from
+ * "progress_base" as entries are written. Returns non-zero on errors.
+ */
+int run_parallel_checkout(struct checkout *state, int num_workers,
+			  int threshold, struct progress *progress,
+			  unsigned progress_base);
+
+#endif /* PARALLEL_CHECKOUT_H */
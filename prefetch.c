@@ -0,0 +1,88 @@
+#include "cache.h"
+#include "object-store.h"
+#include "prefetch.h"
+
+void prefetch_init(struct prefetch *p, hashmap_cmp_fn cmp)
+{
+	pthread_mutex_init(&p->mutex, NULL);
+	pthread_cond_init(&p->work_cond, NULL);
+	pthread_cond_init(&p->done_cond, NULL);
+	hashmap_init(&p->items, cmp, NULL, 0);
+	p->stop = 0;
+	p->threads = NULL;
+	p->nr_threads = 0;
+	p->hits = p->misses = 0;
+}
+
+static void *prefetch_thread(void *data)
+{
+	struct prefetch *p = data;
+
+	pthread_mutex_lock(&p->mutex);
+	for (;;) {
+		void *job = NULL;
+
+		while (!p->stop && !(job = p->next_job(p)))
+			pthread_cond_wait(&p->work_cond, &p->mutex);
+		if (p->stop)
+			break;
+		pthread_mutex_unlock(&p->mutex);
+
+		p->run_job(p, job);
+
+		pthread_mutex_lock(&p->mutex);
+	}
+	pthread_mutex_unlock(&p->mutex);
+	return NULL;
+}
+
+void prefetch_start(struct prefetch *p, int nr_threads)
+{
+	int i;
+
+	enable_obj_read_lock();
+	p->nr_threads = nr_threads;
+	ALLOC_ARRAY(p->threads, p->nr_threads);
+	for (i = 0; i < p->nr_threads; i++) {
+		int err = pthread_create(&p->threads[i], NULL,
+					 prefetch_thread, p);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+}
+
+void prefetch_stop(struct prefetch *p, const char *category,
+		   struct repository *r)
+{
+	int i;
+
+	pthread_mutex_lock(&p->mutex);
+	p->stop = 1;
+	pthread_cond_broadcast(&p->work_cond);
+	pthread_mutex_unlock(&p->mutex);
+	for (i = 0; i < p->nr_threads; i++)
+		if (pthread_join(p->threads[i], NULL))
+			die("unable to join thread");
+	disable_obj_read_lock();
+
+	trace2_data_intmax(category, r, "prefetch/hits", p->hits);
+	trace2_data_intmax(category, r, "prefetch/misses", p->misses);
+
+	pthread_cond_destroy(&p->work_cond);
+	pthread_cond_destroy(&p->done_cond);
+	pthread_mutex_destroy(&p->mutex);
+	FREE_AND_NULL(p->threads);
+}
+
+struct prefetch_item *prefetch_wait(struct prefetch *p,
+				    const struct prefetch_item *key)
+{
+	struct prefetch_item *item;
+
+	while ((item = container_of_or_null(hashmap_get(&p->items, &key->ent,
+							NULL),
+					    struct prefetch_item, ent)) &&
+	       item->state == PREFETCH_RUNNING)
+		pthread_cond_wait(&p->done_cond, &p->mutex);
+	return item;
+}
@@ -0,0 +1,90 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include "hashmap.h"
+#include "thread-utils.h"
+
+struct repository;
+
+/*
+ * Worker threads that compute results ahead of the main thread, which
+ * takes them when it gets there instead of computing them itself.
+ *
+ * The results are items in a hashmap, each embedding a struct
+ * prefetch_item; how they are keyed and queued is up to the caller,
+ * which embeds a struct prefetch in its own state and gets back to it
+ * from the callbacks with container_of(). Everything in it but the
+ * counters is protected by the mutex, and the workers only read
+ * objects with the object read lock enabled.
+ */
+
+enum prefetch_state {
+	/* waiting for a worker */
+	PREFETCH_QUEUED,
+	/* a worker is computing it */
+	PREFETCH_RUNNING,
+	/* computed, and not taken yet */
+	PREFETCH_READY,
+	/* taken, dropped, or computed by the main thread itself */
+	PREFETCH_TAKEN,
+};
+
+struct prefetch_item {
+	struct hashmap_entry ent;
+	enum prefetch_state state;
+};
+
+struct prefetch {
+	pthread_mutex_t mutex;
+	/* workers wait here for jobs, or for ready items to be taken */
+	pthread_cond_t work_cond;
+	/* the main thread waits here for an item that is running */
+	pthread_cond_t done_cond;
+	struct hashmap items;
+	int stop;
+
+	/*
+	 * Called by a worker with the mutex held: return the next job,
+	 * or NULL to wait until work_cond is signaled.
+	 */
+	void *(*next_job)(struct prefetch *p);
+	/* Called by a worker without the mutex, to do the job. */
+	void (*run_job)(struct prefetch *p, void *job);
+
+	pthread_t *threads;
+	int nr_threads;
+
+	/* used by the main thread only */
+	int hits, misses;
+};
+
+void prefetch_init(struct prefetch *p, hashmap_cmp_fn cmp);
+
+/* Start "nr_threads" workers; queue some jobs first, or signal work_cond. */
+void prefetch_start(struct prefetch *p, int nr_threads);
+
+/*
+ * Stop the workers, report the hits and misses to trace2 under
+ * "category", and release everything but the items, which the caller
+ * frees with hashmap_free_entries().
+ */
+void prefetch_stop(struct prefetch *p, const char *category,
+		   struct repository *r);
+
+/*
+ * Look up the item with the key of "key", waiting while a worker is
+ * computing it, so that it is returned in any state but
+ * PREFETCH_RUNNING, or NULL. Called with the mutex held.
+ */
+struct prefetch_item *prefetch_wait(struct prefetch *p,
+				    const struct prefetch_item *key);
+
+/* A worker is done with an item. Called with the mutex held. */
+static inline void prefetch_done(struct prefetch *p, struct prefetch_item *item,
+				 enum prefetch_state state)
+{
+	item->state = state;
+	pthread_cond_broadcast(&p->done_cond);
+}
+
+#endif /* PREFETCH_H */
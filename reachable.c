@@ -13,6 +13,7 @@
 #include "worktree.h"
 #include "object-store.h"
 #include "pack-bitmap.h"
+#include "pack-mtimes.h"
 
 struct connectivity_progress {
 	struct progress *progress;
@@ -135,10 +136,16 @@ static int add_recent_packed(const struct object_id *oid,
 			     void *data)
 {
 	struct object *obj = lookup_object(the_repository, oid);
+	timestamp_t mtime = p->mtime;
 
 	if (obj && obj->flags & SEEN)
 		return 0;
-	add_recent_object(oid, p->mtime, data);
+	if (p->is_cruft) {
+		if (load_pack_mtimes(p) < 0)
+			die(_("could not load cruft pack '%s'"), p->pack_name);
+		mtime = nth_packed_mtime(p, pos);
+	}
+	add_recent_object(oid, mtime, data);
 	return 0;
 }
 
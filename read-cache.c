@@ -25,6 +25,7 @@
 #include "fsmonitor.h"
 #include "thread-utils.h"
 #include "progress.h"
+#include "sparse-index.h"
 
 /* Mask for the name length in ce_flags in the on-disk index */
 
@@ -47,6 +48,7 @@
 #define CACHE_EXT_FSMONITOR 0x46534D4E	  /* "FSMN" */
 #define CACHE_EXT_ENDOFINDEXENTRIES 0x454F4945	/* "EOIE" */
 #define CACHE_EXT_INDEXENTRYOFFSETTABLE 0x49454F54 /* "IEOT" */
+#define CACHE_EXT_SPARSE_DIRECTORIES 0x73646972 /* "sdir" */
 
 /* changes that can be kept in $GIT_DIR/index (basically all extensions) */
 #define EXTMASK (RESOLVE_UNDO_CHANGED | CACHE_TREE_CHANGED | \
@@ -1754,6 +1756,10 @@ static int read_index_extension(struct index_state *istate,
 	case CACHE_EXT_INDEXENTRYOFFSETTABLE:
 		/* already handled in do_read_index() */
 		break;
+	case CACHE_EXT_SPARSE_DIRECTORIES:
+		/* no content, only an indication that this is a sparse index */
+		istate->sparse_index = 1;
+		break;
 	default:
 		if (*ext < 'A' || 'Z' < *ext)
 			return error(_("index uses %.4s extension, which we do not understand"),
@@ -1911,12 +1917,26 @@ static void tweak_split_index(struct index_state *istate)
 	}
 }
 
+/*
+ * Commands that have not been taught about sparse directory entries
+ * must only ever see a full index.
+ */
+static int command_requires_full_index(struct index_state *istate)
+{
+	struct repository *r = istate->repo ? istate->repo : the_repository;
+
+	prepare_repo_settings(r);
+	return r->settings.command_requires_full_index;
+}
+
 static void post_read_index_from(struct index_state *istate)
 {
 	check_ce_order(istate);
 	tweak_untracked_cache(istate);
 	tweak_split_index(istate);
 	tweak_fsmonitor(istate);
+	if (istate->sparse_index && command_requires_full_index(istate))
+		ensure_full_index(istate);
 }
 
 static size_t estimate_cache_size_from_compressed(unsigned int entries)
@@ -2364,6 +2384,7 @@ int discard_index(struct index_state *istate)
 	cache_tree_free(&(istate->cache_tree));
 	istate->initialized = 0;
 	istate->fsmonitor_has_run_once = 0;
+	istate->sparse_index = 0;
 	FREE_AND_NULL(istate->cache);
 	istate->cache_alloc = 0;
 	discard_split_index(istate);
@@ -3002,6 +3023,10 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 		if (err)
 			return -1;
 	}
+	if (istate->sparse_index) {
+		if (write_index_ext_header(&c, &eoie_c, newfd, CACHE_EXT_SPARSE_DIRECTORIES, 0) < 0)
+			return -1;
+	}
 
 	/*
 	 * CACHE_EXT_ENDOFINDEXENTRIES must be written as the last entry before the SHA1
@@ -3224,6 +3249,7 @@ int write_locked_index(struct index_state *istate, struct lock_file *lock,
 {
 	int new_shared_index, ret;
 	struct split_index *si = istate->split_index;
+	int was_full = !istate->sparse_index;
 
 	if (git_env_bool("GIT_TEST_CHECK_CACHE_TREE", 0))
 		cache_tree_verify(the_repository, istate);
@@ -3234,6 +3260,9 @@ int write_locked_index(struct index_state *istate, struct lock_file *lock,
 		return 0;
 	}
 
+	/* This must happen before anything records positions of entries */
+	convert_to_sparse(istate);
+
 	if (istate->fsmonitor_last_update)
 		fill_fsmonitor_bitmap(istate);
 
@@ -3289,6 +3318,10 @@ int write_locked_index(struct index_state *istate, struct lock_file *lock,
 out:
 	if (flags & COMMIT_LOCK)
 		rollback_lock_file(lock);
+	/* The caller may go on using the index it gave us */
+	if (was_full && istate->sparse_index &&
+	    command_requires_full_index(istate))
+		ensure_full_index(istate);
 	return ret;
 }
 
@@ -20,7 +20,7 @@
 /*
  * List of all available backends
  */
-static struct ref_storage_be *refs_backends = &refs_be_files;
+static struct ref_storage_be *refs_backends = &refs_be_reftable;
 
 static struct ref_storage_be *find_ref_storage_backend(const char *name)
 {
@@ -1583,6 +1583,105 @@ int for_each_namespaced_ref(each_ref_fn fn, void *cb_data)
 	return ret;
 }
 
+static int qsort_strcmp(const void *va, const void *vb)
+{
+	const char *a = *(const char **)va;
+	const char *b = *(const char **)vb;
+
+	return strcmp(a, b);
+}
+
+static void find_longest_prefixes_1(struct string_list *out,
+				  struct strbuf *prefix,
+				  const char **patterns, size_t nr)
+{
+	size_t i;
+
+	for (i = 0; i < nr; i++) {
+		char c = patterns[i][prefix->len];
+		if (!c || is_glob_special(c)) {
+			string_list_append(out, prefix->buf);
+			return;
+		}
+	}
+
+	i = 0;
+	while (i < nr) {
+		size_t end;
+
+		/*
+		* Set "end" to the index of the element _after_ the last one
+		* in our group.
+		*/
+		for (end = i + 1; end < nr; end++) {
+			if (patterns[i][prefix->len] != patterns[end][prefix->len])
+				break;
+		}
+
+		strbuf_addch(prefix, patterns[i][prefix->len]);
+		find_longest_prefixes_1(out, prefix, patterns + i, end - i);
+		strbuf_setlen(prefix, prefix->len - 1);
+
+		i = end;
+	}
+}
+
+static void find_longest_prefixes(struct string_list *out,
+				  const char **patterns)
+{
+	struct argv_array sorted = ARGV_ARRAY_INIT;
+	struct strbuf prefix = STRBUF_INIT;
+
+	argv_array_pushv(&sorted, patterns);
+	QSORT(sorted.argv, sorted.argc, qsort_strcmp);
+
+	find_longest_prefixes_1(out, &prefix, sorted.argv, sorted.argc);
+
+	argv_array_clear(&sorted);
+	strbuf_release(&prefix);
+}
+
+int refs_for_each_fullref_in_prefixes(struct ref_store *refs,
+				      const char *namespace,
+				      const char **patterns,
+				      each_ref_fn fn, void *cb_data,
+				      unsigned int broken)
+{
+	struct string_list prefixes = STRING_LIST_INIT_DUP;
+	struct string_list_item *prefix;
+	struct strbuf buf = STRBUF_INIT;
+	int ret = 0, namespace_len;
+
+	find_longest_prefixes(&prefixes, patterns);
+
+	if (namespace)
+		strbuf_addstr(&buf, namespace);
+	namespace_len = buf.len;
+
+	for_each_string_list_item(prefix, &prefixes) {
+		strbuf_addstr(&buf, prefix->string);
+		ret = refs_for_each_fullref_in(refs, buf.buf, fn, cb_data,
+					       broken);
+		if (ret)
+			break;
+		strbuf_setlen(&buf, namespace_len);
+	}
+
+	string_list_clear(&prefixes, 0);
+	strbuf_release(&buf);
+	return ret;
+}
+
+int for_each_fullref_in_prefixes(const char *namespace,
+				 const char **patterns,
+				 each_ref_fn fn, void *cb_data,
+				 unsigned int broken)
+{
+	return refs_for_each_fullref_in_prefixes(get_main_ref_store(the_repository),
+						 namespace, patterns, fn,
+						 cb_data, broken);
+}
+
 int refs_for_each_rawref(struct ref_store *refs, each_ref_fn fn, void *cb_data)
 {
 	return do_for_each_ref(refs, "", fn, 0,
@@ -1790,17 +1889,18 @@ static struct ref_store *lookup_ref_store_map(struct hashmap *map,
 
 /*
  * Create, record, and return a ref_store instance for the specified
- * gitdir.
+ * gitdir, using the backend named by "format" (NULL meaning "files").
  */
 static struct ref_store *ref_store_init(const char *gitdir,
+					const char *format,
 					unsigned int flags)
 {
-	const char *be_name = "files";
+	const char *be_name = format ? format : "files";
 	struct ref_storage_be *be = find_ref_storage_backend(be_name);
 	struct ref_store *refs;
 
 	if (!be)
-		BUG("reference backend %s is unknown", be_name);
+		die(_("reference backend %s is unknown"), be_name);
 
 	refs = be->init(gitdir, flags);
 	return refs;
@@ -1814,7 +1914,8 @@ struct ref_store *get_main_ref_store(struct repository *r)
 	if (!r->gitdir)
 		BUG("attempting to get main_ref_store outside of repository");
 
-	r->refs_private = ref_store_init(r->gitdir, REF_STORE_ALL_CAPS);
+	r->refs_private = ref_store_init(r->gitdir, r->ref_storage_format,
+					 REF_STORE_ALL_CAPS);
 	return r->refs_private;
 }
 
@@ -1840,6 +1941,9 @@ static void register_ref_store_map(struct hashmap *map,
 struct ref_store *get_submodule_ref_store(const char *submodule)
 {
 	struct strbuf submodule_sb = STRBUF_INIT;
+	struct strbuf commondir = STRBUF_INIT;
+	struct strbuf format_path = STRBUF_INIT;
+	struct repository_format format = REPOSITORY_FORMAT_INIT;
 	struct ref_store *refs;
 	char *to_free = NULL;
 	size_t len;
@@ -1868,14 +1972,22 @@ struct ref_store *get_submodule_ref_store(const char *submodule)
 	if (submodule_to_gitdir(&submodule_sb, submodule))
 		goto done;
 
+	/* the submodule may store its references differently */
+	get_common_dir_noenv(&commondir, submodule_sb.buf);
+	strbuf_addf(&format_path, "%s/config", commondir.buf);
+	read_repository_format(&format, format_path.buf);
+
 	/* assume that add_submodule_odb() has been called */
-	refs = ref_store_init(submodule_sb.buf,
+	refs = ref_store_init(submodule_sb.buf, format.ref_storage_format,
 			      REF_STORE_READ | REF_STORE_ODB);
+	clear_repository_format(&format);
 	register_ref_store_map(&submodule_ref_stores, "submodule",
 			       refs, submodule);
 
 done:
 	strbuf_release(&submodule_sb);
+	strbuf_release(&commondir);
+	strbuf_release(&format_path);
 	free(to_free);
 
 	return refs;
@@ -1896,9 +2008,11 @@ struct ref_store *get_worktree_ref_store(const struct worktree *wt)
 
 	if (wt->id)
 		refs = ref_store_init(git_common_path("worktrees/%s", wt->id),
+				      the_repository->ref_storage_format,
 				      REF_STORE_ALL_CAPS);
 	else
 		refs = ref_store_init(get_git_common_dir(),
+				      the_repository->ref_storage_format,
 				      REF_STORE_ALL_CAPS);
 
 	if (refs)
@@ -328,6 +328,24 @@ int refs_for_each_fullref_in(struct ref_store *refs, const char *prefix,
 int for_each_fullref_in(const char *prefix, each_ref_fn fn, void *cb_data,
 			unsigned int broken);
 
+/**
+ * Iterate over the refs matching any of the given patterns, which may
+ * contain globs, in order. Only the refs under the longest literal
+ * prefixes of the patterns are visited, each prefix being a separate
+ * seeked iteration; the callback still has to match each ref against
+ * the patterns. If `namespace` is not NULL, it is prepended to each
+ * prefix. Nothing is visited if there are no patterns.
+ */
+int refs_for_each_fullref_in_prefixes(struct ref_store *refs,
+				      const char *namespace,
+				      const char **patterns,
+				      each_ref_fn fn, void *cb_data,
+				      unsigned int broken);
+int for_each_fullref_in_prefixes(const char *namespace,
+				 const char **patterns,
+				 each_ref_fn fn, void *cb_data,
+				 unsigned int broken);
+
 /**
  * iterate refs from the respective area.
  */
@@ -0,0 +1,2026 @@
+#include "../cache.h"
+#include "../config.h"
+#include "../refs.h"
+#include "refs-internal.h"
+#include "reftable.h"
+#include "../iterator.h"
+#include "../object.h"
+#include "../chdir-notify.h"
+
+/*
+ * This backend uses the following flags in `ref_update::flags` for
+ * internal bookkeeping purposes, with the same meaning as in the files
+ * backend. Their numerical values must not conflict with REF_NO_DEREF,
+ * REF_FORCE_CREATE_REFLOG, REF_HAVE_NEW or REF_HAVE_OLD, which are
+ * also stored in `ref_update::flags`.
+ */
+
+/* The reference is being deleted. */
+#define REF_DELETING (1 << 5)
+
+/* The new value of the reference has to be written. */
+#define REF_NEEDS_COMMIT (1 << 6)
+
+/*
+ * Only log the update, without performing it. This is used when a
+ * symbolic ref update is split up.
+ */
+#define REF_LOG_ONLY (1 << 7)
+
+/* The update is for the referent of HEAD, and came via HEAD. */
+#define REF_UPDATE_VIA_HEAD (1 << 8)
+
+struct reftable_ref_store {
+	struct ref_store base;
+	unsigned int store_flags;
+
+	char *gitdir;
+	char *gitcommondir;
+
+	/* The references shared by all worktrees */
+	struct reftable_stack *main_stack;
+
+	/* The per-worktree references of a linked worktree, or NULL */
+	struct reftable_stack *worktree_stack;
+
+	/*
+	 * Pseudorefs other than HEAD (like ORIG_HEAD or FETCH_HEAD)
+	 * stay files in $GIT_DIR, which is where some commands expect
+	 * to find them; they are handled by a files ref store.
+	 */
+	struct ref_store *pseudoref_store;
+};
+
+static struct reftable_stack *new_stack(const char *dir)
+{
+	struct strbuf sb = STRBUF_INIT;
+	struct reftable_stack *st;
+
+	strbuf_add_absolute_path(&sb, dir);
+	strbuf_addstr(&sb, "/reftable");
+	st = reftable_stack_new(sb.buf);
+	strbuf_release(&sb);
+	return st;
+}
+
+static struct ref_store *reftable_ref_store_create(const char *gitdir,
+						   unsigned int flags)
+{
+	struct reftable_ref_store *refs = xcalloc(1, sizeof(*refs));
+	struct ref_store *ref_store = (struct ref_store *)refs;
+	struct strbuf sb = STRBUF_INIT;
+
+	base_ref_store_init(ref_store, &refs_be_reftable);
+	refs->store_flags = flags;
+
+	refs->gitdir = xstrdup(gitdir);
+	get_common_dir_noenv(&sb, gitdir);
+	refs->gitcommondir = strbuf_detach(&sb, NULL);
+
+	refs->main_stack = new_stack(refs->gitcommondir);
+	if (strcmp(refs->gitdir, refs->gitcommondir))
+		refs->worktree_stack = new_stack(refs->gitdir);
+	refs->pseudoref_store = refs_be_files.init(gitdir, flags);
+
+	chdir_notify_reparent("reftable-backend $GIT_DIR",
+			      &refs->gitdir);
+	chdir_notify_reparent("reftable-backend $GIT_COMMONDIR",
+			      &refs->gitcommondir);
+
+	return ref_store;
+}
+
+/*
+ * Downcast ref_store to reftable_ref_store. Die if ref_store is not a
+ * reftable_ref_store. required_flags is compared with ref_store's
+ * store_flags to ensure the ref_store has all required capabilities.
+ * "caller" is used in any necessary error messages.
+ */
+static struct reftable_ref_store *reftable_downcast(struct ref_store *ref_store,
+						    unsigned int required_flags,
+						    const char *caller)
+{
+	struct reftable_ref_store *refs;
+
+	if (ref_store->be != &refs_be_reftable)
+		BUG("ref_store is type \"%s\" not \"reftable\" in %s",
+		    ref_store->be->name, caller);
+
+	refs = (struct reftable_ref_store *)ref_store;
+
+	if ((refs->store_flags & required_flags) != required_flags)
+		BUG("operation %s requires abilities 0x%x, but only have 0x%x",
+		    caller, required_flags, refs->store_flags);
+
+	return refs;
+}
+
+/*
+ * Return the length of time to retry acquiring the lock of a stack
+ * before giving up, in milliseconds. An update locks the whole stack,
+ * like a rewrite of packed-refs does, so use the same setting.
+ */
+static long reftable_lock_timeout_ms(void)
+{
+	static int configured;
+	static int timeout_ms = 1000;
+
+	if (!configured) {
+		git_config_get_int("core.packedrefstimeout", &timeout_ms);
+		configured = 1;
+	}
+	return timeout_ms;
+}
+
+/*
+ * Is refname a pseudoref other than HEAD, possibly of another
+ * worktree, which lives in the pseudoref store?
+ */
+static int is_files_pseudoref(const char *refname)
+{
+	const char *slash;
+
+	switch (ref_type(refname)) {
+	case REF_TYPE_PSEUDOREF:
+		return 1;
+	case REF_TYPE_MAIN_PSEUDOREF:
+	case REF_TYPE_OTHER_PSEUDOREF:
+		slash = strrchr(refname, '/');
+		return strcmp(slash + 1, "HEAD");
+	default:
+		return 0;
+	}
+}
+
+/* The stack holding the given reference of this worktree. */
+static struct reftable_stack *stack_for(struct reftable_ref_store *refs,
+					const char *refname)
+{
+	if (refs->worktree_stack &&
+	    ref_type(refname) == REF_TYPE_PER_WORKTREE)
+		return refs->worktree_stack;
+	return refs->main_stack;
+}
+
+/*
+ * Like stack_for(), but also handle "main-worktree/HEAD" and
+ * "worktrees/<id>/HEAD", for which *name is set to "HEAD" and a stack
+ * may be opened, to be freed by the caller through *to_free.
+ */
+static struct reftable_stack *stack_for_reading(struct reftable_ref_store *refs,
+						const char *refname,
+						const char **name,
+						struct reftable_stack **to_free)
+{
+	const char *id, *slash;
+
+	*to_free = NULL;
+	*name = refname;
+	switch (ref_type(refname)) {
+	case REF_TYPE_MAIN_PSEUDOREF:
+		skip_prefix(refname, "main-worktree/", name);
+		return refs->main_stack;
+	case REF_TYPE_OTHER_PSEUDOREF: {
+		struct strbuf dir = STRBUF_INIT;
+
+		id = refname + strlen("worktrees/");
+		slash = strchr(id, '/');
+		*name = slash + 1;
+		strbuf_addf(&dir, "%s/worktrees/%.*s", refs->gitcommondir,
+			    (int)(slash - id), id);
+		*to_free = new_stack(dir.buf);
+		strbuf_release(&dir);
+		return *to_free;
+	}
+	default:
+		return stack_for(refs, refname);
+	}
+}
+
+static int read_ref_from_stack(struct reftable_stack *st, const char *refname,
+			       struct object_id *oid, struct strbuf *referent,
+			       unsigned int *type)
+{
+	struct reftable_ref_record rec = REFTABLE_REF_RECORD_INIT;
+	int ret;
+
+	if (reftable_stack_reload(st) < 0) {
+		errno = EIO;
+		return -1;
+	}
+
+	ret = reftable_stack_read_ref(st, refname, &rec);
+	if (ret) {
+		reftable_ref_record_release(&rec);
+		errno = ret > 0 ? ENOENT : EIO;
+		return -1;
+	}
+
+	if (rec.type == REFTABLE_REF_SYMREF) {
+		strbuf_reset(referent);
+		strbuf_addbuf(referent, &rec.target);
+		*type |= REF_ISSYMREF;
+	} else {
+		oidcpy(oid, &rec.value);
+	}
+	reftable_ref_record_release(&rec);
+	return 0;
+}
+
+static int reftable_read_raw_ref(struct ref_store *ref_store,
+				 const char *refname, struct object_id *oid,
+				 struct strbuf *referent, unsigned int *type)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ, "read_raw_ref");
+	struct reftable_stack *st, *to_free;
+	const char *name;
+	int ret, save_errno;
+
+	*type = 0;
+	if (is_files_pseudoref(refname))
+		return refs_read_raw_ref(refs->pseudoref_store, refname,
+					 oid, referent, type);
+
+	st = stack_for_reading(refs, refname, &name, &to_free);
+	ret = read_ref_from_stack(st, name, oid, referent, type);
+	save_errno = errno;
+	reftable_stack_free(to_free);
+	errno = save_errno;
+	return ret;
+}
+
+struct reftable_ref_iterator {
+	struct ref_iterator base;
+
+	struct reftable_ref_store *refs;
+	struct reftable_iterator *iter;
+	struct reftable_ref_record rec;
+	struct object_id oid;
+	char *prefix;
+	unsigned int flags;
+
+	/*
+	 * Positive to only show per-worktree references, negative to
+	 * hide them, and zero to show all references.
+	 */
+	int worktree_refs;
+};
+
+static int reftable_ref_iterator_advance(struct ref_iterator *ref_iterator)
+{
+	struct reftable_ref_iterator *iter =
+		(struct reftable_ref_iterator *)ref_iterator;
+	int ret;
+
+	while (!(ret = reftable_iterator_next_ref(iter->iter, &iter->rec))) {
+		const char *refname = iter->rec.refname.buf;
+		int per_worktree;
+
+		if (!starts_with(refname, iter->prefix)) {
+			ret = 1;
+			break;
+		}
+		/* HEAD lives in the stack, too */
+		if (!starts_with(refname, "refs/"))
+			continue;
+
+		per_worktree = ref_type(refname) == REF_TYPE_PER_WORKTREE;
+		if ((iter->flags & DO_FOR_EACH_PER_WORKTREE_ONLY ||
+		     iter->worktree_refs > 0) && !per_worktree)
+			continue;
+		if (iter->worktree_refs < 0 && per_worktree)
+			continue;
+
+		iter->base.flags = 0;
+		if (iter->rec.type == REFTABLE_REF_SYMREF) {
+			iter->base.flags |= REF_ISSYMREF;
+			if (!refs_resolve_ref_unsafe(&iter->refs->base, refname,
+						     RESOLVE_REF_READING,
+						     &iter->oid, NULL)) {
+				oidclr(&iter->oid);
+				iter->base.flags |= REF_ISBROKEN;
+			}
+		} else {
+			oidcpy(&iter->oid, &iter->rec.value);
+		}
+
+		if (!(iter->flags & DO_FOR_EACH_INCLUDE_BROKEN) &&
+		    !ref_resolves_to_object(refname, &iter->oid,
+					    iter->base.flags))
+			continue;
+
+		iter->base.refname = refname;
+		iter->base.oid = &iter->oid;
+		return ITER_OK;
+	}
+
+	if (ref_iterator_abort(ref_iterator) != ITER_DONE || ret < 0)
+		return ITER_ERROR;
+	return ITER_DONE;
+}
+
+static int reftable_ref_iterator_peel(struct ref_iterator *ref_iterator,
+				      struct object_id *peeled)
+{
+	struct reftable_ref_iterator *iter =
+		(struct reftable_ref_iterator *)ref_iterator;
+
+	if (iter->rec.type == REFTABLE_REF_VAL2) {
+		oidcpy(peeled, &iter->rec.peeled);
+		return 0;
+	}
+	return peel_object(&iter->oid, peeled) ? -1 : 0;
+}
+
+static int reftable_ref_iterator_abort(struct ref_iterator *ref_iterator)
+{
+	struct reftable_ref_iterator *iter =
+		(struct reftable_ref_iterator *)ref_iterator;
+
+	reftable_iterator_release(iter->iter);
+	reftable_ref_record_release(&iter->rec);
+	free(iter->prefix);
+	base_ref_iterator_free(ref_iterator);
+	return ITER_DONE;
+}
+
+static struct ref_iterator_vtable reftable_ref_iterator_vtable = {
+	reftable_ref_iterator_advance,
+	reftable_ref_iterator_peel,
+	reftable_ref_iterator_abort
+};
+
+static struct ref_iterator *stack_ref_iterator_begin(
+		struct reftable_ref_store *refs, struct reftable_stack *st,
+		const char *prefix, unsigned int flags, int worktree_refs)
+{
+	struct reftable_ref_iterator *iter;
+	struct ref_iterator *ref_iterator;
+
+	if (reftable_stack_reload(st) < 0)
+		return empty_ref_iterator_begin();
+
+	iter = xcalloc(1, sizeof(*iter));
+	ref_iterator = &iter->base;
+	base_ref_iterator_init(ref_iterator, &reftable_ref_iterator_vtable, 1);
+	iter->refs = refs;
+	/* seeking to the prefix skips everything before it */
+	iter->iter = reftable_stack_ref_iterator(st, prefix);
+	strbuf_init(&iter->rec.refname, 0);
+	strbuf_init(&iter->rec.target, 0);
+	iter->prefix = xstrdup(prefix);
+	iter->flags = flags;
+	iter->worktree_refs = worktree_refs;
+	return ref_iterator;
+}
+
+static struct ref_iterator *reftable_ref_iterator_begin(
+		struct ref_store *ref_store,
+		const char *prefix, unsigned int flags)
+{
+	struct reftable_ref_store *refs;
+	unsigned int required_flags = REF_STORE_READ;
+
+	if (!(flags & DO_FOR_EACH_INCLUDE_BROKEN))
+		required_flags |= REF_STORE_ODB;
+
+	refs = reftable_downcast(ref_store, required_flags, "ref_iterator_begin");
+
+	if (!refs->worktree_stack)
+		return stack_ref_iterator_begin(refs, refs->main_stack,
+						prefix, flags, 0);
+
+	return overlay_ref_iterator_begin(
+			stack_ref_iterator_begin(refs, refs->worktree_stack,
+						 prefix, flags, 1),
+			stack_ref_iterator_begin(refs, refs->main_stack,
+						 prefix, flags, -1));
+}
+
+/*
+ * Collecting the records of an update, which have to be written in
+ * order. Later records for the same key replace earlier ones.
+ */
+
+struct batch_ref {
+	struct reftable_ref_record rec;
+	size_t seq;
+};
+
+struct batch_log {
+	struct reftable_log_record rec;
+	size_t seq;
+};
+
+struct write_batch {
+	struct reftable_stack *st;
+	uint64_t update_index;
+
+	struct batch_ref *refs;
+	size_t refs_nr, refs_alloc;
+
+	struct batch_log *logs;
+	size_t logs_nr, logs_alloc;
+};
+
+static void batch_init(struct write_batch *batch, struct reftable_stack *st)
+{
+	memset(batch, 0, sizeof(*batch));
+	batch->st = st;
+	batch->update_index = reftable_stack_next_update_index(st);
+}
+
+static void batch_release(struct write_batch *batch)
+{
+	size_t i;
+
+	for (i = 0; i < batch->refs_nr; i++)
+		reftable_ref_record_release(&batch->refs[i].rec);
+	for (i = 0; i < batch->logs_nr; i++)
+		reftable_log_record_release(&batch->logs[i].rec);
+	FREE_AND_NULL(batch->refs);
+	FREE_AND_NULL(batch->logs);
+	batch->refs_nr = batch->refs_alloc = 0;
+	batch->logs_nr = batch->logs_alloc = 0;
+}
+
+static struct reftable_ref_record *batch_add_ref(struct write_batch *batch,
+						 const char *refname)
+{
+	struct batch_ref *ref;
+
+	ALLOC_GROW(batch->refs, batch->refs_nr + 1, batch->refs_alloc);
+	ref = &batch->refs[batch->refs_nr];
+	memset(ref, 0, sizeof(*ref));
+	ref->seq = batch->refs_nr++;
+	strbuf_init(&ref->rec.refname, 0);
+	strbuf_init(&ref->rec.target, 0);
+	strbuf_addstr(&ref->rec.refname, refname);
+	ref->rec.update_index = batch->update_index;
+	return &ref->rec;
+}
+
+static void batch_add_oid(struct write_batch *batch, const char *refname,
+			  const struct object_id *oid)
+{
+	struct reftable_ref_record *rec = batch_add_ref(batch, refname);
+
+	oidcpy(&rec->value, oid);
+	if (peel_object(oid, &rec->peeled) == PEEL_PEELED)
+		rec->type = REFTABLE_REF_VAL2;
+	else
+		rec->type = REFTABLE_REF_VAL1;
+}
+
+static struct reftable_log_record *batch_add_log(struct write_batch *batch,
+						 const char *refname,
+						 uint64_t update_index)
+{
+	struct batch_log *log;
+
+	ALLOC_GROW(batch->logs, batch->logs_nr + 1, batch->logs_alloc);
+	log = &batch->logs[batch->logs_nr];
+	memset(log, 0, sizeof(*log));
+	log->seq = batch->logs_nr++;
+	strbuf_init(&log->rec.refname, 0);
+	strbuf_init(&log->rec.name, 0);
+	strbuf_init(&log->rec.email, 0);
+	strbuf_init(&log->rec.message, 0);
+	strbuf_addstr(&log->rec.refname, refname);
+	log->rec.update_index = update_index;
+	return &log->rec;
+}
+
+/* Add a reflog entry as the files backend would append it. */
+static void batch_add_reflog_entry(struct write_batch *batch,
+				   const char *refname,
+				   const struct object_id *old_oid,
+				   const struct object_id *new_oid,
+				   const char *msg)
+{
+	struct reftable_log_record *log =
+		batch_add_log(batch, refname, batch->update_index);
+	const char *committer = git_committer_info(0);
+	struct ident_split ident;
+
+	oidcpy(&log->old_oid, old_oid);
+	oidcpy(&log->new_oid, new_oid);
+	if (!split_ident_line(&ident, committer, strlen(committer))) {
+		strbuf_add(&log->name, ident.name_begin,
+			   ident.name_end - ident.name_begin);
+		strbuf_add(&log->email, ident.mail_begin,
+			   ident.mail_end - ident.mail_begin);
+		if (ident.date_begin)
+			log->time = parse_timestamp(ident.date_begin, NULL, 10);
+		if (ident.tz_begin)
+			log->tz = strtol(ident.tz_begin, NULL, 10);
+	}
+	if (msg && *msg) {
+		struct strbuf sb = STRBUF_INIT;
+
+		/* skip the tab that separates the message in a reflog file */
+		copy_reflog_msg(&sb, msg);
+		if (sb.len)
+			strbuf_addstr(&log->message, sb.buf + 1);
+		strbuf_release(&sb);
+	}
+}
+
+/*
+ * A reflog that exists but has no entries (e.g. after "git reflog
+ * expire") is recorded as an entry with null object names on both
+ * sides, which is not shown.
+ */
+static void batch_add_reflog_marker(struct write_batch *batch,
+				    const char *refname)
+{
+	batch_add_log(batch, refname, batch->update_index);
+}
+
+static int is_reflog_marker(const struct reftable_log_record *log)
+{
+	return is_null_oid(&log->old_oid) && is_null_oid(&log->new_oid);
+}
+
+/* Delete all entries of the reflog of refname. */
+static int batch_delete_reflog(struct write_batch *batch, const char *refname)
+{
+	struct reftable_iterator *it =
+		reftable_stack_log_iterator(batch->st, refname);
+	struct reftable_log_record log = REFTABLE_LOG_RECORD_INIT;
+	int ret;
+
+	while (!(ret = reftable_iterator_next_log(it, &log)))
+		batch_add_log(batch, refname, log.update_index)->deletion = 1;
+	reftable_log_record_release(&log);
+	reftable_iterator_release(it);
+	return ret < 0 ? -1 : 0;
+}
+
+static int batch_ref_cmp(const void *va, const void *vb)
+{
+	const struct batch_ref *a = va, *b = vb;
+	int cmp = strbuf_cmp(&a->rec.refname, &b->rec.refname);
+
+	if (cmp)
+		return cmp;
+	return a->seq < b->seq ? -1 : a->seq > b->seq;
+}
+
+static int batch_log_cmp(const void *va, const void *vb)
+{
+	const struct batch_log *a = va, *b = vb;
+	int cmp = strcmp(a->rec.refname.buf, b->rec.refname.buf);
+
+	if (cmp)
+		return cmp;
+	if (a->rec.update_index != b->rec.update_index)
+		return a->rec.update_index > b->rec.update_index ? -1 : 1;
+	return a->seq < b->seq ? -1 : a->seq > b->seq;
+}
+
+static int write_batch(struct reftable_writer *w, void *cb_data)
+{
+	struct write_batch *batch = cb_data;
+	size_t i;
+
+	QSORT(batch->refs, batch->refs_nr, batch_ref_cmp);
+	for (i = 0; i < batch->refs_nr; i++) {
+		if (i + 1 < batch->refs_nr &&
+		    !strbuf_cmp(&batch->refs[i].rec.refname,
+				&batch->refs[i + 1].rec.refname))
+			continue;
+		if (reftable_writer_add_ref(w, &batch->refs[i].rec) < 0)
+			return -1;
+	}
+
+	QSORT(batch->logs, batch->logs_nr, batch_log_cmp);
+	for (i = 0; i < batch->logs_nr; i++) {
+		const struct reftable_log_record *log = &batch->logs[i].rec;
+
+		if (i + 1 < batch->logs_nr &&
+		    log->update_index == batch->logs[i + 1].rec.update_index &&
+		    !strcmp(log->refname.buf, batch->logs[i + 1].rec.refname.buf))
+			continue;
+		if (reftable_writer_add_log(w, log) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+static int stack_reflog_exists(struct reftable_stack *st, const char *refname)
+{
+	struct reftable_iterator *it = reftable_stack_log_iterator(st, refname);
+	struct reftable_log_record log = REFTABLE_LOG_RECORD_INIT;
+	int ret = !reftable_iterator_next_log(it, &log);
+
+	reftable_log_record_release(&log);
+	reftable_iterator_release(it);
+	return ret;
+}
+
+/*
+ * Should an update of refname be logged? As with the files backend,
+ * the reflog is created if asked to, or if it is a reflog that is
+ * created automatically; otherwise, only existing reflogs are added to.
+ */
+static int should_write_log(struct reftable_stack *st, const char *refname,
+			    unsigned int flags)
+{
+	if (log_all_ref_updates == LOG_REFS_UNSET)
+		log_all_ref_updates = is_bare_repository() ? LOG_REFS_NONE : LOG_REFS_NORMAL;
+
+	return (flags & REF_FORCE_CREATE_REFLOG) ||
+		should_autocreate_reflog(refname) ||
+		stack_reflog_exists(st, refname);
+}
+
+static int lock_stack(struct reftable_stack *st, struct strbuf *err)
+{
+	return reftable_stack_lock(st, reftable_lock_timeout_ms(), err);
+}
+
+/*
+ * Transactions
+ */
+
+struct reftable_update_data {
+	/* the value of the reference before the update */
+	struct object_id old_oid;
+	int exists;
+};
+
+struct reftable_transaction_data {
+	/* The stacks touched by the transaction; they are locked */
+	struct write_batch batches[2];
+	size_t nr;
+
+	/* The updates of pseudorefs, which are files */
+	struct ref_transaction *pseudoref_transaction;
+};
+
+/*
+ * Return the batch collecting the records for st, locking the stack
+ * if it is not yet locked by the transaction.
+ */
+static struct write_batch *transaction_batch(struct reftable_transaction_data *data,
+					     struct reftable_stack *st,
+					     struct strbuf *err)
+{
+	size_t i;
+
+	for (i = 0; i < data->nr; i++)
+		if (data->batches[i].st == st)
+			return &data->batches[i];
+
+	if (data->nr == ARRAY_SIZE(data->batches))
+		BUG("reftable transaction touching too many stacks");
+	if (lock_stack(st, err))
+		return NULL;
+	batch_init(&data->batches[data->nr], st);
+	return &data->batches[data->nr++];
+}
+
+/*
+ * Unlock the stacks of `transaction` that are still locked, and mark
+ * the transaction closed.
+ */
+static void reftable_transaction_cleanup(struct ref_transaction *transaction)
+{
+	struct reftable_transaction_data *data = transaction->backend_data;
+	struct strbuf err = STRBUF_INIT;
+	size_t i;
+
+	for (i = 0; i < transaction->nr; i++)
+		FREE_AND_NULL(transaction->updates[i]->backend_data);
+
+	if (data) {
+		for (i = 0; i < data->nr; i++) {
+			reftable_stack_unlock(data->batches[i].st);
+			batch_release(&data->batches[i]);
+		}
+		if (data->pseudoref_transaction &&
+		    ref_transaction_abort(data->pseudoref_transaction, &err)) {
+			error("error aborting transaction: %s", err.buf);
+			strbuf_release(&err);
+		}
+		FREE_AND_NULL(transaction->backend_data);
+	}
+
+	transaction->state = REF_TRANSACTION_CLOSED;
+}
+
+/*
+ * If update is a direct update of head_ref (the reference pointed to
+ * by HEAD), then add an extra REF_LOG_ONLY update for HEAD.
+ */
+static int split_head_update(struct ref_update *update,
+			     struct ref_transaction *transaction,
+			     const char *head_ref,
+			     struct string_list *affected_refnames,
+			     struct strbuf *err)
+{
+	struct string_list_item *item;
+	struct ref_update *new_update;
+
+	if ((update->flags & REF_LOG_ONLY) ||
+	    (update->flags & REF_UPDATE_VIA_HEAD))
+		return 0;
+
+	if (strcmp(update->refname, head_ref))
+		return 0;
+
+	if (string_list_has_string(affected_refnames, "HEAD")) {
+		strbuf_addf(err,
+			    "multiple updates for 'HEAD' (including one "
+			    "via its referent '%s') are not allowed",
+			    update->refname);
+		return TRANSACTION_NAME_CONFLICT;
+	}
+
+	new_update = ref_transaction_add_update(
+			transaction, "HEAD",
+			update->flags | REF_LOG_ONLY | REF_NO_DEREF,
+			&update->new_oid, &update->old_oid,
+			update->msg);
+
+	item = string_list_insert(affected_refnames, new_update->refname);
+	item->util = new_update;
+
+	return 0;
+}
+
+/*
+ * update is for a symref that points at referent and doesn't have
+ * REF_NO_DEREF set. Split it into two updates:
+ * - The original update, but with REF_LOG_ONLY and REF_NO_DEREF set
+ * - A new, separate update for the referent reference
+ * Note that the new update will itself be subject to splitting when
+ * the iteration gets to it.
+ */
+static int split_symref_update(struct ref_update *update,
+			       const char *referent,
+			       struct ref_transaction *transaction,
+			       struct string_list *affected_refnames,
+			       struct strbuf *err)
+{
+	struct string_list_item *item;
+	struct ref_update *new_update;
+	unsigned int new_flags;
+
+	if (string_list_has_string(affected_refnames, referent)) {
+		strbuf_addf(err,
+			    "multiple updates for '%s' (including one "
+			    "via symref '%s') are not allowed",
+			    referent, update->refname);
+		return TRANSACTION_NAME_CONFLICT;
+	}
+
+	new_flags = update->flags;
+	if (!strcmp(update->refname, "HEAD"))
+		new_flags |= REF_UPDATE_VIA_HEAD;
+
+	new_update = ref_transaction_add_update(
+			transaction, referent, new_flags,
+			&update->new_oid, &update->old_oid,
+			update->msg);
+
+	new_update->parent_update = update;
+
+	update->flags |= REF_LOG_ONLY | REF_NO_DEREF;
+	update->flags &= ~REF_HAVE_OLD;
+
+	item = string_list_insert(affected_refnames, new_update->refname);
+	if (item->util)
+		BUG("%s unexpectedly found in affected_refnames",
+		    new_update->refname);
+	item->util = new_update;
+
+	return 0;
+}
+
+/*
+ * Return the refname under which update was originally requested.
+ */
+static const char *original_update_refname(struct ref_update *update)
+{
+	while (update->parent_update)
+		update = update->parent_update;
+
+	return update->refname;
+}
+
+/*
+ * Check whether the REF_HAVE_OLD and old_oid values stored in update
+ * are consistent with oid, which is the reference's current value. If
+ * everything is OK, return 0; otherwise, write an error message to
+ * err and return -1.
+ */
+static int check_old_oid(struct ref_update *update, struct object_id *oid,
+			 struct strbuf *err)
+{
+	if (!(update->flags & REF_HAVE_OLD) ||
+		   oideq(oid, &update->old_oid))
+		return 0;
+
+	if (is_null_oid(&update->old_oid))
+		strbuf_addf(err, "cannot lock ref '%s': "
+			    "reference already exists",
+			    original_update_refname(update));
+	else if (is_null_oid(oid))
+		strbuf_addf(err, "cannot lock ref '%s': "
+			    "reference is missing but expected %s",
+			    original_update_refname(update),
+			    oid_to_hex(&update->old_oid));
+	else
+		strbuf_addf(err, "cannot lock ref '%s': "
+			    "is at %s but expected %s",
+			    original_update_refname(update),
+			    oid_to_hex(oid),
+			    oid_to_hex(&update->old_oid));
+
+	return -1;
+}
+
+static int check_new_object(struct ref_update *update, struct strbuf *err)
+{
+	struct object *o = parse_object(the_repository, &update->new_oid);
+
+	if (!o) {
+		strbuf_addf(err, "cannot update ref '%s': "
+			    "trying to write ref '%s' with nonexistent object %s",
+			    update->refname, update->refname,
+			    oid_to_hex(&update->new_oid));
+		return -1;
+	}
+	if (o->type != OBJ_COMMIT && is_branch(update->refname)) {
+		strbuf_addf(err, "cannot update ref '%s': "
+			    "trying to write non-commit object %s to branch '%s'",
+			    update->refname, oid_to_hex(&update->new_oid),
+			    update->refname);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Prepare for carrying out update, like lock_ref_for_update() of the
+ * files backend does:
+ * - Lock the stack holding the reference, and read it.
+ * - Check that its old OID value (if specified) is correct, and in
+ *   any case record it for later use when writing the reflog.
+ * - If it is a symref update without REF_NO_DEREF, split it up into a
+ *   REF_LOG_ONLY update of the symref and add a separate update for
+ *   the referent to transaction.
+ * - If it is an update of head_ref, add a corresponding REF_LOG_ONLY
+ *   update of HEAD.
+ */
+static int prepare_update(struct reftable_ref_store *refs,
+			  struct reftable_transaction_data *data,
+			  struct ref_update *update,
+			  struct ref_transaction *transaction,
+			  const char *head_ref,
+			  struct string_list *affected_refnames,
+			  struct strbuf *err)
+{
+	struct reftable_ref_record rec = REFTABLE_REF_RECORD_INIT;
+	struct reftable_update_data *update_data;
+	struct reftable_stack *st;
+	int mustexist = (update->flags & REF_HAVE_OLD) &&
+		!is_null_oid(&update->old_oid);
+	int ret = 0;
+
+	if (is_files_pseudoref(update->refname)) {
+		if (!data->pseudoref_transaction) {
+			data->pseudoref_transaction =
+				ref_store_transaction_begin(refs->pseudoref_store,
+							    err);
+			if (!data->pseudoref_transaction)
+				return TRANSACTION_GENERIC_ERROR;
+		}
+		ref_transaction_add_update(data->pseudoref_transaction,
+					   update->refname, update->flags,
+					   &update->new_oid, &update->old_oid,
+					   update->msg);
+		return 0;
+	}
+	if (ref_type(update->refname) == REF_TYPE_MAIN_PSEUDOREF ||
+	    ref_type(update->refname) == REF_TYPE_OTHER_PSEUDOREF) {
+		strbuf_addf(err, "cannot update ref '%s': "
+			    "HEAD of another worktree", update->refname);
+		return TRANSACTION_GENERIC_ERROR;
+	}
+
+	if ((update->flags & REF_HAVE_NEW) && is_null_oid(&update->new_oid))
+		update->flags |= REF_DELETING;
+
+	if (head_ref) {
+		ret = split_head_update(update, transaction, head_ref,
+					affected_refnames, err);
+		if (ret)
+			return ret;
+	}
+
+	st = stack_for(refs, update->refname);
+	if (!transaction_batch(data, st, err)) {
+		char *reason = strbuf_detach(err, NULL);
+
+		strbuf_addf(err, "cannot lock ref '%s': %s",
+			    original_update_refname(update), reason);
+		free(reason);
+		return TRANSACTION_GENERIC_ERROR;
+	}
+
+	update_data = xcalloc(1, sizeof(*update_data));
+	update->backend_data = update_data;
+
+	ret = reftable_stack_read_ref(st, update->refname, &rec);
+	if (ret < 0) {
+		strbuf_addf(err, "cannot lock ref '%s': "
+			    "unable to read reference '%s'",
+			    original_update_refname(update), update->refname);
+		ret = TRANSACTION_GENERIC_ERROR;
+		goto out;
+	}
+	update_data->exists = !ret;
+	ret = 0;
+
+	if (!update_data->exists) {
+		if (mustexist) {
+			strbuf_addf(err, "cannot lock ref '%s': "
+				    "unable to resolve reference '%s'",
+				    original_update_refname(update),
+				    update->refname);
+			ret = TRANSACTION_GENERIC_ERROR;
+			goto out;
+		}
+		if ((update->flags & REF_HAVE_NEW) &&
+		    !(update->flags & (REF_DELETING | REF_LOG_ONLY)) &&
+		    refs_verify_refname_available(&refs->base, update->refname,
+						  affected_refnames, NULL, err)) {
+			char *reason = strbuf_detach(err, NULL);
+
+			strbuf_addf(err, "cannot lock ref '%s': %s",
+				    original_update_refname(update), reason);
+			free(reason);
+			ret = TRANSACTION_NAME_CONFLICT;
+			goto out;
+		}
+	}
+
+	if (update_data->exists && rec.type == REFTABLE_REF_SYMREF) {
+		update->type |= REF_ISSYMREF;
+		if (update->flags & REF_NO_DEREF) {
+			/*
+			 * We won't be reading the referent as part of
+			 * the transaction, so we have to read it here
+			 * to record and possibly check old_oid:
+			 */
+			if (refs_read_ref_full(&refs->base, rec.target.buf, 0,
+					       &update_data->old_oid, NULL)) {
+				if (update->flags & REF_HAVE_OLD) {
+					strbuf_addf(err, "cannot lock ref '%s': "
+						    "error reading reference",
+						    original_update_refname(update));
+					ret = TRANSACTION_GENERIC_ERROR;
+					goto out;
+				}
+			} else if (check_old_oid(update, &update_data->old_oid, err)) {
+				ret = TRANSACTION_GENERIC_ERROR;
+				goto out;
+			}
+		} else {
+			ret = split_symref_update(update, rec.target.buf,
+						  transaction, affected_refnames,
+						  err);
+			if (ret)
+				goto out;
+		}
+	} else {
+		struct ref_update *parent_update;
+
+		if (update_data->exists)
+			oidcpy(&update_data->old_oid, &rec.value);
+		if (check_old_oid(update, &update_data->old_oid, err)) {
+			ret = TRANSACTION_GENERIC_ERROR;
+			goto out;
+		}
+
+		/*
+		 * If this update is happening indirectly because of a
+		 * symref update, record the old OID in the parent
+		 * update:
+		 */
+		for (parent_update = update->parent_update;
+		     parent_update;
+		     parent_update = parent_update->parent_update) {
+			struct reftable_update_data *parent_data =
+				parent_update->backend_data;
+			oidcpy(&parent_data->old_oid, &update_data->old_oid);
+		}
+	}
+
+	if ((update->flags & REF_HAVE_NEW) &&
+	    !(update->flags & REF_DELETING) &&
+	    !(update->flags & REF_LOG_ONLY)) {
+		if (!(update->type & REF_ISSYMREF) &&
+		    oideq(&update_data->old_oid, &update->new_oid)) {
+			/*
+			 * The reference already has the desired
+			 * value, so we don't need to write it.
+			 */
+		} else if (check_new_object(update, err)) {
+			ret = TRANSACTION_GENERIC_ERROR;
+			goto out;
+		} else {
+			update->flags |= REF_NEEDS_COMMIT;
+		}
+	}
+
+out:
+	reftable_ref_record_release(&rec);
+	return ret;
+}
+
+static int reftable_transaction_prepare(struct ref_store *ref_store,
+					struct ref_transaction *transaction,
+					struct strbuf *err)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE,
+				  "ref_transaction_prepare");
+	struct string_list affected_refnames = STRING_LIST_INIT_NODUP;
+	struct reftable_transaction_data *data;
+	char *head_ref = NULL;
+	int head_type;
+	size_t i;
+	int ret = 0;
+
+	assert(err);
+
+	if (!transaction->nr)
+		goto cleanup;
+
+	data = xcalloc(1, sizeof(*data));
+	transaction->backend_data = data;
+
+	/*
+	 * Fail if a refname appears more than once in the
+	 * transaction. (If we end up splitting up any updates using
+	 * split_symref_update() or split_head_update(), those
+	 * functions will check that the new updates don't have the
+	 * same refname as any existing ones.)
+	 */
+	for (i = 0; i < transaction->nr; i++) {
+		struct ref_update *update = transaction->updates[i];
+		struct string_list_item *item =
+			string_list_append(&affected_refnames, update->refname);
+
+		item->util = update;
+	}
+	string_list_sort(&affected_refnames);
+	if (ref_update_reject_duplicates(&affected_refnames, err)) {
+		ret = TRANSACTION_GENERIC_ERROR;
+		goto cleanup;
+	}
+
+	/*
+	 * If HEAD is a symbolic reference, then record the name of
+	 * the reference that it points to, so that a direct update
+	 * of that reference is logged for HEAD, too (see the files
+	 * backend for the rationale).
+	 */
+	head_ref = refs_resolve_refdup(ref_store, "HEAD",
+				       RESOLVE_REF_NO_RECURSE,
+				       NULL, &head_type);
+	if (head_ref && !(head_type & REF_ISSYMREF))
+		FREE_AND_NULL(head_ref);
+
+	/*
+	 * Lock the stacks, verify old values if provided and check
+	 * that new values are valid. Note that prepare_update() might
+	 * append more updates to the transaction.
+	 */
+	for (i = 0; i < transaction->nr; i++) {
+		ret = prepare_update(refs, data, transaction->updates[i],
+				     transaction, head_ref,
+				     &affected_refnames, err);
+		if (ret)
+			goto cleanup;
+	}
+
+	if (data->pseudoref_transaction) {
+		ret = ref_transaction_prepare(data->pseudoref_transaction, err);
+		if (ret) {
+			ref_transaction_free(data->pseudoref_transaction);
+			data->pseudoref_transaction = NULL;
+		}
+	}
+
+cleanup:
+	free(head_ref);
+	string_list_clear(&affected_refnames, 0);
+
+	if (ret)
+		reftable_transaction_cleanup(transaction);
+	else
+		transaction->state = REF_TRANSACTION_PREPARED;
+
+	return ret;
+}
+
+static int reftable_transaction_finish(struct ref_store *ref_store,
+				       struct ref_transaction *transaction,
+				       struct strbuf *err)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, 0, "ref_transaction_finish");
+	struct reftable_transaction_data *data = transaction->backend_data;
+	size_t i;
+	int ret = 0;
+
+	assert(err);
+
+	if (!data) {
+		transaction->state = REF_TRANSACTION_CLOSED;
+		return 0;
+	}
+
+	for (i = 0; i < transaction->nr; i++) {
+		struct ref_update *update = transaction->updates[i];
+		struct reftable_update_data *update_data = update->backend_data;
+		struct write_batch *batch;
+
+		if (!update_data)
+			continue; /* a pseudoref */
+		batch = transaction_batch(data, stack_for(refs, update->refname),
+					  err);
+		if (!batch)
+			BUG("stack of '%s' not locked", update->refname);
+
+		if (update->flags & REF_NEEDS_COMMIT)
+			batch_add_oid(batch, update->refname, &update->new_oid);
+
+		if (((update->flags & REF_NEEDS_COMMIT) ||
+		     (update->flags & REF_LOG_ONLY)) &&
+		    should_write_log(batch->st, update->refname, update->flags))
+			batch_add_reflog_entry(batch, update->refname,
+					       &update_data->old_oid,
+					       &update->new_oid, update->msg);
+
+		if ((update->flags & REF_DELETING) &&
+		    !(update->flags & REF_LOG_ONLY)) {
+			if (update_data->exists)
+				batch_add_ref(batch, update->refname);
+			if (batch_delete_reflog(batch, update->refname) < 0) {
+				strbuf_addf(err, "cannot delete the reflog of '%s'",
+					    update->refname);
+				ret = TRANSACTION_GENERIC_ERROR;
+				goto cleanup;
+			}
+		}
+	}
+
+	/*
+	 * Each stack gets a single new table, so that the updates to
+	 * it become visible at once.
+	 */
+	for (i = 0; i < data->nr; i++) {
+		if (reftable_stack_add(data->batches[i].st, write_batch,
+				       &data->batches[i], err)) {
+			ret = TRANSACTION_GENERIC_ERROR;
+			goto cleanup;
+		}
+	}
+
+	if (data->pseudoref_transaction) {
+		ret = ref_transaction_commit(data->pseudoref_transaction, err);
+		ref_transaction_free(data->pseudoref_transaction);
+		data->pseudoref_transaction = NULL;
+	}
+
+cleanup:
+	reftable_transaction_cleanup(transaction);
+	return ret;
+}
+
+static int reftable_transaction_abort(struct ref_store *ref_store,
+				      struct ref_transaction *transaction,
+				      struct strbuf *err)
+{
+	reftable_downcast(ref_store, 0, "ref_transaction_abort");
+	reftable_transaction_cleanup(transaction);
+	return 0;
+}
+
+static int reftable_initial_transaction_commit(struct ref_store *ref_store,
+					       struct ref_transaction *transaction,
+					       struct strbuf *err)
+{
+	int ret = reftable_transaction_prepare(ref_store, transaction, err);
+
+	if (!ret)
+		ret = reftable_transaction_finish(ref_store, transaction, err);
+	return ret;
+}
+
+static int compact_stack(struct reftable_stack *st)
+{
+	struct strbuf err = STRBUF_INIT;
+	int ret = 0;
+
+	if (lock_stack(st, &err) || reftable_stack_compact_all(st, &err))
+		ret = error("%s", err.buf);
+	strbuf_release(&err);
+	return ret;
+}
+
+static int reftable_pack_refs(struct ref_store *ref_store, unsigned int flags)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE | REF_STORE_ODB,
+				  "pack_refs");
+	int ret = compact_stack(refs->main_stack);
+
+	if (refs->worktree_stack)
+		ret |= compact_stack(refs->worktree_stack);
+	return ret;
+}
+
+static int reftable_create_symref(struct ref_store *ref_store,
+				  const char *refname, const char *target,
+				  const char *logmsg)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "create_symref");
+	struct reftable_ref_record rec = REFTABLE_REF_RECORD_INIT;
+	struct reftable_stack *st = stack_for(refs, refname);
+	struct strbuf err = STRBUF_INIT;
+	struct write_batch batch;
+	struct object_id new_oid;
+	int ret;
+
+	if (is_files_pseudoref(refname))
+		return refs_create_symref(refs->pseudoref_store, refname,
+					  target, logmsg);
+
+	if (lock_stack(st, &err)) {
+		ret = error("%s", err.buf);
+		strbuf_release(&err);
+		return ret;
+	}
+	if (reftable_stack_read_ref(st, refname, &rec) &&
+	    refs_verify_refname_available(&refs->base, refname,
+					  NULL, NULL, &err)) {
+		ret = error("cannot lock ref '%s': %s", refname, err.buf);
+		reftable_stack_unlock(st);
+		reftable_ref_record_release(&rec);
+		strbuf_release(&err);
+		return ret;
+	}
+	batch_init(&batch, st);
+
+	strbuf_addstr(&batch_add_ref(&batch, refname)->target, target);
+	batch.refs[0].rec.type = REFTABLE_REF_SYMREF;
+
+	if (logmsg &&
+	    !refs_read_ref_full(&refs->base, target, RESOLVE_REF_READING,
+				&new_oid, NULL) &&
+	    should_write_log(st, refname, 0)) {
+		struct object_id old_oid;
+
+		if (refs_read_ref_full(&refs->base, refname,
+				       RESOLVE_REF_READING, &old_oid, NULL))
+			oidclr(&old_oid);
+		batch_add_reflog_entry(&batch, refname, &old_oid, &new_oid,
+				       logmsg);
+	}
+
+	ret = reftable_stack_add(st, write_batch, &batch, &err);
+	if (ret)
+		ret = error("unable to write symref for %s: %s", refname,
+			    err.buf);
+	batch_release(&batch);
+	reftable_ref_record_release(&rec);
+	strbuf_release(&err);
+	return ret;
+}
+
+static int reftable_delete_refs(struct ref_store *ref_store, const char *msg,
+				struct string_list *refnames, unsigned int flags)
+{
+	struct ref_transaction *transaction;
+	struct strbuf err = STRBUF_INIT;
+	size_t i;
+	int ret = 0;
+
+	reftable_downcast(ref_store, REF_STORE_WRITE, "delete_refs");
+	if (!refnames->nr)
+		return 0;
+
+	/* all of them go into a single new table */
+	transaction = ref_store_transaction_begin(ref_store, &err);
+	if (!transaction)
+		goto error;
+	for (i = 0; i < refnames->nr; i++) {
+		const char *refname = refnames->items[i].string;
+
+		/* pseudorefs are removed as files, as refs_delete_ref() does */
+		if (ref_type(refname) == REF_TYPE_PSEUDOREF) {
+			if (refs_delete_ref(ref_store, msg, refname, NULL, flags))
+				ret = error(_("could not remove reference %s"),
+					    refname);
+			continue;
+		}
+		if (ref_transaction_delete(transaction, refname, NULL,
+					   flags, msg, &err))
+			goto error;
+	}
+	if (ref_transaction_commit(transaction, &err))
+		goto error;
+	goto out;
+
+error:
+	if (refnames->nr == 1)
+		error(_("could not delete reference %s: %s"),
+		      refnames->items[0].string, err.buf);
+	else
+		error(_("could not delete references: %s"), err.buf);
+	ret = -1;
+out:
+	ref_transaction_free(transaction);
+	strbuf_release(&err);
+	return ret;
+}
+
+/* Copy the reflog of oldrefname to newrefname within the batch. */
+static int batch_copy_reflog(struct write_batch *batch,
+			     const char *oldrefname, const char *newrefname)
+{
+	struct reftable_iterator *it =
+		reftable_stack_log_iterator(batch->st, oldrefname);
+	struct reftable_log_record log = REFTABLE_LOG_RECORD_INIT;
+	int ret;
+
+	while (!(ret = reftable_iterator_next_log(it, &log))) {
+		struct reftable_log_record *copy =
+			batch_add_log(batch, newrefname, log.update_index);
+
+		oidcpy(&copy->old_oid, &log.old_oid);
+		oidcpy(&copy->new_oid, &log.new_oid);
+		strbuf_addbuf(&copy->name, &log.name);
+		strbuf_addbuf(&copy->email, &log.email);
+		copy->time = log.time;
+		copy->tz = log.tz;
+		strbuf_addbuf(&copy->message, &log.message);
+	}
+	reftable_log_record_release(&log);
+	reftable_iterator_release(it);
+	return ret < 0 ? -1 : 0;
+}
+
+static int reftable_copy_or_rename_ref(struct ref_store *ref_store,
+				       const char *oldrefname,
+				       const char *newrefname,
+				       const char *logmsg, int copy)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "rename_ref");
+	struct reftable_ref_record rec = REFTABLE_REF_RECORD_INIT;
+	struct reftable_stack *st = stack_for(refs, oldrefname);
+	struct strbuf err = STRBUF_INIT;
+	struct write_batch batch;
+	struct object_id orig_oid;
+	int log, ret;
+
+	if (st != stack_for(refs, newrefname))
+		return error("cannot %s '%s' to '%s': they are stored apart",
+			     copy ? "copy" : "rename", oldrefname, newrefname);
+
+	if (lock_stack(st, &err)) {
+		ret = error("%s", err.buf);
+		strbuf_release(&err);
+		return ret;
+	}
+	batch_init(&batch, st);
+
+	if (reftable_stack_read_ref(st, oldrefname, &rec)) {
+		ret = error("refname %s not found", oldrefname);
+		goto out;
+	}
+	if (rec.type == REFTABLE_REF_SYMREF) {
+		if (copy)
+			ret = error("refname %s is a symbolic ref, copying it is not supported",
+				    oldrefname);
+		else
+			ret = error("refname %s is a symbolic ref, renaming it is not supported",
+				    oldrefname);
+		goto out;
+	}
+	oidcpy(&orig_oid, &rec.value);
+
+	if (!refs_rename_ref_available(&refs->base, oldrefname, newrefname)) {
+		ret = 1;
+		goto out;
+	}
+	/* a copy keeps the old name, which may conflict with the new one */
+	if (copy && refs_verify_refname_available(&refs->base, newrefname,
+						  NULL, NULL, &err)) {
+		ret = error("%s", err.buf);
+		goto out;
+	}
+
+	log = stack_reflog_exists(st, oldrefname);
+	if (batch_delete_reflog(&batch, newrefname) ||
+	    (log && batch_copy_reflog(&batch, oldrefname, newrefname)) ||
+	    (!copy && batch_delete_reflog(&batch, oldrefname))) {
+		ret = error("unable to move the reflog of %s", oldrefname);
+		goto out;
+	}
+
+	if (!copy) {
+		int head_flag;
+		const char *head_ref;
+
+		batch_add_ref(&batch, oldrefname);
+
+		/*
+		 * Deleting the branch HEAD points at is logged for
+		 * HEAD, like refs_delete_ref() of the files backend
+		 * does.
+		 */
+		head_ref = refs_resolve_ref_unsafe(&refs->base, "HEAD",
+						   RESOLVE_REF_NO_RECURSE,
+						   NULL, &head_flag);
+		if (logmsg && head_ref && (head_flag & REF_ISSYMREF) &&
+		    !strcmp(head_ref, oldrefname) &&
+		    should_write_log(stack_for(refs, "HEAD"), "HEAD", 0) &&
+		    stack_for(refs, "HEAD") == st)
+			batch_add_reflog_entry(&batch, "HEAD", &orig_oid,
+					       &null_oid, logmsg);
+	}
+
+	batch_add_oid(&batch, newrefname, &orig_oid);
+	if (log || should_write_log(st, newrefname, 0))
+		batch_add_reflog_entry(&batch, newrefname, &orig_oid,
+				       &orig_oid, logmsg);
+
+	if (reftable_stack_add(st, write_batch, &batch, &err)) {
+		if (copy)
+			ret = error("unable to copy '%s' to '%s': %s",
+				    oldrefname, newrefname, err.buf);
+		else
+			ret = error("unable to rename '%s' to '%s': %s",
+				    oldrefname, newrefname, err.buf);
+	} else {
+		ret = 0;
+	}
+
+out:
+	reftable_stack_unlock(st);
+	batch_release(&batch);
+	reftable_ref_record_release(&rec);
+	strbuf_release(&err);
+	return ret;
+}
+
+static int reftable_rename_ref(struct ref_store *ref_store,
+			       const char *oldrefname, const char *newrefname,
+			       const char *logmsg)
+{
+	return reftable_copy_or_rename_ref(ref_store, oldrefname,
+					   newrefname, logmsg, 0);
+}
+
+static int reftable_copy_ref(struct ref_store *ref_store,
+			     const char *oldrefname, const char *newrefname,
+			     const char *logmsg)
+{
+	return reftable_copy_or_rename_ref(ref_store, oldrefname,
+					   newrefname, logmsg, 1);
+}
+
+/*
+ * Reflogs
+ */
+
+struct reftable_reflog_iterator {
+	struct ref_iterator base;
+
+	struct reftable_ref_store *refs;
+	struct reftable_iterator *iter;
+	struct reftable_log_record rec;
+	struct strbuf refname;
+	struct object_id oid;
+
+	/* Negative to only show the reflogs of shared references */
+	int worktree_refs;
+};
+
+static int reftable_reflog_iterator_advance(struct ref_iterator *ref_iterator)
+{
+	struct reftable_reflog_iterator *iter =
+		(struct reftable_reflog_iterator *)ref_iterator;
+	int ret;
+
+	while (!(ret = reftable_iterator_next_log(iter->iter, &iter->rec))) {
+		int flags;
+
+		/* log records come grouped by reference */
+		if (iter->refname.len &&
+		    !strcmp(iter->rec.refname.buf, iter->refname.buf))
+			continue;
+		strbuf_reset(&iter->refname);
+		strbuf_addbuf(&iter->refname, &iter->rec.refname);
+
+		if (iter->worktree_refs < 0 &&
+		    ref_type(iter->refname.buf) != REF_TYPE_NORMAL)
+			continue;
+
+		if (refs_read_ref_full(&iter->refs->base, iter->refname.buf,
+				       0, &iter->oid, &flags)) {
+			error("bad ref for %s", iter->refname.buf);
+			continue;
+		}
+
+		iter->base.refname = iter->refname.buf;
+		iter->base.oid = &iter->oid;
+		iter->base.flags = flags;
+		return ITER_OK;
+	}
+
+	if (ref_iterator_abort(ref_iterator) != ITER_DONE || ret < 0)
+		return ITER_ERROR;
+	return ITER_DONE;
+}
+
+static int reftable_reflog_iterator_peel(struct ref_iterator *ref_iterator,
+					 struct object_id *peeled)
+{
+	BUG("ref_iterator_peel() called for reflog_iterator");
+}
+
+static int reftable_reflog_iterator_abort(struct ref_iterator *ref_iterator)
+{
+	struct reftable_reflog_iterator *iter =
+		(struct reftable_reflog_iterator *)ref_iterator;
+
+	reftable_iterator_release(iter->iter);
+	reftable_log_record_release(&iter->rec);
+	strbuf_release(&iter->refname);
+	base_ref_iterator_free(ref_iterator);
+	return ITER_DONE;
+}
+
+static struct ref_iterator_vtable reftable_reflog_iterator_vtable = {
+	reftable_reflog_iterator_advance,
+	reftable_reflog_iterator_peel,
+	reftable_reflog_iterator_abort
+};
+
+static struct ref_iterator *stack_reflog_iterator_begin(
+		struct reftable_ref_store *refs, struct reftable_stack *st,
+		int worktree_refs)
+{
+	struct reftable_reflog_iterator *iter;
+	struct ref_iterator *ref_iterator;
+
+	if (reftable_stack_reload(st) < 0)
+		return empty_ref_iterator_begin();
+
+	iter = xcalloc(1, sizeof(*iter));
+	ref_iterator = &iter->base;
+	base_ref_iterator_init(ref_iterator, &reftable_reflog_iterator_vtable, 1);
+	iter->refs = refs;
+	iter->iter = reftable_stack_log_iterator(st, NULL);
+	strbuf_init(&iter->rec.refname, 0);
+	strbuf_init(&iter->rec.name, 0);
+	strbuf_init(&iter->rec.email, 0);
+	strbuf_init(&iter->rec.message, 0);
+	strbuf_init(&iter->refname, 0);
+	iter->worktree_refs = worktree_refs;
+	return ref_iterator;
+}
+
+static struct ref_iterator *reftable_reflog_iterator_begin(struct ref_store *ref_store)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ,
+				  "reflog_iterator_begin");
+
+	if (!refs->worktree_stack)
+		return stack_reflog_iterator_begin(refs, refs->main_stack, 0);
+
+	/*
+	 * The main stack also holds the reflogs of the per-worktree
+	 * references of the main worktree, which are to be ignored.
+	 */
+	return overlay_ref_iterator_begin(
+			stack_reflog_iterator_begin(refs, refs->worktree_stack, 0),
+			stack_reflog_iterator_begin(refs, refs->main_stack, -1));
+}
+
+/*
+ * Read the entries of the reflog of refname, newest first, into
+ * *logs. Returns -1 on errors.
+ */
+static int read_reflog(struct reftable_stack *st, const char *refname,
+		       struct reftable_log_record **logs, size_t *nr,
+		       int *has_marker)
+{
+	struct reftable_iterator *it;
+	size_t alloc = 0;
+	int ret;
+
+	*logs = NULL;
+	*nr = 0;
+	if (has_marker)
+		*has_marker = 0;
+	it = reftable_stack_log_iterator(st, refname);
+	for (;;) {
+		struct reftable_log_record *log;
+
+		ALLOC_GROW(*logs, *nr + 1, alloc);
+		log = &(*logs)[*nr];
+		memset(log, 0, sizeof(*log));
+		strbuf_init(&log->refname, 0);
+		strbuf_init(&log->name, 0);
+		strbuf_init(&log->email, 0);
+		strbuf_init(&log->message, 0);
+		ret = reftable_iterator_next_log(it, log);
+		if (!ret && is_reflog_marker(log)) {
+			if (has_marker)
+				*has_marker = 1;
+			ret = -2;
+		}
+		if (ret == -2 || ret) {
+			reftable_log_record_release(log);
+			if (ret == -2)
+				continue;
+			break;
+		}
+		(*nr)++;
+	}
+	reftable_iterator_release(it);
+	return ret < 0 ? -1 : 0;
+}
+
+static void free_reflog(struct reftable_log_record *logs, size_t nr)
+{
+	size_t i;
+
+	for (i = 0; i < nr; i++)
+		reftable_log_record_release(&logs[i]);
+	free(logs);
+}
+
+/* Call fn for a reflog entry, as it would be read from a reflog file. */
+static int show_one_reflog_ent(const struct reftable_log_record *log,
+			       each_reflog_ent_fn fn, void *cb_data)
+{
+	struct strbuf ident = STRBUF_INIT;
+	struct strbuf msg = STRBUF_INIT;
+	struct object_id old_oid, new_oid;
+	int ret;
+
+	strbuf_addf(&ident, "%s <%s>", log->name.buf, log->email.buf);
+	strbuf_addf(&msg, "%s\n", log->message.buf);
+	oidcpy(&old_oid, &log->old_oid);
+	oidcpy(&new_oid, &log->new_oid);
+	ret = fn(&old_oid, &new_oid, ident.buf, log->time, log->tz,
+		 msg.buf, cb_data);
+	strbuf_release(&ident);
+	strbuf_release(&msg);
+	return ret;
+}
+
+static int stack_for_each_reflog_ent(struct reftable_ref_store *refs,
+				     const char *refname, each_reflog_ent_fn fn,
+				     void *cb_data, int reverse)
+{
+	struct reftable_stack *st, *to_free;
+	struct reftable_log_record *logs;
+	const char *name;
+	size_t i, nr;
+	int ret = 0;
+
+	st = stack_for_reading(refs, refname, &name, &to_free);
+	if (reftable_stack_reload(st) < 0 ||
+	    read_reflog(st, name, &logs, &nr, NULL) < 0) {
+		reftable_stack_free(to_free);
+		return -1;
+	}
+
+	for (i = 0; i < nr && !ret; i++)
+		ret = show_one_reflog_ent(&logs[reverse ? i : nr - 1 - i],
+					  fn, cb_data);
+
+	free_reflog(logs, nr);
+	reftable_stack_free(to_free);
+	return ret;
+}
+
+static int reftable_for_each_reflog_ent(struct ref_store *ref_store,
+					const char *refname,
+					each_reflog_ent_fn fn, void *cb_data)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ,
+				  "for_each_reflog_ent");
+
+	if (is_files_pseudoref(refname))
+		return refs_for_each_reflog_ent(refs->pseudoref_store, refname,
+						fn, cb_data);
+	return stack_for_each_reflog_ent(refs, refname, fn, cb_data, 0);
+}
+
+static int reftable_for_each_reflog_ent_reverse(struct ref_store *ref_store,
+						const char *refname,
+						each_reflog_ent_fn fn,
+						void *cb_data)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ,
+				  "for_each_reflog_ent_reverse");
+
+	if (is_files_pseudoref(refname))
+		return refs_for_each_reflog_ent_reverse(refs->pseudoref_store,
+							refname, fn, cb_data);
+	return stack_for_each_reflog_ent(refs, refname, fn, cb_data, 1);
+}
+
+static int reftable_reflog_exists(struct ref_store *ref_store,
+				  const char *refname)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ, "reflog_exists");
+	struct reftable_stack *st, *to_free;
+	const char *name;
+	int ret;
+
+	if (is_files_pseudoref(refname))
+		return refs_reflog_exists(refs->pseudoref_store, refname);
+
+	st = stack_for_reading(refs, refname, &name, &to_free);
+	ret = reftable_stack_reload(st) >= 0 && stack_reflog_exists(st, name);
+	reftable_stack_free(to_free);
+	return ret;
+}
+
+static int reftable_create_reflog(struct ref_store *ref_store,
+				  const char *refname, int force_create,
+				  struct strbuf *err)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "create_reflog");
+	struct reftable_stack *st = stack_for(refs, refname);
+	struct write_batch batch;
+
+	if (is_files_pseudoref(refname))
+		return refs_create_reflog(refs->pseudoref_store, refname,
+					  force_create, err);
+	if (!force_create && !should_autocreate_reflog(refname))
+		return 0;
+
+	if (lock_stack(st, err))
+		return -1;
+	if (stack_reflog_exists(st, refname)) {
+		reftable_stack_unlock(st);
+		return 0;
+	}
+
+	batch_init(&batch, st);
+	batch_add_reflog_marker(&batch, refname);
+	if (reftable_stack_add(st, write_batch, &batch, err)) {
+		batch_release(&batch);
+		return -1;
+	}
+	batch_release(&batch);
+	return 0;
+}
+
+static int reftable_delete_reflog(struct ref_store *ref_store,
+				  const char *refname)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "delete_reflog");
+	struct reftable_stack *st = stack_for(refs, refname);
+	struct strbuf err = STRBUF_INIT;
+	struct write_batch batch;
+	int ret = 0;
+
+	if (is_files_pseudoref(refname))
+		return refs_delete_reflog(refs->pseudoref_store, refname);
+
+	if (lock_stack(st, &err)) {
+		ret = error("%s", err.buf);
+		strbuf_release(&err);
+		return ret;
+	}
+	batch_init(&batch, st);
+	if (batch_delete_reflog(&batch, refname) < 0)
+		ret = error("cannot read the reflog of '%s'", refname);
+	else if (reftable_stack_add(st, write_batch, &batch, &err))
+		ret = error("%s", err.buf);
+	reftable_stack_unlock(st);
+	batch_release(&batch);
+	strbuf_release(&err);
+	return ret;
+}
+
+static int reftable_reflog_expire(struct ref_store *ref_store,
+				  const char *refname, const struct object_id *oid,
+				  unsigned int flags,
+				  reflog_expiry_prepare_fn prepare_fn,
+				  reflog_expiry_should_prune_fn should_prune_fn,
+				  reflog_expiry_cleanup_fn cleanup_fn,
+				  void *policy_cb_data)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "reflog_expire");
+	struct reftable_ref_record rec = REFTABLE_REF_RECORD_INIT;
+	struct reftable_stack *st, *to_free;
+	struct reftable_log_record *logs;
+	struct strbuf err = STRBUF_INIT;
+	struct strbuf ident = STRBUF_INIT;
+	struct strbuf msg = STRBUF_INIT;
+	struct object_id last_kept_oid;
+	struct write_batch batch;
+	int dry_run = flags & EXPIRE_REFLOGS_DRY_RUN;
+	int has_marker, status = 0;
+	size_t i, nr, kept = 0;
+	const char *name;
+
+	if (is_files_pseudoref(refname))
+		return refs_reflog_expire(refs->pseudoref_store, refname, oid,
+					  flags, prepare_fn, should_prune_fn,
+					  cleanup_fn, policy_cb_data);
+
+	/*
+	 * "git reflog expire --all" expires the reflogs of the HEADs of
+	 * other worktrees, too.
+	 */
+	st = stack_for_reading(refs, refname, &name, &to_free);
+
+	/* The lock on the stack also covers the reference itself */
+	if (lock_stack(st, &err)) {
+		status = error("cannot lock ref '%s': %s", refname, err.buf);
+		goto out;
+	}
+	if (!stack_reflog_exists(st, name)) {
+		reftable_stack_unlock(st);
+		goto out;
+	}
+	if (read_reflog(st, name, &logs, &nr, &has_marker) < 0) {
+		reftable_stack_unlock(st);
+		status = error("cannot read the reflog of '%s'", refname);
+		goto out;
+	}
+	batch_init(&batch, st);
+	oidclr(&last_kept_oid);
+
+	(*prepare_fn)(refname, oid, policy_cb_data);
+	for (i = nr; i--; ) {
+		struct reftable_log_record *log = &logs[i];
+		struct object_id *ooid = &log->old_oid;
+
+		if (flags & EXPIRE_REFLOGS_REWRITE)
+			ooid = &last_kept_oid;
+
+		strbuf_reset(&ident);
+		strbuf_addf(&ident, "%s <%s>", log->name.buf, log->email.buf);
+		strbuf_reset(&msg);
+		strbuf_addf(&msg, "%s\n", log->message.buf);
+
+		if ((*should_prune_fn)(ooid, &log->new_oid, ident.buf,
+				       log->time, log->tz, msg.buf,
+				       policy_cb_data)) {
+			if (dry_run)
+				printf("would prune %s", msg.buf);
+			else if (flags & EXPIRE_REFLOGS_VERBOSE)
+				printf("prune %s", msg.buf);
+			batch_add_log(&batch, name,
+				      log->update_index)->deletion = 1;
+		} else {
+			if (!dry_run) {
+				if (!oideq(ooid, &log->old_oid)) {
+					/* rewrite the entry in place */
+					struct reftable_log_record *copy =
+						batch_add_log(&batch, name,
+							      log->update_index);
+
+					oidcpy(&copy->old_oid, ooid);
+					oidcpy(&copy->new_oid, &log->new_oid);
+					strbuf_addbuf(&copy->name, &log->name);
+					strbuf_addbuf(&copy->email, &log->email);
+					copy->time = log->time;
+					copy->tz = log->tz;
+					strbuf_addbuf(&copy->message, &log->message);
+				}
+				oidcpy(&last_kept_oid, &log->new_oid);
+			}
+			if (flags & EXPIRE_REFLOGS_VERBOSE)
+				printf("keep %s", msg.buf);
+			kept++;
+		}
+	}
+	(*cleanup_fn)(policy_cb_data);
+
+	if (!dry_run) {
+		/*
+		 * It doesn't make sense to adjust a reference pointed
+		 * to by a symbolic ref based on expiring entries in
+		 * the symbolic reference's reflog. Nor can we update
+		 * a reference if there are no remaining reflog
+		 * entries.
+		 */
+		int update = (flags & EXPIRE_REFLOGS_UPDATE_REF) &&
+			!is_null_oid(&last_kept_oid) &&
+			!(!reftable_stack_read_ref(st, name, &rec) &&
+			  rec.type == REFTABLE_REF_SYMREF);
+
+		/* an emptied reflog still exists */
+		if (!kept && !has_marker)
+			batch_add_reflog_marker(&batch, name);
+		if (update)
+			batch_add_oid(&batch, name, &last_kept_oid);
+		if (reftable_stack_add(st, write_batch, &batch, &err))
+			status = error("unable to write reflog '%s' (%s)",
+				       refname, err.buf);
+	}
+
+	reftable_stack_unlock(st);
+	batch_release(&batch);
+	free_reflog(logs, nr);
+out:
+	reftable_stack_free(to_free);
+	reftable_ref_record_release(&rec);
+	strbuf_release(&ident);
+	strbuf_release(&msg);
+	strbuf_release(&err);
+	return status;
+}
+
+static int reftable_init_db(struct ref_store *ref_store, struct strbuf *err)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "init_db");
+	struct strbuf sb = STRBUF_INIT;
+	int fd;
+
+	strbuf_addf(&sb, "%s/reftable", refs->gitcommondir);
+	safe_create_dir(sb.buf, 1);
+
+	strbuf_addstr(&sb, "/tables.list");
+	fd = open(sb.buf, O_WRONLY | O_CREAT, 0666);
+	if (fd < 0) {
+		strbuf_addf(err, "unable to create '%s': %s", sb.buf,
+			    strerror(errno));
+		strbuf_release(&sb);
+		return -1;
+	}
+	close(fd);
+	adjust_shared_perm(sb.buf);
+
+	/*
+	 * Versions of Git that do not know about reftables still need
+	 * a HEAD to recognize the repository; give them one that points
+	 * at a branch that cannot exist. The real HEAD is in the stack.
+	 */
+	strbuf_reset(&sb);
+	strbuf_addf(&sb, "%s/HEAD", refs->gitdir);
+	if (access(sb.buf, F_OK))
+		write_file(sb.buf, "ref: refs/heads/.invalid");
+
+	strbuf_release(&sb);
+	return 0;
+}
+
+struct ref_storage_be refs_be_reftable = {
+	&refs_be_files,
+	"reftable",
+	reftable_ref_store_create,
+	reftable_init_db,
+	reftable_transaction_prepare,
+	reftable_transaction_finish,
+	reftable_transaction_abort,
+	reftable_initial_transaction_commit,
+
+	reftable_pack_refs,
+	reftable_create_symref,
+	reftable_delete_refs,
+	reftable_rename_ref,
+	reftable_copy_ref,
+
+	reftable_ref_iterator_begin,
+	reftable_read_raw_ref,
+
+	reftable_reflog_iterator_begin,
+	reftable_for_each_reflog_ent,
+	reftable_for_each_reflog_ent_reverse,
+	reftable_reflog_exists,
+	reftable_create_reflog,
+	reftable_delete_reflog,
+	reftable_reflog_expire
+};
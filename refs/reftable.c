@@ -0,0 +1,1571 @@
+#include "../cache.h"
+#include "../lockfile.h"
+#include "../tempfile.h"
+#include "../varint.h"
+#include "reftable.h"
+
+#define REFTABLE_MAGIC "REFT"
+#define REFTABLE_VERSION 1
+
+/* magic, version, block size, min and max update index, hash format id */
+#define HEADER_SIZE (4 + 1 + 3 + 8 + 8 + 4)
+/* header, ref index, log and log index offsets, CRC-32 */
+#define FOOTER_SIZE (HEADER_SIZE + 8 + 8 + 8 + 4)
+
+/* block type and length */
+#define BLOCK_HEADER_SIZE 4
+
+#define BLOCK_TYPE_REF 'r'
+#define BLOCK_TYPE_LOG 'g'
+#define BLOCK_TYPE_INDEX 'i'
+
+#define DEFAULT_BLOCK_SIZE 4096
+#define MAX_BLOCK_SIZE ((1 << 24) - 1)
+#define RESTART_INTERVAL 16
+
+#define MAX_RELOAD_ATTEMPTS 5
+
+/* The number of bytes of the stack key of a log record after the name */
+#define LOG_KEY_SUFFIX_SIZE 9
+
+static void put_be24(unsigned char *p, uint32_t v)
+{
+	p[0] = (v >> 16) & 0xff;
+	p[1] = (v >> 8) & 0xff;
+	p[2] = v & 0xff;
+}
+
+static uint32_t get_be24(const unsigned char *p)
+{
+	return (uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | p[2];
+}
+
+static void strbuf_add_varint(struct strbuf *sb, uintmax_t value)
+{
+	unsigned char buf[16];
+
+	strbuf_add(sb, buf, encode_varint(value, buf));
+}
+
+static void strbuf_add_string(struct strbuf *sb, const struct strbuf *s)
+{
+	strbuf_add_varint(sb, s->len);
+	strbuf_addbuf(sb, s);
+}
+
+void reftable_ref_record_release(struct reftable_ref_record *rec)
+{
+	strbuf_release(&rec->refname);
+	strbuf_release(&rec->target);
+}
+
+void reftable_log_record_release(struct reftable_log_record *rec)
+{
+	strbuf_release(&rec->refname);
+	strbuf_release(&rec->name);
+	strbuf_release(&rec->email);
+	strbuf_release(&rec->message);
+}
+
+/*
+ * The key of a log record is the reference name, a NUL and the update
+ * index inverted, so that newer records of a reference sort first.
+ */
+static void log_record_key(struct strbuf *key, const char *refname,
+			   uint64_t update_index)
+{
+	unsigned char buf[8];
+
+	strbuf_reset(key);
+	strbuf_addstr(key, refname);
+	strbuf_addch(key, '\0');
+	put_be64(buf, ~update_index);
+	strbuf_add(key, buf, sizeof(buf));
+}
+
+/*
+ * Writing
+ */
+
+struct index_record {
+	struct strbuf last_key;
+	uint64_t offset;
+};
+
+struct block_writer {
+	uint8_t type;
+	struct strbuf records;
+	uint32_t *restarts;
+	size_t restart_nr, restart_alloc;
+	size_t entries;
+	struct strbuf last_key;
+};
+
+struct reftable_writer {
+	int fd;
+	uint64_t offset;
+	uint64_t min_update_index, max_update_index;
+	uint32_t block_size;
+	int error;
+
+	uint8_t section;
+	struct block_writer block;
+	struct strbuf record;
+
+	/* the blocks written in the current section or index level */
+	struct index_record *index;
+	size_t index_nr, index_alloc;
+
+	uint64_t ref_index_offset, log_offset, log_index_offset;
+	uint64_t nr_records;
+};
+
+static void write_header(unsigned char *buf, const struct reftable_writer *w)
+{
+	memcpy(buf, REFTABLE_MAGIC, 4);
+	buf[4] = REFTABLE_VERSION;
+	put_be24(buf + 5, w->block_size);
+	put_be64(buf + 8, w->min_update_index);
+	put_be64(buf + 16, w->max_update_index);
+	put_be32(buf + 24, the_hash_algo->format_id);
+}
+
+static int writer_write(struct reftable_writer *w, const void *buf, size_t len)
+{
+	if (w->error)
+		return -1;
+	if (write_in_full(w->fd, buf, len) < 0) {
+		w->error = errno;
+		return -1;
+	}
+	w->offset += len;
+	return 0;
+}
+
+static struct reftable_writer *writer_new(int fd, uint64_t min_update_index,
+					  uint64_t max_update_index)
+{
+	struct reftable_writer *w = xcalloc(1, sizeof(*w));
+	unsigned char header[HEADER_SIZE];
+
+	w->fd = fd;
+	w->min_update_index = min_update_index;
+	w->max_update_index = max_update_index;
+	w->block_size = DEFAULT_BLOCK_SIZE;
+	strbuf_init(&w->block.records, 0);
+	strbuf_init(&w->block.last_key, 0);
+	strbuf_init(&w->record, 0);
+
+	write_header(header, w);
+	writer_write(w, header, sizeof(header));
+	return w;
+}
+
+static void writer_free(struct reftable_writer *w)
+{
+	size_t i;
+
+	for (i = 0; i < w->index_nr; i++)
+		strbuf_release(&w->index[i].last_key);
+	free(w->index);
+	strbuf_release(&w->block.records);
+	strbuf_release(&w->block.last_key);
+	free(w->block.restarts);
+	strbuf_release(&w->record);
+	free(w);
+}
+
+static size_t block_size_with(const struct block_writer *b, size_t record_len,
+			      int restart)
+{
+	return BLOCK_HEADER_SIZE + b->records.len + record_len +
+		3 * (b->restart_nr + !!restart) + 2;
+}
+
+/* Write out the current block, if it has any records. */
+static int writer_flush_block(struct reftable_writer *w)
+{
+	struct block_writer *b = &w->block;
+	struct strbuf out = STRBUF_INIT;
+	struct index_record *ir;
+	unsigned char buf[4];
+	size_t i, len;
+	int ret;
+
+	if (!b->entries)
+		return 0;
+
+	len = block_size_with(b, 0, 0);
+	if (len > MAX_BLOCK_SIZE)
+		return error(_("reftable record too large"));
+
+	buf[0] = b->type;
+	put_be24(buf + 1, len);
+	strbuf_add(&out, buf, 4);
+	strbuf_addbuf(&out, &b->records);
+	for (i = 0; i < b->restart_nr; i++) {
+		put_be24(buf, b->restarts[i]);
+		strbuf_add(&out, buf, 3);
+	}
+	buf[0] = (b->restart_nr >> 8) & 0xff;
+	buf[1] = b->restart_nr & 0xff;
+	strbuf_add(&out, buf, 2);
+
+	ALLOC_GROW(w->index, w->index_nr + 1, w->index_alloc);
+	ir = &w->index[w->index_nr++];
+	strbuf_init(&ir->last_key, 0);
+	strbuf_addbuf(&ir->last_key, &b->last_key);
+	ir->offset = w->offset;
+
+	ret = writer_write(w, out.buf, out.len);
+	strbuf_release(&out);
+
+	strbuf_reset(&b->records);
+	b->restart_nr = 0;
+	b->entries = 0;
+	return ret;
+}
+
+/*
+ * Append a record with the given key to the current block, whose
+ * value (after the key and type) the caller has put into w->record.
+ */
+static int writer_add_record(struct reftable_writer *w, uint8_t block_type,
+			     const struct strbuf *key, uint8_t value_type)
+{
+	struct block_writer *b = &w->block;
+	struct strbuf rec = STRBUF_INIT;
+	int attempt;
+
+	if (b->entries && b->type != block_type)
+		BUG("reftable block of type '%c' gets a record of type '%c'",
+		    b->type, block_type);
+	b->type = block_type;
+
+	for (attempt = 0; attempt < 2; attempt++) {
+		int restart = !(b->entries % RESTART_INTERVAL);
+		size_t prefix = 0;
+
+		if (!restart)
+			while (prefix < b->last_key.len && prefix < key->len &&
+			       b->last_key.buf[prefix] == key->buf[prefix])
+				prefix++;
+
+		strbuf_reset(&rec);
+		strbuf_add_varint(&rec, prefix);
+		strbuf_add_varint(&rec, ((uintmax_t)(key->len - prefix) << 3) |
+					value_type);
+		strbuf_add(&rec, key->buf + prefix, key->len - prefix);
+		strbuf_addbuf(&rec, &w->record);
+
+		if (b->entries &&
+		    block_size_with(b, rec.len, restart) > w->block_size) {
+			if (writer_flush_block(w) < 0) {
+				strbuf_release(&rec);
+				return -1;
+			}
+			continue;
+		}
+
+		if (restart) {
+			ALLOC_GROW(b->restarts, b->restart_nr + 1,
+				   b->restart_alloc);
+			b->restarts[b->restart_nr++] =
+				BLOCK_HEADER_SIZE + b->records.len;
+		}
+		strbuf_addbuf(&b->records, &rec);
+		strbuf_reset(&b->last_key);
+		strbuf_addbuf(&b->last_key, key);
+		b->entries++;
+		break;
+	}
+	strbuf_release(&rec);
+	return 0;
+}
+
+/*
+ * Flush the last block of the current section and write the index
+ * blocks for it, if it has more than one block. Returns the offset of
+ * the root index block, or 0 if there is none.
+ */
+static uint64_t writer_finish_section(struct reftable_writer *w)
+{
+	uint64_t root = 0;
+
+	if (writer_flush_block(w) < 0)
+		return 0;
+
+	while (w->index_nr > 1) {
+		struct index_record *level = w->index;
+		size_t i, nr = w->index_nr;
+
+		w->index = NULL;
+		w->index_nr = w->index_alloc = 0;
+		for (i = 0; i < nr; i++) {
+			strbuf_reset(&w->record);
+			strbuf_add_varint(&w->record, level[i].offset);
+			writer_add_record(w, BLOCK_TYPE_INDEX,
+					  &level[i].last_key, 0);
+			strbuf_release(&level[i].last_key);
+		}
+		free(level);
+		writer_flush_block(w);
+		root = w->index[w->index_nr - 1].offset;
+	}
+
+	while (w->index_nr)
+		strbuf_release(&w->index[--w->index_nr].last_key);
+	strbuf_reset(&w->block.last_key);
+	w->section = 0;
+	return root;
+}
+
+static void writer_check_order(struct reftable_writer *w, uint8_t section,
+			       const struct strbuf *key)
+{
+	if (w->section != section) {
+		if (section == BLOCK_TYPE_REF && w->section)
+			BUG("reftable refs must be written before logs");
+		w->section = section;
+		if (section == BLOCK_TYPE_LOG)
+			w->log_offset = w->offset;
+		return;
+	}
+	if (strbuf_cmp(&w->block.last_key, key) >= 0 &&
+	    (w->block.entries || w->index_nr))
+		BUG("reftable records added out of order");
+}
+
+int reftable_writer_add_ref(struct reftable_writer *w,
+			    const struct reftable_ref_record *rec)
+{
+	if (rec->update_index < w->min_update_index ||
+	    rec->update_index > w->max_update_index)
+		BUG("reftable ref update index out of range");
+	writer_check_order(w, BLOCK_TYPE_REF, &rec->refname);
+
+	strbuf_reset(&w->record);
+	strbuf_add_varint(&w->record, rec->update_index - w->min_update_index);
+	switch (rec->type) {
+	case REFTABLE_REF_DELETION:
+		break;
+	case REFTABLE_REF_VAL2:
+		strbuf_add(&w->record, rec->value.hash, the_hash_algo->rawsz);
+		strbuf_add(&w->record, rec->peeled.hash, the_hash_algo->rawsz);
+		break;
+	case REFTABLE_REF_VAL1:
+		strbuf_add(&w->record, rec->value.hash, the_hash_algo->rawsz);
+		break;
+	case REFTABLE_REF_SYMREF:
+		strbuf_add_string(&w->record, &rec->target);
+		break;
+	default:
+		BUG("unknown reftable ref type %d", rec->type);
+	}
+	w->nr_records++;
+	return writer_add_record(w, BLOCK_TYPE_REF, &rec->refname, rec->type);
+}
+
+int reftable_writer_add_log(struct reftable_writer *w,
+			    const struct reftable_log_record *rec)
+{
+	struct strbuf key = STRBUF_INIT;
+	unsigned char tz[2];
+	int ret;
+
+	if (w->section == BLOCK_TYPE_REF)
+		w->ref_index_offset = writer_finish_section(w);
+
+	log_record_key(&key, rec->refname.buf, rec->update_index);
+	writer_check_order(w, BLOCK_TYPE_LOG, &key);
+
+	strbuf_reset(&w->record);
+	if (!rec->deletion) {
+		strbuf_add(&w->record, rec->old_oid.hash, the_hash_algo->rawsz);
+		strbuf_add(&w->record, rec->new_oid.hash, the_hash_algo->rawsz);
+		strbuf_add_string(&w->record, &rec->name);
+		strbuf_add_string(&w->record, &rec->email);
+		strbuf_add_varint(&w->record, rec->time);
+		tz[0] = ((uint16_t)rec->tz >> 8) & 0xff;
+		tz[1] = (uint16_t)rec->tz & 0xff;
+		strbuf_add(&w->record, tz, 2);
+		strbuf_add_string(&w->record, &rec->message);
+	}
+	w->nr_records++;
+	ret = writer_add_record(w, BLOCK_TYPE_LOG, &key, !rec->deletion);
+	strbuf_release(&key);
+	return ret;
+}
+
+static int writer_finish(struct reftable_writer *w)
+{
+	unsigned char footer[FOOTER_SIZE];
+
+	if (w->section == BLOCK_TYPE_REF)
+		w->ref_index_offset = writer_finish_section(w);
+	else if (w->section == BLOCK_TYPE_LOG)
+		w->log_index_offset = writer_finish_section(w);
+
+	write_header(footer, w);
+	put_be64(footer + HEADER_SIZE, w->ref_index_offset);
+	put_be64(footer + HEADER_SIZE + 8, w->log_offset);
+	put_be64(footer + HEADER_SIZE + 16, w->log_index_offset);
+	put_be32(footer + HEADER_SIZE + 24,
+		 crc32(0, footer, FOOTER_SIZE - 4));
+	writer_write(w, footer, sizeof(footer));
+
+	if (w->error) {
+		errno = w->error;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Reading
+ */
+
+struct reftable_table {
+	char *name;
+	/* held by the stack and by every iterator reading the table */
+	int refcount;
+	const unsigned char *map;
+	size_t size;
+	uint64_t min_update_index, max_update_index;
+	uint64_t ref_index_offset, log_offset, log_index_offset;
+	uint64_t footer_offset;
+};
+
+static int table_corrupt(const struct reftable_table *t, const char *what)
+{
+	return error(_("corrupt reftable '%s': %s"), t->name, what);
+}
+
+static struct reftable_table *table_open(const char *dir, const char *name)
+{
+	struct reftable_table *t;
+	char *path = xstrfmt("%s/%s", dir, name);
+	const unsigned char *h, *f;
+	struct stat st;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		if (errno != ENOENT)
+			error_errno(_("unable to open '%s'"), path);
+		free(path);
+		return NULL;
+	}
+	if (fstat(fd, &st) < 0) {
+		error_errno(_("unable to stat '%s'"), path);
+		close(fd);
+		free(path);
+		return NULL;
+	}
+
+	t = xcalloc(1, sizeof(*t));
+	t->name = xstrdup(name);
+	t->refcount = 1;
+	t->size = xsize_t(st.st_size);
+	if (t->size < HEADER_SIZE + FOOTER_SIZE) {
+		close(fd);
+		free(path);
+		table_corrupt(t, _("file too short"));
+		goto fail;
+	}
+	t->map = xmmap(NULL, t->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	free(path);
+
+	h = t->map;
+	f = t->map + t->size - FOOTER_SIZE;
+	if (memcmp(h, REFTABLE_MAGIC, 4) || h[4] != REFTABLE_VERSION) {
+		table_corrupt(t, _("unknown format"));
+		goto fail;
+	}
+	if (memcmp(h, f, HEADER_SIZE)) {
+		table_corrupt(t, _("header and footer differ"));
+		goto fail;
+	}
+	if (get_be32(f + HEADER_SIZE + 24) != crc32(0, f, FOOTER_SIZE - 4)) {
+		table_corrupt(t, _("footer checksum mismatch"));
+		goto fail;
+	}
+	if (get_be32(h + 24) != the_hash_algo->format_id) {
+		table_corrupt(t, _("wrong object format"));
+		goto fail;
+	}
+
+	t->min_update_index = get_be64(h + 8);
+	t->max_update_index = get_be64(h + 16);
+	t->ref_index_offset = get_be64(f + HEADER_SIZE);
+	t->log_offset = get_be64(f + HEADER_SIZE + 8);
+	t->log_index_offset = get_be64(f + HEADER_SIZE + 16);
+	t->footer_offset = t->size - FOOTER_SIZE;
+	if (t->ref_index_offset >= t->footer_offset ||
+	    t->log_offset >= t->footer_offset ||
+	    t->log_index_offset >= t->footer_offset) {
+		table_corrupt(t, _("bad section offsets"));
+		goto fail;
+	}
+	return t;
+
+fail:
+	if (t->map)
+		munmap((void *)t->map, t->size);
+	free(t->name);
+	free(t);
+	return NULL;
+}
+
+static void table_close(struct reftable_table *t)
+{
+	if (!t || --t->refcount)
+		return;
+	munmap((void *)t->map, t->size);
+	free(t->name);
+	free(t);
+}
+
+struct block {
+	const unsigned char *data;
+	uint64_t offset;
+	uint32_t len;
+	uint8_t type;
+	uint32_t restart_nr;
+	const unsigned char *restarts;
+};
+
+/* Returns 0 on success, 1 if there is no block there, -1 if corrupt */
+static int block_init(struct block *b, const struct reftable_table *t,
+		      uint64_t offset)
+{
+	if (offset < HEADER_SIZE || offset + BLOCK_HEADER_SIZE > t->footer_offset)
+		return 1;
+
+	b->data = t->map + offset;
+	b->offset = offset;
+	b->type = b->data[0];
+	if (b->type != BLOCK_TYPE_REF && b->type != BLOCK_TYPE_LOG &&
+	    b->type != BLOCK_TYPE_INDEX)
+		return table_corrupt(t, _("unknown block type"));
+	b->len = get_be24(b->data + 1);
+	if (b->len < BLOCK_HEADER_SIZE + 2 || offset + b->len > t->footer_offset)
+		return table_corrupt(t, _("bad block length"));
+	b->restart_nr = get_be16(b->data + b->len - 2);
+	if (!b->restart_nr ||
+	    BLOCK_HEADER_SIZE + 3 * b->restart_nr + 2 > b->len)
+		return table_corrupt(t, _("bad restart table"));
+	b->restarts = b->data + b->len - 2 - 3 * b->restart_nr;
+	return 0;
+}
+
+struct block_iter {
+	const struct reftable_table *t;
+	struct block block;
+	const unsigned char *pos;
+
+	/* the current record */
+	struct strbuf key;
+	uint8_t value_type;
+	const unsigned char *value;
+	size_t value_len;
+};
+
+/* Skip the value of a record, returning its length or -1 if corrupt. */
+static ssize_t value_len(uint8_t block_type, uint8_t value_type,
+			 const unsigned char *p, const unsigned char *end)
+{
+	const unsigned char *start = p;
+	size_t rawsz = the_hash_algo->rawsz;
+	int i;
+
+	switch (block_type) {
+	case BLOCK_TYPE_INDEX:
+		decode_varint(&p);
+		break;
+	case BLOCK_TYPE_REF:
+		decode_varint(&p);
+		if (value_type == REFTABLE_REF_VAL1)
+			p += rawsz;
+		else if (value_type == REFTABLE_REF_VAL2)
+			p += 2 * rawsz;
+		else if (value_type == REFTABLE_REF_SYMREF) {
+			uintmax_t len = decode_varint(&p);
+
+			if (len > end - p)
+				return -1;
+			p += len;
+		} else if (value_type != REFTABLE_REF_DELETION)
+			return -1;
+		break;
+	case BLOCK_TYPE_LOG:
+		if (!value_type)
+			break;
+		if (end - p < 2 * rawsz)
+			return -1;
+		p += 2 * rawsz;
+		/*
+		 * The name, the email, the time (which is followed by
+		 * the two bytes of the time zone) and the message.
+		 */
+		for (i = 0; i < 4; i++) {
+			uintmax_t len;
+
+			if (p >= end)
+				return -1;
+			len = decode_varint(&p);
+			if (i == 2)
+				len = 2;
+			if (len > end - p)
+				return -1;
+			p += len;
+		}
+		break;
+	}
+	if (p > end)
+		return -1;
+	return p - start;
+}
+
+/*
+ * Decode the record at bi->pos. Returns 0 on success, 1 at the end of
+ * the block and -1 if it is corrupt.
+ */
+static int block_iter_next(struct block_iter *bi)
+{
+	const unsigned char *end = bi->block.restarts;
+	const unsigned char *p = bi->pos;
+	uintmax_t prefix, suffix;
+	ssize_t len;
+
+	if (p >= end)
+		return 1;
+
+	prefix = decode_varint(&p);
+	if (p >= end)
+		return table_corrupt(bi->t, _("truncated record"));
+	suffix = decode_varint(&p);
+	bi->value_type = suffix & 0x7;
+	suffix >>= 3;
+	if (prefix > bi->key.len || suffix > end - p)
+		return table_corrupt(bi->t, _("bad record key"));
+
+	strbuf_setlen(&bi->key, prefix);
+	strbuf_add(&bi->key, p, suffix);
+	p += suffix;
+
+	len = value_len(bi->block.type, bi->value_type, p, end);
+	if (len < 0)
+		return table_corrupt(bi->t, _("bad record value"));
+	bi->value = p;
+	bi->value_len = len;
+	bi->pos = p + len;
+	return 0;
+}
+
+static int block_iter_start(struct block_iter *bi, const struct reftable_table *t,
+			    uint64_t offset)
+{
+	int ret;
+
+	bi->t = t;
+	ret = block_init(&bi->block, t, offset);
+	if (ret)
+		return ret;
+	bi->pos = bi->block.data + BLOCK_HEADER_SIZE;
+	strbuf_reset(&bi->key);
+	return 0;
+}
+
+static const unsigned char *restart_pos(const struct block *b, uint32_t i)
+{
+	return b->data + get_be24(b->restarts + 3 * i);
+}
+
+/*
+ * Position the iterator on the first record of the block whose key is
+ * at least `want`. Returns 0 on success, 1 if there is no such record
+ * and -1 on errors.
+ */
+static int block_iter_seek(struct block_iter *bi, const struct strbuf *want)
+{
+	const struct block *b = &bi->block;
+	uint32_t lo = 0, hi = b->restart_nr;
+	int ret;
+
+	/* find the first restart point whose key is larger than want */
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+
+		bi->pos = restart_pos(b, mid);
+		strbuf_reset(&bi->key);
+		if (bi->pos < b->data + BLOCK_HEADER_SIZE ||
+		    bi->pos >= b->restarts)
+			return table_corrupt(bi->t, _("bad restart point"));
+		ret = block_iter_next(bi);
+		if (ret)
+			return ret < 0 ? ret : table_corrupt(bi->t, _("bad restart point"));
+		if (strbuf_cmp(&bi->key, want) > 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	bi->pos = lo ? restart_pos(b, lo - 1) : b->data + BLOCK_HEADER_SIZE;
+	strbuf_reset(&bi->key);
+	while (!(ret = block_iter_next(bi)))
+		if (strbuf_cmp(&bi->key, want) >= 0)
+			return 0;
+	return ret;
+}
+
+struct table_iter {
+	const struct reftable_table *t;
+	uint8_t type;
+	struct block_iter bi;
+	int done;
+};
+
+/* Move to the next record, going on to the next block if necessary. */
+static int table_iter_advance(struct table_iter *ti)
+{
+	int ret;
+
+	if (ti->done)
+		return 1;
+	while ((ret = block_iter_next(&ti->bi)) == 1) {
+		ret = block_iter_start(&ti->bi, ti->t,
+				       ti->bi.block.offset + ti->bi.block.len);
+		if (ret < 0)
+			break;
+		if (ret || ti->bi.block.type != ti->type) {
+			ret = 1;
+			break;
+		}
+	}
+	if (ret)
+		ti->done = 1;
+	return ret;
+}
+
+/* Position the iterator on the first record with a key >= want. */
+static int table_iter_seek(struct table_iter *ti, const struct reftable_table *t,
+			   uint8_t type, const struct strbuf *want)
+{
+	uint64_t offset = type == BLOCK_TYPE_REF ? HEADER_SIZE : t->log_offset;
+	uint64_t root = type == BLOCK_TYPE_REF ? t->ref_index_offset :
+						 t->log_index_offset;
+	int ret;
+
+	ti->t = t;
+	ti->type = type;
+	ti->done = 1;
+	if (!offset)
+		return 1;
+
+	if (root) {
+		offset = root;
+		for (;;) {
+			const unsigned char *p;
+
+			ret = block_iter_start(&ti->bi, t, offset);
+			if (ret)
+				return ret < 0 ? ret : table_corrupt(t, _("bad index offset"));
+			if (ti->bi.block.type != BLOCK_TYPE_INDEX)
+				break;
+			ret = block_iter_seek(&ti->bi, want);
+			if (ret)
+				return ret;
+			p = ti->bi.value;
+			offset = decode_varint(&p);
+		}
+		if (ti->bi.block.type != type)
+			return table_corrupt(t, _("index points at wrong block type"));
+	} else {
+		ret = block_iter_start(&ti->bi, t, offset);
+		if (ret < 0)
+			return ret;
+		if (ret || ti->bi.block.type != type)
+			return 1;
+	}
+
+	ti->done = 0;
+	for (;;) {
+		ret = block_iter_seek(&ti->bi, want);
+		if (ret <= 0)
+			break;
+		/* not in this block; try the next one */
+		ret = block_iter_start(&ti->bi, t,
+				       ti->bi.block.offset + ti->bi.block.len);
+		if (ret < 0)
+			break;
+		if (ret || ti->bi.block.type != type) {
+			ret = 1;
+			break;
+		}
+	}
+	if (ret)
+		ti->done = 1;
+	return ret;
+}
+
+static void decode_ref(const struct table_iter *ti, struct reftable_ref_record *rec)
+{
+	const unsigned char *p = ti->bi.value;
+	size_t rawsz = the_hash_algo->rawsz;
+
+	strbuf_reset(&rec->refname);
+	strbuf_addbuf(&rec->refname, &ti->bi.key);
+	rec->update_index = ti->t->min_update_index + decode_varint(&p);
+	rec->type = ti->bi.value_type;
+	oidclr(&rec->value);
+	oidclr(&rec->peeled);
+	strbuf_reset(&rec->target);
+	switch (rec->type) {
+	case REFTABLE_REF_VAL2:
+		hashcpy(rec->peeled.hash, p + rawsz);
+		/* fallthrough */
+	case REFTABLE_REF_VAL1:
+		hashcpy(rec->value.hash, p);
+		break;
+	case REFTABLE_REF_SYMREF: {
+		size_t len = decode_varint(&p);
+
+		strbuf_add(&rec->target, p, len);
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+static void decode_string(const unsigned char **p, struct strbuf *sb)
+{
+	size_t len = decode_varint(p);
+
+	strbuf_reset(sb);
+	strbuf_add(sb, *p, len);
+	*p += len;
+}
+
+static int decode_log(const struct table_iter *ti, struct reftable_log_record *rec)
+{
+	const struct strbuf *key = &ti->bi.key;
+	const unsigned char *p = ti->bi.value;
+	size_t rawsz = the_hash_algo->rawsz;
+
+	if (key->len < LOG_KEY_SUFFIX_SIZE ||
+	    key->buf[key->len - LOG_KEY_SUFFIX_SIZE])
+		return table_corrupt(ti->t, _("bad log record key"));
+
+	strbuf_reset(&rec->refname);
+	strbuf_add(&rec->refname, key->buf, key->len - LOG_KEY_SUFFIX_SIZE);
+	rec->update_index = ~get_be64(key->buf + key->len - 8);
+	rec->deletion = !ti->bi.value_type;
+	oidclr(&rec->old_oid);
+	oidclr(&rec->new_oid);
+	strbuf_reset(&rec->name);
+	strbuf_reset(&rec->email);
+	strbuf_reset(&rec->message);
+	rec->time = 0;
+	rec->tz = 0;
+	if (rec->deletion)
+		return 0;
+
+	hashcpy(rec->old_oid.hash, p);
+	hashcpy(rec->new_oid.hash, p + rawsz);
+	p += 2 * rawsz;
+	decode_string(&p, &rec->name);
+	decode_string(&p, &rec->email);
+	rec->time = decode_varint(&p);
+	rec->tz = (int16_t)(p[0] << 8 | p[1]);
+	p += 2;
+	decode_string(&p, &rec->message);
+	return 0;
+}
+
+/*
+ * Merged iteration over the tables of a stack
+ */
+
+struct reftable_iterator {
+	uint8_t type;
+	int keep_deletions;
+	/* one per table, oldest first */
+	struct reftable_table **tables;
+	struct table_iter *subs;
+	size_t nr;
+	/* the sub-iterator holding the record to return next, or -1 */
+	ssize_t current;
+	/* for log iterators limited to a single reference */
+	struct strbuf limit;
+};
+
+static void merged_iter_init(struct reftable_iterator *it, uint8_t type,
+			     struct reftable_table **tables, size_t nr,
+			     const struct strbuf *seek)
+{
+	size_t i;
+
+	it->type = type;
+	it->nr = nr;
+	ALLOC_ARRAY(it->tables, nr);
+	CALLOC_ARRAY(it->subs, nr);
+	it->current = -1;
+	strbuf_init(&it->limit, 0);
+	for (i = 0; i < nr; i++) {
+		it->tables[i] = tables[i];
+		tables[i]->refcount++;
+		strbuf_init(&it->subs[i].bi.key, 0);
+		table_iter_seek(&it->subs[i], tables[i], type, seek);
+	}
+}
+
+static void merged_iter_release(struct reftable_iterator *it)
+{
+	size_t i;
+
+	for (i = 0; i < it->nr; i++) {
+		strbuf_release(&it->subs[i].bi.key);
+		table_close(it->tables[i]);
+	}
+	free(it->subs);
+	free(it->tables);
+	strbuf_release(&it->limit);
+}
+
+/*
+ * Find the next record to return, leaving it in it->current. Records
+ * for the same key in older tables are skipped. Returns 0 on success
+ * and 1 at the end.
+ */
+static int merged_iter_next(struct reftable_iterator *it)
+{
+	for (;;) {
+		ssize_t best = -1;
+		size_t i;
+
+		/* skip past the previously returned key */
+		if (it->current >= 0) {
+			struct strbuf prev = STRBUF_INIT;
+
+			strbuf_addbuf(&prev, &it->subs[it->current].bi.key);
+			for (i = 0; i < it->nr; i++)
+				if (!it->subs[i].done &&
+				    !strbuf_cmp(&it->subs[i].bi.key, &prev))
+					table_iter_advance(&it->subs[i]);
+			strbuf_release(&prev);
+			it->current = -1;
+		}
+
+		for (i = 0; i < it->nr; i++) {
+			if (it->subs[i].done)
+				continue;
+			/* on ties the newer table, which comes later, wins */
+			if (best < 0 ||
+			    strbuf_cmp(&it->subs[i].bi.key,
+				       &it->subs[best].bi.key) <= 0)
+				best = i;
+		}
+		if (best < 0)
+			return 1;
+		it->current = best;
+
+		if (it->limit.len &&
+		    (it->subs[best].bi.key.len <= it->limit.len ||
+		     memcmp(it->subs[best].bi.key.buf, it->limit.buf,
+			    it->limit.len)))
+			return 1;
+		if (it->keep_deletions || it->subs[best].bi.value_type)
+			return 0;
+	}
+}
+
+static struct reftable_iterator *stack_iterator(struct reftable_stack *st,
+						uint8_t type,
+						const struct strbuf *seek);
+
+int reftable_iterator_next_ref(struct reftable_iterator *it,
+			       struct reftable_ref_record *rec)
+{
+	int ret;
+
+	if (it->type != BLOCK_TYPE_REF)
+		BUG("reading refs from a reftable log iterator");
+	ret = merged_iter_next(it);
+	if (ret)
+		return ret;
+	decode_ref(&it->subs[it->current], rec);
+	return 0;
+}
+
+int reftable_iterator_next_log(struct reftable_iterator *it,
+			       struct reftable_log_record *rec)
+{
+	int ret;
+
+	if (it->type != BLOCK_TYPE_LOG)
+		BUG("reading logs from a reftable ref iterator");
+	ret = merged_iter_next(it);
+	if (ret)
+		return ret;
+	return decode_log(&it->subs[it->current], rec);
+}
+
+void reftable_iterator_release(struct reftable_iterator *it)
+{
+	if (!it)
+		return;
+	merged_iter_release(it);
+	free(it);
+}
+
+/*
+ * Stacks
+ */
+
+struct reftable_stack {
+	char *dir;
+	char *list_file;
+
+	/* oldest first */
+	struct reftable_table **tables;
+	size_t nr, alloc;
+
+	int loaded;
+	struct stat_validity validity;
+
+	struct lock_file lock;
+	int locked;
+};
+
+struct reftable_stack *reftable_stack_new(const char *dir)
+{
+	struct reftable_stack *st = xcalloc(1, sizeof(*st));
+
+	st->dir = xstrdup(dir);
+	st->list_file = xstrfmt("%s/tables.list", dir);
+	return st;
+}
+
+static void stack_close_tables(struct reftable_stack *st)
+{
+	while (st->nr)
+		table_close(st->tables[--st->nr]);
+}
+
+void reftable_stack_free(struct reftable_stack *st)
+{
+	if (!st)
+		return;
+	if (st->locked)
+		BUG("freeing a locked reftable stack");
+	stack_close_tables(st);
+	free(st->tables);
+	stat_validity_clear(&st->validity);
+	free(st->dir);
+	free(st->list_file);
+	free(st);
+}
+
+static struct reftable_table *stack_find_table(struct reftable_stack *st,
+					       const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < st->nr; i++)
+		if (st->tables[i] && !strcmp(st->tables[i]->name, name))
+			return st->tables[i];
+	return NULL;
+}
+
+/*
+ * Read the list of tables and open them, keeping the tables we already
+ * have open. Returns 0 on success, 1 if a table has gone missing
+ * (because of a concurrent compaction) and -1 on errors.
+ */
+static int stack_load(struct reftable_stack *st)
+{
+	struct strbuf list = STRBUF_INIT;
+	struct string_list names = STRING_LIST_INIT_DUP;
+	struct reftable_table **tables;
+	struct stat_validity validity = { NULL };
+	size_t i;
+	int fd, ret = 0;
+
+	fd = open(st->list_file, O_RDONLY);
+	if (fd < 0) {
+		if (errno != ENOENT)
+			return error_errno(_("unable to open '%s'"), st->list_file);
+	} else {
+		stat_validity_update(&validity, fd);
+		if (strbuf_read(&list, fd, 0) < 0) {
+			ret = error_errno(_("unable to read '%s'"), st->list_file);
+			close(fd);
+			goto out;
+		}
+		close(fd);
+	}
+	string_list_split(&names, list.buf, '\n', -1);
+	if (names.nr && !*names.items[names.nr - 1].string)
+		names.nr--;
+
+	CALLOC_ARRAY(tables, names.nr);
+	for (i = 0; i < names.nr; i++) {
+		const char *name = names.items[i].string;
+
+		tables[i] = stack_find_table(st, name);
+		if (!tables[i])
+			tables[i] = table_open(st->dir, name);
+		if (!tables[i]) {
+			size_t j;
+
+			ret = errno == ENOENT ? 1 : -1;
+			for (j = 0; j < i; j++)
+				if (!stack_find_table(st, tables[j]->name))
+					table_close(tables[j]);
+			free(tables);
+			stat_validity_clear(&validity);
+			goto out;
+		}
+	}
+
+	/* close the tables that are gone from the list */
+	for (i = 0; i < st->nr; i++) {
+		size_t j;
+
+		for (j = 0; j < names.nr; j++)
+			if (tables[j] == st->tables[i])
+				break;
+		if (j == names.nr)
+			table_close(st->tables[i]);
+	}
+	free(st->tables);
+	st->tables = tables;
+	st->nr = st->alloc = names.nr;
+	stat_validity_clear(&st->validity);
+	st->validity = validity;
+	st->loaded = 1;
+
+out:
+	string_list_clear(&names, 0);
+	strbuf_release(&list);
+	return ret;
+}
+
+static int stack_reload(struct reftable_stack *st, int force)
+{
+	int attempt, ret = 1;
+
+	if (!force && st->loaded &&
+	    stat_validity_check(&st->validity, st->list_file))
+		return 0;
+
+	for (attempt = 0; attempt < MAX_RELOAD_ATTEMPTS && ret > 0; attempt++)
+		ret = stack_load(st);
+	if (ret > 0)
+		return error(_("reftable stack '%s' keeps changing"), st->dir);
+	return ret;
+}
+
+int reftable_stack_reload(struct reftable_stack *st)
+{
+	/* do not look behind the back of an update in progress */
+	if (st->locked)
+		return 0;
+	return stack_reload(st, 0);
+}
+
+static struct reftable_iterator *stack_iterator(struct reftable_stack *st,
+						uint8_t type,
+						const struct strbuf *seek)
+{
+	struct reftable_iterator *it = xcalloc(1, sizeof(*it));
+
+	merged_iter_init(it, type, st->tables, st->nr, seek);
+	return it;
+}
+
+struct reftable_iterator *reftable_stack_ref_iterator(struct reftable_stack *st,
+						      const char *seek)
+{
+	struct strbuf key = STRBUF_INIT;
+	struct reftable_iterator *it;
+
+	strbuf_addstr(&key, seek ? seek : "");
+	it = stack_iterator(st, BLOCK_TYPE_REF, &key);
+	strbuf_release(&key);
+	return it;
+}
+
+struct reftable_iterator *reftable_stack_log_iterator(struct reftable_stack *st,
+						      const char *refname)
+{
+	struct strbuf key = STRBUF_INIT;
+	struct reftable_iterator *it;
+
+	if (refname)
+		log_record_key(&key, refname, UINT64_MAX);
+	it = stack_iterator(st, BLOCK_TYPE_LOG, &key);
+	if (refname) {
+		strbuf_addstr(&it->limit, refname);
+		strbuf_addch(&it->limit, '\0');
+	}
+	strbuf_release(&key);
+	return it;
+}
+
+int reftable_stack_read_ref(struct reftable_stack *st, const char *refname,
+			    struct reftable_ref_record *rec)
+{
+	struct strbuf want = STRBUF_INIT;
+	struct table_iter ti = { NULL };
+	size_t i;
+	int ret = 1;
+
+	strbuf_addstr(&want, refname);
+	strbuf_init(&ti.bi.key, 0);
+	for (i = st->nr; i--; ) {
+		int found = table_iter_seek(&ti, st->tables[i], BLOCK_TYPE_REF,
+					    &want);
+
+		if (found < 0) {
+			ret = -1;
+			break;
+		}
+		if (found || strbuf_cmp(&ti.bi.key, &want))
+			continue;
+		decode_ref(&ti, rec);
+		ret = rec->type == REFTABLE_REF_DELETION;
+		break;
+	}
+	strbuf_release(&ti.bi.key);
+	strbuf_release(&want);
+	return ret;
+}
+
+int reftable_stack_lock(struct reftable_stack *st, long timeout_ms,
+			struct strbuf *err)
+{
+	if (st->locked)
+		BUG("reftable stack '%s' locked twice", st->dir);
+
+	if (safe_create_leading_directories_const(st->list_file) < 0 ||
+	    (mkdir(st->dir, 0777) < 0 && errno != EEXIST)) {
+		strbuf_addf(err, _("unable to create directory '%s': %s"),
+			    st->dir, strerror(errno));
+		return -1;
+	}
+	adjust_shared_perm(st->dir);
+
+	if (hold_lock_file_for_update_timeout(&st->lock, st->list_file, 0,
+					      timeout_ms) < 0) {
+		unable_to_lock_message(st->list_file, errno, err);
+		return -1;
+	}
+	st->locked = 1;
+
+	if (stack_reload(st, 1) < 0) {
+		strbuf_addf(err, _("unable to read reftable stack '%s'"), st->dir);
+		reftable_stack_unlock(st);
+		return -1;
+	}
+	return 0;
+}
+
+void reftable_stack_unlock(struct reftable_stack *st)
+{
+	if (!st->locked)
+		return;
+	rollback_lock_file(&st->lock);
+	st->locked = 0;
+}
+
+uint64_t reftable_stack_next_update_index(struct reftable_stack *st)
+{
+	if (!st->nr)
+		return 1;
+	return st->tables[st->nr - 1]->max_update_index + 1;
+}
+
+/*
+ * Write a table with the records produced by `write_fn` into the
+ * stack directory, and open it. Returns NULL (after filling `err`) on
+ * errors, and also if the table would have no records and
+ * `keep_empty` is not set.
+ */
+static struct reftable_table *stack_write_table(struct reftable_stack *st,
+						uint64_t min_update_index,
+						uint64_t max_update_index,
+						reftable_write_fn *write_fn,
+						void *cb_data, int keep_empty,
+						struct strbuf *err)
+{
+	static unsigned int counter;
+	struct strbuf path = STRBUF_INIT;
+	struct tempfile *tmp;
+	struct reftable_writer *w;
+	struct reftable_table *t = NULL;
+	char *name = NULL;
+
+	strbuf_addf(&path, "%s/tmp_table_XXXXXX", st->dir);
+	tmp = mks_tempfile_m(path.buf, 0666);
+	if (!tmp) {
+		strbuf_addf(err, _("unable to create '%s': %s"), path.buf,
+			    strerror(errno));
+		goto out;
+	}
+
+	w = writer_new(get_tempfile_fd(tmp), min_update_index,
+		       max_update_index);
+	if (write_fn(w, cb_data) < 0 || writer_finish(w) < 0) {
+		strbuf_addf(err, _("unable to write reftable '%s': %s"),
+			    get_tempfile_path(tmp), strerror(errno));
+		writer_free(w);
+		delete_tempfile(&tmp);
+		goto out;
+	}
+	if (!w->nr_records && !keep_empty) {
+		writer_free(w);
+		delete_tempfile(&tmp);
+		goto out;
+	}
+	writer_free(w);
+
+	name = xstrfmt("0x%012"PRIx64"-0x%012"PRIx64"-%08x.ref",
+		       min_update_index, max_update_index,
+		       (unsigned int)(getpid() * 1000003u + counter++) ^
+		       (unsigned int)time(NULL));
+	strbuf_reset(&path);
+	strbuf_addf(&path, "%s/%s", st->dir, name);
+	if (adjust_shared_perm(get_tempfile_path(tmp)) ||
+	    rename_tempfile(&tmp, path.buf) < 0) {
+		strbuf_addf(err, _("unable to rename reftable to '%s': %s"),
+			    path.buf, strerror(errno));
+		delete_tempfile(&tmp);
+		goto out;
+	}
+
+	t = table_open(st->dir, name);
+	if (!t)
+		strbuf_addf(err, _("unable to read back reftable '%s'"), path.buf);
+
+out:
+	free(name);
+	strbuf_release(&path);
+	return t;
+}
+
+struct compact_data {
+	struct reftable_table **tables;
+	size_t nr;
+	int keep_deletions;
+};
+
+static int write_compacted(struct reftable_writer *w, void *cb_data)
+{
+	struct compact_data *data = cb_data;
+	struct reftable_iterator it = { 0 };
+	struct reftable_ref_record ref = REFTABLE_REF_RECORD_INIT;
+	struct reftable_log_record log = REFTABLE_LOG_RECORD_INIT;
+	struct strbuf empty = STRBUF_INIT;
+	int ret;
+
+	merged_iter_init(&it, BLOCK_TYPE_REF, data->tables, data->nr, &empty);
+	it.keep_deletions = data->keep_deletions;
+	while (!(ret = reftable_iterator_next_ref(&it, &ref)))
+		if (reftable_writer_add_ref(w, &ref) < 0)
+			ret = -1;
+	merged_iter_release(&it);
+	if (ret < 0)
+		goto out;
+
+	memset(&it, 0, sizeof(it));
+	merged_iter_init(&it, BLOCK_TYPE_LOG, data->tables, data->nr, &empty);
+	it.keep_deletions = data->keep_deletions;
+	while (!(ret = reftable_iterator_next_log(&it, &log)))
+		if (reftable_writer_add_log(w, &log) < 0)
+			ret = -1;
+	merged_iter_release(&it);
+
+out:
+	reftable_ref_record_release(&ref);
+	reftable_log_record_release(&log);
+	return ret < 0 ? -1 : 0;
+}
+
+/*
+ * Merge the tables [first, st->nr) of the locked stack into one. The
+ * replaced tables are added to `obsolete`, to be deleted once the new
+ * list is in place.
+ */
+static int stack_compact(struct reftable_stack *st, size_t first,
+			 struct string_list *obsolete, struct strbuf *err)
+{
+	struct compact_data data;
+	struct reftable_table *t;
+	uint64_t min_update_index;
+	size_t i;
+
+	if (first >= st->nr)
+		return 0;
+
+	data.tables = st->tables + first;
+	data.nr = st->nr - first;
+	/* tombstones must stay if older tables may have what they delete */
+	data.keep_deletions = first > 0;
+
+	/* log records may be older than the table holding them */
+	min_update_index = st->tables[first]->min_update_index;
+	for (i = first + 1; i < st->nr; i++)
+		if (st->tables[i]->min_update_index < min_update_index)
+			min_update_index = st->tables[i]->min_update_index;
+
+	trace2_region_enter("refs", "reftable/compact", the_repository);
+	t = stack_write_table(st, min_update_index,
+			      st->tables[st->nr - 1]->max_update_index,
+			      write_compacted, &data, first > 0, err);
+	trace2_data_intmax("refs", the_repository, "reftable/compacted",
+			   data.nr);
+	trace2_region_leave("refs", "reftable/compact", the_repository);
+	if (!t && err->len)
+		return -1;
+
+	for (i = first; i < st->nr; i++) {
+		string_list_append(obsolete, st->tables[i]->name);
+		table_close(st->tables[i]);
+	}
+	st->nr = first;
+	if (t) {
+		ALLOC_GROW(st->tables, st->nr + 1, st->alloc);
+		st->tables[st->nr++] = t;
+	}
+	return 0;
+}
+
+/*
+ * Keep the table sizes decreasing geometrically from the oldest to the
+ * newest table, by merging the newest tables whenever one of them is
+ * no more than twice as large as all of the newer ones together.
+ * This bounds the number of tables by the logarithm of the number of
+ * records, while each record gets rewritten a logarithmic number of
+ * times.
+ */
+static size_t stack_compaction_start(struct reftable_stack *st)
+{
+	size_t first = st->nr - 1;
+	uint64_t newer;
+
+	if (st->nr < 2)
+		return st->nr;
+	newer = st->tables[first]->size;
+	while (first > 0 && st->tables[first - 1]->size <= 2 * newer) {
+		first--;
+		newer += st->tables[first]->size;
+	}
+	return first < st->nr - 1 ? first : st->nr;
+}
+
+/* Write the new list of tables to the lock, and commit it. */
+static int stack_commit(struct reftable_stack *st,
+			struct string_list *obsolete, struct strbuf *err)
+{
+	struct strbuf list = STRBUF_INIT;
+	size_t i;
+	int fd = get_lock_file_fd(&st->lock);
+
+	for (i = 0; i < st->nr; i++)
+		strbuf_addf(&list, "%s\n", st->tables[i]->name);
+	if (write_in_full(fd, list.buf, list.len) < 0 ||
+	    commit_lock_file(&st->lock) < 0) {
+		strbuf_addf(err, _("unable to write '%s': %s"), st->list_file,
+			    strerror(errno));
+		strbuf_release(&list);
+		reftable_stack_unlock(st);
+		return -1;
+	}
+	st->locked = 0;
+	strbuf_release(&list);
+
+	/* what we have open is what the list says now */
+	fd = open(st->list_file, O_RDONLY);
+	stat_validity_clear(&st->validity);
+	if (fd >= 0) {
+		stat_validity_update(&st->validity, fd);
+		close(fd);
+	}
+
+	/*
+	 * Readers that still have the old tables open are fine; those
+	 * that read the old list retry when a table is missing.
+	 */
+	for (i = 0; i < obsolete->nr; i++) {
+		struct strbuf path = STRBUF_INIT;
+
+		strbuf_addf(&path, "%s/%s", st->dir, obsolete->items[i].string);
+		unlink_or_warn(path.buf);
+		strbuf_release(&path);
+	}
+	return 0;
+}
+
+int reftable_stack_add(struct reftable_stack *st, reftable_write_fn *write_fn,
+		       void *cb_data, struct strbuf *err)
+{
+	struct string_list obsolete = STRING_LIST_INIT_DUP;
+	struct reftable_table *t;
+	uint64_t update_index;
+	int ret;
+
+	if (!st->locked)
+		BUG("adding to reftable stack '%s' without holding the lock",
+		    st->dir);
+
+	update_index = reftable_stack_next_update_index(st);
+	t = stack_write_table(st, update_index, update_index, write_fn,
+			      cb_data, 0, err);
+	if (!t) {
+		if (err->len) {
+			reftable_stack_unlock(st);
+			return -1;
+		}
+		/* nothing to record */
+		reftable_stack_unlock(st);
+		return 0;
+	}
+	ALLOC_GROW(st->tables, st->nr + 1, st->alloc);
+	st->tables[st->nr++] = t;
+
+	if (stack_compact(st, stack_compaction_start(st), &obsolete, err) < 0) {
+		/* the new table is complete; just do without compaction */
+		strbuf_reset(err);
+	}
+
+	ret = stack_commit(st, &obsolete, err);
+	string_list_clear(&obsolete, 0);
+	return ret;
+}
+
+int reftable_stack_compact_all(struct reftable_stack *st, struct strbuf *err)
+{
+	struct string_list obsolete = STRING_LIST_INIT_DUP;
+	int ret;
+
+	if (!st->locked)
+		BUG("compacting reftable stack '%s' without holding the lock",
+		    st->dir);
+	if (!st->nr) {
+		reftable_stack_unlock(st);
+		return 0;
+	}
+
+	if (stack_compact(st, 0, &obsolete, err) < 0) {
+		reftable_stack_unlock(st);
+		string_list_clear(&obsolete, 0);
+		return -1;
+	}
+	ret = stack_commit(st, &obsolete, err);
+	string_list_clear(&obsolete, 0);
+	return ret;
+}
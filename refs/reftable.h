@@ -0,0 +1,157 @@
+#ifndef REFS_REFTABLE_H
+#define REFS_REFTABLE_H
+
+#include "../cache.h"
+
+/*
+ * Reading and writing reftables, and stacks of them.
+ *
+ * A reftable is an immutable file holding a sorted set of reference
+ * records and reflog records, in prefix-compressed blocks with restart
+ * points and a multi-level index, so that looking up a single record
+ * costs O(log n) and iterating over all records with a given prefix
+ * only reads the blocks that contain them. The file format is
+ * described in Documentation/technical/reftable.txt.
+ *
+ * A stack is a directory holding a list of reftables
+ * ("tables.list"), from oldest to newest. Every record carries the
+ * update index of the transaction that wrote it, and records in newer
+ * tables override those with the same key in older tables; deletions
+ * are recorded as tombstones. Updates are atomic: a new table is
+ * written, and then the list is replaced under a lock. Small tables
+ * are merged into larger ones as they pile up, so that the stack stays
+ * logarithmic in size.
+ */
+
+struct reftable_stack;
+struct reftable_writer;
+struct reftable_iterator;
+
+enum reftable_ref_type {
+	REFTABLE_REF_DELETION = 0,
+	REFTABLE_REF_VAL1 = 1, /* an object name */
+	REFTABLE_REF_VAL2 = 2, /* an object name and its peeled value */
+	REFTABLE_REF_SYMREF = 3,
+};
+
+struct reftable_ref_record {
+	struct strbuf refname;
+	uint64_t update_index;
+	enum reftable_ref_type type;
+	struct object_id value;
+	struct object_id peeled;
+	struct strbuf target;
+};
+
+#define REFTABLE_REF_RECORD_INIT { STRBUF_INIT, 0, REFTABLE_REF_DELETION, \
+				   { { 0 } }, { { 0 } }, STRBUF_INIT }
+
+void reftable_ref_record_release(struct reftable_ref_record *rec);
+
+struct reftable_log_record {
+	struct strbuf refname;
+	uint64_t update_index;
+	int deletion;
+	struct object_id old_oid;
+	struct object_id new_oid;
+	struct strbuf name;
+	struct strbuf email;
+	timestamp_t time;
+	int tz;
+	struct strbuf message;
+};
+
+#define REFTABLE_LOG_RECORD_INIT { STRBUF_INIT, 0, 0, { { 0 } }, { { 0 } }, \
+				   STRBUF_INIT, STRBUF_INIT, 0, 0, STRBUF_INIT }
+
+void reftable_log_record_release(struct reftable_log_record *rec);
+
+/*
+ * Writing a table. All reference records must be added before the
+ * log records, each kind in ascending order: references by name, log
+ * records by name and then by descending update index. The update
+ * indices of reference records must be within the range of the table
+ * being written; log records keep the update index of the transaction
+ * that logged them, even when they are copied or rewritten later.
+ */
+
+int reftable_writer_add_ref(struct reftable_writer *w,
+			    const struct reftable_ref_record *rec);
+int reftable_writer_add_log(struct reftable_writer *w,
+			    const struct reftable_log_record *rec);
+
+/*
+ * Iterating over the records of a stack. Both iterators skip over
+ * tombstones and return the newest version of each record; they must
+ * be released with reftable_iterator_release().
+ */
+
+/* Iterate over the references whose names are at least `seek`. */
+struct reftable_iterator *reftable_stack_ref_iterator(struct reftable_stack *st,
+						      const char *seek);
+
+/*
+ * Iterate over the log records, starting with the newest record for
+ * `refname`, or at the beginning if it is NULL.
+ */
+struct reftable_iterator *reftable_stack_log_iterator(struct reftable_stack *st,
+						      const char *refname);
+
+/* Return 0 and fill `rec` on success, 1 at the end and -1 on errors. */
+int reftable_iterator_next_ref(struct reftable_iterator *it,
+			       struct reftable_ref_record *rec);
+int reftable_iterator_next_log(struct reftable_iterator *it,
+			       struct reftable_log_record *rec);
+void reftable_iterator_release(struct reftable_iterator *it);
+
+/* Stacks */
+
+/*
+ * Create a stack for the directory `dir`, which need not exist until
+ * the first update. Nothing is read until it is used.
+ */
+struct reftable_stack *reftable_stack_new(const char *dir);
+void reftable_stack_free(struct reftable_stack *st);
+
+/*
+ * Make sure the stack reflects the list of tables on disk. Returns 0
+ * on success and -1 (after reporting an error) otherwise.
+ */
+int reftable_stack_reload(struct reftable_stack *st);
+
+/*
+ * Look up a reference. Return 0 if found, 1 if it does not exist (or
+ * was deleted) and -1 on errors.
+ */
+int reftable_stack_read_ref(struct reftable_stack *st, const char *refname,
+			    struct reftable_ref_record *rec);
+
+/*
+ * Lock the stack for an update, waiting for up to `timeout_ms` for a
+ * concurrent update to finish, and reload it. The lock is released by
+ * reftable_stack_add() or reftable_stack_unlock().
+ */
+int reftable_stack_lock(struct reftable_stack *st, long timeout_ms,
+			struct strbuf *err);
+void reftable_stack_unlock(struct reftable_stack *st);
+
+/* The update index to use for the records of the next update. */
+uint64_t reftable_stack_next_update_index(struct reftable_stack *st);
+
+/*
+ * Add a table to the locked stack, whose records are written by
+ * `write_fn` with update indices of reftable_stack_next_update_index().
+ * The stack is then compacted as needed, and unlocked. Returns 0 on
+ * success; on errors, fills `err`, unlocks the stack and returns -1.
+ */
+typedef int reftable_write_fn(struct reftable_writer *w, void *cb_data);
+int reftable_stack_add(struct reftable_stack *st, reftable_write_fn *write_fn,
+		       void *cb_data, struct strbuf *err);
+
+/*
+ * Merge all tables of the locked stack into one, dropping tombstones,
+ * and unlock it.
+ */
+int reftable_stack_compact_all(struct reftable_stack *st, struct strbuf *err);
+
+#endif /* REFS_REFTABLE_H */
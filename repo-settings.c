@@ -47,6 +47,11 @@ void prepare_repo_settings(struct repository *r)
 		r->settings.pack_use_sparse = value;
 	UPDATE_DEFAULT_BOOL(r->settings.pack_use_sparse, 1);
 
+	if (!repo_config_get_bool(r, "index.sparse", &value))
+		r->settings.sparse_index = value;
+	UPDATE_DEFAULT_BOOL(r->settings.sparse_index, 0);
+	UPDATE_DEFAULT_BOOL(r->settings.command_requires_full_index, 1);
+
 	if (!repo_config_get_bool(r, "feature.manyfiles", &value) && value) {
 		UPDATE_DEFAULT_BOOL(r->settings.index_version, 4);
 		UPDATE_DEFAULT_BOOL(r->settings.core_untracked_cache, UNTRACKED_CACHE_WRITE);
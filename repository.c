@@ -95,6 +95,12 @@ void repo_set_hash_algo(struct repository *repo, int hash_algo)
 #endif
 }
 
+void repo_set_ref_storage_format(struct repository *repo, const char *format)
+{
+	free(repo->ref_storage_format);
+	repo->ref_storage_format = xstrdup_or_null(format);
+}
+
 /*
  * Attempt to resolve and set the provided 'gitdir' for repository 'repo'.
  * Return 0 upon success and a non-zero value upon failure.
@@ -174,6 +180,7 @@ int repo_init(struct repository *repo,
 		goto error;
 
 	repo_set_hash_algo(repo, format.hash_algo);
+	repo_set_ref_storage_format(repo, format.ref_storage_format);
 
 	if (worktree)
 		repo_set_worktree(repo, worktree);
@@ -239,6 +246,7 @@ void repo_clear(struct repository *repo)
 	FREE_AND_NULL(repo->index_file);
 	FREE_AND_NULL(repo->worktree);
 	FREE_AND_NULL(repo->submodule_prefix);
+	FREE_AND_NULL(repo->ref_storage_format);
 
 	raw_object_store_clear(repo->objects);
 	FREE_AND_NULL(repo->objects);
@@ -267,6 +275,7 @@ int repo_read_index(struct repository *repo)
 {
 	if (!repo->index)
 		repo->index = xcalloc(1, sizeof(*repo->index));
+	repo->index->repo = repo;
 
 	return read_index_from(repo->index, repo->index_file, repo->gitdir);
 }
@@ -37,6 +37,13 @@ struct repo_settings {
 
 	int pack_use_sparse;
 	enum fetch_negotiation_setting fetch_negotiation_algorithm;
+
+	int sparse_index;
+	/*
+	 * Commands that can work on sparse directory entries set this
+	 * to zero before reading the index; see sparse-index.h.
+	 */
+	int command_requires_full_index;
 };
 
 struct repository {
@@ -126,6 +133,12 @@ struct repository {
 	/* Repository's current hash algorithm, as serialized on disk. */
 	const struct git_hash_algo *hash_algo;
 
+	/*
+	 * The backend storing the repository's references, or NULL for
+	 * the default "files" backend (extensions.refStorage).
+	 */
+	char *ref_storage_format;
+
 	/* A unique-id for tracing purposes. */
 	int trace2_repo_id;
 
@@ -156,6 +169,7 @@ void repo_set_gitdir(struct repository *repo, const char *root,
 		     const struct set_gitdir_args *extra_args);
 void repo_set_worktree(struct repository *repo, const char *path);
 void repo_set_hash_algo(struct repository *repo, int algo);
+void repo_set_ref_storage_format(struct repository *repo, const char *format);
 void initialize_the_repository(void);
 int repo_init(struct repository *r, const char *gitdir, const char *worktree);
 
@@ -652,25 +652,33 @@ static void trace2_bloom_filter_statistics_atexit(void)
 
 static int forbid_bloom_filters(struct pathspec *spec)
 {
+	int i;
+
 	if (spec->has_wildcard)
 		return 1;
-	if (spec->nr > 1)
-		return 1;
 	if (spec->magic & ~PATHSPEC_LITERAL)
 		return 1;
-	if (spec->nr && (spec->items[0].magic & ~PATHSPEC_LITERAL))
-		return 1;
+	for (i = 0; i < spec->nr; i++)
+		if (spec->items[i].magic & ~PATHSPEC_LITERAL)
+			return 1;
 
 	return 0;
 }
 
+static void free_bloom_keyvecs(struct rev_info *revs)
+{
+	int i;
+
+	for (i = 0; i < revs->bloom_keyvecs_nr; i++)
+		bloom_keyvec_free(revs->bloom_keyvecs[i]);
+	FREE_AND_NULL(revs->bloom_keyvecs);
+	revs->bloom_keyvecs_nr = 0;
+}
+
 static void prepare_to_use_bloom_filter(struct rev_info *revs)
 {
-	struct pathspec_item *pi;
-	char *path_alloc = NULL;
-	const char *path;
-	int last_index;
-	int len;
+	struct pathspec *spec = &revs->pruning.pathspec;
+	int i;
 
 	if (!revs->commits)
 		return;
@@ -687,35 +695,44 @@ static void prepare_to_use_bloom_filter(struct rev_info *revs)
 	if (!revs->bloom_filter_settings)
 		return;
 
-	pi = &revs->pruning.pathspec.items[0];
-	last_index = pi->len - 1;
-
-	/* remove single trailing slash from path, if needed */
-	if (pi->match[last_index] == '/') {
-	    path_alloc = xstrdup(pi->match);
-	    path_alloc[last_index] = '\0';
-	    path = path_alloc;
-	} else
-	    path = pi->match;
-
-	len = strlen(path);
+	/*
+	 * A commit can only have changed the paths matched by one of the
+	 * pathspec items if it changed that path and all of its leading
+	 * directories; compute all their keys once here.
+	 */
+	ALLOC_ARRAY(revs->bloom_keyvecs, spec->nr);
+	for (i = 0; i < spec->nr; i++) {
+		struct pathspec_item *pi = &spec->items[i];
+		size_t len = pi->len;
+
+		/* remove single trailing slash from path, if needed */
+		if (len && pi->match[len - 1] == '/')
+			len--;
+
+		/* the whole tree is never in the filters */
+		if (!len) {
+			free_bloom_keyvecs(revs);
+			return;
+		}
 
-	revs->bloom_key = xmalloc(sizeof(struct bloom_key));
-	fill_bloom_key(path, len, revs->bloom_key, revs->bloom_filter_settings);
+		revs->bloom_keyvecs[i] = bloom_keyvec_new(pi->match, len,
+							  revs->bloom_filter_settings);
+		revs->bloom_keyvecs_nr++;
+	}
 
 	if (trace2_is_enabled() && !bloom_filter_atexit_registered) {
 		atexit(trace2_bloom_filter_statistics_atexit);
 		bloom_filter_atexit_registered = 1;
 	}
-
-	free(path_alloc);
 }
 
 static int check_maybe_different_in_bloom_filter(struct rev_info *revs,
-						 struct commit *commit)
+						 struct commit *commit,
+						 struct commit *parent,
+						 int nth_parent)
 {
-	struct bloom_filter *filter;
-	int result;
+	struct bloom_filter *filter, parent_filter;
+	int i, result = 0;
 
 	if (!revs->repo->objects->commit_graph)
 		return -1;
@@ -723,21 +740,31 @@ static int check_maybe_different_in_bloom_filter(struct rev_info *revs,
 	if (commit->generation == GENERATION_NUMBER_INFINITY)
 		return -1;
 
-	filter = get_bloom_filter(revs->repo, commit, 0);
+	if (nth_parent) {
+		if (!get_bloom_filter_for_parent(revs->repo, commit, parent,
+						 &parent_filter)) {
+			count_bloom_filter_not_present++;
+			return -1;
+		}
+		filter = &parent_filter;
+	} else {
+		filter = get_bloom_filter(revs->repo, commit, 0);
 
-	if (!filter) {
-		count_bloom_filter_not_present++;
-		return -1;
-	}
+		if (!filter) {
+			count_bloom_filter_not_present++;
+			return -1;
+		}
 
-	if (!filter->len) {
-		count_bloom_filter_length_zero++;
-		return -1;
+		if (!filter->len) {
+			count_bloom_filter_length_zero++;
+			return -1;
+		}
 	}
 
-	result = bloom_filter_contains(filter,
-				       revs->bloom_key,
-				       revs->bloom_filter_settings);
+	for (i = 0; !result && i < revs->bloom_keyvecs_nr; i++)
+		result = bloom_filter_contains_vec(filter,
+						   revs->bloom_keyvecs[i],
+						   revs->bloom_filter_settings);
 
 	if (result)
 		count_bloom_filter_maybe++;
@@ -777,8 +804,10 @@ static int rev_compare_tree(struct rev_info *revs,
 			return REV_TREE_SAME;
 	}
 
-	if (revs->bloom_key && !nth_parent) {
-		bloom_ret = check_maybe_different_in_bloom_filter(revs, commit);
+	if (revs->bloom_keyvecs_nr) {
+		bloom_ret = check_maybe_different_in_bloom_filter(revs, commit,
+								  parent,
+								  nth_parent);
 
 		if (bloom_ret == 0)
 			return REV_TREE_SAME;
@@ -790,9 +819,8 @@ static int rev_compare_tree(struct rev_info *revs,
 			   &revs->pruning) < 0)
 		return REV_TREE_DIFFERENT;
 
-	if (!nth_parent)
-		if (bloom_ret == 1 && tree_difference == REV_TREE_SAME)
-			count_bloom_filter_false_positive++;
+	if (bloom_ret == 1 && tree_difference == REV_TREE_SAME)
+		count_bloom_filter_false_positive++;
 
 	return tree_difference;
 }
@@ -2191,7 +2219,6 @@ static int handle_revision_opt(struct rev_info *revs, int argc, const char **arg
 	} else if (!strcmp(arg, "--ancestry-path")) {
 		revs->ancestry_path = 1;
 		revs->simplify_history = 0;
-		revs->limited = 1;
 	} else if (!strcmp(arg, "-g") || !strcmp(arg, "--walk-reflogs")) {
 		init_reflog_walk(&revs->reflog_info);
 	} else if (!strcmp(arg, "--default")) {
@@ -2822,6 +2849,20 @@ int setup_revisions(int argc, const char **argv, struct rev_info *revs, struct s
 			copy_pathspec(&revs->diffopt.pathspec,
 				      &revs->prune_data);
 	}
+
+	/*
+	 * The incremental topo-walk can filter --ancestry-path on the fly
+	 * as long as no commit can become TREESAME after the fact. With
+	 * --first-parent, limit_to_ancestry() keeps a commit if any of its
+	 * parents is on the path, although only first parents are walked;
+	 * leave that to limit_list().
+	 */
+	if (revs->ancestry_path &&
+	    (!revs->topo_order || revs->first_parent_only ||
+	     !generation_numbers_enabled(the_repository) ||
+	     limiting_can_increase_treesame(revs)))
+		revs->limited = 1;
+
 	if (revs->combine_merges)
 		revs->ignore_merges = 0;
 	if (revs->combined_all_paths && !revs->combine_merges)
@@ -3261,16 +3302,47 @@ static int mark_uninteresting(const struct object_id *oid,
 
 define_commit_slab(indegree_slab, int);
 define_commit_slab(author_date_slab, timestamp_t);
+define_commit_slab(ancestry_path_slab, int);
+
+#define ANCESTRY_PATH_UNKNOWN 0
+#define ANCESTRY_PATH_ON 1
+#define ANCESTRY_PATH_OFF 2
 
 struct topo_walk_info {
-	uint32_t min_generation;
+	timestamp_t min_generation;
 	struct prio_queue explore_queue;
 	struct prio_queue indegree_queue;
 	struct prio_queue topo_queue;
 	struct indegree_slab indegree;
 	struct author_date_slab author_date;
+
+	/* only used with --ancestry-path */
+	timestamp_t ancestry_min_generation;
+	struct ancestry_path_slab ancestry_path;
 };
 
+static int topo_walk_atexit_registered;
+static unsigned int count_explore_walked;
+static unsigned int count_indegree_walked;
+static unsigned int count_topo_walked;
+static unsigned int count_ancestry_path_walked;
+
+static void trace2_topo_walk_statistics_atexit(void)
+{
+	struct json_writer jw = JSON_WRITER_INIT;
+
+	jw_object_begin(&jw, 0);
+	jw_object_intmax(&jw, "count_explore_walked", count_explore_walked);
+	jw_object_intmax(&jw, "count_indegree_walked", count_indegree_walked);
+	jw_object_intmax(&jw, "count_topo_walked", count_topo_walked);
+	jw_object_intmax(&jw, "count_ancestry_path_walked", count_ancestry_path_walked);
+	jw_end(&jw);
+
+	trace2_data_json("topo_walk", the_repository, "statistics", &jw);
+
+	jw_release(&jw);
+}
+
 static inline void test_flag_and_insert(struct prio_queue *q, struct commit *c, int flag)
 {
 	if (c->object.flags & flag)
@@ -3292,6 +3364,8 @@ static void explore_walk_step(struct rev_info *revs)
 	if (parse_commit_gently(c, 1) < 0)
 		return;
 
+	count_explore_walked++;
+
 	if (revs->sort_order == REV_SORT_BY_AUTHOR_DATE)
 		record_author_date(&info->author_date, c);
 
@@ -3309,7 +3383,7 @@ static void explore_walk_step(struct rev_info *revs)
 }
 
 static void explore_to_depth(struct rev_info *revs,
-			     uint32_t gen_cutoff)
+			     timestamp_t gen_cutoff)
 {
 	struct topo_walk_info *info = revs->topo_walk_info;
 	struct commit *c;
@@ -3330,6 +3404,8 @@ static void indegree_walk_step(struct rev_info *revs)
 	if (parse_commit_gently(c, 1) < 0)
 		return;
 
+	count_indegree_walked++;
+
 	explore_to_depth(revs, c->generation);
 
 	for (p = c->parents; p; p = p->next) {
@@ -3349,7 +3425,7 @@ static void indegree_walk_step(struct rev_info *revs)
 }
 
 static void compute_indegrees_to_depth(struct rev_info *revs,
-				       uint32_t gen_cutoff)
+				       timestamp_t gen_cutoff)
 {
 	struct topo_walk_info *info = revs->topo_walk_info;
 	struct commit *c;
@@ -3358,6 +3434,80 @@ static void compute_indegrees_to_depth(struct rev_info *revs,
 		indegree_walk_step(revs);
 }
 
+/*
+ * Return whether "commit" belongs in the output of --ancestry-path,
+ * i.e. whether it can reach one of the bottom commits through
+ * interesting commits only (see limit_to_ancestry()).
+ *
+ * The answer is found with a depth-first search that never goes below
+ * the generation of the lowest bottom commit, exploring just enough of
+ * the graph to know which commits on the way are UNINTERESTING.
+ * Results are memoized, so the total cost over the whole walk stays
+ * bounded by the size of the explored region.
+ */
+static int ancestry_path_contains(struct rev_info *revs, struct commit *commit)
+{
+	struct topo_walk_info *info = revs->topo_walk_info;
+	struct commit_list *stack = NULL;
+	int *state = ancestry_path_slab_at(&info->ancestry_path, commit);
+
+	if (*state)
+		return *state == ANCESTRY_PATH_ON;
+
+	commit_list_insert(commit, &stack);
+	while (stack) {
+		struct commit *c = stack->item;
+		struct commit_list *p;
+		int pending = 0;
+
+		state = ancestry_path_slab_at(&info->ancestry_path, c);
+		if (*state) {
+			pop_commit(&stack);
+			continue;
+		}
+
+		count_ancestry_path_walked++;
+
+		if (parse_commit_gently(c, 1) < 0 ||
+		    c->generation < info->ancestry_min_generation) {
+			*state = ANCESTRY_PATH_OFF;
+			pop_commit(&stack);
+			continue;
+		}
+
+		explore_to_depth(revs, c->generation);
+		if (c->object.flags & UNINTERESTING) {
+			*state = ANCESTRY_PATH_OFF;
+			pop_commit(&stack);
+			continue;
+		}
+
+		for (p = c->parents; p; p = p->next) {
+			int pstate = *ancestry_path_slab_at(&info->ancestry_path,
+							    p->item);
+			if (pstate == ANCESTRY_PATH_ON) {
+				*state = ANCESTRY_PATH_ON;
+				break;
+			}
+			if (pstate == ANCESTRY_PATH_UNKNOWN) {
+				commit_list_insert(p->item, &stack);
+				pending = 1;
+				break;
+			}
+		}
+
+		if (*state) {
+			pop_commit(&stack);
+		} else if (!pending) {
+			*state = ANCESTRY_PATH_OFF;
+			pop_commit(&stack);
+		}
+	}
+
+	return *ancestry_path_slab_at(&info->ancestry_path, commit) ==
+		ANCESTRY_PATH_ON;
+}
+
 static void reset_topo_walk(struct rev_info *revs)
 {
 	struct topo_walk_info *info = revs->topo_walk_info;
@@ -3367,6 +3517,7 @@ static void reset_topo_walk(struct rev_info *revs)
 	clear_prio_queue(&info->topo_queue);
 	clear_indegree_slab(&info->indegree);
 	clear_author_date_slab(&info->author_date);
+	clear_ancestry_path_slab(&info->ancestry_path);
 
 	FREE_AND_NULL(revs->topo_walk_info);
 }
@@ -3404,6 +3555,30 @@ static void init_topo_walk(struct rev_info *revs)
 	info->explore_queue.compare = compare_commits_by_gen_then_commit_date;
 	info->indegree_queue.compare = compare_commits_by_gen_then_commit_date;
 
+	if (revs->ancestry_path) {
+		struct commit_list *bottom = collect_bottom_commits(revs->commits);
+
+		if (!bottom)
+			die("--ancestry-path given but there are no bottom commits");
+
+		init_ancestry_path_slab(&info->ancestry_path);
+		info->ancestry_min_generation = GENERATION_NUMBER_INFINITY;
+		for (list = bottom; list; list = list->next) {
+			struct commit *c = list->item;
+
+			*(ancestry_path_slab_at(&info->ancestry_path, c)) = ANCESTRY_PATH_ON;
+			if (!parse_commit_gently(c, 1) &&
+			    c->generation < info->ancestry_min_generation)
+				info->ancestry_min_generation = c->generation;
+		}
+		free_commit_list(bottom);
+	}
+
+	if (trace2_is_enabled() && !topo_walk_atexit_registered) {
+		atexit(trace2_topo_walk_statistics_atexit);
+		topo_walk_atexit_registered = 1;
+	}
+
 	info->min_generation = GENERATION_NUMBER_INFINITY;
 	for (list = revs->commits; list; list = list->next) {
 		struct commit *c = list->item;
@@ -3427,6 +3602,11 @@ static void init_topo_walk(struct rev_info *revs)
 	for (list = revs->commits; list; list = list->next) {
 		struct commit *c = list->item;
 
+		if (revs->ancestry_path &&
+		    !(c->object.flags & UNINTERESTING) &&
+		    !ancestry_path_contains(revs, c))
+			c->object.flags |= UNINTERESTING;
+
 		if (*(indegree_slab_at(&info->indegree, c)) == 1)
 			prio_queue_put(&info->topo_queue, c);
 	}
@@ -3457,6 +3637,9 @@ static void expand_topo_walk(struct rev_info *revs, struct commit *commit)
 {
 	struct commit_list *p;
 	struct topo_walk_info *info = revs->topo_walk_info;
+
+	count_topo_walked++;
+
 	if (process_parents(revs, commit, NULL, NULL) < 0) {
 		if (!revs->ignore_missing_links)
 			die("Failed to traverse parents of commit %s",
@@ -3473,6 +3656,17 @@ static void expand_topo_walk(struct rev_info *revs, struct commit *commit)
 		if (parse_commit_gently(parent, 1) < 0)
 			continue;
 
+		/*
+		 * Like limit_to_ancestry(), mark the commits that cannot
+		 * reach a bottom commit as UNINTERESTING, so that they are
+		 * neither shown nor drawn as parents by --graph.
+		 */
+		if (revs->ancestry_path &&
+		    !ancestry_path_contains(revs, parent)) {
+			parent->object.flags |= UNINTERESTING;
+			continue;
+		}
+
 		if (parent->generation < info->min_generation) {
 			info->min_generation = parent->generation;
 			compute_indegrees_to_depth(revs, info->min_generation);
@@ -3521,7 +3715,7 @@ int prepare_revision_walk(struct rev_info *revs)
 				       FOR_EACH_OBJECT_PROMISOR_ONLY);
 	}
 
-	if (revs->pruning.pathspec.nr == 1 && !revs->reflog_info)
+	if (revs->pruning.pathspec.nr && !revs->reflog_info)
 		prepare_to_use_bloom_filter(revs);
 	if (revs->no_walk != REVISION_WALK_NO_WALK_UNSORTED)
 		commit_list_sort_by_date(&revs->commits);
@@ -59,7 +59,7 @@ struct repository;
 struct rev_info;
 struct string_list;
 struct saved_parents;
-struct bloom_key;
+struct bloom_keyvec;
 struct bloom_filter_settings;
 define_shared_commit_slab(revision_sources, char *);
 
@@ -183,6 +183,12 @@ struct rev_info {
 			/* for internal use only */
 			exclude_promisor_objects:1;
 
+	/*
+	 * Threads reading trees ahead of traverse_commit_list(); with
+	 * fewer than two, the walk reads them itself.
+	 */
+	int traverse_threads;
+
 	/* Diff flags */
 	unsigned int	diff:1,
 			full_diff:1,
@@ -300,10 +306,14 @@ struct rev_info {
 	struct topo_walk_info *topo_walk_info;
 
 	/* Commit graph bloom filter fields */
-	/* The bloom filter key for the pathspec */
-	struct bloom_key *bloom_key;
 	/*
-	 * The bloom filter settings used to generate the key.
+	 * The bloom filter keys for the pathspec, one vector per item
+	 * holding the keys of the path and of its leading directories.
+	 */
+	struct bloom_keyvec **bloom_keyvecs;
+	int bloom_keyvecs_nr;
+	/*
+	 * The bloom filter settings used to generate the keys.
 	 * This is loaded from the commit-graph being used.
 	 */
 	struct bloom_filter_settings *bloom_filter_settings;
@@ -15,6 +15,7 @@
 #include "revision.h"
 #include "rerere.h"
 #include "merge-recursive.h"
+#include "merge-ort.h"
 #include "refs.h"
 #include "argv-array.h"
 #include "quote.h"
@@ -281,6 +282,12 @@ static const char *gpg_sign_opt_quoted(struct replay_opts *opts)
 	return buf.buf;
 }
 
+/*
+ * The result of the previous merge with the "ort" strategy, which lets
+ * the next pick reuse the renames it detected.
+ */
+static struct merge_result ort_result;
+
 int sequencer_remove_state(struct replay_opts *opts)
 {
 	struct strbuf buf = STRBUF_INIT;
@@ -303,6 +310,8 @@ int sequencer_remove_state(struct replay_opts *opts)
 		}
 	}
 
+	merge_finalize(&ort_result);
+
 	free(opts->gpg_sign);
 	free(opts->strategy);
 	for (i = 0; i < opts->xopts_nr; i++)
@@ -606,9 +615,17 @@ static int do_recursive_merge(struct repository *r,
 	for (i = 0; i < opts->xopts_nr; i++)
 		parse_merge_opt(&o, opts->xopts[i]);
 
-	clean = merge_trees(&o,
-			    head_tree,
-			    next_tree, base_tree);
+	if ((opts->strategy && !strcmp(opts->strategy, "ort")) ||
+	    (!opts->strategy && merge_ort_replaces_recursive())) {
+		merge_incore_nonrecursive(&o, base_tree, head_tree, next_tree,
+					  &ort_result);
+		merge_switch_to_result(&o, head_tree, &ort_result, 1, 1);
+		clean = ort_result.clean;
+	} else {
+		clean = merge_trees(&o,
+				    head_tree,
+				    next_tree, base_tree);
+	}
 	if (is_rebase_i(opts) && clean <= 0)
 		fputs(o.obuf.buf, stdout);
 	strbuf_release(&o.obuf);
@@ -1905,7 +1922,10 @@ static int do_pick_commit(struct repository *r,
 
 	if (is_rebase_i(opts) && write_author_script(msg.message) < 0)
 		res = -1;
-	else if (!opts->strategy || !strcmp(opts->strategy, "recursive") || command == TODO_REVERT) {
+	else if (!opts->strategy ||
+		 !strcmp(opts->strategy, "recursive") ||
+		 !strcmp(opts->strategy, "ort") ||
+		 command == TODO_REVERT) {
 		res = do_recursive_merge(r, base, next, base_label, next_label,
 					 &head, &msgbuf, opts);
 		if (res < 0)
@@ -5,6 +5,7 @@
 #include "string-list.h"
 #include "chdir-notify.h"
 #include "promisor-remote.h"
+#include "refs.h"
 
 static int inside_git_dir = -1;
 static int inside_work_tree = -1;
@@ -470,6 +471,12 @@ static int check_repo_format(const char *var, const char *value, void *vdata)
 			data->partial_clone = xstrdup(value);
 		} else if (!strcmp(ext, "worktreeconfig"))
 			data->worktree_config = git_config_bool(var, value);
+		else if (!strcmp(ext, "refstorage")) {
+			if (!value)
+				return config_error_nonbool(var);
+			free(data->ref_storage_format);
+			data->ref_storage_format = xstrdup(value);
+		}
 		else
 			string_list_append(&data->unknown_extensions, ext);
 	}
@@ -509,6 +516,8 @@ static int check_repository_format_gently(const char *gitdir, struct repository_
 	repository_format_precious_objects = candidate->precious_objects;
 	set_repository_format_partial_clone(candidate->partial_clone);
 	repository_format_worktree_config = candidate->worktree_config;
+	repo_set_ref_storage_format(the_repository,
+				    candidate->ref_storage_format);
 	string_list_clear(&candidate->unknown_extensions, 0);
 
 	if (repository_format_worktree_config) {
@@ -559,6 +568,7 @@ void clear_repository_format(struct repository_format *format)
 	string_list_clear(&format->unknown_extensions, 0);
 	free(format->work_tree);
 	free(format->partial_clone);
+	free(format->ref_storage_format);
 	init_repository_format(format);
 }
 
@@ -582,6 +592,13 @@ int verify_repository_format(const struct repository_format *format,
 		return -1;
 	}
 
+	if (format->ref_storage_format &&
+	    !ref_storage_backend_exists(format->ref_storage_format)) {
+		strbuf_addf(err, _("unknown ref storage format '%s'"),
+			    format->ref_storage_format);
+		return -1;
+	}
+
 	return 0;
 }
 
@@ -1919,6 +1919,13 @@ static int freshen_packed_object(const struct object_id *oid)
 	struct pack_entry e;
 	if (!find_pack_entry(the_repository, oid, &e))
 		return 0;
+	/*
+	 * The times of objects in a cruft pack are in its .mtimes file;
+	 * touching the pack would not change them, so write the object
+	 * out loose instead.
+	 */
+	if (e.p->is_cruft)
+		return 0;
 	if (e.p->freshened)
 		return 1;
 	if (!freshen_file(e.p->pack_name))
@@ -0,0 +1,284 @@
+#include "cache.h"
+#include "cache-tree.h"
+#include "dir.h"
+#include "pathspec.h"
+#include "repository.h"
+#include "sparse-index.h"
+#include "tree.h"
+
+static struct repository *index_repo(struct index_state *istate)
+{
+	return istate->repo ? istate->repo : the_repository;
+}
+
+static int sparse_index_allowed(struct index_state *istate)
+{
+	struct repository *r = index_repo(istate);
+
+	/* the split index shares entries by position; do not mix the two */
+	if (istate->split_index ||
+	    !core_apply_sparse_checkout || !core_sparse_checkout_cone)
+		return 0;
+
+	prepare_repo_settings(r);
+	return r->settings.sparse_index;
+}
+
+/*
+ * Return the cone-mode patterns to collapse against, loading them
+ * into "pl" unless the caller gave us some already, or NULL if the
+ * sparse-checkout is not in cone mode after all.
+ */
+static struct pattern_list *get_cone_patterns(struct index_state *istate,
+					      struct pattern_list *pl)
+{
+	char *sparse_filename;
+	int res;
+
+	if (istate->sparse_checkout_patterns) {
+		pl = istate->sparse_checkout_patterns;
+		return pl->use_cone_patterns ? pl : NULL;
+	}
+
+	memset(pl, 0, sizeof(*pl));
+	pl->use_cone_patterns = 1;
+	sparse_filename = repo_git_path(index_repo(istate),
+					"info/sparse-checkout");
+	res = add_patterns_from_file_to_list(sparse_filename, "", 0, pl, NULL);
+	free(sparse_filename);
+	if (res < 0 || !pl->use_cone_patterns) {
+		clear_pattern_list(pl);
+		return NULL;
+	}
+	return pl;
+}
+
+/*
+ * Can the entries [start, end) of the index be replaced by a single
+ * sparse directory entry without losing information?
+ */
+static int can_collapse(struct index_state *istate, int start, int end)
+{
+	int i;
+
+	for (i = start; i < end; i++) {
+		const struct cache_entry *ce = istate->cache[i];
+
+		if (ce_stage(ce) || S_ISGITLINK(ce->ce_mode) ||
+		    !ce_skip_worktree(ce) || ce_intent_to_add(ce) ||
+		    (ce->ce_flags & CE_REMOVE))
+			return 0;
+	}
+	return 1;
+}
+
+static struct cache_entry *make_sparse_dir_entry(struct index_state *istate,
+						 const struct strbuf *path,
+						 const struct object_id *oid)
+{
+	struct cache_entry *ce = make_empty_cache_entry(istate, path->len);
+
+	ce->ce_mode = S_IFDIR;
+	ce->ce_flags = create_ce_flags(0) | CE_SKIP_WORKTREE;
+	ce->ce_namelen = path->len;
+	oidcpy(&ce->oid, oid);
+	memcpy(ce->name, path->buf, path->len);
+	return ce;
+}
+
+/* The cache tree of a sparse directory is a leaf with a single entry. */
+static void collapse_cache_tree(struct cache_tree *ct)
+{
+	int i;
+
+	for (i = 0; i < ct->subtree_nr; i++) {
+		cache_tree_free(&ct->down[i]->cache_tree);
+		free(ct->down[i]);
+	}
+	ct->subtree_nr = 0;
+	ct->entry_count = 1;
+}
+
+/*
+ * The entries [start, end) of the index make up the directory "path"
+ * (empty, or ending in a slash), which the valid cache tree "ct"
+ * describes. Collapse what can be collapsed in there and move the
+ * result down to position "dest", keeping the cache tree in sync.
+ * Returns the number of entries left for the directory.
+ */
+static int convert_to_sparse_rec(struct index_state *istate, int dest,
+				 int start, int end, struct strbuf *path,
+				 struct cache_tree *ct, struct pattern_list *pl,
+				 int *nr_sparse)
+{
+	int i, nr = 0;
+	int dtype = DT_DIR;
+
+	if (path->len &&
+	    path_matches_pattern_list(path->buf, path->len, NULL, &dtype,
+				      pl, istate) == NOT_MATCHED &&
+	    can_collapse(istate, start, end)) {
+		struct cache_entry *se;
+
+		se = make_sparse_dir_entry(istate, path, &ct->oid);
+		for (i = start; i < end; i++)
+			discard_cache_entry(istate->cache[i]);
+		istate->cache[dest] = se;
+		collapse_cache_tree(ct);
+		(*nr_sparse)++;
+		return 1;
+	}
+
+	for (i = start; i < end; ) {
+		struct cache_entry *ce = istate->cache[i];
+		const char *name = ce->name + path->len;
+		const char *slash = strchr(name, '/');
+		struct cache_tree *sub;
+		size_t len = path->len;
+		int pos = -1, span;
+
+		if (slash)
+			pos = cache_tree_subtree_pos(ct, name, slash - name);
+		if (pos < 0) {
+			istate->cache[dest + nr++] = ce;
+			i++;
+			continue;
+		}
+
+		sub = ct->down[pos]->cache_tree;
+		span = sub->entry_count;
+		strbuf_add(path, name, slash - name + 1);
+		nr += convert_to_sparse_rec(istate, dest + nr, i, i + span,
+					    path, sub, pl, nr_sparse);
+		strbuf_setlen(path, len);
+		i += span;
+	}
+
+	ct->entry_count = nr;
+	return nr;
+}
+
+void convert_to_sparse(struct index_state *istate)
+{
+	struct repository *r = index_repo(istate);
+	struct pattern_list pl, *patterns;
+	struct strbuf path = STRBUF_INIT;
+	int nr_sparse = 0;
+
+	if (!sparse_index_allowed(istate)) {
+		ensure_full_index(istate);
+		return;
+	}
+	if (!istate->cache_nr)
+		return;
+
+	patterns = get_cone_patterns(istate, &pl);
+	if (!patterns) {
+		ensure_full_index(istate);
+		return;
+	}
+
+	/*
+	 * We need a valid cache tree to know the trees to point at and
+	 * where the directories start and end. If that cannot be had
+	 * (e.g. because of unmerged entries), stay as we are for now.
+	 */
+	if (!istate->cache_tree)
+		istate->cache_tree = cache_tree();
+	if (cache_tree_update(istate, WRITE_TREE_SILENT | WRITE_TREE_MISSING_OK))
+		goto out;
+
+	trace2_region_enter("index", "convert_to_sparse", r);
+	free_name_hash(istate);
+	istate->cache_nr = convert_to_sparse_rec(istate, 0, 0, istate->cache_nr,
+						 &path, istate->cache_tree,
+						 patterns, &nr_sparse);
+	istate->sparse_index = !!nr_sparse;
+	istate->cache_changed |= CACHE_TREE_CHANGED;
+	trace2_data_intmax("index", r, "sparse_directories", nr_sparse);
+	trace2_region_leave("index", "convert_to_sparse", r);
+
+out:
+	if (patterns == &pl)
+		clear_pattern_list(&pl);
+	strbuf_release(&path);
+}
+
+struct expand_data {
+	struct index_state *istate;
+	struct cache_entry **cache;
+	unsigned int nr, alloc;
+};
+
+static int add_path_to_index(const struct object_id *oid,
+			     struct strbuf *base, const char *path,
+			     unsigned int mode, int stage, void *context)
+{
+	struct expand_data *data = context;
+	size_t len = base->len + strlen(path);
+	struct cache_entry *ce;
+
+	if (S_ISDIR(mode))
+		return READ_TREE_RECURSIVE;
+
+	ce = make_empty_cache_entry(data->istate, len);
+	ce->ce_mode = create_ce_mode(mode);
+	ce->ce_flags = create_ce_flags(stage) | CE_SKIP_WORKTREE;
+	ce->ce_namelen = len;
+	oidcpy(&ce->oid, oid);
+	memcpy(ce->name, base->buf, base->len);
+	memcpy(ce->name + base->len, path, len - base->len);
+
+	ALLOC_GROW(data->cache, data->nr + 1, data->alloc);
+	data->cache[data->nr++] = ce;
+	return 0;
+}
+
+void ensure_full_index(struct index_state *istate)
+{
+	struct repository *r;
+	struct expand_data data = { istate };
+	struct pathspec ps;
+	unsigned int i;
+
+	if (!istate || !istate->sparse_index)
+		return;
+
+	r = index_repo(istate);
+	trace2_region_enter("index", "ensure_full_index", r);
+
+	memset(&ps, 0, sizeof(ps));
+	free_name_hash(istate);
+	data.alloc = istate->cache_alloc;
+	ALLOC_ARRAY(data.cache, data.alloc);
+
+	for (i = 0; i < istate->cache_nr; i++) {
+		struct cache_entry *ce = istate->cache[i];
+		struct tree *tree;
+
+		if (!S_ISSPARSEDIR(ce->ce_mode)) {
+			ALLOC_GROW(data.cache, data.nr + 1, data.alloc);
+			data.cache[data.nr++] = ce;
+			continue;
+		}
+
+		tree = lookup_tree(r, &ce->oid);
+		if (!tree || parse_tree(tree) ||
+		    read_tree_recursive(r, tree, ce->name, ce_namelen(ce),
+					0, &ps, add_path_to_index, &data))
+			die(_("unable to expand sparse directory '%s' (tree %s)"),
+			    ce->name, oid_to_hex(&ce->oid));
+		if (istate->cache_tree)
+			cache_tree_expand_sparse_dir(r, istate->cache_tree,
+						     ce->name, tree);
+		discard_cache_entry(ce);
+	}
+
+	free(istate->cache);
+	istate->cache = data.cache;
+	istate->cache_nr = data.nr;
+	istate->cache_alloc = data.alloc;
+	istate->sparse_index = 0;
+
+	trace2_region_leave("index", "ensure_full_index", r);
+}
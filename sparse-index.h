@@ -0,0 +1,41 @@
+#ifndef SPARSE_INDEX_H
+#define SPARSE_INDEX_H
+
+struct index_state;
+
+/*
+ * With a cone-mode sparse-checkout, whole directories are left out of
+ * the working tree. A sparse index stores each such directory as a
+ * single "sparse directory" entry, whose name is the directory path
+ * with a trailing slash, whose mode is S_IFDIR and whose object name
+ * is the tree it stands for, instead of one entry for every file in
+ * it. The on-disk index then carries the "sdir" extension, so that
+ * versions of Git that do not know about sparse directories refuse
+ * to use it.
+ *
+ * Code that has not been taught about sparse directory entries never
+ * sees them: reading the index expands it again, unless the command
+ * sets "command_requires_full_index" to zero in the repository
+ * settings (see repository.h). Such commands may still call
+ * ensure_full_index() when they run into a case they cannot handle.
+ */
+
+/*
+ * Collapse the directories outside of the sparse-checkout cone into
+ * sparse directory entries, if the index is enabled to be sparse
+ * (index.sparse) and the worktree uses a cone-mode sparse-checkout.
+ * Directories containing an entry that is checked out, unmerged or
+ * otherwise special are kept as they are. An index that is sparse but
+ * may no longer be (e.g. because index.sparse was turned off) is
+ * expanded instead.
+ */
+void convert_to_sparse(struct index_state *istate);
+
+/*
+ * Replace every sparse directory entry of the index with the entries
+ * of the tree it stands for, all marked skip-worktree. Does nothing
+ * on an index that is not sparse.
+ */
+void ensure_full_index(struct index_state *istate);
+
+#endif /* SPARSE_INDEX_H */
@@ -32,10 +32,16 @@ int cmd__read_graph(int argc, const char **argv)
 		printf(" oid_lookup");
 	if (graph->chunk_commit_data)
 		printf(" commit_metadata");
+	if (graph->chunk_generation_data)
+		printf(" generation_data");
+	if (graph->chunk_generation_data_overflow)
+		printf(" generation_data_overflow");
 	if (graph->chunk_extra_edges)
 		printf(" extra_edges");
 	if (graph->chunk_bloom_indexes)
 		printf(" bloom_indexes");
+	if (graph->chunk_bloom_parent_indexes)
+		printf(" bloom_parent_indexes");
 	if (graph->chunk_bloom_data)
 		printf(" bloom_data");
 	printf("\n");
@@ -0,0 +1,61 @@
+#!/bin/sh
+
+test_description="Test diff performance on large files
+
+Most of the time spent diffing large files that differ in few places
+goes to hashing and classifying their lines. Compare the results
+of different builds with ./run to see how these stages do."
+
+. ./perf-lib.sh
+
+test_perf_fresh_repo
+
+test_expect_success 'setup' '
+	cat >generate.pl <<-\EOF &&
+	for (1..500000) {
+		printf "line %d: %s\n", $_ % 50000, "x" x ($_ % 37);
+	}
+	EOF
+	cat >change.pl <<-\EOF &&
+	my ($prefix, $offset) = @ARGV;
+	open(my $in, "<", "base") or die;
+	while (<$in>) {
+		s/^/$prefix / unless ($. + $offset) % 1000;
+		print;
+	}
+	EOF
+	perl generate.pl >base &&
+	perl change.pl one 0 >one &&
+	perl change.pl two 500 >two &&
+	cp base orig &&
+	git add base &&
+	git commit -q -m base &&
+	cp one base &&
+	git commit -q -a -m one
+'
+
+test_perf 'diff --no-index' '
+	test_expect_code 1 git diff --no-index orig two >/dev/null
+'
+
+test_perf 'diff --no-index --histogram' '
+	test_expect_code 1 git diff --no-index --histogram orig two >/dev/null
+'
+
+test_perf 'diff --no-index --patience' '
+	test_expect_code 1 git diff --no-index --patience orig two >/dev/null
+'
+
+test_perf 'diff --no-index --ignore-space-change' '
+	test_expect_code 1 git diff --no-index --ignore-space-change orig two >/dev/null
+'
+
+test_perf 'merge-file' '
+	git merge-file -p one orig two >/dev/null
+'
+
+test_perf 'blame' '
+	git blame base >/dev/null
+'
+
+test_done
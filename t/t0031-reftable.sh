@@ -0,0 +1,210 @@
+#!/bin/sh
+
+test_description='reftable ref storage'
+
+. ./test-lib.sh
+
+test_expect_success 'init with --ref-format=reftable' '
+	git init --ref-format=reftable repo &&
+	test_path_is_file repo/.git/reftable/tables.list &&
+	echo reftable >expect &&
+	git -C repo config extensions.refstorage >actual &&
+	test_cmp expect actual &&
+	echo 1 >expect &&
+	git -C repo config core.repositoryformatversion >actual &&
+	test_cmp expect actual &&
+	echo refs/heads/master >expect &&
+	git -C repo symbolic-ref HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'init rejects unknown and changed formats' '
+	test_must_fail git init --ref-format=nonsense unknown 2>err &&
+	test_i18ngrep "unknown ref storage format" err &&
+	test_must_fail git init --ref-format=files repo 2>err &&
+	test_i18ngrep "different ref format" err &&
+	git init --ref-format=reftable repo &&
+	GIT_DEFAULT_REF_FORMAT=reftable git init from-env &&
+	test_path_is_dir from-env/.git/reftable
+'
+
+test_expect_success 'commits and references' '
+	(
+		cd repo &&
+		test_commit one &&
+		test_commit two &&
+		git rev-parse two >expect &&
+		git rev-parse HEAD >actual &&
+		test_cmp expect actual &&
+		git rev-parse refs/heads/master >actual &&
+		test_cmp expect actual &&
+		test_path_is_missing .git/refs/heads/master &&
+		git show-ref -d >actual &&
+		test_line_count = 3 actual
+	)
+'
+
+test_expect_success 'update-ref with old value' '
+	(
+		cd repo &&
+		git update-ref refs/heads/new one &&
+		test_must_fail git update-ref refs/heads/new two two 2>err &&
+		test_i18ngrep "is at .* but expected" err &&
+		git update-ref refs/heads/new two one &&
+		git rev-parse two >expect &&
+		git rev-parse new >actual &&
+		test_cmp expect actual &&
+		test_must_fail git update-ref refs/heads/new/sub two 2>err &&
+		test_i18ngrep "refs/heads/new.* exists" err
+	)
+'
+
+test_expect_success 'update-ref --stdin is a single update' '
+	(
+		cd repo &&
+		for i in $(test_seq 100)
+		do
+			echo "create refs/heads/many/$i HEAD" || return 1
+		done >input &&
+		git update-ref --stdin <input &&
+		git for-each-ref refs/heads/many/ >actual &&
+		test_line_count = 100 actual &&
+		git for-each-ref --format="%(refname)" refs/heads/many/1 >actual &&
+		echo refs/heads/many/1 >expect &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'reflogs' '
+	(
+		cd repo &&
+		git reflog show master >actual &&
+		test_line_count = 2 actual &&
+		git reflog show HEAD >actual &&
+		test_line_count = 2 actual &&
+		git reflog exists refs/heads/master &&
+		test_must_fail git reflog exists refs/heads/nothing &&
+		git rev-parse one >expect &&
+		git rev-parse master@{1} >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'symbolic refs' '
+	(
+		cd repo &&
+		git symbolic-ref refs/heads/sym refs/heads/new &&
+		echo refs/heads/new >expect &&
+		git symbolic-ref refs/heads/sym >actual &&
+		test_cmp expect actual &&
+		git update-ref refs/heads/sym one &&
+		git rev-parse one >expect &&
+		git rev-parse new >actual &&
+		test_cmp expect actual &&
+		git update-ref -d --no-deref refs/heads/sym &&
+		test_must_fail git rev-parse --verify -q refs/heads/sym
+	)
+'
+
+test_expect_success 'branch rename, copy and delete' '
+	(
+		cd repo &&
+		git branch -m new renamed &&
+		test_must_fail git rev-parse --verify -q new &&
+		git branch -c renamed copied &&
+		git reflog show renamed >renamed.log &&
+		git reflog show copied >copied.log &&
+		test_line_count = 4 renamed.log &&
+		test_line_count = 5 copied.log &&
+		git branch -D renamed copied &&
+		test_must_fail git reflog exists refs/heads/renamed &&
+		git branch --list "*ed" >actual &&
+		test_must_be_empty actual
+	)
+'
+
+test_expect_success 'pack-refs compacts the stack' '
+	(
+		cd repo &&
+		git for-each-ref >expect &&
+		git pack-refs &&
+		git for-each-ref >actual &&
+		test_cmp expect actual &&
+		test_line_count = 1 .git/reftable/tables.list
+	)
+'
+
+test_expect_success 'stack stays short' '
+	(
+		cd repo &&
+		for i in $(test_seq 50)
+		do
+			git update-ref refs/heads/branch-$i HEAD || return 1
+		done &&
+		test $(wc -l <.git/reftable/tables.list) -lt 10 &&
+		ls .git/reftable/*.ref >tables &&
+		test_line_count = $(wc -l <.git/reftable/tables.list) tables
+	)
+'
+
+test_expect_success 'pseudorefs other than HEAD are files' '
+	(
+		cd repo &&
+		git update-ref ORIG_HEAD one &&
+		test_path_is_file .git/ORIG_HEAD &&
+		git rev-parse one >expect &&
+		git rev-parse ORIG_HEAD >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'reflog expire' '
+	(
+		cd repo &&
+		git reflog expire --expire=all master &&
+		git reflog show master >actual &&
+		test_must_be_empty actual &&
+		git reflog exists refs/heads/master &&
+		test_commit three &&
+		git reflog show master >actual &&
+		test_line_count = 1 actual
+	)
+'
+
+test_expect_success 'worktrees' '
+	git -C repo worktree add ../wt &&
+	(
+		cd wt &&
+		test_commit in-worktree &&
+		git rev-parse HEAD >expect &&
+		git rev-parse refs/heads/wt >actual &&
+		test_cmp expect actual &&
+		git rev-parse master >expect &&
+		git rev-parse main-worktree/HEAD >actual &&
+		test_cmp expect actual &&
+		git update-ref refs/bisect/bad HEAD &&
+		git rev-parse --verify refs/bisect/bad &&
+		test_must_fail git -C ../repo rev-parse --verify -q refs/bisect/bad &&
+		git update-ref -d refs/bisect/bad
+	) &&
+	git -C wt rev-parse HEAD >expect &&
+	git -C repo rev-parse worktrees/wt/HEAD >actual &&
+	test_cmp expect actual &&
+	git -C repo fsck &&
+	git -C repo reflog expire --expire=all --all &&
+	git -C wt reflog show HEAD >actual &&
+	test_must_be_empty actual
+'
+
+test_expect_success 'clone into reftable' '
+	GIT_DEFAULT_REF_FORMAT=reftable git clone repo clone &&
+	test_path_is_dir clone/.git/reftable &&
+	git -C repo for-each-ref --format="%(objectname)" refs/heads/ >expect &&
+	git -C clone for-each-ref --format="%(objectname)" refs/remotes/origin/ \
+		>actual.raw &&
+	sort -u expect >expect.sorted &&
+	sort -u actual.raw >actual &&
+	test_cmp expect.sorted actual
+'
+
+test_done
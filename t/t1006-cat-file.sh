@@ -588,4 +588,53 @@ test_expect_success 'cat-file --unordered works' '
 	test_cmp expect actual
 '
 
+test_expect_success 'setup repository with long delta chains' '
+	git init delta-chains &&
+	(
+		cd delta-chains &&
+		for i in $(test_seq 1 40)
+		do
+			test_seq 1 $((200 + $i)) >file &&
+			git add file &&
+			git commit -q -m "commit $i" || return 1
+		done &&
+		git repack -adf --depth=50 &&
+		git rev-list --objects --all | cut -d" " -f1 >../delta-objects
+	)
+'
+
+test_expect_success 'cat-file --batch --prefetch matches --batch' '
+	git -C delta-chains cat-file --batch <delta-objects >expect &&
+	git -C delta-chains cat-file --batch --prefetch \
+		<delta-objects >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'cat-file --prefetch copes with names and missing objects' '
+	{
+		echo HEAD &&
+		echo $(test_oid deadbeef) &&
+		cat delta-objects &&
+		echo HEAD:file
+	} >input &&
+	git -C delta-chains cat-file --batch <input >expect &&
+	git -C delta-chains cat-file --batch --prefetch <input >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'cat-file --prefetch reports delta base cache statistics' '
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git -C delta-chains cat-file --batch --prefetch \
+		<delta-objects >/dev/null &&
+	grep "\"category\":\"delta_base_cache\"" trace.event >stats &&
+	grep "\"prefetched\":" stats
+'
+
+test_expect_success 'cat-file --prefetch requires --batch' '
+	test_must_fail git cat-file --batch-check --prefetch </dev/null 2>err &&
+	test_i18ngrep "requires --batch" err &&
+	test_must_fail git cat-file --batch --batch-all-objects --prefetch 2>err &&
+	test_i18ngrep "cannot be combined" err
+'
+
 test_done
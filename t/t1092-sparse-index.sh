@@ -0,0 +1,153 @@
+#!/bin/sh
+
+test_description='sparse index: collapsing directories outside of the cone
+
+Every test runs the same commands in a cone-mode sparse-checkout with a
+full index and in one with a sparse index, and expects the same results.
+'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	git init initial-repo &&
+	(
+		cd initial-repo &&
+		echo a >a &&
+		echo e >e &&
+		mkdir folder1 folder2 deep &&
+		mkdir deep/deeper1 deep/deeper2 &&
+		mkdir deep/deeper1/deepest &&
+		cp a folder1 &&
+		cp a folder2 &&
+		cp a deep &&
+		cp a deep/deeper1 &&
+		cp a deep/deeper2 &&
+		cp a deep/deeper1/deepest &&
+		git add . &&
+		git commit -m "initial commit" &&
+		git checkout -b update-deep &&
+		echo updated >deep/a &&
+		git commit -a -m "update deep" &&
+		git checkout -b update-folder1 master &&
+		echo updated >folder1/a &&
+		git commit -a -m "update folder1" &&
+		git checkout -b rename-out-of-cone master &&
+		git mv folder2/a folder2/b &&
+		git commit -m "rename in folder2" &&
+		git checkout master
+	) &&
+
+	git clone initial-repo full-checkout &&
+	git -C full-checkout sparse-checkout init --cone &&
+	git -C full-checkout sparse-checkout set deep &&
+
+	git clone initial-repo sparse-index &&
+	git -C sparse-index sparse-checkout init --cone --sparse-index &&
+	git -C sparse-index sparse-checkout set deep
+'
+
+run_on_both () {
+	(
+		cd full-checkout &&
+		"$@" >../full-out 2>../full-err
+	) &&
+	(
+		cd sparse-index &&
+		"$@" >../sparse-out 2>../sparse-err
+	)
+}
+
+test_all_match () {
+	run_on_both "$@" &&
+	test_cmp full-out sparse-out &&
+	test_cmp full-err sparse-err
+}
+
+test_expect_success 'sparse index has sparse directory entries' '
+	GIT_TRACE2_EVENT="$(pwd)/trace.txt" \
+		git -C sparse-index update-index --force-write-index &&
+	grep "\"key\":\"sparse_directories\",\"value\":\"2\"" trace.txt &&
+	grep sdir sparse-index/.git/index &&
+	! grep sdir full-checkout/.git/index
+'
+
+test_expect_success 'index contents are the same when expanded' '
+	test_all_match git ls-files -s &&
+	test_all_match git ls-files -t
+'
+
+test_expect_success 'status with sparse index' '
+	test_all_match git status --porcelain=v2 &&
+	echo modified >>full-checkout/deep/a &&
+	echo modified >>sparse-index/deep/a &&
+	test_all_match git status --porcelain=v2 &&
+	test_all_match git add deep/a &&
+	test_all_match git status --porcelain=v2 &&
+	test_all_match git commit -m "modify deep/a" &&
+	test_all_match git status --porcelain=v2
+'
+
+test_expect_success 'status does not expand the index' '
+	rm -f trace.txt &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.txt" git -C sparse-index status &&
+	! grep ensure_full_index trace.txt
+'
+
+test_expect_success 'status with changes outside of the cone' '
+	test_all_match git reset --soft HEAD~1 &&
+	test_all_match git status --porcelain=v2 &&
+	test_all_match git reset --soft origin/update-folder1 &&
+	test_all_match git status --porcelain=v2 &&
+	test_all_match git status --porcelain=v2 -- folder1 &&
+	test_all_match git status --porcelain=v2 -- folder2 &&
+	test_all_match git reset --soft origin/rename-out-of-cone &&
+	test_all_match git status --porcelain=v2 &&
+	test_all_match git reset --hard master
+'
+
+test_expect_success 'untracked files inside sparse directories' '
+	mkdir -p full-checkout/folder1 sparse-index/folder1 &&
+	echo untracked >full-checkout/folder1/untracked &&
+	echo untracked >sparse-index/folder1/untracked &&
+	test_all_match git status --porcelain=v2 &&
+	test_all_match git status --porcelain=v2 --untracked-files=all &&
+	rm -r full-checkout/folder1 sparse-index/folder1
+'
+
+test_expect_success 'checkout, commit and merge across the cone' '
+	test_all_match git checkout update-folder1 &&
+	test_all_match git status --porcelain=v2 &&
+	test_all_match git checkout -b merged origin/update-deep &&
+	test_all_match git merge -m merge origin/update-folder1 &&
+	test_all_match git ls-files -s &&
+	test_all_match git rev-parse HEAD^{tree} &&
+	test_all_match git diff --stat HEAD~1 &&
+	test_all_match git checkout master
+'
+
+test_expect_success 'sparse-checkout set keeps the index sparse' '
+	test_all_match git sparse-checkout set deep/deeper1 &&
+	test_all_match git ls-files -s &&
+	test_all_match git status --porcelain=v2 &&
+	grep sdir sparse-index/.git/index &&
+	test_all_match git sparse-checkout set deep &&
+	grep sdir sparse-index/.git/index
+'
+
+test_expect_success 'index.sparse=false expands the index' '
+	git clone initial-repo no-sparse &&
+	git -C no-sparse sparse-checkout init --cone --sparse-index &&
+	git -C no-sparse sparse-checkout set deep &&
+	grep sdir no-sparse/.git/index &&
+	git -C no-sparse sparse-checkout init --cone --no-sparse-index &&
+	test_must_fail git -C no-sparse config index.sparse &&
+	! grep sdir no-sparse/.git/index &&
+	git -C no-sparse sparse-checkout init --cone --sparse-index &&
+	grep sdir no-sparse/.git/index &&
+	git -C no-sparse sparse-checkout disable &&
+	! grep sdir no-sparse/.git/index &&
+	git -C no-sparse status --porcelain >actual &&
+	test_must_be_empty actual
+'
+
+test_done
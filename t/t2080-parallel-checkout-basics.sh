@@ -0,0 +1,155 @@
+#!/bin/sh
+
+test_description='parallel-checkout basics
+
+Check that parallel checkout writes the same working tree and index as
+the sequential one, and that entries which cannot be written in
+parallel fall back to the sequential path.
+'
+
+. ./test-lib.sh
+
+sane_unset GIT_TEST_CHECKOUT_WORKERS
+
+parallel () {
+	git -c checkout.workers=4 -c checkout.thresholdForParallelism=0 "$@"
+}
+
+test_expect_success 'setup repository' '
+	mkdir -p a/b c &&
+	for i in $(test_seq 1 20)
+	do
+		echo "file $i" >a/file$i &&
+		echo "deep $i" >a/b/deep$i || return 1
+	done &&
+	test_seq 1 5000 >c/big &&
+	printf "\$Id\$\r\n" >c/ident &&
+	echo "c/ident ident" >.gitattributes &&
+	echo "#!/bin/sh" >c/exec &&
+	chmod +x c/exec &&
+	git add . &&
+	git commit -q -m base &&
+	git checkout -q -b other &&
+	git rm -q -r a/b &&
+	echo changed >a/file1 &&
+	echo new >d &&
+	git add . &&
+	git commit -q -m other &&
+	git checkout -q master
+'
+
+test_expect_success 'switching branches in parallel' '
+	parallel checkout -q other &&
+	git diff-index --exit-code HEAD &&
+	git ls-files -m >modified &&
+	test_must_be_empty modified &&
+	echo changed >expect &&
+	test_cmp expect a/file1 &&
+	test_path_is_missing a/b &&
+	parallel checkout -q master &&
+	git diff-index --exit-code HEAD &&
+	test_path_is_file a/b/deep20
+'
+
+test_expect_success 'parallel checkout reports its entries to trace2' '
+	rm -f trace.event &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" parallel checkout -q other &&
+	grep "\"key\":\"parallel/entries\"" trace.event &&
+	git checkout -q master
+'
+
+test_expect_success 'clone with parallel checkout matches sequential clone' '
+	git clone -q . sequential &&
+	parallel clone -q . parallel-clone &&
+	(
+		cd sequential &&
+		git ls-files -s >../expect.files &&
+		git ls-files --debug >../expect.debug
+	) &&
+	(
+		cd parallel-clone &&
+		git ls-files -s >../actual.files &&
+		git diff-index --exit-code HEAD &&
+		git status --porcelain >../actual.status
+	) &&
+	test_cmp expect.files actual.files &&
+	test_must_be_empty actual.status &&
+	for f in $(cat actual.files | cut -f2)
+	do
+		test_cmp sequential/$f parallel-clone/$f || return 1
+	done
+'
+
+test_expect_success 'entries with a smudge filter are written sequentially' '
+	test_config filter.rot13.smudge "tr a-zA-Z n-za-mN-ZA-M" &&
+	test_config filter.rot13.clean "tr a-zA-Z n-za-mN-ZA-M" &&
+	echo "a/file* filter=rot13" >>.git/info/attributes &&
+	rm -f a/file* &&
+	parallel reset -q --hard &&
+	echo "svyr 7" >expect &&
+	test_cmp expect a/file7 &&
+	echo "deep 7" >expect &&
+	test_cmp expect a/b/deep7 &&
+	rm .git/info/attributes &&
+	git reset -q --hard
+'
+
+test_expect_success 'eol conversion is applied by the workers' '
+	test_config core.autocrlf true &&
+	rm -rf a c &&
+	parallel reset -q --hard &&
+	printf "file 3\r\n" >expect &&
+	test_cmp expect a/file3 &&
+	git diff-index --exit-code HEAD
+'
+
+test_expect_success 'below the threshold, entries are written sequentially' '
+	rm -rf a trace.event &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git -c checkout.workers=4 reset -q --hard &&
+	grep "\"key\":\"parallel/workers\",\"value\":\"1\"" trace.event &&
+	test_path_is_file a/b/deep1 &&
+	git diff-index --exit-code HEAD &&
+
+	rm -rf a trace.event &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git -c checkout.workers=4 -c checkout.thresholdForParallelism=10 \
+		reset -q --hard &&
+	grep "\"key\":\"parallel/workers\",\"value\":\"4\"" trace.event &&
+	git diff-index --exit-code HEAD
+'
+
+test_expect_success CASE_INSENSITIVE_FS 'colliding paths are retried sequentially' '
+	git init collide &&
+	(
+		cd collide &&
+		empty=$(git hash-object -w --stdin </dev/null) &&
+		one=$(echo one | git hash-object -w --stdin) &&
+		printf "100644 blob $empty\tFILE\n100644 blob $one\tfile\n" >index.info &&
+		git update-index --index-info <index.info &&
+		git commit -q -m collide
+	) &&
+	parallel clone -q collide collide-clone 2>err &&
+	test_i18ngrep "the following paths have collided" err
+'
+
+test_expect_success SYMLINKS,CASE_INSENSITIVE_FS 'workers do not write through a colliding symlink' '
+	git init symlink-collide &&
+	(
+		cd symlink-collide &&
+		empty=$(git hash-object -w --stdin </dev/null) &&
+		link=$(printf e | git hash-object -w --stdin) &&
+		cat >index.info <<-EOF &&
+		100644 blob $empty	A/B
+		120000 blob $link	a
+		100644 blob $empty	e/file
+		EOF
+		git update-index --index-info <index.info &&
+		git commit -q -m collide
+	) &&
+	parallel clone -q symlink-collide symlink-collide-clone 2>err &&
+	test_path_is_file symlink-collide-clone/e/file &&
+	test_path_is_missing symlink-collide-clone/e/B
+'
+
+test_done
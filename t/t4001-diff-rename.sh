@@ -262,4 +262,51 @@ test_expect_success 'diff-tree -l0 defaults to a big rename limit, not zero' '
 	grep "myotherfile.*myfile" actual
 '
 
+test_expect_success 'setup moving a directory with edits' '
+	mkdir old &&
+	for i in $(test_seq 20)
+	do
+		test_seq $i $(($i + 9)) >old/file$i || return 1
+	done &&
+	git add old &&
+	git commit -m "add old" &&
+	git mv old new &&
+	for i in $(test_seq 20)
+	do
+		echo edited >>new/file$i || return 1
+	done &&
+	git mv new/file1 new/first &&
+	git mv new/file2 new/second &&
+	git add new &&
+	git commit -m "move old to new"
+'
+
+test_expect_success 'matching basenames are found beyond the rename limit' '
+	git diff -M -l5 --name-status HEAD^ HEAD >actual &&
+	for i in $(test_seq 3 20)
+	do
+		printf "R0[0-9]*\told/file$i\tnew/file$i\n" || return 1
+	done >expect &&
+	grep "	new/file" actual >actual.files &&
+	test_line_count = 18 actual.files &&
+	while read pattern
+	do
+		grep "^$pattern\$" actual.files || return 1
+	done <expect
+'
+
+test_expect_success 'files in renamed directories are found beyond the rename limit' '
+	git diff -M -l5 --name-status HEAD^ HEAD >actual &&
+	grep "^R0[0-9]*	old/file1	new/first\$" actual &&
+	grep "^R0[0-9]*	old/file2	new/second\$" actual &&
+	test_line_count = 20 actual
+'
+
+test_expect_success 'similarity matrix does not depend on threading' '
+	git diff -C -C --name-status HEAD^ HEAD >expect &&
+	GIT_TEST_RENAME_THREADS=1 git diff -C -C --name-status HEAD^ HEAD >actual &&
+	test_cmp expect actual &&
+	grep "^R" actual
+'
+
 test_done
@@ -0,0 +1,59 @@
+#!/bin/sh
+
+test_description='diff of files with many lines
+
+Files large enough for the default algorithm to cut them at lines that
+are unique on both sides before running the Myers algorithm.'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	perl -e "
+		for (1..140000) {
+			print \$_ % 10 ? \"common \" . (\$_ % 97) : \"line \$_\", \"\\n\";
+		}
+	" >old &&
+	perl -ne "
+		next if \$. % 5000 == 17;
+		print \"changed \$.\\n\" if \$. % 3000 == 5;
+		print \"moved\\n\" if \$. == 130000;
+		print unless \$. == 20;
+	" old >new &&
+	git add old &&
+	git commit -q -m old &&
+	cp new old &&
+	git commit -q -a -m new &&
+	git show HEAD^:old >old
+'
+
+for algo in myers minimal patience histogram
+do
+	test_expect_success "$algo diff of large files applies" '
+		git diff --diff-algorithm=$algo HEAD^ HEAD >patch &&
+		git show HEAD^:old >old &&
+		git apply patch &&
+		test_cmp new old
+	'
+done
+
+test_expect_success 'default diff is as small as the minimal one here' '
+	git diff --numstat HEAD^ HEAD >default &&
+	git diff --numstat --minimal HEAD^ HEAD >minimal &&
+	test_cmp minimal default
+'
+
+test_expect_success 'unique line moved across the file' '
+	perl -e "
+		print \"unique\\n\";
+		print \"common \", \$_ % 97, \"\\n\" for (1..140000);
+	" >one &&
+	perl -e "
+		print \"common \", \$_ % 97, \"\\n\" for (1..140000);
+		print \"unique\\n\";
+	" >two &&
+	test_expect_code 1 git diff --no-index --numstat one two >actual &&
+	echo "1	1	one => two" >expect &&
+	test_cmp expect actual
+'
+
+test_done
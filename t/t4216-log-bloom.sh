@@ -5,6 +5,7 @@ test_description='git log for a path with Bloom filters'
 
 GIT_TEST_COMMIT_GRAPH=0
 GIT_TEST_COMMIT_GRAPH_CHANGED_PATHS=0
+GIT_TEST_COMMIT_GRAPH_NO_GDAT=0
 
 test_expect_success 'setup test - repo, commits, commit graph, log outputs' '
 	git init &&
@@ -33,11 +34,11 @@ test_expect_success 'setup test - repo, commits, commit graph, log outputs' '
 	git commit-graph write --reachable --changed-paths
 '
 graph_read_expect () {
-	NUM_CHUNKS=5
+	NUM_CHUNKS=7
 	cat >expect <<- EOF
 	header: 43475048 1 1 $NUM_CHUNKS 0
 	num_commits: $1
-	chunks: oid_fanout oid_lookup commit_metadata bloom_indexes bloom_data
+	chunks: oid_fanout oid_lookup commit_metadata generation_data bloom_indexes bloom_parent_indexes bloom_data
 	EOF
 	test-tool read-graph >actual &&
 	test_cmp expect actual
@@ -108,8 +109,8 @@ test_expect_success 'git log with --walk-reflogs does not use Bloom filters' '
 	test_bloom_filters_not_used "--walk-reflogs -- A"
 '
 
-test_expect_success 'git log -- multiple path specs does not use Bloom filters' '
-	test_bloom_filters_not_used "-- file4 A/file1"
+test_expect_success 'git log -- multiple path specs uses Bloom filters' '
+	test_bloom_filters_used "-- file4 A/file1"
 '
 
 test_expect_success 'git log with wildcard that resolves to a single path uses Bloom filters' '
@@ -117,9 +118,13 @@ test_expect_success 'git log with wildcard that resolves to a single path uses B
 	test_bloom_filters_used "-- *renamed"
 '
 
-test_expect_success 'git log with wildcard that resolves to a multiple paths does not uses Bloom filters' '
-	test_bloom_filters_not_used "-- *" &&
-	test_bloom_filters_not_used "-- file*"
+test_expect_success 'git log with wildcard that resolves to a multiple paths uses Bloom filters' '
+	test_bloom_filters_used "-- *" &&
+	test_bloom_filters_used "-- file*"
+'
+
+test_expect_success 'git log with pathspec magic does not use Bloom filters' '
+	test_bloom_filters_not_used "-- :(icase)file4 A/file1"
 '
 
 test_expect_success 'setup - add commit-graph to the chain without Bloom filters' '
@@ -142,7 +147,7 @@ test_expect_success 'setup - add commit-graph to the chain with Bloom filters' '
 
 test_bloom_filters_used_when_some_filters_are_missing () {
 	log_args=$1
-	bloom_trace_prefix="statistics:{\"filter_not_present\":3,\"zero_length_filter\":0,\"maybe\":8,\"definitely_not\":6"
+	bloom_trace_prefix="statistics:{\"filter_not_present\":3,\"zero_length_filter\":0,\"maybe\":6,\"definitely_not\":8"
 	setup "$log_args" &&
 	grep -q "$bloom_trace_prefix" "$TRASH_DIRECTORY/trace.perf" &&
 	test_cmp log_wo_bloom log_w_bloom
@@ -152,4 +157,155 @@ test_expect_success 'Use Bloom filters if they exist in the latest but not all c
 	test_bloom_filters_used_when_some_filters_are_missing "-- A/B"
 '
 
+test_expect_success 'setup - merges with filters against every parent' '
+	git init merges &&
+	(
+		cd merges &&
+		test_commit base &&
+		git checkout -b side &&
+		test_commit side-only &&
+		git checkout master &&
+		test_commit main-only &&
+		git merge -m merge side &&
+		test_commit after &&
+		git commit-graph write --reachable --changed-paths
+	)
+'
+
+test_expect_success 'git log --full-history uses filters for all parents of a merge' '
+	(
+		cd merges &&
+		rm -f "$TRASH_DIRECTORY/trace.perf" &&
+		git -c core.commitGraph=false log --full-history \
+			--pretty="format:%s" -- side-only.t >expect &&
+		GIT_TRACE2_PERF="$TRASH_DIRECTORY/trace.perf" \
+			git log --full-history --pretty="format:%s" \
+			-- side-only.t >actual &&
+		test_cmp expect actual &&
+		grep "statistics:" "$TRASH_DIRECTORY/trace.perf" >stats &&
+		# the merge is checked against its second parent, too
+		grep "\"maybe\":2,\"definitely_not\":3" stats
+	)
+'
+
+test_filter_stat () {
+	grep "\"key\":\"filter-$1\",\"value\":\"$2\"" "$3"
+}
+
+test_expect_success 'setup - repository for Bloom filter settings' '
+	git init settings &&
+	(
+		cd settings &&
+		mkdir dir &&
+		test_commit one dir/one &&
+		test_commit two dir/two &&
+		test_write_lines a b c >dir/a &&
+		test_write_lines a b c >dir/b &&
+		test_write_lines a b c >dir/c &&
+		git add dir &&
+		test_tick &&
+		git commit -m three
+	)
+'
+
+test_expect_success 'configured Bloom filter settings are used' '
+	(
+		cd settings &&
+		GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+			git -c commitGraph.bloomNumHashes=5 \
+			-c commitGraph.bloomBitsPerEntry=16 \
+			commit-graph write --reachable --changed-paths &&
+		test_filter_stat computed 3 trace.event &&
+		git -c core.commitGraph=false log --oneline -- dir/two >expect &&
+		GIT_TRACE2_PERF="$(pwd)/trace.perf" \
+			git log --oneline -- dir/two >actual &&
+		test_cmp expect actual &&
+		grep "\"filter_not_present\":0" trace.perf
+	)
+'
+
+test_expect_success 'filters with the same settings are reused' '
+	(
+		cd settings &&
+		rm -f trace.event &&
+		GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+			git -c commitGraph.bloomNumHashes=5 \
+			-c commitGraph.bloomBitsPerEntry=16 \
+			commit-graph write --reachable --changed-paths &&
+		test_filter_stat computed 0 trace.event &&
+		test_filter_stat not-computed 3 trace.event &&
+		rm -f trace.event &&
+		GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+			git commit-graph write --reachable --changed-paths &&
+		test_filter_stat computed 3 trace.event
+	)
+'
+
+test_expect_success 'commits changing too many paths match every path' '
+	(
+		cd settings &&
+		rm -f trace.event .git/objects/info/commit-graph &&
+		GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+			git -c commitGraph.maxChangedPaths=2 \
+			commit-graph write --reachable --changed-paths &&
+		test_filter_stat trunc-large 1 trace.event &&
+		git -c core.commitGraph=false log --oneline -- dir/b >expect &&
+		git log --oneline -- dir/b >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'split layers inherit the Bloom filter settings of the chain' '
+	(
+		cd settings &&
+		rm -f .git/objects/info/commit-graph &&
+		git -c commitGraph.bloomNumHashes=5 \
+			commit-graph write --reachable --changed-paths --split &&
+		test_commit four dir/four &&
+		rm -f trace.event &&
+		GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+			git commit-graph write --reachable --changed-paths \
+			--split=no-merge &&
+		test_filter_stat computed 1 trace.event &&
+		test_line_count = 2 .git/objects/info/commit-graphs/commit-graph-chain &&
+		git -c core.commitGraph=false log --oneline -- dir >expect &&
+		GIT_TRACE2_PERF="$(pwd)/trace.perf" \
+			git log --oneline -- dir >actual &&
+		test_cmp expect actual &&
+		grep "\"filter_not_present\":0" trace.perf
+	)
+'
+
+test_expect_success 'invalid Bloom filter settings are rejected' '
+	(
+		cd settings &&
+		test_must_fail git -c commitGraph.bloomNumHashes=0 \
+			commit-graph write --reachable --changed-paths 2>err &&
+		test_i18ngrep "bloomNumHashes" err
+	)
+'
+
+test_expect_success 'filters do not depend on the number of threads' '
+	git init threads &&
+	(
+		cd threads &&
+		mkdir dir &&
+		for i in $(test_seq 200)
+		do
+			echo $i >dir/$((i % 7)) &&
+			echo $i >$((i % 5)) &&
+			git add . &&
+			git commit -q -m $i || return 1
+		done &&
+		git -c commitGraph.threads=1 \
+			commit-graph write --reachable --changed-paths &&
+		mv .git/objects/info/commit-graph expect &&
+		GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+			git -c commitGraph.threads=3 \
+			commit-graph write --reachable --changed-paths &&
+		grep "\"key\":\"filter-threads\",\"value\":\"3\"" trace.event &&
+		test_cmp_bin expect .git/objects/info/commit-graph
+	)
+'
+
 test_done
\ No newline at end of file
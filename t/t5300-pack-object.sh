@@ -386,6 +386,19 @@ test_expect_success 'index-pack with --strict' '
 	)
 '
 
+test_expect_success PTHREADS 'compressing on several threads gives the same pack' '
+	for opts in --window=0 --no-reuse-delta --no-reuse-object
+	do
+		one=$(git pack-objects --threads=1 $opts test-12 <obj-list) &&
+		four=$(git pack-objects --threads=4 $opts test-13 <obj-list) &&
+		test "$one" = "$four" &&
+		test_cmp test-12-$one.pack test-13-$four.pack &&
+		git pack-objects --threads=1 $opts --stdout <obj-list >one.pack &&
+		git pack-objects --threads=4 $opts --stdout <obj-list >four.pack &&
+		test_cmp one.pack four.pack || return 1
+	done
+'
+
 test_expect_success 'honor pack.packSizeLimit' '
 	git config pack.packSizeLimit 3m &&
 	packname_10=$(git pack-objects test-10 <obj-list) &&
@@ -5,6 +5,7 @@ test_description='split commit graph'
 
 GIT_TEST_COMMIT_GRAPH=0
 GIT_TEST_COMMIT_GRAPH_CHANGED_PATHS=0
+GIT_TEST_COMMIT_GRAPH_NO_GDAT=0
 
 test_expect_success 'setup repo' '
 	git init &&
@@ -14,11 +15,11 @@ test_expect_success 'setup repo' '
 	graphdir="$infodir/commit-graphs" &&
 	test_oid_init &&
 	test_oid_cache <<-EOM
-	shallow sha1:1760
-	shallow sha256:2064
+	shallow sha1:1812
+	shallow sha256:2116
 
-	base sha1:1376
-	base sha256:1496
+	base sha1:1404
+	base sha256:1524
 	EOM
 '
 
@@ -29,9 +30,9 @@ graph_read_expect() {
 		NUM_BASE=$2
 	fi
 	cat >expect <<- EOF
-	header: 43475048 1 1 3 $NUM_BASE
+	header: 43475048 1 1 4 $NUM_BASE
 	num_commits: $1
-	chunks: oid_fanout oid_lookup commit_metadata
+	chunks: oid_fanout oid_lookup commit_metadata generation_data
 	EOF
 	test-tool read-graph >output &&
 	test_cmp expect output
@@ -405,6 +406,30 @@ test_expect_success ULIMIT_FILE_DESCRIPTORS 'handles file descriptor exhaustion'
 	)
 '
 
+test_expect_success 'new layer does not write GDAT over a base without it' '
+	git init mixed &&
+	(
+		cd mixed &&
+		test_commit_bulk 5 &&
+		GIT_TEST_COMMIT_GRAPH_NO_GDAT=1 git commit-graph write --reachable --split &&
+		test_commit_bulk --start=6 5 &&
+		git commit-graph write --reachable --split=no-merge &&
+		test_line_count = 2 $graphdir/commit-graph-chain &&
+		cat >expect <<-EOF &&
+		header: 43475048 1 1 4 1
+		num_commits: 5
+		chunks: oid_fanout oid_lookup commit_metadata
+		EOF
+		test-tool read-graph >actual &&
+		test_cmp expect actual &&
+		git commit-graph verify &&
+		git commit-graph write --reachable --split=replace &&
+		test_line_count = 1 $graphdir/commit-graph-chain &&
+		graph_read_expect 10 &&
+		git commit-graph verify
+	)
+'
+
 while read mode modebits
 do
 	test_expect_success POSIXPERM "split commit-graph respects core.sharedrepository $mode" '
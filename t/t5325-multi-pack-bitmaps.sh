@@ -0,0 +1,132 @@
+#!/bin/sh
+
+test_description='exercise basic multi-pack bitmap functionality'
+. ./test-lib.sh
+
+midx_bitmap () {
+	ls .git/objects/pack/multi-pack-index-*.bitmap
+}
+
+test_expect_success 'setup history spread over several packs' '
+	git config core.multiPackIndex true &&
+	test_commit_bulk --id=file 50 &&
+	git repack -d &&
+	git checkout -b other HEAD~5 &&
+	test_commit_bulk --id=side 10 &&
+	git repack -d &&
+	git checkout master &&
+	test_commit_bulk --id=more 20 &&
+	git repack -d &&
+	blob=$(echo tagged-blob | git hash-object -w --stdin) &&
+	git tag tagged-blob $blob &&
+	git repack -d &&
+	ls .git/objects/pack/*.pack >packs &&
+	test_line_count = 4 packs
+'
+
+test_expect_success 'write multi-pack bitmap' '
+	git multi-pack-index write --bitmap &&
+	midx_bitmap >bitmaps &&
+	test_line_count = 1 bitmaps &&
+	git multi-pack-index verify
+'
+
+test_expect_success 'rev-list --test-bitmap verifies multi-pack bitmaps' '
+	git rev-list --test-bitmap HEAD 2>out &&
+	grep "^OK!" out
+'
+
+rev_list_tests () {
+	state=$1
+
+	test_expect_success "counting commits via bitmap ($state)" '
+		git rev-list --count HEAD >expect &&
+		git rev-list --use-bitmap-index --count HEAD >actual &&
+		test_cmp expect actual
+	'
+
+	test_expect_success "counting non-linear history ($state)" '
+		git rev-list --count other...master >expect &&
+		git rev-list --use-bitmap-index --count other...master >actual &&
+		test_cmp expect actual
+	'
+
+	test_expect_success "counting objects via bitmap ($state)" '
+		git rev-list --count --objects HEAD >expect &&
+		git rev-list --use-bitmap-index --count --objects HEAD >actual &&
+		test_cmp expect actual
+	'
+
+	test_expect_success "enumerate --objects ($state)" '
+		git rev-list --objects --use-bitmap-index HEAD >actual &&
+		git rev-list --objects HEAD >expect &&
+		test_bitmap_traversal expect actual
+	'
+
+	test_expect_success "enumerate partial --objects ($state)" '
+		git rev-list --objects --use-bitmap-index other..master >actual &&
+		git rev-list --objects other..master >expect &&
+		test_bitmap_traversal expect actual
+	'
+
+	test_expect_success "bitmap --objects handles non-commit objects ($state)" '
+		git rev-list --objects --use-bitmap-index HEAD tagged-blob >actual &&
+		grep $blob actual
+	'
+}
+
+rev_list_tests 'multi-pack bitmap'
+
+test_expect_success 'clone from repository with multi-pack bitmap' '
+	git clone --no-local --bare . clone.git &&
+	git rev-parse HEAD other >expect &&
+	git --git-dir=clone.git rev-parse HEAD other >actual &&
+	test_cmp expect actual &&
+	git --git-dir=clone.git fsck
+'
+
+test_expect_success 'fetch into repository using multi-pack bitmap' '
+	git clone --no-local --bare --single-branch --branch=other . fetch.git &&
+	git --git-dir=fetch.git fetch origin master:master &&
+	git rev-parse master >expect &&
+	git --git-dir=fetch.git rev-parse master >actual &&
+	test_cmp expect actual &&
+	git --git-dir=fetch.git fsck
+'
+
+test_expect_success 'bitmap honors --preferred-pack' '
+	pack=$(ls -S .git/objects/pack/*.pack | tail -n 1) &&
+	git multi-pack-index write --bitmap --preferred-pack=$(basename $pack) &&
+	git multi-pack-index verify &&
+	git rev-list --test-bitmap HEAD 2>out &&
+	grep "^OK!" out &&
+	git rev-list --objects --use-bitmap-index HEAD >actual &&
+	git rev-list --objects HEAD >expect &&
+	test_bitmap_traversal expect actual
+'
+
+test_expect_success 'rewriting the MIDX without --bitmap drops stale bitmaps' '
+	midx_bitmap >before &&
+	test_commit loose &&
+	git repack -d &&
+	git multi-pack-index write &&
+	test_must_fail midx_bitmap &&
+	git rev-list --objects --use-bitmap-index HEAD >actual &&
+	git rev-list --objects HEAD >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'bitmap is not written without full closure' '
+	test_commit unpacked &&
+	test_must_fail git multi-pack-index write --bitmap 2>err &&
+	test_i18ngrep "not in the multi-pack-index" err &&
+	test_must_fail midx_bitmap &&
+	git multi-pack-index verify
+'
+
+test_expect_success '--bitmap is only for the write subcommand' '
+	test_must_fail git multi-pack-index verify --bitmap 2>err &&
+	test_i18ngrep "only for .write. subcommand" err
+'
+
+test_done
@@ -0,0 +1,143 @@
+#!/bin/sh
+
+test_description='cruft packs of unreachable objects'
+
+. ./test-lib.sh
+
+loose_path () {
+	echo .git/objects/$(test_oid_to_path "$1")
+}
+
+# make the loose object "$1" look "$2" seconds old
+age_loose () {
+	test-tool chmtime =-$2 "$(loose_path $1)"
+}
+
+cruft_objects () {
+	for idx in .git/objects/pack/*.idx
+	do
+		test -f "${idx%.idx}.mtimes" || continue
+		git show-index <$idx | cut -d" " -f2
+	done | sort
+}
+
+test_expect_success 'setup' '
+	test_commit base &&
+	git checkout -b side &&
+	test_commit unreachable &&
+	git checkout - &&
+	git branch -D side &&
+	git reflog expire --expire=all --all &&
+	git rev-parse unreachable >commit &&
+	git tag -d unreachable &&
+	orphan=$(echo orphan | git hash-object -w --stdin)
+'
+
+test_expect_success 'repack --cruft packs unreachable objects' '
+	git repack -ad --cruft &&
+	ls .git/objects/pack/*.mtimes >mtimes &&
+	test_line_count = 1 mtimes &&
+	git count-objects -v >count &&
+	grep "^count: 0" count &&
+	cruft_objects >cruft &&
+	grep $orphan cruft &&
+	grep $(cat commit) cruft &&
+	test_must_fail grep $(git rev-parse base) cruft &&
+	git cat-file -p $orphan >actual &&
+	echo orphan >expect &&
+	test_cmp expect actual &&
+	git fsck
+'
+
+test_expect_success 'repacking keeps the cruft objects' '
+	cruft_objects >before &&
+	git repack -ad --cruft &&
+	cruft_objects >after &&
+	test_cmp before after
+'
+
+test_expect_success 'expiration drops objects by their own times' '
+	old=$(echo old | git hash-object -w --stdin) &&
+	age_loose $old 2592000 &&
+	git repack -ad --cruft &&
+	cruft_objects >cruft &&
+	grep $old cruft &&
+
+	# the pack is new, but the object keeps its old time
+	git repack -ad --cruft --cruft-expiration=1.week.ago &&
+	cruft_objects >cruft &&
+	test_must_fail grep $old cruft &&
+	grep $orphan cruft &&
+	test_must_fail git cat-file -e $old
+'
+
+test_expect_success 'expiration keeps old objects reachable from recent ones' '
+	blob=$(echo kept | git hash-object -w --stdin) &&
+	tree=$(printf "100644 blob $blob\tkept\n" | git mktree) &&
+	age_loose $blob 2592000 &&
+	git repack -ad --cruft --cruft-expiration=1.week.ago &&
+	cruft_objects >cruft &&
+	grep $blob cruft &&
+	grep $tree cruft
+'
+
+test_expect_success 'prune uses the times of cruft objects' '
+	blob=$(echo loose | git hash-object --stdin) &&
+	tree=$(printf "100644 blob $blob\tloose\n" | git mktree --missing) &&
+	other=$(echo other | git hash-object --stdin) &&
+	old_tree=$(printf "100644 blob $other\tother\n" | git mktree --missing) &&
+	age_loose $old_tree 2592000 &&
+	git repack -ad --cruft &&
+
+	# the blobs only appear now, and look old
+	echo loose | git hash-object -w --stdin &&
+	echo other | git hash-object -w --stdin &&
+	age_loose $blob 2592000 &&
+	age_loose $other 2592000 &&
+
+	# $blob is reachable from a recent cruft tree, $other only
+	# from an old one
+	git prune --expire=1.week.ago &&
+	test_path_is_file $(loose_path $blob) &&
+	test_path_is_missing $(loose_path $other)
+'
+
+test_expect_success 'writing a cruft object makes it loose' '
+	git prune --expire=now &&
+	git repack -ad --cruft &&
+	test_path_is_missing $(loose_path $orphan) &&
+	echo orphan | git hash-object -w --stdin &&
+	test_path_is_file $(loose_path $orphan)
+'
+
+test_expect_success 'repack -A turns cruft objects loose with their times' '
+	old=$(echo old again | git hash-object -w --stdin) &&
+	age_loose $old 2592000 &&
+	git repack -ad --cruft &&
+	test_path_is_missing $(loose_path $old) &&
+	git repack -Ad &&
+	test_path_is_file $(loose_path $old) &&
+	git prune --expire=1.week.ago &&
+	test_path_is_missing $(loose_path $old) &&
+	test_path_is_file $(loose_path $orphan)
+'
+
+test_expect_success 'gc with gc.cruftPacks does not explode objects' '
+	git -c gc.cruftPacks=true gc &&
+	git count-objects -v >count &&
+	grep "^count: 0" count &&
+	cruft_objects >cruft &&
+	grep $orphan cruft &&
+	git gc --cruft --prune=now &&
+	cruft_objects >cruft &&
+	test_must_be_empty cruft &&
+	test_must_fail git cat-file -e $orphan &&
+	git cat-file -e base
+'
+
+test_expect_success 'pack-objects --cruft needs a pack on disk' '
+	test_must_fail git pack-objects --cruft --stdout </dev/null &&
+	test_must_fail git repack -ad --cruft -A
+'
+
+test_done
@@ -0,0 +1,148 @@
+#!/bin/sh
+
+test_description='upload-pack answering identical requests from a cache of packs'
+
+. ./test-lib.sh
+
+cache_event () {
+	grep "\"key\":\"pack-cache\",\"value\":\"$1\"" "$2"
+}
+
+test_expect_success 'setup' '
+	test_commit one &&
+	test_commit two &&
+	git tag -a -m "annotated" annotated one &&
+	test_commit three &&
+	git config uploadpack.packCache true
+'
+
+test_expect_success 'first clone writes the pack to the cache' '
+	GIT_TRACE2_EVENT="$(pwd)/trace" git clone --no-local . first &&
+	cache_event write trace &&
+	ls .git/objects/info/pack-cache/*.pack >packs &&
+	test_line_count = 1 packs
+'
+
+test_expect_success 'identical clone is answered from the cache' '
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git clone --no-local . second &&
+	cache_event hit trace &&
+	! cache_event write trace &&
+	git -C second fsck &&
+	git -C first for-each-ref >expect &&
+	git -C second for-each-ref >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'cache works without a sideband' '
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git -c protocol.version=0 clone --no-local \
+		-u "git -c uploadpack.packCache=true upload-pack" . v0 &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git -c protocol.version=0 clone --no-local . v0-again &&
+	cache_event hit trace &&
+	git -C v0-again fsck
+'
+
+test_expect_success 'fetches with haves get their own pack' '
+	test_commit four &&
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git -C first fetch &&
+	cache_event write trace &&
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git -C second fetch &&
+	cache_event hit trace &&
+	git -C second fsck &&
+	git -C second rev-parse origin/master >actual &&
+	git rev-parse master >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'a new tag changes the pack' '
+	git clone --no-local . before-tag &&
+	git tag -a -m "new" new-tag two &&
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git clone --no-local . after-tag &&
+	! cache_event hit trace &&
+	git -C after-tag rev-parse --verify new-tag
+'
+
+test_expect_success 'packs not used for long are not used' '
+	rm -rf .git/objects/info/pack-cache &&
+	git clone --no-local . fresh &&
+	test-tool chmtime =-172800 .git/objects/info/pack-cache/*.pack &&
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git clone --no-local . stale &&
+	cache_event write trace &&
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git clone --no-local \
+		-u "git -c uploadpack.packCacheMaxAge=now upload-pack" . now &&
+	! cache_event hit trace
+'
+
+test_expect_success 'packs over the size limit are not kept' '
+	rm -rf .git/objects/info/pack-cache &&
+	git clone --no-local \
+		-u "git -c uploadpack.packCacheMaxSize=100 upload-pack" . small &&
+	git -C small fsck &&
+	test_path_is_missing .git/objects/info/pack-cache/*.pack
+'
+
+test_expect_success 'corrupt packs in the cache are not sent' '
+	rm -rf .git/objects/info/pack-cache &&
+	git clone --no-local . good &&
+	for p in .git/objects/info/pack-cache/*.pack
+	do
+		echo garbage >"$p" || return 1
+	done &&
+	git clone --no-local . after-garbage &&
+	git -C after-garbage fsck
+'
+
+# replace the packs listed in "kept" with a lock holding "$1"
+lock_cached_pack () {
+	for p in $(cat kept)
+	do
+		rm -f "$p" &&
+		printf "%s" "$1" >"$p.lock" || return 1
+	done
+}
+
+test_expect_success 'a pack being written does not hold up the request' '
+	rm -rf .git/objects/info/pack-cache &&
+	git clone --no-local . locked &&
+	ls .git/objects/info/pack-cache/*.pack >kept &&
+	lock_cached_pack "$$ $(uname -n)" &&
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git clone --no-local . busy &&
+	git -C busy fsck &&
+	cache_event busy trace &&
+	! cache_event write trace &&
+	ls .git/objects/info/pack-cache/*.lock &&
+
+	lock_cached_pack "1 some-other-host" &&
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git clone --no-local . busy-elsewhere &&
+	cache_event busy trace &&
+	ls .git/objects/info/pack-cache/*.lock
+'
+
+test_expect_success 'lock of a writer that is gone is removed' '
+	pid=$(sh -c "echo \$\$") &&
+	lock_cached_pack "$pid $(uname -n)" &&
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git clone --no-local . unlocked &&
+	cache_event write trace &&
+	! ls .git/objects/info/pack-cache/*.lock &&
+
+	lock_cached_pack "" &&
+	test-tool chmtime =-120 .git/objects/info/pack-cache/*.lock &&
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git clone --no-local . unlocked-empty &&
+	cache_event write trace &&
+	! ls .git/objects/info/pack-cache/*.lock
+'
+
+test_done
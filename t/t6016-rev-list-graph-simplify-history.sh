@@ -260,4 +260,29 @@ test_expect_success '--graph --boundary ^C3' '
 	test_cmp expected actual
 	'
 
+test_expect_success 'write commit-graph for incremental topo-order walks' '
+	git commit-graph write --reachable
+'
+
+for args in "--all -- foo.txt" "--boundary --all ^C3" "--all ^A2 -- bar.txt" \
+	"--simplify-by-decoration --all" "--ancestry-path --all ^A2"
+do
+	test_expect_success "--graph $args matches the limited walk" '
+		GIT_TEST_COMMIT_GRAPH=0 git -c core.commitGraph=false \
+			rev-list --graph $args >expected &&
+		git rev-list --graph $args >actual &&
+		test_cmp expected actual
+	'
+done
+
+for args in "--all -- foo.txt" "--boundary --all ^C3" "--ancestry-path --all ^A2"
+do
+	test_expect_success "--graph $args streams through the topo-walk" '
+		GIT_TRACE2_EVENT="$(pwd)/trace.txt" \
+			git rev-list --graph $args >actual &&
+		grep "\"topo_walk\"" trace.txt &&
+		rm -f trace.txt
+	'
+done
+
 test_done
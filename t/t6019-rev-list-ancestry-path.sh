@@ -115,6 +115,35 @@ test_expect_success 'rev-list --ancestry-path --simplify-merges G^..M -- G.t' '
 	test_cmp expect actual
 '
 
+test_expect_success 'write commit-graph for incremental topo-order walks' '
+	git commit-graph write --reachable
+'
+
+for opts in "--topo-order" "--graph" "--graph --boundary" "--date-order"
+do
+	for range in "D..M" "F...I" "--all ^D" "G..M -- G.t"
+	do
+		test_expect_success "log --ancestry-path $opts $range" '
+			GIT_TEST_COMMIT_GRAPH=0 git -c core.commitGraph=false \
+				log --ancestry-path $opts --format=%s $range >expect &&
+			git log --ancestry-path $opts --format=%s $range >actual &&
+			test_cmp expect actual
+		'
+	done
+done
+
+test_expect_success '--ancestry-path --graph uses the incremental topo-walk' '
+	GIT_TRACE2_EVENT="$(pwd)/trace.txt" \
+		git log --ancestry-path --graph --format=%s D..M >actual &&
+	grep "\"topo_walk\"" trace.txt &&
+	rm -f trace.txt &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.txt" GIT_TEST_COMMIT_GRAPH=0 \
+		git -c core.commitGraph=false log --ancestry-path --graph \
+		--format=%s D..M >expect &&
+	! grep "\"topo_walk\"" trace.txt &&
+	test_cmp expect actual
+'
+
 #   b---bc
 #  / \ /
 # a   X
@@ -153,4 +182,36 @@ test_expect_success 'criss-cross: rev-list --ancestry-path --all ^cb' '
 	 test_must_be_empty actual)
 '
 
+test_expect_success 'criss-cross: rev-list --ancestry-path --topo-order with commit-graph' '
+	(cd criss-cross &&
+	 git commit-graph write --reachable &&
+	 git rev-list --ancestry-path --topo-order xcb..xbc >actual &&
+	 test_must_be_empty actual &&
+	 git rev-list --ancestry-path --topo-order --all ^xcb >actual &&
+	 test_must_be_empty actual &&
+	 git rev-list --ancestry-path --topo-order --all ^master >actual &&
+	 GIT_TEST_COMMIT_GRAPH=0 git -c core.commitGraph=false \
+		rev-list --ancestry-path --topo-order --all ^master >expect &&
+	 test_cmp expect actual)
+'
+
+test_expect_success '--first-parent --ancestry-path with and without commit-graph' '
+	git init first-parent &&
+	(cd first-parent &&
+	 test_commit base &&
+	 git checkout -b side &&
+	 test_commit B &&
+	 git checkout master &&
+	 test_commit main &&
+	 git merge --no-ff -m A side &&
+	 git tag A &&
+	 GIT_TEST_COMMIT_GRAPH=0 git -c core.commitGraph=false \
+		log --graph --first-parent --ancestry-path --format=%s B..A >expect &&
+	 echo "* A" >expected &&
+	 test_cmp expected expect &&
+	 git commit-graph write --reachable &&
+	 git log --graph --first-parent --ancestry-path --format=%s B..A >actual &&
+	 test_cmp expect actual)
+'
+
 test_done
@@ -0,0 +1,149 @@
+#!/bin/sh
+
+test_description='merging with the ort strategy'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	test_write_lines 1 2 3 4 5 6 7 8 9 >file &&
+	test_write_lines a b c d e f g h i >other &&
+	git add file other &&
+	test_tick &&
+	git commit -m base &&
+	git tag base &&
+
+	git checkout -b renamed &&
+	git mv file moved &&
+	test_tick &&
+	git commit -m rename &&
+
+	git checkout -b modified base &&
+	test_write_lines 1 2 3 4 5 6 7 8 9 10 >file &&
+	test_tick &&
+	git commit -am modify &&
+
+	git checkout -b deleted base &&
+	git rm file &&
+	test_tick &&
+	git commit -m delete
+'
+
+test_expect_success 'merge a rename with a modification' '
+	git checkout -q renamed^0 &&
+	git merge -s ort -m merged modified &&
+	test_path_is_missing file &&
+	test_write_lines 1 2 3 4 5 6 7 8 9 10 >expect &&
+	test_cmp expect moved &&
+	git diff --exit-code HEAD &&
+	git rev-parse HEAD^{tree} >expect &&
+	git checkout -q renamed^0 &&
+	git merge -s recursive -m merged modified &&
+	git rev-parse HEAD^{tree} >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'modify/delete conflict' '
+	git checkout -q modified^0 &&
+	test_must_fail git merge -s ort deleted >out &&
+	test_i18ngrep "CONFLICT (modify/delete)" out &&
+	git ls-files -s file >actual &&
+	test_line_count = 2 actual &&
+	git rev-parse >expect base:file modified:file &&
+	git rev-parse >actual :1:file :2:file &&
+	test_cmp expect actual &&
+	test_path_is_file file &&
+	git reset --hard
+'
+
+test_expect_success 'merge refuses to clobber local changes' '
+	git checkout -q renamed^0 &&
+	echo dirty >other &&
+	test_must_fail git merge -s ort -m merged deleted &&
+	echo dirty >expect &&
+	test_cmp expect other &&
+	git reset --hard
+'
+
+test_expect_success 'criss-cross merge' '
+	git checkout -q -b cross-1 base &&
+	test_write_lines 0 1 2 3 4 5 6 7 8 9 >file &&
+	test_tick &&
+	git commit -am cross-1 &&
+	git tag cross-1-start &&
+	git checkout -q -b cross-2 base &&
+	test_write_lines 1 2 3 4 5 6 7 8 9 10 >file &&
+	test_tick &&
+	git commit -am cross-2 &&
+
+	git checkout -q cross-1 &&
+	git merge -s ort -m m1 cross-2^0 &&
+	git checkout -q cross-2 &&
+	git merge -s ort -m m2 cross-1~1 &&
+	test_write_lines a b c d e f g h i j >other &&
+	git commit -am change-other &&
+	git checkout -q cross-1 &&
+	test_write_lines 0 1 2 3 4 5 6 7 8 9 10 11 >file &&
+	git commit -am change-file &&
+
+	test 2 -eq $(git merge-base --all cross-1 cross-2 | wc -l) &&
+	git merge -s ort -m criss-cross cross-2 &&
+	test_write_lines 0 1 2 3 4 5 6 7 8 9 10 11 >expect &&
+	test_cmp expect file &&
+	test_write_lines a b c d e f g h i j >expect &&
+	test_cmp expect other
+'
+
+test_expect_success 'cherry-pick records conflicts in the index' '
+	git checkout -q modified^0 &&
+	test_write_lines one 2 3 4 5 6 7 8 9 10 >file &&
+	test_tick &&
+	git commit -am conflicting &&
+	test_must_fail git cherry-pick --strategy=ort cross-1-start &&
+	git rev-parse >expect base:file HEAD:file cross-1-start:file &&
+	git rev-parse >actual :1:file :2:file :3:file &&
+	test_cmp expect actual &&
+	grep "^<<<<<<< " file &&
+	git cherry-pick --abort &&
+	git diff --exit-code HEAD
+'
+
+test_expect_success 'rebase a series across a rename' '
+	git checkout -q -b series modified &&
+	for i in 11 12 13 14 15
+	do
+		echo $i >>file &&
+		test_tick &&
+		git commit -qam "add $i" || return 1
+	done &&
+	git rebase -s ort renamed &&
+	test_path_is_missing file &&
+	test_seq 1 15 >expect &&
+	test_cmp expect moved &&
+	test 6 -eq $(git rev-list --count renamed..) &&
+	git diff --exit-code HEAD
+'
+
+test_expect_success 'rebase stops at a conflict and continues' '
+	git checkout -q -b series-2 base &&
+	echo one >>other &&
+	test_tick &&
+	git commit -qam one &&
+	echo two >>other &&
+	test_tick &&
+	git commit -qam two &&
+	git checkout -q -b upstream base &&
+	echo upstream >>other &&
+	test_tick &&
+	git commit -qam upstream &&
+	git checkout -q series-2 &&
+	test_must_fail git rebase -s ort upstream &&
+	git ls-files -u other >actual &&
+	test_line_count = 3 actual &&
+	test_write_lines a b c d e f g h i upstream one >other &&
+	git add other &&
+	GIT_EDITOR=true git rebase --continue &&
+	test_write_lines a b c d e f g h i upstream one two >expect &&
+	test_cmp expect other
+'
+
+test_done
@@ -0,0 +1,62 @@
+#!/bin/sh
+
+test_description='rev-list --objects reading trees on several threads'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	for i in 1 2 3 4 5 6 7 8 9 10
+	do
+		mkdir -p a/b$i/c b/c$i &&
+		echo $i >a/b$i/c/file &&
+		echo $i >b/c$i/file &&
+		echo $i >top$i &&
+		git add . &&
+		git commit -q -m "commit $i" &&
+		git tag c$i || return 1
+	done &&
+	git checkout -q -b side c4 &&
+	cp -R a same &&
+	echo side >a/b2/c/file &&
+	git add . &&
+	git commit -q -m side &&
+	git checkout -q master &&
+	git merge -q -m merge side
+'
+
+for args in "HEAD" "--all" "c8..HEAD" "HEAD ^side" "--in-commit-order HEAD" \
+	"--objects-edge c3..c9" "HEAD^{tree} c5" "--no-object-names HEAD"
+do
+	test_expect_success "rev-list --objects $args on threads" '
+		git rev-list --objects --threads=1 $args >expect &&
+		git rev-list --objects --threads=4 $args >actual &&
+		test_cmp expect actual &&
+		git rev-list --objects $args >plain &&
+		test_cmp plain actual
+	'
+done
+
+test_expect_success PTHREADS 'trees are read ahead with several threads' '
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git rev-list --objects --threads=4 HEAD >/dev/null &&
+	grep "\"prefetch/hits\"" trace &&
+	rm trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git rev-list --objects --threads=4 HEAD -- a >/dev/null &&
+	! grep "\"prefetch/hits\"" trace
+'
+
+test_expect_success 'pack-objects finds the same objects on threads' '
+	git -c pack.threads=1 pack-objects --window=0 --all --stdout \
+		</dev/null >expect.pack &&
+	git -c pack.threads=4 pack-objects --window=0 --all --stdout \
+		</dev/null >actual.pack &&
+	test_cmp expect.pack actual.pack
+'
+
+test_expect_success 'rev-list rejects a negative number of threads' '
+	test_must_fail git rev-list --objects --threads=-1 HEAD 2>err &&
+	test_i18ngrep "invalid number of threads" err
+'
+
+test_done
@@ -0,0 +1,188 @@
+#!/bin/sh
+
+test_description='builtin file system monitor daemon'
+
+. ./test-lib.sh
+
+if ! test_have_prereq FSMONITOR_DAEMON
+then
+	skip_all='fsmonitor--daemon is not supported on this platform'
+	test_done
+fi
+
+stop_daemon () {
+	git -C "${1:-.}" fsmonitor--daemon stop 2>/dev/null
+	:
+}
+
+test_expect_success 'setup' '
+	mkdir -p dir1/sub dir2 &&
+	for f in tracked dir1/tracked dir1/sub/tracked dir2/tracked
+	do
+		echo "$f" >$f || return 1
+	done &&
+	cat >.gitignore <<-\EOF &&
+	expect*
+	actual*
+	EOF
+	git add . &&
+	git commit -q -m initial
+'
+
+test_expect_success 'start, status and stop' '
+	test_when_finished "stop_daemon" &&
+	test_must_fail git fsmonitor--daemon status &&
+	git fsmonitor--daemon start &&
+	git fsmonitor--daemon status >actual &&
+	test_i18ngrep "is watching" actual &&
+	test_must_fail git fsmonitor--daemon start 2>err &&
+	test_i18ngrep "already watching" err &&
+	git fsmonitor--daemon stop &&
+	test_must_fail git fsmonitor--daemon status &&
+	test_path_is_missing .git/fsmonitor--daemon.ipc
+'
+
+test_expect_success 'query reports changes since a token' '
+	test_when_finished "stop_daemon" &&
+	git fsmonitor--daemon start &&
+	git fsmonitor--daemon query 0 >actual &&
+	echo / >expect &&
+	sed 1d actual >actual.paths &&
+	test_cmp expect actual.paths &&
+
+	token=$(head -n 1 actual) &&
+	echo changed >dir1/tracked &&
+	: >dir2/new &&
+	git fsmonitor--daemon query "$token" >actual &&
+	# ignore our own scratch files
+	grep "^dir" actual | sort >actual.paths &&
+	cat >expect <<-\EOF &&
+	dir1/tracked
+	dir2/new
+	EOF
+	test_cmp expect actual.paths &&
+
+	token=$(head -n 1 actual) &&
+	git fsmonitor--daemon query "$token" >actual &&
+	! grep "^dir" actual
+'
+
+test_expect_success 'new directories are watched and reported' '
+	test_when_finished "stop_daemon" &&
+	git fsmonitor--daemon start &&
+	token=$(git fsmonitor--daemon query 0 | head -n 1) &&
+	mkdir -p dir3/deeper &&
+	: >dir3/deeper/file &&
+	token2=$(git fsmonitor--daemon query "$token" | head -n 1) &&
+	git fsmonitor--daemon query "$token" >actual &&
+	grep "^dir3/$" actual &&
+	grep "^dir3/deeper/file$" actual &&
+	echo more >dir3/deeper/file &&
+	git fsmonitor--daemon query "$token2" >actual &&
+	grep "^dir3/deeper/file$" actual &&
+	rm -rf dir3
+'
+
+test_expect_success 'renamed directories are reported with a trailing slash' '
+	test_when_finished "stop_daemon; git reset -q --hard; rm -rf renamed" &&
+	git fsmonitor--daemon start &&
+	token=$(git fsmonitor--daemon query 0 | head -n 1) &&
+	mv dir1 renamed &&
+	git fsmonitor--daemon query "$token" >actual &&
+	grep "^dir1/$" actual &&
+	grep "^renamed/$" actual &&
+	grep "^renamed/sub/tracked$" actual
+'
+
+check_status () {
+	git -c core.useBuiltinFSMonitor=false status --porcelain >expect &&
+	git -c core.useBuiltinFSMonitor=true status --porcelain >actual &&
+	test_cmp expect actual
+}
+
+test_expect_success 'status with the builtin monitor starts the daemon' '
+	test_when_finished "stop_daemon" &&
+	test_must_fail git fsmonitor--daemon status &&
+	git config core.useBuiltinFSMonitor true &&
+	git update-index --fsmonitor &&
+	git status &&
+	git fsmonitor--daemon status
+'
+
+test_expect_success 'status with the builtin monitor matches status without' '
+	test_when_finished "stop_daemon" &&
+	git status &&
+	check_status &&
+
+	echo modified >tracked &&
+	check_status &&
+
+	: >untracked &&
+	: >dir2/untracked &&
+	check_status &&
+
+	rm dir1/sub/tracked &&
+	check_status &&
+
+	mv dir2 moved &&
+	check_status &&
+
+	git add -A &&
+	check_status &&
+
+	git reset -q --hard &&
+	git clean -q -fd &&
+	check_status
+'
+
+test_expect_success PERL 'a client that sends nothing does not hold up others' '
+	test_when_finished "stop_daemon; kill \$stall_pid" &&
+	git fsmonitor--daemon start &&
+	rm -f connected &&
+	perl -MIO::Socket::UNIX -e "
+		my \$s = IO::Socket::UNIX->new(Peer => shift) or die;
+		open(my \$fh, \">\", \"connected\");
+		close(\$fh);
+		sleep 30;
+	" .git/fsmonitor--daemon.ipc &
+	stall_pid=$! &&
+	for i in $(test_seq 50)
+	do
+		test -f connected && break
+		sleep 0.1
+	done &&
+	test_path_is_file connected &&
+	git fsmonitor--daemon status &&
+	kill -0 $stall_pid
+'
+
+# Run the daemon for the worktree "$1" in the foreground, in the
+# background, recording its exit code in "$1.exit".
+run_daemon_in_background () {
+	(
+		git -C "$1" fsmonitor--daemon run >"$1.out" 2>&1
+		echo $? >"$1.exit"
+	) &
+	for i in $(test_seq 50)
+	do
+		test -s "$1.out" && break
+		sleep 0.1
+	done
+	echo ok >expect &&
+	test_cmp expect "$1.out"
+}
+
+test_expect_success 'the daemon exits when the worktree goes away' '
+	git init gone &&
+	run_daemon_in_background gone &&
+	rm -rf gone &&
+	for i in $(test_seq 50)
+	do
+		test -f gone.exit && break
+		sleep 0.1
+	done &&
+	echo 0 >expect &&
+	test_cmp expect gone.exit
+'
+
+test_done
@@ -0,0 +1,141 @@
+#!/bin/sh
+
+test_description='git repack --geometric works correctly'
+
+. ./test-lib.sh
+
+packdir=.git/objects/pack
+midx=$packdir/multi-pack-index
+
+# write a pack of the objects of "$1" new commits
+pack_commits () {
+	test_commit_bulk --start=$(($(git rev-list --all | wc -l) + 1)) $1 &&
+	git repack -q
+}
+
+test_expect_success '--geometric with no packs' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+		git repack --geometric=2 -d >out &&
+		test_i18ngrep "Nothing new to pack" out
+	)
+'
+
+test_expect_success '--geometric packs loose objects' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+		test_commit_bulk 3 &&
+		git repack --geometric=2 -d &&
+		ls $packdir/*.pack >packs &&
+		test_line_count = 1 packs &&
+		git count-objects -v >count &&
+		grep "^count: 0" count &&
+		test_path_is_file $midx &&
+		git multi-pack-index verify
+	)
+'
+
+test_expect_success '--geometric leaves a progression alone' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+		pack_commits 20 &&
+		pack_commits 2 &&
+		ls $packdir/*.pack >before &&
+		git repack --geometric=2 -d &&
+		ls $packdir/*.pack >after &&
+		test_cmp before after
+	)
+'
+
+test_expect_success '--geometric rolls up the small packs only' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+		pack_commits 20 &&
+		ls $packdir/*.pack >large &&
+		pack_commits 2 &&
+		pack_commits 2 &&
+		pack_commits 2 &&
+		git repack --geometric=2 -d &&
+		ls $packdir/*.pack >packs &&
+		test_line_count = 2 packs &&
+		grep -f large packs &&
+		git fsck &&
+		git multi-pack-index verify
+	)
+'
+
+test_expect_success '--geometric rolls up larger packs that break the progression' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+		pack_commits 6 &&
+		pack_commits 3 &&
+		pack_commits 3 &&
+		git repack --geometric=2 -d &&
+		ls $packdir/*.pack >packs &&
+		test_line_count = 1 packs &&
+		git fsck
+	)
+'
+
+test_expect_success '--geometric keeps unreachable objects' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+		pack_commits 20 &&
+		blob=$(echo unreachable | git hash-object -w --stdin) &&
+		pack_commits 2 &&
+		git repack --geometric=2 -d &&
+		git cat-file -e $blob
+	)
+'
+
+test_expect_success '--geometric leaves kept packs alone' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+		pack_commits 2 &&
+		ls $packdir/*.pack >kept &&
+		touch $(sed "s/\.pack$/.keep/" kept) &&
+		pack_commits 2 &&
+		pack_commits 2 &&
+		git repack --geometric=2 -d &&
+		ls $packdir/*.pack >packs &&
+		test_line_count = 2 packs &&
+		grep -f kept packs
+	)
+'
+
+test_expect_success '--geometric writes a multi-pack bitmap with -b' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+		git config core.multiPackIndex true &&
+		pack_commits 20 &&
+		pack_commits 2 &&
+		git repack --geometric=2 -d -b &&
+		ls $packdir/multi-pack-index-*.bitmap >bitmaps &&
+		test_line_count = 1 bitmaps &&
+		git rev-list --test-bitmap HEAD 2>out &&
+		grep "^OK!" out
+	)
+'
+
+test_expect_success '--geometric rejects bad options' '
+	test_must_fail git repack --geometric=1 &&
+	test_must_fail git repack --geometric=2 -a
+'
+
+test_done
@@ -0,0 +1,65 @@
+#!/bin/sh
+
+test_description='git blame with diffs prepared on several threads'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	test_seq 1 200 >file &&
+	git add file &&
+	test_tick &&
+	git commit -m base &&
+	for i in 1 2 3 4 5 6
+	do
+		sed -e "$((i * 20))s/\$/ main $i/" file >tmp &&
+		mv tmp file &&
+		test_tick &&
+		git commit -qam "main $i" || return 1
+	done &&
+	git tag main-tip &&
+	git checkout -q -b side HEAD~4 &&
+	for i in 1 2 3
+	do
+		sed -e "$((i * 30 + 5))s/\$/ side $i/" file >tmp &&
+		mv tmp file &&
+		test_tick &&
+		git commit -qam "side $i" || return 1
+	done &&
+	git checkout -q main-tip &&
+	test_tick &&
+	git merge -q -m merge side &&
+	sed -e "100s/\$/ top/" -e 150d file >tmp &&
+	mv tmp file &&
+	test_tick &&
+	git commit -qam top
+'
+
+for opts in "" "-w" "-M" "-C" "--first-parent" "-L 30,120" "--ignore-rev HEAD~1"
+do
+	test_expect_success "blame $opts does not depend on the threads" '
+		git -c blame.threads=1 blame -p $opts file >expect &&
+		git -c blame.threads=4 blame -p $opts file >actual &&
+		test_cmp expect actual
+	'
+done
+
+test_expect_success PTHREADS 'threads are only started when asked for' '
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git -c blame.threads=4 blame file >/dev/null &&
+	grep "\"key\":\"prefetch/hits\"" trace.event &&
+	rm trace.event &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git -c blame.threads=1 blame file >/dev/null &&
+	! grep "\"key\":\"prefetch/hits\"" trace.event &&
+	rm trace.event &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git -c blame.threads=4 blame --reverse HEAD~3.. file >/dev/null &&
+	! grep "\"key\":\"prefetch/hits\"" trace.event
+'
+
+test_expect_success 'blame.threads must not be negative' '
+	test_must_fail git -c blame.threads=-1 blame file 2>err &&
+	test_i18ngrep "invalid number of threads" err
+'
+
+test_done
@@ -0,0 +1,140 @@
+#!/bin/sh
+
+test_description='git blame with results cached per commit and path'
+
+. ./test-lib.sh
+
+cache_files () {
+	find .git/objects/info/blame-cache -type f 2>/dev/null | wc -l
+}
+
+test_expect_success 'setup' '
+	test_seq 1 100 >file &&
+	git add file &&
+	test_tick &&
+	git commit -m base &&
+	for i in 1 2 3 4
+	do
+		sed -e "$((i * 20))s/\$/ main $i/" file >tmp &&
+		mv tmp file &&
+		test_tick &&
+		git commit -qam "main $i" || return 1
+	done &&
+	git tag main-tip &&
+	git checkout -q -b side HEAD~2 &&
+	sed -e "35s/\$/ side/" file >tmp &&
+	mv tmp file &&
+	test_tick &&
+	git commit -qam side &&
+	git checkout -q main-tip &&
+	test_tick &&
+	git merge -q -m merge side &&
+	git tag merged &&
+	git mv file renamed &&
+	sed -e "50s/\$/ top/" -e 70d renamed >tmp &&
+	mv tmp renamed &&
+	test_tick &&
+	git commit -qam top
+'
+
+test_expect_success 'the cache is off by default' '
+	git blame merged -- file >/dev/null &&
+	test 0 = $(cache_files)
+'
+
+test_expect_success 'blaming a whole file stores the result' '
+	git -c blame.cache=true blame merged -- file >/dev/null &&
+	test 1 = $(cache_files)
+'
+
+test_expect_success 'blaming some lines does not store a result' '
+	git -c blame.cache=true blame -L 10,20 main-tip -- file >/dev/null &&
+	test 1 = $(cache_files)
+'
+
+test_expect_success 'reblaming after a commit needs a single diff' '
+	git -c blame.cache=true blame --show-stats HEAD -- renamed >out &&
+	grep "num get patch: 1\$" out
+'
+
+for opts in "" "-L 40,60" "--first-parent"
+do
+	test_expect_success "cached result is reused: $opts" '
+		git blame -p $opts HEAD -- renamed >expect &&
+		git -c blame.cache=true blame -p $opts HEAD -- renamed >actual &&
+		test_cmp expect actual
+	'
+done
+
+test_expect_success 'a result for the same commit is used right away' '
+	git -c blame.cache=true blame --show-stats merged -- file >out &&
+	grep "num get patch: 0\$" out &&
+	sed -n "/^num/!p" out >actual &&
+	git blame merged -- file >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'options changing the blame do not use the cache' '
+	git blame -w -p HEAD -- renamed >expect &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git -c blame.cache=true blame -w -p HEAD -- renamed >actual &&
+	test_cmp expect actual &&
+	grep "\"key\":\"cache/hits\",\"value\":\"0\"" trace.event &&
+	rm trace.event &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git -c blame.cache=true blame -M HEAD -- renamed >/dev/null &&
+	! grep "\"key\":\"cache/" trace.event &&
+	rm trace.event &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git -c blame.cache=true blame main-tip..HEAD -- renamed >/dev/null &&
+	! grep "\"key\":\"cache/" trace.event
+'
+
+test_expect_success 'corrupt results are ignored' '
+	git blame -p HEAD -- renamed >expect &&
+	for f in $(find .git/objects/info/blame-cache -type f)
+	do
+		echo garbage >>"$f" || return 1
+	done &&
+	git -c blame.cache=true blame -p HEAD -- renamed >actual 2>err &&
+	test_cmp expect actual &&
+	test_i18ngrep "ignoring corrupt blame cache file" err
+'
+
+test_expect_success 'rewritten history neither uses nor stores results' '
+	rm -rf .git/objects/info/blame-cache &&
+	git blame HEAD -- renamed >expect &&
+	git rev-parse HEAD >revs &&
+	git -c blame.cache=true blame -S revs HEAD -- renamed >/dev/null &&
+	test 0 = $(cache_files) &&
+	git replace --graft HEAD &&
+	git -c blame.cache=true blame HEAD -- renamed >/dev/null &&
+	test 0 = $(cache_files) &&
+	git replace -d HEAD &&
+	git -c blame.cache=true blame HEAD -- renamed >actual &&
+	test_cmp expect actual &&
+	test 1 = $(cache_files) &&
+
+	git replace --graft HEAD &&
+	git blame HEAD -- renamed >expect &&
+	git -c blame.cache=true blame HEAD -- renamed >actual &&
+	git replace -d HEAD &&
+	test_cmp expect actual
+'
+
+test_expect_success 'gc prunes results that were not used recently' '
+	git gc &&
+	test 1 = $(cache_files) &&
+	test-tool chmtime =-5184000 $(find .git/objects/info/blame-cache -type f) &&
+	git -c blame.cache=true blame HEAD -- renamed >/dev/null &&
+	git gc &&
+	test 1 = $(cache_files) &&
+	test-tool chmtime =-5184000 $(find .git/objects/info/blame-cache -type f) &&
+	git gc &&
+	test 0 = $(cache_files) &&
+	git -c blame.cache=true blame HEAD -- renamed >/dev/null &&
+	git -c gc.blameCacheExpire=now gc &&
+	test 0 = $(cache_files)
+'
+
+test_done
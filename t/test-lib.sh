@@ -448,6 +448,11 @@ GIT_COMMITTER_NAME='C O Mitter'
 GIT_MERGE_VERBOSITY=5
 GIT_MERGE_AUTOEDIT=no
 export GIT_MERGE_VERBOSITY GIT_MERGE_AUTOEDIT
+if test -n "$GIT_TEST_DEFAULT_REF_FORMAT"
+then
+	GIT_DEFAULT_REF_FORMAT=$GIT_TEST_DEFAULT_REF_FORMAT
+	export GIT_DEFAULT_REF_FORMAT
+fi
 export GIT_AUTHOR_EMAIL GIT_AUTHOR_NAME
 export GIT_COMMITTER_EMAIL GIT_COMMITTER_NAME
 export EDITOR
@@ -1519,6 +1524,7 @@ esac
 ( COLUMNS=1 && test $COLUMNS = 1 ) && test_set_prereq COLUMNS_CAN_BE_1
 test -z "$NO_PERL" && test_set_prereq PERL
 test -z "$NO_PTHREADS" && test_set_prereq PTHREADS
+test -n "$HAVE_FSMONITOR_DAEMON" && test_set_prereq FSMONITOR_DAEMON
 test -z "$NO_PYTHON" && test_set_prereq PYTHON
 test -n "$USE_LIBPCRE1$USE_LIBPCRE2" && test_set_prereq PCRE
 test -n "$USE_LIBPCRE1" && test_set_prereq LIBPCRE1
@@ -16,6 +16,8 @@
 #include "fsmonitor.h"
 #include "object-store.h"
 #include "promisor-remote.h"
+#include "parallel-checkout.h"
+#include "sparse-index.h"
 
 /*
  * Error messages expected by scripts out of plumbing commands such as
@@ -397,7 +399,7 @@ static int check_updates(struct unpack_trees_options *o,
 	int errs = 0;
 	struct progress *progress;
 	struct checkout state = CHECKOUT_INIT;
-	int i;
+	int i, pc_workers, pc_threshold;
 
 	trace_performance_enter();
 	state.force = 1;
@@ -437,7 +439,11 @@ static int check_updates(struct unpack_trees_options *o,
 	if (should_update_submodules())
 		load_gitmodules_file(index, &state);
 
+	get_parallel_checkout_configs(&pc_workers, &pc_threshold);
+
 	enable_delayed_checkout(&state);
+	if (pc_workers > 1)
+		init_parallel_checkout();
 	if (has_promisor_remote()) {
 		/*
 		 * Prefetch the objects that are to be checked out in the loop
@@ -467,11 +473,17 @@ static int check_updates(struct unpack_trees_options *o,
 			if (ce->ce_flags & CE_WT_REMOVE)
 				BUG("both update and delete flags are set on %s",
 				    ce->name);
-			display_progress(progress, ++cnt);
 			ce->ce_flags &= ~CE_UPDATE;
 			errs |= checkout_entry(ce, &state, NULL, NULL);
+			/* queued entries are counted once they are written */
+			display_progress(progress,
+					 ++cnt - parallel_checkout_pending());
 		}
 	}
+	if (pc_workers > 1)
+		errs |= run_parallel_checkout(&state, pc_workers, pc_threshold,
+					      progress,
+					      cnt - parallel_checkout_pending());
 	stop_progress(&progress);
 	errs |= finish_delayed_checkout(&state, NULL);
 	git_attr_set_direction(GIT_ATTR_CHECKIN);
@@ -986,6 +998,13 @@ static int compare_entry(const struct cache_entry *ce, const struct traverse_inf
 	if (cmp)
 		return cmp;
 
+	/*
+	 * A sparse directory entry "dir/" is the tree "dir" itself.
+	 */
+	if (S_ISSPARSEDIR(ce->ce_mode) && S_ISDIR(n->mode) &&
+	    ce_namelen(ce) == traverse_path_len(info, tree_entry_len(n)) + 1)
+		return 0;
+
 	/*
 	 * Even if the beginning compared identically, the ce should
 	 * compare as bigger than a directory leading up to it!
@@ -1012,13 +1031,15 @@ static struct cache_entry *create_ce_entry(const struct traverse_info *info,
 	const struct name_entry *n,
 	int stage,
 	struct index_state *istate,
-	int is_transient)
+	int is_transient,
+	int is_sparse_directory)
 {
 	size_t len = traverse_path_len(info, tree_entry_len(n));
+	size_t alloc_len = is_sparse_directory ? len + 1 : len;
 	struct cache_entry *ce =
 		is_transient ?
-		make_empty_transient_cache_entry(len) :
-		make_empty_cache_entry(istate, len);
+		make_empty_transient_cache_entry(alloc_len) :
+		make_empty_cache_entry(istate, alloc_len);
 
 	ce->ce_mode = create_ce_mode(n->mode);
 	ce->ce_flags = create_ce_flags(stage);
@@ -1027,6 +1048,14 @@ static struct cache_entry *create_ce_entry(const struct traverse_info *info,
 	/* len+1 because the cache_entry allocates space for NUL */
 	make_traverse_path(ce->name, len + 1, info, n->path, n->pathlen);
 
+	if (is_sparse_directory) {
+		ce->name[len] = '/';
+		ce->name[len + 1] = '\0';
+		ce->ce_namelen++;
+		ce->ce_mode = S_IFDIR;
+		ce->ce_flags |= CE_SKIP_WORKTREE;
+	}
+
 	return ce;
 }
 
@@ -1044,11 +1073,19 @@ static int unpack_nondirectories(int n, unsigned long mask,
 	int i;
 	struct unpack_trees_options *o = info->data;
 	unsigned long conflicts = info->df_conflicts | dirmask;
+	int sparse_directory = src[0] && S_ISSPARSEDIR(src[0]->ce_mode);
 
 	/* Do we have *only* directories? Nothing to do */
 	if (mask == dirmask && !src[0])
 		return 0;
 
+	/*
+	 * The index has the directory as a sparse directory entry:
+	 * compare the trees as a whole with it instead of descending.
+	 */
+	if (sparse_directory)
+		conflicts = info->df_conflicts;
+
 	/*
 	 * Ok, we've filled in up to any potential index entry in src[0],
 	 * now do the rest.
@@ -1078,7 +1115,10 @@ static int unpack_nondirectories(int n, unsigned long mask,
 		 * not stored in the index.  otherwise construct the
 		 * cache entry from the index aware logic.
 		 */
-		src[i + o->merge] = create_ce_entry(info, names + i, stage, &o->result, o->merge);
+		src[i + o->merge] = create_ce_entry(info, names + i, stage,
+						    &o->result, o->merge,
+						    sparse_directory &&
+						    (dirmask & bit));
 	}
 
 	if (o->merge) {
@@ -1187,11 +1227,22 @@ static struct cache_entry *find_cache_entry(struct traverse_info *info,
 {
 	int pos = find_cache_pos(info, p->path, p->pathlen);
 	struct unpack_trees_options *o = info->data;
+	struct cache_entry *ce;
 
 	if (0 <= pos)
 		return o->src_index->cache[pos];
-	else
+	if (pos == -1 || !S_ISDIR(p->mode))
 		return NULL;
+
+	/*
+	 * The index has something under the directory p->path; if it is
+	 * a sparse directory entry for p->path itself, that is our match.
+	 */
+	ce = o->src_index->cache[-2 - pos];
+	if (S_ISSPARSEDIR(ce->ce_mode) &&
+	    ce_namelen(ce) == info->pathlen + p->pathlen + 1)
+		return ce;
+	return NULL;
 }
 
 static void debug_path(struct traverse_info *info)
@@ -1294,6 +1345,10 @@ static int unpack_callback(int n, unsigned long mask, unsigned long dirmask, str
 
 	/* Now handle any directories.. */
 	if (dirmask) {
+		/* A sparse directory entry was compared as a whole above */
+		if (src[0] && S_ISSPARSEDIR(src[0]->ce_mode))
+			return mask;
+
 		/* special case: "diff-index --cached" looking at a tree */
 		if (o->diff_index_cached &&
 		    n == 1 && dirmask == 1 && S_ISDIR(names->mode)) {
@@ -1579,6 +1634,14 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 	if (len > MAX_UNPACK_TREES)
 		die("unpack_trees takes at most %d trees", MAX_UNPACK_TREES);
 
+	/*
+	 * Only comparing trees with the index knows about sparse directory
+	 * entries; producing a new index or updating the working tree
+	 * needs them expanded.
+	 */
+	if (o->dst_index || o->update)
+		ensure_full_index(o->src_index);
+
 	trace_performance_enter();
 	if (!core_apply_sparse_checkout || !o->update)
 		o->skip_sparse_checkout = 1;
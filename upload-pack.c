@@ -26,6 +26,9 @@
 #include "serve.h"
 #include "commit-graph.h"
 #include "commit-reach.h"
+#include "lockfile.h"
+#include "oid-array.h"
+#include "dir.h"
 
 /* Remember to update object flag allocation in object.h */
 #define THEY_HAVE	(1u << 11)
@@ -72,6 +75,11 @@ static struct list_objects_filter_options filter_options;
 
 static int allow_sideband_all;
 
+static int use_pack_cache;
+static unsigned long pack_cache_max_size = 1024 * 1024 * 1024;
+static timestamp_t pack_cache_max_age;
+static int pack_cache_max_age_set;
+
 static void reset_timeout(void)
 {
 	alarm(timeout);
@@ -102,6 +110,343 @@ static int write_one_shallow(const struct commit_graft *graft, void *cb_data)
 	return 0;
 }
 
+/*
+ * With uploadpack.packCache, the packs we send are kept below
+ * "$GIT_OBJECT_DIRECTORY/info/pack-cache", named after everything that
+ * goes into pack-objects, so that a request identical to an earlier
+ * one gets the same pack without running pack-objects again.
+ */
+#define PACK_CACHE_SIGNATURE "upload-pack-cache v1"
+/* the pid goes into the lock right away; one empty this long is stale */
+#define PACK_CACHE_EMPTY_LOCK_AGE 60
+
+struct pack_cache {
+	struct strbuf path;
+	/* held with our pid while we write the pack */
+	struct lock_file lock;
+	struct tempfile *tmp;
+	unsigned long written;
+};
+
+#define PACK_CACHE_INIT { STRBUF_INIT, LOCK_INIT, NULL, 0 }
+
+static int add_oid_to_key(const struct object_id *oid, void *data)
+{
+	struct strbuf *key = data;
+
+	strbuf_addf(key, " %s", oid_to_hex(oid));
+	return 0;
+}
+
+static int add_shallow_to_key(const struct commit_graft *graft, void *data)
+{
+	if (graft->nr_parent == -1)
+		oid_array_append(data, &graft->oid);
+	return 0;
+}
+
+static int add_tag_to_key(const char *refname, const struct object_id *oid,
+			  int flag, void *data)
+{
+	struct strbuf *key = data;
+
+	strbuf_addf(key, "tag %s %s\n", oid_to_hex(oid), refname);
+	return 0;
+}
+
+/*
+ * Name the pack for the request. The wants and haves are sorted, so
+ * that the order in which the client sent them does not matter.
+ * Return -1 if the pack depends on more than we can name.
+ */
+static int pack_cache_path(struct strbuf *path, const struct argv_array *args,
+			   const struct object_array *have_obj,
+			   const struct object_array *want_obj)
+{
+	struct strbuf key = STRBUF_INIT;
+	struct oid_array oids = OID_ARRAY_INIT;
+	unsigned char hash[GIT_MAX_RAWSZ];
+	git_hash_ctx ctx;
+	int i;
+
+	/* pack-objects would cut the history at our own shallow commits */
+	if (!shallow_nr && file_exists(git_path_shallow(the_repository)))
+		return -1;
+
+	strbuf_addstr(&key, PACK_CACHE_SIGNATURE "\n");
+	for (i = 0; i < args->argc; i++)
+		if (strcmp(args->argv[i], "--progress"))
+			strbuf_addf(&key, "arg %s\n", args->argv[i]);
+
+	strbuf_addstr(&key, "shallow");
+	for_each_commit_graft(add_shallow_to_key, &oids);
+	oid_array_for_each_unique(&oids, add_oid_to_key, &key);
+	oid_array_clear(&oids);
+
+	strbuf_addstr(&key, "\nwant");
+	for (i = 0; i < want_obj->nr; i++)
+		oid_array_append(&oids, &want_obj->objects[i].item->oid);
+	oid_array_for_each_unique(&oids, add_oid_to_key, &key);
+	oid_array_clear(&oids);
+
+	strbuf_addstr(&key, "\nhave");
+	for (i = 0; i < have_obj->nr; i++)
+		oid_array_append(&oids, &have_obj->objects[i].item->oid);
+	for (i = 0; i < extra_edge_obj.nr; i++)
+		oid_array_append(&oids, &extra_edge_obj.objects[i].item->oid);
+	oid_array_for_each_unique(&oids, add_oid_to_key, &key);
+	oid_array_clear(&oids);
+	strbuf_addch(&key, '\n');
+
+	/* which tags pack-objects adds depends on the refs we have */
+	if (use_include_tag)
+		for_each_tag_ref(add_tag_to_key, &key);
+
+	the_hash_algo->init_fn(&ctx);
+	the_hash_algo->update_fn(&ctx, key.buf, key.len);
+	the_hash_algo->final_fn(hash, &ctx);
+	strbuf_release(&key);
+
+	strbuf_addf(path, "%s/info/pack-cache/%s.pack",
+		    the_repository->objects->odb->path, hash_to_hex(hash));
+	return 0;
+}
+
+static timestamp_t pack_cache_expiry(void)
+{
+	timestamp_t expire;
+
+	if (pack_cache_max_age_set)
+		return pack_cache_max_age;
+	parse_expiry_date("1.day.ago", &expire);
+	return expire;
+}
+
+/*
+ * Send the cached pack. Return -1 if there is none we can use, 0 if
+ * it was sent, and 1 if reading it failed after part of it was sent.
+ */
+static int send_cached_pack(const char *path)
+{
+	char data[8192];
+	struct stat st;
+	ssize_t sz;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) || st.st_mtime <= pack_cache_expiry() ||
+	    read_in_full(fd, data, 4) != 4 || memcmp(data, "PACK", 4)) {
+		close(fd);
+		return -1;
+	}
+	/* the mtime tells when the pack was last used */
+	utime(path, NULL);
+
+	sz = 4;
+	do {
+		reset_timeout();
+		send_client_data(1, data, sz);
+		sz = xread(fd, data, sizeof(data));
+	} while (sz > 0);
+	close(fd);
+	if (sz < 0) {
+		error_errno(_("unable to read '%s'"), path);
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * Remove the lock on the pack if the process that took it is gone.
+ * Like "gc.pid", the lock has the pid and host name of its owner, so
+ * that one that died on this host can be told. Return 1 if the lock
+ * was removed.
+ */
+static int remove_stale_pack_cache_lock(const char *lock_path)
+{
+	char my_host[HOST_NAME_MAX + 1];
+	struct strbuf buf = STRBUF_INIT;
+	struct stat st;
+	uintmax_t pid;
+	char *end;
+	int stale;
+
+	if (stat(lock_path, &st) ||
+	    strbuf_read_file(&buf, lock_path, 0) < 0)
+		return 0;
+	if (xgethostname(my_host, sizeof(my_host)))
+		xsnprintf(my_host, sizeof(my_host), "unknown");
+
+	pid = strtoumax(buf.buf, &end, 10);
+	if (*end != ' ')
+		/* killed between taking the lock and writing to it? */
+		stale = time(NULL) - st.st_mtime > PACK_CACHE_EMPTY_LOCK_AGE;
+	else
+		stale = !strcmp(end + 1, my_host) &&
+			kill(pid, 0) && errno == ESRCH;
+	strbuf_release(&buf);
+	return stale && !unlink(lock_path);
+}
+
+static int lock_pack_cache(struct pack_cache *cache)
+{
+	struct strbuf lock_path = STRBUF_INIT;
+	int fd;
+
+	fd = hold_lock_file_for_update(&cache->lock, cache->path.buf, 0);
+	if (fd < 0 && errno == EEXIST) {
+		strbuf_addf(&lock_path, "%s%s", cache->path.buf, LOCK_SUFFIX);
+		if (remove_stale_pack_cache_lock(lock_path.buf))
+			fd = hold_lock_file_for_update(&cache->lock,
+						       cache->path.buf, 0);
+		strbuf_release(&lock_path);
+	}
+	return fd;
+}
+
+/*
+ * Send the pack from the cache if it is there. Otherwise get ready to
+ * write it as pack-objects produces it, unless another process is
+ * already writing it: that one goes at the pace of its own client, so
+ * rather than waiting for it we run pack-objects ourselves, without
+ * keeping the result. Return 0 if the pack was sent, 1 if reading it
+ * failed on the way, and -1 if it has to be produced.
+ */
+static int pack_cache_begin(struct pack_cache *cache)
+{
+	char host[HOST_NAME_MAX + 1];
+	struct strbuf buf = STRBUF_INIT;
+	int fd, ret;
+
+	ret = send_cached_pack(cache->path.buf);
+	if (ret >= 0) {
+		trace2_data_string("upload-pack", the_repository,
+				   "pack-cache", "hit");
+		return ret;
+	}
+
+	if (safe_create_leading_directories(cache->path.buf))
+		return -1;
+	fd = lock_pack_cache(cache);
+	if (fd < 0) {
+		if (errno == EEXIST)
+			trace2_data_string("upload-pack", the_repository,
+					   "pack-cache", "busy");
+		return -1;
+	}
+
+	if (xgethostname(host, sizeof(host)))
+		xsnprintf(host, sizeof(host), "unknown");
+	strbuf_addf(&buf, "%"PRIuMAX" %s", (uintmax_t)getpid(), host);
+	write_in_full(fd, buf.buf, buf.len);
+	strbuf_reset(&buf);
+	strbuf_addf(&buf, "%s.tmp-XXXXXX", cache->path.buf);
+	cache->tmp = mks_tempfile_m(buf.buf, 0444);
+	if (!cache->tmp)
+		rollback_lock_file(&cache->lock);
+	strbuf_release(&buf);
+	return -1;
+}
+
+static void pack_cache_write(struct pack_cache *cache,
+			     const char *data, ssize_t sz)
+{
+	if (!cache->tmp)
+		return;
+	cache->written += sz;
+	if (cache->written > pack_cache_max_size ||
+	    write_in_full(get_tempfile_fd(cache->tmp), data, sz) < 0) {
+		delete_tempfile(&cache->tmp);
+		rollback_lock_file(&cache->lock);
+	}
+}
+
+struct cached_pack {
+	char *path;
+	time_t mtime;
+	off_t size;
+};
+
+static int cached_pack_cmp(const void *va, const void *vb)
+{
+	const struct cached_pack *a = va, *b = vb;
+
+	/* most recently used first */
+	if (a->mtime != b->mtime)
+		return a->mtime < b->mtime ? 1 : -1;
+	return strcmp(a->path, b->path);
+}
+
+/* Drop the packs not used for a while, then the least recently used. */
+static void prune_pack_cache(const char *dir)
+{
+	struct cached_pack *packs = NULL;
+	size_t nr = 0, alloc = 0, i;
+	timestamp_t expire = pack_cache_expiry();
+	uintmax_t total = 0;
+	struct dirent *de;
+	DIR *d;
+
+	d = opendir(dir);
+	if (!d)
+		return;
+	while ((de = readdir(d)) != NULL) {
+		struct stat st;
+		char *path;
+
+		if (!ends_with(de->d_name, ".pack"))
+			continue;
+		path = xstrfmt("%s/%s", dir, de->d_name);
+		if (stat(path, &st)) {
+			free(path);
+			continue;
+		}
+		if (st.st_mtime <= expire) {
+			unlink(path);
+			free(path);
+			continue;
+		}
+		ALLOC_GROW(packs, nr + 1, alloc);
+		packs[nr].path = path;
+		packs[nr].mtime = st.st_mtime;
+		packs[nr].size = st.st_size;
+		nr++;
+	}
+	closedir(d);
+
+	QSORT(packs, nr, cached_pack_cmp);
+	for (i = 0; i < nr; i++) {
+		total += packs[i].size;
+		if (total > pack_cache_max_size)
+			unlink(packs[i].path);
+		free(packs[i].path);
+	}
+	free(packs);
+}
+
+/* Put the pack in place, once pack-objects has written all of it. */
+static void pack_cache_finish(struct pack_cache *cache)
+{
+	if (cache->tmp) {
+		const char *slash;
+
+		if (rename_tempfile(&cache->tmp, cache->path.buf))
+			error_errno(_("unable to cache pack in '%s'"),
+				    cache->path.buf);
+		else
+			trace2_data_string("upload-pack", the_repository,
+					   "pack-cache", "write");
+		adjust_shared_perm(cache->path.buf);
+		slash = strrchr(cache->path.buf, '/');
+		strbuf_setlen(&cache->path, slash - cache->path.buf);
+		prune_pack_cache(cache->path.buf);
+	}
+	rollback_lock_file(&cache->lock);
+	strbuf_release(&cache->path);
+}
+
 static void create_pack_file(const struct object_array *have_obj,
 			     const struct object_array *want_obj)
 {
@@ -109,6 +454,7 @@ static void create_pack_file(const struct object_array *have_obj,
 	char data[8193], progress[128];
 	char abort_msg[] = "aborting due to possible repository "
 		"corruption on the remote side.";
+	struct pack_cache cache = PACK_CACHE_INIT;
 	int buffered = -1;
 	ssize_t sz;
 	int i;
@@ -154,6 +500,22 @@ static void create_pack_file(const struct object_array *have_obj,
 		}
 	}
 
+	if (use_pack_cache &&
+	    !pack_cache_path(&cache.path, &pack_objects.args,
+			     have_obj, want_obj)) {
+		int ret = pack_cache_begin(&cache);
+
+		if (ret >= 0) {
+			strbuf_release(&cache.path);
+			child_process_clear(&pack_objects);
+			if (ret)
+				goto fail;
+			if (use_sideband)
+				packet_flush(1);
+			return;
+		}
+	}
+
 	pack_objects.in = -1;
 	pack_objects.out = -1;
 	pack_objects.err = -1;
@@ -271,6 +633,7 @@ static void create_pack_file(const struct object_array *have_obj,
 			else
 				buffered = -1;
 			send_client_data(1, data, sz);
+			pack_cache_write(&cache, data, sz);
 		}
 
 		/*
@@ -298,10 +661,12 @@ static void create_pack_file(const struct object_array *have_obj,
 	if (0 <= buffered) {
 		data[0] = buffered;
 		send_client_data(1, data, 1);
+		pack_cache_write(&cache, data, 1);
 		fprintf(stderr, "flushed.\n");
 	}
 	if (use_sideband)
 		packet_flush(1);
+	pack_cache_finish(&cache);
 	return;
 
  fail:
@@ -347,7 +712,7 @@ static int got_oid(const char *hex, struct object_id *oid,
 static int ok_to_give_up(const struct object_array *have_obj,
 			 struct object_array *want_obj)
 {
-	uint32_t min_generation = GENERATION_NUMBER_ZERO;
+	timestamp_t min_generation = GENERATION_NUMBER_ZERO;
 
 	if (!have_obj->nr)
 		return 0;
@@ -1069,6 +1434,14 @@ static int upload_pack_config(const char *var, const char *value, void *unused)
 		allow_ref_in_want = git_config_bool(var, value);
 	} else if (!strcmp("uploadpack.allowsidebandall", var)) {
 		allow_sideband_all = git_config_bool(var, value);
+	} else if (!strcmp("uploadpack.packcache", var)) {
+		use_pack_cache = git_config_bool(var, value);
+	} else if (!strcmp("uploadpack.packcachemaxsize", var)) {
+		pack_cache_max_size = git_config_ulong(var, value);
+	} else if (!strcmp("uploadpack.packcachemaxage", var)) {
+		if (git_config_expiry_date(&pack_cache_max_age, var, value))
+			return -1;
+		pack_cache_max_age_set = 1;
 	} else if (!strcmp("core.precomposeunicode", var)) {
 		precomposed_unicode = git_config_bool(var, value);
 	}
@@ -27,6 +27,7 @@
 #define XDL_LINE_MAX (long)((1UL << (CHAR_BIT * sizeof(long) - 1)) - 1)
 #define XDL_SNAKE_CNT 20
 #define XDL_K_HEUR 4
+#define XDL_ANCHOR_MIN_RECS (1L << 18)
 
 typedef struct s_xdpsplit {
 	long i1, i2;
@@ -309,22 +310,126 @@ int xdl_recs_cmp(diffdata_t *dd1, long off1, long lim1,
 }
 
 
-int xdl_do_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
-		xdfenv_t *xe) {
-	long ndiags;
-	long *kvd, *kvdf, *kvdb;
-	xdalgoenv_t xenv;
-	diffdata_t dd1, dd2;
+/*
+ * Find the records that occur exactly once in each file, and among them
+ * the longest sequence that is in the same order in both files, like the
+ * patience diff does. Each of these pairs is a common line the diff is made
+ * to go through. A unique line that moved on its own would drag everything
+ * between its two positions into the diff, so only lines that also have a
+ * matching neighbour are considered. Return the number of pairs, whose
+ * positions are stored in anchors1 and anchors2, or -1 on error. The arrays
+ * live in scratch memory.
+ */
+static long xdl_find_anchors(xdfenv_t *xe, long **anchors1, long **anchors2) {
+	unsigned long const *ha1 = xe->xdf1.ha, *ha2 = xe->xdf2.ha;
+	long n1 = xe->xdf1.nreff, n2 = xe->xdf2.nreff;
+	long i, j, k, left, right, middle, nr = 0, len = 0;
+	unsigned long c, nclass = 0;
+	char *count1;
+	long *pos2, *cand, *prev, *tails;
+
+	for (i = 0; i < n1; i++)
+		nclass = XDL_MAX(nclass, ha1[i] + 1);
+	for (j = 0; j < n2; j++)
+		nclass = XDL_MAX(nclass, ha2[j] + 1);
+	k = XDL_MIN(n1, n2);
+
+	if (!(count1 = (char *) xdl_arena_alloc(xe->scratch, nclass)) ||
+	    !(pos2 = (long *) xdl_arena_alloc(xe->scratch, nclass * sizeof(long))) ||
+	    !(cand = (long *) xdl_arena_alloc(xe->scratch, k * sizeof(long))) ||
+	    !(prev = (long *) xdl_arena_alloc(xe->scratch, k * sizeof(long))) ||
+	    !(tails = (long *) xdl_arena_alloc(xe->scratch, k * sizeof(long))))
+		return -1;
 
-	if (XDF_DIFF_ALG(xpp->flags) == XDF_PATIENCE_DIFF)
-		return xdl_do_patience_diff(mf1, mf2, xpp, xe);
+	/*
+	 * count1 saturates at 2; pos2 is -1 for classes absent from the
+	 * second file and -2 for those that occur more than once.
+	 */
+	memset(count1, 0, nclass);
+	for (c = 0; c < nclass; c++)
+		pos2[c] = -1;
+	for (i = 0; i < n1; i++)
+		if (count1[ha1[i]] < 2)
+			count1[ha1[i]]++;
+	for (j = 0; j < n2; j++)
+		pos2[ha2[j]] = pos2[ha2[j]] == -1 ? j : -2;
 
-	if (XDF_DIFF_ALG(xpp->flags) == XDF_HISTOGRAM_DIFF)
-		return xdl_do_histogram_diff(mf1, mf2, xpp, xe);
+	/*
+	 * Longest increasing subsequence of the positions in the second
+	 * file, taking the candidates in the order of the first: tails[l]
+	 * is the candidate ending the best sequence of length l + 1 found
+	 * so far.
+	 */
+	for (i = 0; i < n1; i++) {
+		c = ha1[i];
+		if (count1[c] != 1 || (j = pos2[c]) < 0)
+			continue;
+		if (!(i > 0 && j > 0 && ha1[i - 1] == ha2[j - 1]) &&
+		    !(i + 1 < n1 && j + 1 < n2 && ha1[i + 1] == ha2[j + 1]))
+			continue;
+		left = -1;
+		right = len;
+		while (left + 1 < right) {
+			middle = left + (right - left) / 2;
+			if (pos2[ha1[cand[tails[middle]]]] < j)
+				left = middle;
+			else
+				right = middle;
+		}
+		cand[nr] = i;
+		prev[nr] = left < 0 ? -1 : tails[left];
+		tails[left + 1] = nr;
+		if (left + 1 == len)
+			len++;
+		nr++;
+	}
 
-	if (xdl_prepare_env(mf1, mf2, xpp, xe) < 0) {
+	/* Walk the chain back, reusing tails and prev for the result. */
+	if (len) {
+		for (j = len - 1, k = tails[len - 1]; j >= 0; j--, k = prev[k])
+			tails[j] = cand[k];
+		for (j = 0; j < len; j++)
+			prev[j] = pos2[ha1[tails[j]]];
+	}
+	*anchors1 = tails;
+	*anchors2 = prev;
 
-		return -1;
+	return len;
+}
+
+
+/*
+ * Run the Myers algorithm over the whole of the prepared files. Very large
+ * inputs are first cut at the lines that are unique on both sides, unless
+ * a minimal diff was asked for: each piece is then diffed on its own,
+ * which keeps the K vectors as small as the largest piece and the cost of
+ * a piece from spilling over the others, at the price of optimality when a
+ * unique line is best left unmatched.
+ */
+static int xdl_myers_diff(xpparam_t const *xpp, xdfenv_t *xe) {
+	long ndiags, nanchors = 0, a, max1, max2, off1, off2, lim1, lim2;
+	long *anchors1 = NULL, *anchors2 = NULL;
+	long *kvd, *kvdf, *kvdb;
+	int need_min = (xpp->flags & XDF_NEED_MINIMAL) != 0;
+	int ret = -1;
+	xdalgoenv_t xenv;
+	diffdata_t dd1, dd2;
+	xdlarena_mark_t mark;
+
+	xdl_arena_mark(xe->scratch, &mark);
+
+	if (!need_min &&
+	    xe->xdf1.nreff + xe->xdf2.nreff >= XDL_ANCHOR_MIN_RECS &&
+	    (nanchors = xdl_find_anchors(xe, &anchors1, &anchors2)) < 0)
+		goto out;
+
+	for (a = 0, max1 = max2 = off1 = off2 = 0; a <= nanchors; a++) {
+		lim1 = a < nanchors ? anchors1[a] : xe->xdf1.nreff;
+		lim2 = a < nanchors ? anchors2[a] : xe->xdf2.nreff;
+		max1 = XDL_MAX(max1, lim1 - off1);
+		max2 = XDL_MAX(max2, lim2 - off2);
+		off1 = lim1 + 1;
+		off2 = lim2 + 1;
 	}
 
 	/*
@@ -333,41 +438,75 @@ int xdl_do_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
 	 *
 	 * One is to store the forward path and one to store the backward path.
 	 */
-	ndiags = xe->xdf1.nreff + xe->xdf2.nreff + 3;
-	if (!(kvd = (long *) xdl_malloc((2 * ndiags + 2) * sizeof(long)))) {
-
-		xdl_free_env(xe);
-		return -1;
-	}
+	ndiags = max1 + max2 + 3;
+	if (!(kvd = (long *) xdl_arena_alloc(xe->scratch, (2 * ndiags + 2) * sizeof(long))))
+		goto out;
 	kvdf = kvd;
 	kvdb = kvdf + ndiags;
-	kvdf += xe->xdf2.nreff + 1;
-	kvdb += xe->xdf2.nreff + 1;
+	kvdf += max2 + 1;
+	kvdb += max2 + 1;
 
-	xenv.mxcost = xdl_bogosqrt(ndiags);
-	if (xenv.mxcost < XDL_MAX_COST_MIN)
-		xenv.mxcost = XDL_MAX_COST_MIN;
 	xenv.snake_cnt = XDL_SNAKE_CNT;
 	xenv.heur_min = XDL_HEUR_MIN_COST;
 
-	dd1.nrec = xe->xdf1.nreff;
-	dd1.ha = xe->xdf1.ha;
 	dd1.rchg = xe->xdf1.rchg;
-	dd1.rindex = xe->xdf1.rindex;
-	dd2.nrec = xe->xdf2.nreff;
-	dd2.ha = xe->xdf2.ha;
 	dd2.rchg = xe->xdf2.rchg;
-	dd2.rindex = xe->xdf2.rindex;
 
-	if (xdl_recs_cmp(&dd1, 0, dd1.nrec, &dd2, 0, dd2.nrec,
-			 kvdf, kvdb, (xpp->flags & XDF_NEED_MINIMAL) != 0, &xenv) < 0) {
+	for (a = 0, off1 = off2 = 0; a <= nanchors; a++) {
+		lim1 = a < nanchors ? anchors1[a] : xe->xdf1.nreff;
+		lim2 = a < nanchors ? anchors2[a] : xe->xdf2.nreff;
+
+		dd1.nrec = lim1 - off1;
+		dd1.ha = xe->xdf1.ha + off1;
+		dd1.rindex = xe->xdf1.rindex + off1;
+		dd2.nrec = lim2 - off2;
+		dd2.ha = xe->xdf2.ha + off2;
+		dd2.rindex = xe->xdf2.rindex + off2;
+
+		xenv.mxcost = xdl_bogosqrt(dd1.nrec + dd2.nrec + 3);
+		if (xenv.mxcost < XDL_MAX_COST_MIN)
+			xenv.mxcost = XDL_MAX_COST_MIN;
+
+		if (xdl_recs_cmp(&dd1, 0, dd1.nrec, &dd2, 0, dd2.nrec,
+				 kvdf, kvdb, need_min, &xenv) < 0)
+			goto out;
+
+		off1 = lim1 + 1;
+		off2 = lim2 + 1;
+	}
+	ret = 0;
+
+out:
+	xdl_arena_release(xe->scratch, &mark);
+	return ret;
+}
+
+
+int xdl_do_diff_env(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
+		    xdfenv_t *xe) {
+
+	if (XDF_DIFF_ALG(xpp->flags) == XDF_PATIENCE_DIFF)
+		return xdl_do_patience_diff(mf1, mf2, xpp, xe);
+
+	if (XDF_DIFF_ALG(xpp->flags) == XDF_HISTOGRAM_DIFF)
+		return xdl_do_histogram_diff(mf1, mf2, xpp, xe);
+
+	return xdl_myers_diff(xpp, xe);
+}
+
+
+int xdl_do_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
+		xdfenv_t *xe) {
+
+	if (xdl_prepare_env(mf1, mf2, xpp, xe) < 0) {
 
-		xdl_free(kvd);
-		xdl_free_env(xe);
 		return -1;
 	}
+	if (xdl_do_diff_env(mf1, mf2, xpp, xe) < 0) {
 
-	xdl_free(kvd);
+		xdl_free_env(xe);
+		return -1;
+	}
 
 	return 0;
 }
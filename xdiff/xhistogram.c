@@ -55,7 +55,7 @@ struct histindex {
 		struct record *next;
 	} **records, /* an occurrence */
 	  **line_map; /* map of line to record chain */
-	chastore_t rcha;
+	xdlarena_mark_t mark;
 	unsigned int *next_ptrs;
 	unsigned int table_bits,
 		     records_size,
@@ -143,7 +143,7 @@ static int scanA(struct histindex *index, int line1, int count1)
 		 * This is the first time we have ever seen this particular
 		 * element in the sequence. Construct a new chain for it.
 		 */
-		if (!(rec = xdl_cha_alloc(&index->rcha)))
+		if (!(rec = xdl_arena_alloc(index->env->scratch, sizeof(*rec))))
 			return -1;
 		rec->ptr = ptr;
 		rec->cnt = 1;
@@ -243,10 +243,7 @@ static int fall_back_to_classic_diff(xpparam_t const *xpp, xdfenv_t *env,
 
 static inline void free_index(struct histindex *index)
 {
-	xdl_free(index->records);
-	xdl_free(index->line_map);
-	xdl_free(index->next_ptrs);
-	xdl_cha_free(&index->rcha);
+	xdl_arena_release(index->env->scratch, &index->mark);
 }
 
 static int find_lcs(xpparam_t const *xpp, xdfenv_t *env,
@@ -262,34 +259,31 @@ static int find_lcs(xpparam_t const *xpp, xdfenv_t *env,
 	index.env = env;
 	index.xpp = xpp;
 
-	index.records = NULL;
-	index.line_map = NULL;
-	/* in case of early xdl_cha_free() */
-	index.rcha.head = NULL;
+	/*
+	 * The tables and records only live for this call; give their
+	 * memory back to the scratch arena for the next region to use.
+	 */
+	xdl_arena_mark(env->scratch, &index.mark);
 
 	index.table_bits = xdl_hashbits(count1);
 	sz = index.records_size = 1 << index.table_bits;
 	sz *= sizeof(struct record *);
-	if (!(index.records = (struct record **) xdl_malloc(sz)))
+	if (!(index.records = (struct record **) xdl_arena_alloc(env->scratch, sz)))
 		goto cleanup;
 	memset(index.records, 0, sz);
 
 	sz = index.line_map_size = count1;
 	sz *= sizeof(struct record *);
-	if (!(index.line_map = (struct record **) xdl_malloc(sz)))
+	if (!(index.line_map = (struct record **) xdl_arena_alloc(env->scratch, sz)))
 		goto cleanup;
 	memset(index.line_map, 0, sz);
 
 	sz = index.line_map_size;
 	sz *= sizeof(unsigned int);
-	if (!(index.next_ptrs = (unsigned int *) xdl_malloc(sz)))
+	if (!(index.next_ptrs = (unsigned int *) xdl_arena_alloc(env->scratch, sz)))
 		goto cleanup;
 	memset(index.next_ptrs, 0, sz);
 
-	/* lines / 4 + 1 comes from xprepare.c:xdl_prepare_ctx() */
-	if (xdl_cha_init(&index.rcha, sizeof(struct record), count1 / 4 + 1) < 0)
-		goto cleanup;
-
 	index.ptr_shift = line1;
 	index.max_chain_length = 64;
 
@@ -375,9 +369,6 @@ static int histogram_diff(xpparam_t const *xpp, xdfenv_t *env,
 int xdl_do_histogram_diff(mmfile_t *file1, mmfile_t *file2,
 	xpparam_t const *xpp, xdfenv_t *env)
 {
-	if (xdl_prepare_env(file1, file2, xpp, env) < 0)
-		return -1;
-
 	return histogram_diff(xpp, env,
 		env->xdf1.dstart + 1, env->xdf1.dend - env->xdf1.dstart + 1,
 		env->xdf2.dstart + 1, env->xdf2.dend - env->xdf2.dstart + 1);
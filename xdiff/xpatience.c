@@ -156,7 +156,7 @@ static int fill_hashmap(mmfile_t *file1, mmfile_t *file2,
 	/* We know exactly how large we want the hash map */
 	result->alloc = count1 * 2;
 	result->entries = (struct entry *)
-		xdl_malloc(result->alloc * sizeof(struct entry));
+		xdl_arena_alloc(env->scratch, result->alloc * sizeof(struct entry));
 	if (!result->entries)
 		return -1;
 	memset(result->entries, 0, result->alloc * sizeof(struct entry));
@@ -204,9 +204,10 @@ static int binary_search(struct entry **sequence, int longest,
  */
 static struct entry *find_longest_common_sequence(struct hashmap *map)
 {
-	struct entry **sequence = xdl_malloc(map->nr * sizeof(struct entry *));
+	struct entry **sequence;
 	int longest = 0, i;
 	struct entry *entry;
+	xdlarena_mark_t mark;
 
 	/*
 	 * If not -1, this entry in sequence must never be overridden.
@@ -215,6 +216,10 @@ static struct entry *find_longest_common_sequence(struct hashmap *map)
 	 */
 	int anchor_i = -1;
 
+	xdl_arena_mark(map->env->scratch, &mark);
+	sequence = xdl_arena_alloc(map->env->scratch,
+				   map->nr * sizeof(struct entry *));
+
 	for (entry = map->first; entry; entry = entry->next) {
 		if (!entry->line2 || entry->line2 == NON_UNIQUE)
 			continue;
@@ -234,7 +239,7 @@ static struct entry *find_longest_common_sequence(struct hashmap *map)
 
 	/* No common unique lines were found */
 	if (!longest) {
-		xdl_free(sequence);
+		xdl_arena_release(map->env->scratch, &mark);
 		return NULL;
 	}
 
@@ -245,7 +250,7 @@ static struct entry *find_longest_common_sequence(struct hashmap *map)
 		entry->previous->next = entry;
 		entry = entry->previous;
 	}
-	xdl_free(sequence);
+	xdl_arena_release(map->env->scratch, &mark);
 	return entry;
 }
 
@@ -337,6 +342,7 @@ static int patience_diff(mmfile_t *file1, mmfile_t *file2,
 	struct hashmap map;
 	struct entry *first;
 	int result = 0;
+	xdlarena_mark_t mark;
 
 	/* trivial case: one side is empty */
 	if (!count1) {
@@ -349,10 +355,18 @@ static int patience_diff(mmfile_t *file1, mmfile_t *file2,
 		return 0;
 	}
 
+	/*
+	 * The map has to stay around while we recurse into the regions
+	 * between its common lines, whose maps are stacked on top of it in
+	 * the scratch arena.
+	 */
+	xdl_arena_mark(env->scratch, &mark);
 	memset(&map, 0, sizeof(map));
 	if (fill_hashmap(file1, file2, xpp, env, &map,
-			line1, count1, line2, count2))
+			line1, count1, line2, count2)) {
+		xdl_arena_release(env->scratch, &mark);
 		return -1;
+	}
 
 	/* are there any matching lines at all? */
 	if (!map.has_matches) {
@@ -360,7 +374,7 @@ static int patience_diff(mmfile_t *file1, mmfile_t *file2,
 			env->xdf1.rchg[line1++ - 1] = 1;
 		while(count2--)
 			env->xdf2.rchg[line2++ - 1] = 1;
-		xdl_free(map.entries);
+		xdl_arena_release(env->scratch, &mark);
 		return 0;
 	}
 
@@ -372,17 +386,14 @@ static int patience_diff(mmfile_t *file1, mmfile_t *file2,
 		result = fall_back_to_classic_diff(&map,
 			line1, count1, line2, count2);
 
-	xdl_free(map.entries);
+	xdl_arena_release(env->scratch, &mark);
 	return result;
 }
 
 int xdl_do_patience_diff(mmfile_t *file1, mmfile_t *file2,
 		xpparam_t const *xpp, xdfenv_t *env)
 {
-	if (xdl_prepare_env(file1, file2, xpp, env) < 0)
-		return -1;
-
-	/* environment is cleaned up in xdl_diff() */
+	/* environment is prepared and cleaned up by xdl_do_diff() */
 	return patience_diff(file1, file2, xpp, env,
 			1, env->xdf1.nrec, 1, env->xdf2.nrec);
 }
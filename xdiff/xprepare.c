@@ -55,8 +55,8 @@ typedef struct s_xdlclassifier {
 
 static int xdl_init_classifier(xdlclassifier_t *cf, long size, long flags);
 static void xdl_free_classifier(xdlclassifier_t *cf);
-static int xdl_classify_record(unsigned int pass, xdlclassifier_t *cf, xrecord_t **rhash,
-			       unsigned int hbits, xrecord_t *rec);
+static int xdl_grow_classifier(xdlclassifier_t *cf);
+static int xdl_classify_record(unsigned int pass, xdlclassifier_t *cf, xrecord_t *rec);
 static int xdl_prepare_ctx(unsigned int pass, mmfile_t *mf, long narec, xpparam_t const *xpp,
 			   xdlclassifier_t *cf, xdfile_t *xdf);
 static void xdl_free_ctx(xdfile_t *xdf);
@@ -107,8 +107,39 @@ static void xdl_free_classifier(xdlclassifier_t *cf) {
 }
 
 
-static int xdl_classify_record(unsigned int pass, xdlclassifier_t *cf, xrecord_t **rhash,
-			       unsigned int hbits, xrecord_t *rec) {
+/*
+ * The classifier is sized after a guess at the number of lines, from a
+ * sample at the start of the files. When the guess is too low, double
+ * the hash table whenever there are more classes than buckets, so the
+ * chains stay short.
+ */
+static int xdl_grow_classifier(xdlclassifier_t *cf) {
+	unsigned int hbits = cf->hbits + 1;
+	long hsize = 1L << hbits, i, hi;
+	xdlclass_t **rchash;
+
+	if (!(rchash = (xdlclass_t **) xdl_malloc(hsize * sizeof(xdlclass_t *))))
+		return -1;
+	memset(rchash, 0, hsize * sizeof(xdlclass_t *));
+
+	for (i = 0; i < cf->count; i++) {
+		xdlclass_t *rcrec = cf->rcrecs[i];
+
+		hi = (long) XDL_HASHLONG(rcrec->ha, hbits);
+		rcrec->next = rchash[hi];
+		rchash[hi] = rcrec;
+	}
+
+	xdl_free(cf->rchash);
+	cf->rchash = rchash;
+	cf->hbits = hbits;
+	cf->hsize = hsize;
+
+	return 0;
+}
+
+
+static int xdl_classify_record(unsigned int pass, xdlclassifier_t *cf, xrecord_t *rec) {
 	long hi;
 	char const *line;
 	xdlclass_t *rcrec;
@@ -143,29 +174,26 @@ static int xdl_classify_record(unsigned int pass, xdlclassifier_t *cf, xrecord_t
 		rcrec->len1 = rcrec->len2 = 0;
 		rcrec->next = cf->rchash[hi];
 		cf->rchash[hi] = rcrec;
+
+		if (cf->count > cf->hsize && xdl_grow_classifier(cf) < 0)
+			return -1;
 	}
 
 	(pass == 1) ? rcrec->len1++ : rcrec->len2++;
 
 	rec->ha = (unsigned long) rcrec->idx;
 
-	hi = (long) XDL_HASHLONG(rec->ha, hbits);
-	rec->next = rhash[hi];
-	rhash[hi] = rec;
-
 	return 0;
 }
 
 
 static int xdl_prepare_ctx(unsigned int pass, mmfile_t *mf, long narec, xpparam_t const *xpp,
 			   xdlclassifier_t *cf, xdfile_t *xdf) {
-	unsigned int hbits;
-	long nrec, hsize, bsize;
+	long i, nrec, bsize;
 	unsigned long hav;
 	char const *blk, *cur, *top, *prev;
 	xrecord_t *crec;
 	xrecord_t **recs, **rrecs;
-	xrecord_t **rhash;
 	unsigned long *ha;
 	char *rchg;
 	long *rindex;
@@ -173,7 +201,6 @@ static int xdl_prepare_ctx(unsigned int pass, mmfile_t *mf, long narec, xpparam_
 	ha = NULL;
 	rindex = NULL;
 	rchg = NULL;
-	rhash = NULL;
 	recs = NULL;
 
 	if (xdl_cha_init(&xdf->rcha, sizeof(xrecord_t), narec / 4 + 1) < 0)
@@ -181,16 +208,6 @@ static int xdl_prepare_ctx(unsigned int pass, mmfile_t *mf, long narec, xpparam_
 	if (!(recs = (xrecord_t **) xdl_malloc(narec * sizeof(xrecord_t *))))
 		goto abort;
 
-	if (XDF_DIFF_ALG(xpp->flags) == XDF_HISTOGRAM_DIFF)
-		hbits = hsize = 0;
-	else {
-		hbits = xdl_hashbits((unsigned int) narec);
-		hsize = 1 << hbits;
-		if (!(rhash = (xrecord_t **) xdl_malloc(hsize * sizeof(xrecord_t *))))
-			goto abort;
-		memset(rhash, 0, hsize * sizeof(xrecord_t *));
-	}
-
 	nrec = 0;
 	if ((cur = blk = xdl_mmfile_first(mf, &bsize)) != NULL) {
 		for (top = blk + bsize; cur < top; ) {
@@ -208,13 +225,19 @@ static int xdl_prepare_ctx(unsigned int pass, mmfile_t *mf, long narec, xpparam_
 			crec->size = (long) (cur - prev);
 			crec->ha = hav;
 			recs[nrec++] = crec;
-
-			if ((XDF_DIFF_ALG(xpp->flags) != XDF_HISTOGRAM_DIFF) &&
-			    xdl_classify_record(pass, cf, rhash, hbits, crec) < 0)
-				goto abort;
 		}
 	}
 
+	/*
+	 * Classify the records in a separate pass: each lookup is likely
+	 * to miss the cache, and without the hashing of the lines in
+	 * between, the CPU can overlap the misses of consecutive ones.
+	 */
+	if (XDF_DIFF_ALG(xpp->flags) != XDF_HISTOGRAM_DIFF)
+		for (i = 0; i < nrec; i++)
+			if (xdl_classify_record(pass, cf, recs[i]) < 0)
+				goto abort;
+
 	if (!(rchg = (char *) xdl_malloc((nrec + 2) * sizeof(char))))
 		goto abort;
 	memset(rchg, 0, (nrec + 2) * sizeof(char));
@@ -226,8 +249,6 @@ static int xdl_prepare_ctx(unsigned int pass, mmfile_t *mf, long narec, xpparam_
 
 	xdf->nrec = nrec;
 	xdf->recs = recs;
-	xdf->hbits = hbits;
-	xdf->rhash = rhash;
 	xdf->rchg = rchg + 1;
 	xdf->rindex = rindex;
 	xdf->nreff = 0;
@@ -241,7 +262,6 @@ static int xdl_prepare_ctx(unsigned int pass, mmfile_t *mf, long narec, xpparam_
 	xdl_free(ha);
 	xdl_free(rindex);
 	xdl_free(rchg);
-	xdl_free(rhash);
 	xdl_free(recs);
 	xdl_cha_free(&xdf->rcha);
 	return -1;
@@ -250,7 +270,6 @@ static int xdl_prepare_ctx(unsigned int pass, mmfile_t *mf, long narec, xpparam_
 
 static void xdl_free_ctx(xdfile_t *xdf) {
 
-	xdl_free(xdf->rhash);
 	xdl_free(xdf->rindex);
 	xdl_free(xdf->rchg - 1);
 	xdl_free(xdf->ha);
@@ -265,12 +284,14 @@ int xdl_prepare_env(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
 	xdlclassifier_t cf;
 
 	memset(&cf, 0, sizeof(cf));
+	xdl_arena_init(&xe->arena);
+	xe->scratch = &xe->arena;
 
 	/*
 	 * For histogram diff, we can afford a smaller sample size and
-	 * thus a poorer estimate of the number of lines, as the hash
-	 * table (rhash) won't be filled up/grown. The number of lines
-	 * (nrecs) will be updated correctly anyway by
+	 * thus a poorer estimate of the number of lines, as it does not
+	 * use the classifier, whose hash table is sized after it. The
+	 * number of lines (nrecs) will be updated correctly anyway by
 	 * xdl_prepare_ctx().
 	 */
 	sample = (XDF_DIFF_ALG(xpp->flags) == XDF_HISTOGRAM_DIFF
@@ -316,6 +337,7 @@ void xdl_free_env(xdfenv_t *xe) {
 
 	xdl_free_ctx(&xe->xdf2);
 	xdl_free_ctx(&xe->xdf1);
+	xdl_arena_free(&xe->arena);
 }
 
 
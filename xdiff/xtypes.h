@@ -38,8 +38,26 @@ typedef struct s_chastore {
 	long scurr;
 } chastore_t;
 
+typedef struct s_xdlarena_block {
+	struct s_xdlarena_block *next;
+	long size, used;
+} xdlarena_block_t;
+
+/*
+ * Scratch memory handed out in stack order: everything allocated after
+ * a mark is given back at once by releasing to that mark, and the blocks
+ * are kept around for the next allocations.
+ */
+typedef struct s_xdlarena {
+	xdlarena_block_t *head, *cur;
+} xdlarena_t;
+
+typedef struct s_xdlarena_mark {
+	xdlarena_block_t *block;
+	long used;
+} xdlarena_mark_t;
+
 typedef struct s_xrecord {
-	struct s_xrecord *next;
 	char const *ptr;
 	long size;
 	unsigned long ha;
@@ -48,8 +66,6 @@ typedef struct s_xrecord {
 typedef struct s_xdfile {
 	chastore_t rcha;
 	long nrec;
-	unsigned int hbits;
-	xrecord_t **rhash;
 	long dstart, dend;
 	xrecord_t **recs;
 	char *rchg;
@@ -60,6 +76,9 @@ typedef struct s_xdfile {
 
 typedef struct s_xdfenv {
 	xdfile_t xdf1, xdf2;
+	xdlarena_t arena;
+	/* where the diff algorithms get their scratch memory; &arena or borrowed */
+	xdlarena_t *scratch;
 } xdfenv_t;
 
 
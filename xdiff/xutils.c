@@ -118,6 +118,84 @@ void *xdl_cha_alloc(chastore_t *cha) {
 	return data;
 }
 
+#define XDL_ARENA_ALIGN(n) (((n) + 15) & ~15L)
+#define XDL_ARENA_HDR XDL_ARENA_ALIGN((long) sizeof(xdlarena_block_t))
+#define XDL_ARENA_MIN_BLOCK (64 * 1024)
+
+void xdl_arena_init(xdlarena_t *arena) {
+
+	arena->head = arena->cur = NULL;
+}
+
+
+void xdl_arena_free(xdlarena_t *arena) {
+	xdlarena_block_t *cur, *tmp;
+
+	for (cur = arena->head; (tmp = cur) != NULL;) {
+		cur = cur->next;
+		xdl_free(tmp);
+	}
+	arena->head = arena->cur = NULL;
+}
+
+
+void *xdl_arena_alloc(xdlarena_t *arena, long size) {
+	xdlarena_block_t *blk, *prev;
+	void *data;
+
+	size = XDL_ARENA_ALIGN(size);
+	blk = arena->cur;
+	if (!blk || blk->size - blk->used < size) {
+		/*
+		 * The blocks after the current one were given back by
+		 * xdl_arena_release(); reuse the first one that is large
+		 * enough before asking for more memory.
+		 */
+		prev = blk;
+		for (blk = prev ? prev->next : arena->head; blk;
+		     prev = blk, blk = blk->next) {
+			blk->used = 0;
+			if (blk->size >= size)
+				break;
+		}
+		if (!blk) {
+			long bsize = XDL_MAX(size, XDL_ARENA_MIN_BLOCK);
+
+			if (!(blk = (xdlarena_block_t *) xdl_malloc(XDL_ARENA_HDR + bsize)))
+				return NULL;
+			blk->next = NULL;
+			blk->size = bsize;
+			blk->used = 0;
+			if (prev)
+				prev->next = blk;
+			else
+				arena->head = blk;
+		}
+		arena->cur = blk;
+	}
+
+	data = (char *) blk + XDL_ARENA_HDR + blk->used;
+	blk->used += size;
+
+	return data;
+}
+
+
+void xdl_arena_mark(xdlarena_t *arena, xdlarena_mark_t *mark) {
+
+	mark->block = arena->cur;
+	mark->used = arena->cur ? arena->cur->used : 0;
+}
+
+
+void xdl_arena_release(xdlarena_t *arena, xdlarena_mark_t const *mark) {
+
+	arena->cur = mark->block;
+	if (mark->block)
+		mark->block->used = mark->used;
+}
+
+
 long xdl_guess_lines(mmfile_t *mf, long sample) {
 	long nl = 0, size, tsize = 0;
 	char const *data, *cur, *top;
@@ -297,15 +375,25 @@ static unsigned long xdl_hash_record_with_whitespace(char const **data,
 unsigned long xdl_hash_record(char const **data, char const *top, long flags) {
 	unsigned long ha = 5381;
 	char const *ptr = *data;
+	char const *eol;
 
 	if (flags & XDF_WHITESPACE_FLAGS)
 		return xdl_hash_record_with_whitespace(data, top, flags);
 
-	for (; ptr < top && *ptr != '\n'; ptr++) {
+	/*
+	 * Find the end of the line first: memchr() is vectorized by the
+	 * C library for the CPU it runs on, and the hashing loop is then
+	 * left with a single bound to check. Each step of the hash depends
+	 * on the previous one, so it cannot be vectorized itself without
+	 * changing the hash values.
+	 */
+	if (!(eol = memchr(ptr, '\n', top - ptr)))
+		eol = top;
+	for (; ptr < eol; ptr++) {
 		ha += (ha << 5);
 		ha ^= (unsigned long) *ptr;
 	}
-	*data = ptr < top ? ptr + 1: ptr;
+	*data = eol < top ? eol + 1: eol;
 
 	return ha;
 }
@@ -415,6 +503,7 @@ int xdl_fall_back_diff(xdfenv_t *diff_env, xpparam_t const *xpp,
 	 */
 	mmfile_t subfile1, subfile2;
 	xdfenv_t env;
+	int ret;
 
 	subfile1.ptr = (char *)diff_env->xdf1.recs[line1 - 1]->ptr;
 	subfile1.size = diff_env->xdf1.recs[line1 + count1 - 2]->ptr +
@@ -422,13 +511,18 @@ int xdl_fall_back_diff(xdfenv_t *diff_env, xpparam_t const *xpp,
 	subfile2.ptr = (char *)diff_env->xdf2.recs[line2 - 1]->ptr;
 	subfile2.size = diff_env->xdf2.recs[line2 + count2 - 2]->ptr +
 		diff_env->xdf2.recs[line2 + count2 - 2]->size - subfile2.ptr;
-	if (xdl_do_diff(&subfile1, &subfile2, xpp, &env) < 0)
+	if (xdl_prepare_env(&subfile1, &subfile2, xpp, &env) < 0)
 		return -1;
 
-	memcpy(diff_env->xdf1.rchg + line1 - 1, env.xdf1.rchg, count1);
-	memcpy(diff_env->xdf2.rchg + line2 - 1, env.xdf2.rchg, count2);
+	/* Stack our scratch memory on top of the caller's. */
+	env.scratch = diff_env->scratch;
+	ret = xdl_do_diff_env(&subfile1, &subfile2, xpp, &env);
+	if (!ret) {
+		memcpy(diff_env->xdf1.rchg + line1 - 1, env.xdf1.rchg, count1);
+		memcpy(diff_env->xdf2.rchg + line2 - 1, env.xdf2.rchg, count2);
+	}
 
 	xdl_free_env(&env);
 
-	return 0;
+	return ret;
 }
@@ -31,6 +31,11 @@ int xdl_emit_diffrec(char const *rec, long size, char const *pre, long psize,
 int xdl_cha_init(chastore_t *cha, long isize, long icount);
 void xdl_cha_free(chastore_t *cha);
 void *xdl_cha_alloc(chastore_t *cha);
+void xdl_arena_init(xdlarena_t *arena);
+void xdl_arena_free(xdlarena_t *arena);
+void *xdl_arena_alloc(xdlarena_t *arena, long size);
+void xdl_arena_mark(xdlarena_t *arena, xdlarena_mark_t *mark);
+void xdl_arena_release(xdlarena_t *arena, xdlarena_mark_t const *mark);
 long xdl_guess_lines(mmfile_t *mf, long sample);
 int xdl_blankline(const char *line, long size, long flags);
 int xdl_recmatch(const char *l1, long s1, const char *l2, long s2, long flags);